@@ -0,0 +1,79 @@
+/*
+ * CS 261: Runtime for ahead-of-time translated programs
+ *
+ * Name: Ben Berry
+ */
+
+#include "aot.h"
+#include "p4-interp.h"
+#include "io.h"
+#include "icache.h"
+
+/* Last instruction run by the runtime (every fault passes through here) */
+static y86_inst_t last;
+
+static bool hits_code (address_t lo, address_t hi);
+
+bool aot_slow (y86_t *cpu, byte_t *memory, int *count) {
+    address_t store, lo, hi;
+    last = step_reference(cpu, memory, count, &store);
+    //Once translated code has been overwritten it can no longer be trusted
+    //(that includes all a hypercall wrote)
+    if(cpu->stat != AOK || (store < MEMSIZE && hits_code(store, store + STORE_SIZE)))
+        return false;
+    return !io_stored(cpu, &last, &lo, &hi) || !hits_code(lo, hi);
+}
+
+//True if any byte from lo up to hi is translated code (aot_guard[a] is set
+//when any of the eight bytes from a is)
+static bool hits_code (address_t lo, address_t hi) {
+    if(hi > MEMSIZE)
+        hi = MEMSIZE;
+    for(address_t a = (lo >= STORE_SIZE - 1) ? lo - (STORE_SIZE - 1) : 0; a < hi; a++) {
+        if(aot_guard[a])
+            return true;
+    }
+    return false;
+}
+
+int main (void)
+{
+    //Create "virtual memory" in the heap and load the saved image
+    byte_t *memory = (byte_t *) calloc(MEMSIZE, sizeof(byte_t));
+    if(memory == NULL)
+        return EXIT_FAILURE;
+    memcpy(memory, aot_image, MEMSIZE);
+
+    y86_t cpu;
+    memset(&cpu, 0x00, sizeof(cpu));
+    memset(&last, 0x00, sizeof(last));
+    cpu.pc = aot_entry;
+    cpu.stat = AOK;
+    //Guest input comes from our own stdin, as with "y86 -e"
+    cpu.io = io_create();
+    if(cpu.io == NULL) {
+        free(memory);
+        return EXIT_FAILURE;
+    }
+    io_set_input_fd(cpu.io, 0);
+    int numInstructions = 0;
+
+    printf("Beginning execution at 0x%04lx\n", aot_entry);
+    aot_run(&cpu, memory, &numInstructions);
+    //Self-modifying code: interpret whatever is left
+    while(cpu.stat == AOK)
+        aot_slow(&cpu, memory, &numInstructions);
+    io_flush(cpu.io);
+
+    //Update program counter if bad address was given (as in the -e loop)
+    if(cpu.stat == ADR){
+        cpu.pc = last.valP;
+        if(last.icode == CALL)
+            cpu.pc ++;
+    }
+    dump_cpu_state(&cpu);
+    printf("Total execution count: %d\n", numInstructions);
+    io_free(cpu.io);
+    free(memory);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,340 @@
+/*
+ * CS 261: Ahead-of-time translation of Mini-ELF programs to C
+ *
+ * Name: Ben Berry
+ */
+
+#include "aot.h"
+#include "icache.h"
+#include "p3-disas.h"
+
+/* Names of the generated locals holding each guest register */
+static const char *regnames[NUMREGS] = {
+    "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+    "r8", "r9", "r10", "r11", "r12", "r13", "r14"
+};
+
+/* Translator storage structure */
+typedef struct aot_prog {
+
+    y86_inst_t inst[MEMSIZE];           // decoded instruction at each reachable address
+    bool reach[MEMSIZE];                // address is reachable from the entry point
+    bool fast[MEMSIZE];                 // instruction there is translated (not left to the runtime)
+    byte_t code[MEMSIZE + STORE_SIZE];  // nonzero where translated bytes live
+    bool stale;                         // generated code has an exit for stores into code
+
+} aot_prog_t;
+
+static void discover (aot_prog_t *prog, byte_t *memory, elf_hdr_t *hdr,
+        elf_phdr_t *phdrs);
+static void emit_inst (FILE *out, aot_prog_t *prog, address_t pc);
+static void emit_sync (FILE *out, bool in);
+
+/**********************************************************************
+ *                         TRANSLATOR FUNCTIONS
+ *********************************************************************/
+
+bool aot_translate (FILE *out, const char *filename, byte_t *memory,
+        elf_hdr_t *hdr, elf_phdr_t *phdrs) {
+    //Check for null parameters
+    if(out == NULL || memory == NULL || hdr == NULL || phdrs == NULL)
+        return false;
+    aot_prog_t *prog = (aot_prog_t *) calloc(1, sizeof(aot_prog_t));
+    if(prog == NULL)
+        return false;
+    discover(prog, memory, hdr, phdrs);
+
+    fprintf(out, "/*\n * Translated from %s by \"y86 -C\"; link with aot-rt.c\n */\n\n",
+            filename == NULL ? "(unknown)" : filename);
+    fprintf(out, "#include \"aot.h\"\n\n");
+    fprintf(out, "const address_t aot_entry = 0x%04x;\n\n", hdr->e_entry);
+
+    //Initial memory image
+    fprintf(out, "const byte_t aot_image[MEMSIZE] = {");
+    for(int i = 0; i < MEMSIZE; i++)
+        fprintf(out, "%s0x%02x,", (i % 16 == 0) ? "\n    " : " ", memory[i]);
+    fprintf(out, "\n};\n\n");
+
+    //Store addresses that would overwrite translated code
+    int guards = 0;
+    fprintf(out, "const byte_t aot_guard[MEMSIZE] = {");
+    for(int i = 0; i < MEMSIZE; i++) {
+        bool hit = false;
+        for(int j = 0; j < STORE_SIZE; j++)
+            hit |= prog->code[i + j];
+        if(hit)
+            fprintf(out, "%s[0x%04x] = 1,", (guards++ % 8 == 0) ? "\n    " : " ", i);
+    }
+    fprintf(out, "%s};\n\n", guards > 0 ? "\n" : " 0 ");
+
+    //Translated code, with every register and flag in a local
+    fprintf(out, "void aot_run (y86_t *cpu, byte_t *memory, int *count) {\n");
+    for(int r = 0; r < NUMREGS; r++)
+        fprintf(out, "    y86_reg_t %s;\n", regnames[r]);
+    fprintf(out, "    flag_t zf, sf, of;\n");
+    fprintf(out, "    int n;\n");
+    fprintf(out, "    address_t pc;\n\n");
+    emit_sync(out, true);
+    fprintf(out, "    goto dispatch;\n\n");
+
+    //Everything not translated goes through the runtime one instruction at a time
+    fprintf(out, "slow:\n");
+    emit_sync(out, false);
+    fprintf(out, "    if(!aot_slow(cpu, memory, count))\n        return;\n");
+    emit_sync(out, true);
+
+    //Indirect control flow (ret, and resuming after the runtime) lands here
+    fprintf(out, "dispatch:\n    switch(pc) {\n");
+    for(address_t pc = 0; pc < MEMSIZE; pc++) {
+        if(prog->reach[pc])
+            fprintf(out, "        case 0x%04lx: goto L_%04lx;\n", pc, pc);
+    }
+    fprintf(out, "        default: goto slow;\n    }\n");
+
+    //Straight-line code in address order, falling through where possible
+    for(address_t pc = 0; pc < MEMSIZE; pc++) {
+        if(prog->reach[pc])
+            emit_inst(out, prog, pc);
+    }
+
+    if(prog->stale) {
+        fprintf(out, "\nstale:\n");
+        emit_sync(out, false);
+    }
+    fprintf(out, "}\n");
+
+    free(prog);
+    return true;
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+//True if an address lies inside a CODE segment
+static bool in_code (elf_hdr_t *hdr, elf_phdr_t *phdrs, address_t addr) {
+    for(int i = 0; i < hdr->e_num_phdr; i++) {
+        if(phdrs[i].p_type == CODE && addr >= phdrs[i].p_vaddr
+                && addr < (address_t) phdrs[i].p_vaddr + phdrs[i].p_size)
+            return true;
+    }
+    return false;
+}
+
+//Decide whether a cleanly decoded instruction can be translated. Operands
+//naming %r15 (NOREG) reach past the register file in the reference code, and
+//halt, iotrap and jumps or calls out of memory are rare enough to leave to
+//the runtime.
+static bool translatable (y86_inst_t *ins) {
+    switch(ins->icode) {
+        case(NOP): case(RET):
+            return true;
+        case(JUMP):
+            return ins->valC.dest < MEMSIZE || ins->ifun.jump != JMP;
+        case(CMOV): case(RMMOVQ): case(MRMOVQ): case(OPQ):
+            return ins->ra < NOREG && ins->rb < NOREG;
+        case(IRMOVQ):
+            return ins->rb < NOREG;
+        case(PUSHQ): case(POPQ):
+            return ins->ra < NOREG;
+        case(CALL):
+            return ins->valC.dest < MEMSIZE;
+        default:
+            return false;
+    }
+}
+
+//Find every instruction reachable from the entry point
+static void discover (aot_prog_t *prog, byte_t *memory, elf_hdr_t *hdr,
+        elf_phdr_t *phdrs) {
+    address_t *work = (address_t *) malloc(MEMSIZE * sizeof(address_t));
+    if(work == NULL)
+        return;
+    int top = 0;
+    if(hdr->e_entry < MEMSIZE) {
+        prog->reach[hdr->e_entry] = true;
+        work[top++] = hdr->e_entry;
+    }
+
+    while(top > 0) {
+        address_t pc = work[--top];
+        if(!in_code(hdr, phdrs, pc))
+            continue;
+
+        //Decode on a scratch CPU so faults only mark the address as untranslated
+        y86_t probe;
+        memset(&probe, 0x00, sizeof(probe));
+        probe.pc = pc;
+        probe.stat = AOK;
+        y86_inst_t ins = fetch(&probe, memory);
+        if(probe.stat != AOK || ins.icode == INVALID)
+            continue;
+        prog->inst[pc] = ins;
+        if(translatable(&ins)) {
+            prog->fast[pc] = true;
+            memset(&prog->code[pc], 1, ins.valP - pc);
+        }
+
+        //Successors: fall-through, branch targets and return addresses
+        address_t next[2];
+        int numnext = 0;
+        switch(ins.icode) {
+            case(HALT): case(RET): case(IOTRAP):
+                break;
+            case(JUMP):
+                next[numnext++] = ins.valC.dest;
+                if(ins.ifun.jump != JMP)
+                    next[numnext++] = ins.valP;
+                break;
+            case(CALL):
+                next[numnext++] = ins.valC.dest;
+                next[numnext++] = ins.valP;
+                break;
+            default:
+                next[numnext++] = ins.valP;
+                break;
+        }
+        for(int i = 0; i < numnext; i++) {
+            if(next[i] < MEMSIZE && !prog->reach[next[i]]) {
+                prog->reach[next[i]] = true;
+                work[top++] = next[i];
+            }
+        }
+    }
+    free(work);
+}
+
+//C expression for a cmovXX/jXX condition, matching decode_execute()
+static const char *cond_expr (int ifun) {
+    switch(ifun) {
+        case(JLE): return "zf || sf != of";
+        case(JL):  return "sf != of";
+        case(JE):  return "zf";
+        case(JNE): return "!zf";
+        case(JGE): return "sf == of";
+        case(JG):  return "!zf && sf == of";
+        default:   return "1";
+    }
+}
+
+//Copy the locals in from the CPU structure, or back out to it
+static void emit_sync (FILE *out, bool in) {
+    for(int r = 0; r < NUMREGS; r++) {
+        if(in)
+            fprintf(out, "    %s = cpu->reg[%d];\n", regnames[r], r);
+        else
+            fprintf(out, "    cpu->reg[%d] = %s;\n", r, regnames[r]);
+    }
+    if(in) {
+        fprintf(out, "    zf = cpu->zf; sf = cpu->sf; of = cpu->of;\n");
+        fprintf(out, "    n = *count;\n    pc = cpu->pc;\n");
+    } else {
+        fprintf(out, "    cpu->zf = zf; cpu->sf = sf; cpu->of = of;\n");
+        fprintf(out, "    *count = n;\n    cpu->pc = pc;\n");
+    }
+}
+
+//Translate the instruction at one reachable address
+static void emit_inst (FILE *out, aot_prog_t *prog, address_t pc) {
+    y86_inst_t *ins = &prog->inst[pc];
+    const char *ra = (ins->ra < NOREG) ? regnames[ins->ra] : NULL;
+    const char *rb = (ins->rb < NOREG) ? regnames[ins->rb] : NULL;
+    const char *cond = cond_expr(ins->ifun.b);
+    static const char *opmacros[] = { "AOT_ADDQ", "AOT_SUBQ", "AOT_ANDQ", "AOT_XORQ" };
+
+    fprintf(out, "L_%04lx:\n", pc);
+    if(!prog->fast[pc]) {
+        fprintf(out, "    pc = 0x%04lx; goto slow;\n", pc);
+        return;
+    }
+
+    //Operands are fixed at translation time; only values are computed here.
+    //Stores count themselves before checking whether they hit code.
+    bool counted = false;
+    switch(ins->icode) {
+        case(NOP):
+            break;
+        case(CMOV):
+            if(ins->ifun.cmov == RRMOVQ)
+                fprintf(out, "    %s = %s;\n", rb, ra);
+            else
+                fprintf(out, "    if(%s) %s = %s;\n", cond, rb, ra);
+            break;
+        case(IRMOVQ):
+            fprintf(out, "    %s = 0x%lxull;\n", rb, (y86_reg_t) ins->valC.v);
+            break;
+        case(RMMOVQ):
+            fprintf(out, "    {\n        y86_reg_t a = %s + 0x%lxull;\n", rb, (y86_reg_t) ins->valC.d);
+            fprintf(out, "        if(a > MEMSIZE - 8) { pc = 0x%04lx; goto slow; }\n", pc);
+            fprintf(out, "        aot_store(memory, a, %s);\n", ra);
+            fprintf(out, "        n++;\n");
+            fprintf(out, "        if(aot_guard[a]) { pc = 0x%04lx; goto stale; }\n    }\n", ins->valP);
+            prog->stale = true;
+            counted = true;
+            break;
+        case(MRMOVQ):
+            fprintf(out, "    {\n        y86_reg_t a = %s + 0x%lxull;\n", rb, (y86_reg_t) ins->valC.d);
+            fprintf(out, "        if(a > MEMSIZE - 8) { pc = 0x%04lx; goto slow; }\n", pc);
+            fprintf(out, "        %s = aot_load(memory, a);\n    }\n", ra);
+            break;
+        case(OPQ):
+            fprintf(out, "    %s(%s, %s);\n", opmacros[ins->ifun.op], ra, rb);
+            break;
+        case(JUMP):
+            //Jumps out of memory fault, and the runtime reports that
+            if(ins->valC.dest >= MEMSIZE) {
+                fprintf(out, "    if(%s) { pc = 0x%04lx; goto slow; }\n", cond, pc);
+                break;
+            }
+            fprintf(out, "    n++;\n");
+            if(ins->ifun.jump == JMP) {
+                fprintf(out, "    goto L_%04lx;\n", ins->valC.dest);
+                return;
+            }
+            fprintf(out, "    if(%s) goto L_%04lx;\n", cond, ins->valC.dest);
+            counted = true;
+            break;
+        case(CALL):
+            fprintf(out, "    {\n        y86_reg_t a = rsp - 8;\n");
+            fprintf(out, "        if(a > MEMSIZE - 8) { pc = 0x%04lx; goto slow; }\n", pc);
+            fprintf(out, "        aot_store(memory, a, 0x%04lx);\n", ins->valP);
+            fprintf(out, "        rsp = a;\n        n++;\n");
+            fprintf(out, "        if(aot_guard[a]) { pc = 0x%04lx; goto stale; }\n    }\n", ins->valC.dest);
+            fprintf(out, "    goto L_%04lx;\n", ins->valC.dest);
+            prog->stale = true;
+            return;
+        case(RET):
+            fprintf(out, "    {\n        if(rsp > MEMSIZE - 8) { pc = 0x%04lx; goto slow; }\n", pc);
+            fprintf(out, "        y86_reg_t t = aot_load(memory, rsp);\n");
+            fprintf(out, "        if(t >= MEMSIZE) { pc = 0x%04lx; goto slow; }\n", pc);
+            fprintf(out, "        rsp += 8;\n        n++;\n        pc = t;\n    }\n");
+            fprintf(out, "    goto dispatch;\n");
+            return;
+        case(PUSHQ):
+            fprintf(out, "    {\n        y86_reg_t a = rsp - 8;\n");
+            fprintf(out, "        if(a > MEMSIZE - 8) { pc = 0x%04lx; goto slow; }\n", pc);
+            fprintf(out, "        aot_store(memory, a, %s);\n", ra);
+            fprintf(out, "        rsp = a;\n        n++;\n");
+            fprintf(out, "        if(aot_guard[a]) { pc = 0x%04lx; goto stale; }\n    }\n", ins->valP);
+            prog->stale = true;
+            counted = true;
+            break;
+        case(POPQ):
+            fprintf(out, "    {\n        if(rsp > MEMSIZE - 8) { pc = 0x%04lx; goto slow; }\n", pc);
+            fprintf(out, "        y86_reg_t v = aot_load(memory, rsp);\n");
+            fprintf(out, "        rsp += 8;\n        %s = v;\n    }\n", ra);
+            break;
+        default:
+            break;
+    }
+
+    if(!counted)
+        fprintf(out, "    n++;\n");
+
+    //Continue at the next instruction unless it comes straight after this one
+    address_t a = pc + 1;
+    while(a < MEMSIZE && !prog->reach[a])
+        a++;
+    if(a != ins->valP)
+        fprintf(out, "    goto L_%04lx;\n", ins->valP);
+}
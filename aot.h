@@ -0,0 +1,104 @@
+#ifndef __CS261_AOT__
+#define __CS261_AOT__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elf.h"
+#include "y86.h"
+
+/**********************************************************************
+ *                         TRANSLATOR (aot.c, part of y86)
+ *********************************************************************/
+
+/**
+ * @brief Translate the reachable code of a loaded Mini-ELF into C source
+ *
+ * Every instruction reachable from the entry point (following fall-through,
+ * jump and call targets and return addresses) inside a CODE segment becomes
+ * a labelled block of C operating on local copies of the registers and
+ * flags. Direct jumps and calls become gotos; ret goes through a switch
+ * from guest address to label. Faults, halt, iotrap and anything unusual
+ * are handed to the runtime (aot-rt.c), which runs them through the same
+ * pipeline as -e. The generated file also holds the initial memory image,
+ * so compiling it together with aot-rt.c gives a standalone program whose
+ * output matches "y86 -e".
+ *
+ * @param out Stream to write the C source to
+ * @param filename Name of the Mini-ELF file (only used in a comment)
+ * @param memory Memory with all segments loaded
+ * @param hdr File header (for the entry point)
+ * @param phdrs Array of program headers (for the CODE segments)
+ * @returns True if the source was written
+ */
+bool aot_translate (FILE *out, const char *filename, byte_t *memory,
+        elf_hdr_t *hdr, elf_phdr_t *phdrs);
+
+/**********************************************************************
+ *                         GENERATED CODE INTERFACE
+ *********************************************************************/
+
+/* Defined by the generated file */
+extern const address_t aot_entry;           // program entry point
+extern const byte_t aot_image[MEMSIZE];     // memory after loading every segment
+extern const byte_t aot_guard[MEMSIZE];     // nonzero where an 8-byte store hits translated code
+
+/**
+ * @brief Run translated code (generated) from cpu->pc until it can go no further
+ *
+ * Returns with cpu->stat no longer AOK, or with cpu->stat still AOK after a
+ * store into translated code, in which case the rest of the run must be
+ * interpreted.
+ *
+ * @param cpu Y86 CPU structure
+ * @param memory Pointer to the beginning of the Y86 address space
+ * @param count Pointer to the running execution count to be updated
+ */
+void aot_run (y86_t *cpu, byte_t *memory, int *count);
+
+/**
+ * @brief Run one instruction the translated code does not handle (aot-rt.c)
+ *
+ * @param cpu Y86 CPU structure
+ * @param memory Pointer to the beginning of the Y86 address space
+ * @param count Pointer to the running execution count to be updated
+ * @returns True if translated code can carry on from cpu->pc
+ */
+bool aot_slow (y86_t *cpu, byte_t *memory, int *count);
+
+/* 8-byte guest memory accesses for generated code. Bounds are checked by the
+   caller, which leaves anything out of range to aot_slow(). */
+static inline y86_reg_t aot_load (const byte_t *memory, y86_reg_t addr) {
+    y86_reg_t v;
+    memcpy(&v, &memory[addr], sizeof(v));
+    return v;
+}
+
+static inline void aot_store (byte_t *memory, y86_reg_t addr, y86_reg_t v) {
+    memcpy(&memory[addr], &v, sizeof(v));
+}
+
+/* opq with the flag rules of decode_execute() (andq/xorq leave OF alone) */
+#define AOT_ADDQ(a, b) do { \
+    int64_t va_ = (int64_t) (a), vb_ = (int64_t) (b); \
+    int64_t ve_ = (int64_t) ((y86_reg_t) vb_ + (y86_reg_t) va_); \
+    of = ((vb_ < 0) == (va_ < 0)) && ((ve_ < 0) != (vb_ < 0)); \
+    (b) = ve_; sf = ve_ < 0; zf = ve_ == 0; \
+} while(0)
+#define AOT_SUBQ(a, b) do { \
+    int64_t va_ = (int64_t) (a), vb_ = (int64_t) (b); \
+    int64_t ve_ = (int64_t) ((y86_reg_t) vb_ - (y86_reg_t) va_); \
+    of = ((vb_ < 0) != (va_ < 0)) && ((ve_ < 0) != (vb_ < 0)); \
+    (b) = ve_; sf = ve_ < 0; zf = ve_ == 0; \
+} while(0)
+#define AOT_ANDQ(a, b) do { \
+    (b) &= (a); sf = (int64_t) (b) < 0; zf = (b) == 0; \
+} while(0)
+#define AOT_XORQ(a, b) do { \
+    (b) ^= (a); sf = (int64_t) (b) < 0; zf = (b) == 0; \
+} while(0)
+
+#endif
@@ -0,0 +1,311 @@
+/*
+ * CS 261: Parallel batch runner
+ *
+ * Name: Ben Berry
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "block.h"
+#include "p4-interp.h"
+#include "y86vm.h"
+
+/* One image to run, and where its output ends up */
+typedef struct batch_task {
+    char *path;                 // image file name
+    char *result;               // everything printed for the image
+    size_t resultlen;           // bytes in result
+    int count;                  // instructions executed
+    bool loaded;                // false if the image could not be read
+} batch_task_t;
+
+/* Double-ended queue of task indices owned by one worker. The owner takes
+   from the bottom and idle workers steal from the top. */
+typedef struct batch_deque {
+    pthread_mutex_t lock;
+    int *tasks;                 // task indices
+    int top;                    // next index to steal
+    int bottom;                 // one past the next index the owner takes
+} batch_deque_t;
+
+/* State shared by every worker */
+typedef struct batch_pool {
+    batch_task_t *tasks;
+    batch_deque_t *deques;
+    int numworkers;
+    uint64_t stolen;            // protected by stolenlock
+    pthread_mutex_t stolenlock;
+} batch_pool_t;
+
+/* Per-thread argument */
+typedef struct batch_worker {
+    batch_pool_t *pool;
+    int id;
+} batch_worker_t;
+
+static char **list_images (const char *path, int *count);
+static void *worker_main (void *arg);
+static void run_task (batch_task_t *task);
+
+/**********************************************************************
+ *                         BATCH FUNCTIONS
+ *********************************************************************/
+
+bool batch_run (const char *path, FILE *out, batch_stats_t *stats) {
+    //Check for null parameters
+    if(path == NULL || out == NULL || stats == NULL)
+        return false;
+    memset(stats, 0x00, sizeof(*stats));
+
+    int numimages = 0;
+    char **images = list_images(path, &numimages);
+    if(images == NULL)
+        return false;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    //One worker per online CPU (or $Y86_THREADS), but never more workers than images
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if(getenv("Y86_THREADS") != NULL)
+        cpus = atol(getenv("Y86_THREADS"));
+    int numworkers = (cpus < 1) ? 1 : (int) cpus;
+    if(numworkers > numimages)
+        numworkers = (numimages > 0) ? numimages : 1;
+
+    batch_pool_t pool;
+    pool.tasks = (batch_task_t *) calloc(numimages + 1, sizeof(batch_task_t));
+    pool.deques = (batch_deque_t *) calloc(numworkers, sizeof(batch_deque_t));
+    int *indices = (int *) malloc((numimages + 1) * sizeof(int));
+    pool.numworkers = numworkers;
+    pool.stolen = 0;
+    pthread_mutex_init(&pool.stolenlock, NULL);
+    if(pool.tasks == NULL || pool.deques == NULL || indices == NULL) {
+        free(pool.tasks);
+        free(pool.deques);
+        free(indices);
+        for(int i = 0; i < numimages; i++)
+            free(images[i]);
+        free(images);
+        return false;
+    }
+
+    //Deal out contiguous runs of images; stealing evens out the rest
+    for(int i = 0; i < numimages; i++) {
+        pool.tasks[i].path = images[i];
+        indices[i] = i;
+    }
+    for(int w = 0; w < numworkers; w++) {
+        batch_deque_t *dq = &pool.deques[w];
+        pthread_mutex_init(&dq->lock, NULL);
+        dq->tasks = indices;
+        dq->top = (int) ((long) numimages * w / numworkers);
+        dq->bottom = (int) ((long) numimages * (w + 1) / numworkers);
+    }
+
+    //The calling thread is worker 0
+    pthread_t threads[numworkers];
+    batch_worker_t args[numworkers];
+    for(int w = 0; w < numworkers; w++) {
+        args[w].pool = &pool;
+        args[w].id = w;
+    }
+    int started = 1;
+    for(int w = 1; w < numworkers; w++) {
+        if(pthread_create(&threads[w], NULL, worker_main, &args[w]) != 0)
+            break;
+        started++;
+    }
+    worker_main(&args[0]);
+    for(int w = 1; w < started; w++)
+        pthread_join(threads[w], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    //Print results in input order
+    for(int i = 0; i < numimages; i++) {
+        batch_task_t *task = &pool.tasks[i];
+        fprintf(out, "%s:\n", task->path);
+        if(task->result != NULL)
+            fwrite(task->result, 1, task->resultlen, out);
+        if(!task->loaded)
+            stats->failed++;
+        stats->instructions += task->count;
+        free(task->result);
+        free(task->path);
+    }
+
+    stats->images = numimages;
+    stats->threads = numworkers;
+    stats->stolen = pool.stolen;
+    stats->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    for(int w = 0; w < numworkers; w++)
+        pthread_mutex_destroy(&pool.deques[w].lock);
+    pthread_mutex_destroy(&pool.stolenlock);
+    free(pool.tasks);
+    free(pool.deques);
+    free(indices);
+    free(images);
+    return true;
+}
+
+void dump_batch_stats (FILE *out, batch_stats_t *stats) {
+    double rate = 0;
+    double mips = 0;
+    if(stats->seconds > 0) {
+        rate = stats->images / stats->seconds;
+        mips = stats->instructions / stats->seconds / 1e6;
+    }
+    fprintf(out, "Batch: %d images (%d failed) on %d threads, %lu tasks stolen\n",
+            stats->images, stats->failed, stats->threads, stats->stolen);
+    fprintf(out, "Batch throughput: %lu instructions in %.3f s (%.1f images/s, %.2f MIPS)\n",
+            stats->instructions, stats->seconds, rate, mips);
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+static int compare_names (const void *a, const void *b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+//Add a copy of a path to a growing array of paths
+static bool add_image (char ***images, int *count, int *capacity, const char *path) {
+    if(*count == *capacity) {
+        int newcap = (*capacity == 0) ? 64 : *capacity * 2;
+        char **bigger = (char **) realloc(*images, newcap * sizeof(char *));
+        if(bigger == NULL)
+            return false;
+        *images = bigger;
+        *capacity = newcap;
+    }
+    char *copy = strdup(path);
+    if(copy == NULL)
+        return false;
+    (*images)[(*count)++] = copy;
+    return true;
+}
+
+//Collect image paths from a directory (regular files, sorted) or a list file
+static char **list_images (const char *path, int *count) {
+    char **images = NULL;
+    int capacity = 0;
+    bool ok = true;
+    *count = 0;
+
+    DIR *dir = opendir(path);
+    if(dir != NULL) {
+        struct dirent *entry;
+        while(ok && (entry = readdir(dir)) != NULL) {
+            if(entry->d_name[0] == '.')
+                continue;
+            size_t len = strlen(path) + strlen(entry->d_name) + 2;
+            char full[len];
+            snprintf(full, len, "%s/%s", path, entry->d_name);
+            struct stat info;
+            if(stat(full, &info) == 0 && S_ISREG(info.st_mode))
+                ok = add_image(&images, count, &capacity, full);
+        }
+        closedir(dir);
+        if(ok && *count > 0)
+            qsort(images, *count, sizeof(char *), compare_names);
+    } else {
+        FILE *list = fopen(path, "r");
+        if(list == NULL)
+            return NULL;
+        char *line = NULL;
+        size_t linecap = 0;
+        ssize_t len;
+        while(ok && (len = getline(&line, &linecap, list)) != -1) {
+            while(len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+                line[--len] = '\0';
+            if(len > 0)
+                ok = add_image(&images, count, &capacity, line);
+        }
+        free(line);
+        fclose(list);
+    }
+
+    if(!ok) {
+        for(int i = 0; i < *count; i++)
+            free(images[i]);
+        free(images);
+        return NULL;
+    }
+    //An empty batch is still a valid batch
+    if(images == NULL)
+        images = (char **) calloc(1, sizeof(char *));
+    return images;
+}
+
+//Take the next task: our own newest one first, otherwise the oldest one
+//from another worker. Returns -1 once every deque is empty.
+static int next_task (batch_pool_t *pool, int self) {
+    batch_deque_t *own = &pool->deques[self];
+    int task = -1;
+    pthread_mutex_lock(&own->lock);
+    if(own->top < own->bottom)
+        task = own->tasks[--own->bottom];
+    pthread_mutex_unlock(&own->lock);
+    if(task >= 0)
+        return task;
+
+    //Nothing creates new tasks, so a full pass over empty deques means we are done
+    for(int i = 1; i < pool->numworkers && task < 0; i++) {
+        batch_deque_t *victim = &pool->deques[(self + i) % pool->numworkers];
+        pthread_mutex_lock(&victim->lock);
+        if(victim->top < victim->bottom)
+            task = victim->tasks[victim->top++];
+        pthread_mutex_unlock(&victim->lock);
+    }
+    if(task >= 0) {
+        pthread_mutex_lock(&pool->stolenlock);
+        pool->stolen++;
+        pthread_mutex_unlock(&pool->stolenlock);
+    }
+    return task;
+}
+
+static void *worker_main (void *arg) {
+    batch_worker_t *worker = (batch_worker_t *) arg;
+    int task;
+    while((task = next_task(worker->pool, worker->id)) >= 0)
+        run_task(&worker->pool->tasks[task]);
+    return NULL;
+}
+
+//Load and run one image, keeping its -e output in memory
+static void run_task (batch_task_t *task) {
+    FILE *out = open_memstream(&task->result, &task->resultlen);
+    if(out == NULL)
+        return;
+
+    //Each image gets its own CPU and guest memory
+    y86_vm_t *vm = y86_vm_create();
+    task->loaded = vm != NULL && y86_vm_load_file(vm, task->path);
+    if(!task->loaded) {
+        fprintf(out, "Failed to read file\n");
+        fclose(out);
+        y86_vm_free(vm);
+        return;
+    }
+
+    //Guest output is kept with the rest of the image's output
+    io_set_output(vm->io, out);
+    fprintf(out, "Beginning execution at 0x%04x\n", vm->hdr.e_entry);
+    vm->last = block_run(&vm->cpu, vm->memory, &vm->count, false, NULL);
+    y86_vm_run(vm, -1);
+    fdump_cpu_state(out, &vm->cpu);
+    fprintf(out, "Total execution count: %d\n", vm->count);
+    task->count = vm->count;
+
+    fclose(out);
+    y86_vm_free(vm);
+}
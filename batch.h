@@ -0,0 +1,47 @@
+#ifndef __CS261_BATCH__
+#define __CS261_BATCH__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "y86.h"
+
+/* Aggregate results of a batch run */
+typedef struct batch_stats {
+    int images;                 // images in the batch
+    int failed;                 // images that could not be loaded
+    int threads;                // worker threads used
+    uint64_t instructions;      // instructions executed across all images
+    uint64_t stolen;            // tasks run by a worker other than their owner
+    double seconds;             // wall-clock time for loading and running
+} batch_stats_t;
+
+/**
+ * @brief Run many Mini-ELF images on a work-stealing pool of threads
+ *
+ * Each image is loaded into its own VM (see y86vm.h) and run by the
+ * basic-block engine. Results are
+ * printed in input order, each as the image's name followed by exactly what
+ * "-e" prints for it. The pool has one thread per online CPU unless the
+ * Y86_THREADS environment variable asks for a different number.
+ *
+ * @param path A directory of images (every regular file in name order) or a
+ * text file listing one image path per line
+ * @param out Stream to print results to
+ * @param stats Pointer to aggregate statistics to fill in
+ * @returns True if the list of images could be read
+ */
+bool batch_run (const char *path, FILE *out, batch_stats_t *stats);
+
+/**
+ * @brief Print aggregate throughput statistics for a batch
+ *
+ * @param out Stream to print to
+ * @param stats Statistics filled in by batch_run()
+ */
+void dump_batch_stats (FILE *out, batch_stats_t *stats);
+
+#endif
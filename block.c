@@ -0,0 +1,497 @@
+/*
+ * CS 261: Basic-block translation cache
+ *
+ * Name: Ben Berry
+ */
+
+#include "block.h"
+#include "icache.h"
+#include "jit.h"
+#include "p3-disas.h"
+#include "p4-interp.h"
+#include "io.h"
+
+/* Translation cache storage structure */
+typedef struct block_cache {
+
+    block_t *map[MEMSIZE];              // translated block starting at each address
+    byte_t code[MEMSIZE + STORE_SIZE];  // nonzero where translated bytes live
+
+    block_t **all;              // every live block, so they can be freed
+    int numblocks;              // number of entries used in all
+    int capacity;               // number of entries allocated in all
+
+    bool stale;                 // a store hit translated code; flush before reuse
+
+} block_cache_t;
+
+static block_t *translate (block_cache_t *cache, y86_t *cpu, byte_t *memory,
+        block_stats_t *stats);
+static const block_uop_t *exec_block (block_cache_t *cache, block_t *b,
+        y86_t *cpu, byte_t *memory, int *count, y86_inst_t *slow);
+static y86_inst_t run_native (block_cache_t *cache, block_t *b, y86_t *cpu,
+        byte_t *memory, int *count);
+static bool hits_code (block_cache_t *cache, address_t addr);
+static bool slow_hits_code (block_cache_t *cache, y86_t *cpu, const y86_inst_t *ins,
+        address_t store);
+static y86_inst_t uop_to_inst (const block_uop_t *u);
+static void flush (block_cache_t *cache);
+
+/**********************************************************************
+ *                         ENGINE FUNCTIONS
+ *********************************************************************/
+
+y86_inst_t block_run (y86_t *cpu, byte_t *memory, int *count, bool jit,
+        block_stats_t *stats) {
+    y86_inst_t last;
+    memset(&last, 0x00, sizeof(last));
+
+    //Check for null parameters
+    if(cpu == NULL)
+        return last;
+    if(memory == NULL || count == NULL) {
+        cpu->stat = INS;
+        return last;
+    }
+    //Stores here are not tracked, so a snapshot restore must copy everything
+    cpu->dirty = DIRTY_ALL;
+    block_stats_t unused;
+    if(stats == NULL)
+        stats = &unused;
+    memset(stats, 0x00, sizeof(*stats));
+
+    block_cache_t *cache = (block_cache_t *) calloc(1, sizeof(block_cache_t));
+    if(cache == NULL) {
+        cpu->stat = INS;
+        return last;
+    }
+
+    //Native code is optional; without it every block is interpreted
+    jit_t *native = jit ? jit_create() : NULL;
+
+    block_t *b = NULL;
+    if(cpu->pc >= MEMSIZE)
+        cpu->stat = ADR;
+
+    while(cpu->stat == AOK) {
+        //No direct link to follow, so look the block up (or translate it)
+        if(b == NULL) {
+            b = cache->map[cpu->pc];
+            if(b != NULL)
+                stats->found++;
+            else if((b = translate(cache, cpu, memory, stats)) == NULL) {
+                cpu->stat = INS;
+                break;
+            }
+        }
+        stats->execs++;
+
+        //Run the whole block, then note which instruction finished it
+        if(b->native != NULL) {
+            stats->native++;
+            last = run_native(cache, b, cpu, memory, count);
+        } else {
+            y86_inst_t slow;
+            const block_uop_t *u = exec_block(cache, b, cpu, memory, count, &slow);
+            last = (u == NULL) ? slow : uop_to_inst(u);
+
+            //Compile blocks that keep getting run (unless they just went stale)
+            if(native != NULL && ++b->execs == JIT_THRESHOLD && !cache->stale) {
+                b->native = jit_compile(native, b, cache->code);
+                if(b->native != NULL)
+                    stats->compiled++;
+            }
+        }
+
+        //Self-modifying code: every translation might be wrong now
+        if(cache->stale) {
+            flush(cache);
+            jit_reset(native);
+            stats->flushes++;
+            b = NULL;
+            continue;
+        }
+        if(cpu->stat != AOK)
+            break;
+
+        //Follow a direct link to the successor if there is one for this PC
+        block_t *next = NULL;
+        int slot = 1;
+        for(int i = 0; i < 2; i++) {
+            if(b->link[i].pc == cpu->pc) {
+                next = b->link[i].next;
+                slot = i;
+                break;
+            }
+        }
+        if(next != NULL) {
+            stats->chained++;
+            b = next;
+            continue;
+        }
+
+        //Otherwise find the successor and remember it for next time. Dynamic
+        //targets (ret) reuse the second link as a one-entry prediction.
+        next = cache->map[cpu->pc];
+        if(next != NULL)
+            stats->found++;
+        else if((next = translate(cache, cpu, memory, stats)) == NULL) {
+            cpu->stat = INS;
+            break;
+        }
+        b->link[slot].pc = cpu->pc;
+        b->link[slot].next = next;
+        b = next;
+    }
+
+    flush(cache);
+    free(cache->all);
+    free(cache);
+    jit_free(native);
+    return last;
+}
+
+void dump_block_stats (FILE *out, block_stats_t *stats) {
+    double hitrate = 0;
+    double avglen = 0;
+    if(stats->execs > 0)
+        hitrate = 100.0 * (stats->chained + stats->found) / stats->execs;
+    if(stats->blocks > 0)
+        avglen = (double) stats->insts / stats->blocks;
+
+    fprintf(out, "Block cache: %lu blocks translated, average length %.2f instructions\n",
+            stats->blocks, avglen);
+    fprintf(out, "Block executions: %lu, hit rate %.2f%% (%lu via direct links)\n",
+            stats->execs, hitrate, stats->chained);
+    fprintf(out, "Block cache flushes: %lu\n", stats->flushes);
+    if(stats->compiled > 0)
+        fprintf(out, "JIT: %lu blocks compiled, %lu native block executions\n",
+                stats->compiled, stats->native);
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+//Pick the micro-op for a cleanly decoded instruction. Operands naming %r15
+//(NOREG) reach past the register file in the reference code, so those run
+//through the slow path to keep identical results.
+static block_uop_kind_t select_uop (y86_inst_t *inst) {
+    switch(inst->icode) {
+        case(HALT):   return U_HALT;
+        case(NOP):    return U_NOP;
+        case(CMOV):   return U_CMOV;
+        case(IRMOVQ): return U_IRMOVQ;
+        case(RMMOVQ): return (inst->ra == NOREG || inst->rb == NOREG) ? U_SLOW : U_RMMOVQ;
+        case(MRMOVQ): return (inst->rb == NOREG) ? U_SLOW : U_MRMOVQ;
+        case(OPQ):
+            if(inst->ra == NOREG || inst->rb == NOREG)
+                return U_SLOW;
+            return U_ADDQ + inst->ifun.op;
+        case(JUMP):   return U_JUMP;
+        case(CALL):   return U_CALL;
+        case(RET):    return U_RET;
+        case(PUSHQ):  return U_PUSHQ;
+        case(POPQ):   return (inst->ra == NOREG) ? U_SLOW : U_POPQ;
+        default:      return U_SLOW;
+    }
+}
+
+//Decode the block starting at the current PC and add it to the cache
+static block_t *translate (block_cache_t *cache, y86_t *cpu, byte_t *memory,
+        block_stats_t *stats) {
+    block_uop_t uops[BLOCK_MAXLEN];
+    int len = 0;
+    address_t pc = cpu->pc;
+    bool end = false;
+
+    while(!end && len < BLOCK_MAXLEN) {
+        //Decode on a copy so the real CPU status is left alone
+        y86_t probe = *cpu;
+        probe.pc = pc;
+        y86_inst_t ins = fetch(&probe, memory);
+
+        block_uop_t *u = &uops[len++];
+        u->kind = (probe.stat == cpu->stat) ? select_uop(&ins) : U_SLOW;
+        u->cond = ins.ifun.b;
+        u->ra = ins.ra;
+        u->rb = ins.rb;
+        u->imm = ins.valC.v;
+        u->valP = ins.valP;
+
+        switch(u->kind) {
+            case(U_HALT): case(U_JUMP): case(U_CALL): case(U_RET): case(U_SLOW):
+                end = true;
+                break;
+            default:
+                break;
+        }
+        //Slow micro-ops decode from memory every time, so only mark the rest
+        if(u->kind != U_SLOW)
+            memset(&cache->code[pc], 1, ins.valP - pc);
+        pc = ins.valP;
+    }
+
+    block_t *b = (block_t *) malloc(sizeof(block_t) + len * sizeof(block_uop_t));
+    if(b == NULL)
+        return NULL;
+    b->start = cpu->pc;
+    b->len = len;
+    b->execs = 0;
+    b->native = NULL;
+    memcpy(b->uops, uops, len * sizeof(block_uop_t));
+
+    //Static successors get their link slots now; they are filled on first use
+    block_uop_t *tail = &b->uops[len - 1];
+    b->link[0].pc = MEMSIZE;
+    b->link[1].pc = MEMSIZE;
+    b->link[0].next = NULL;
+    b->link[1].next = NULL;
+    if(tail->kind == U_JUMP || tail->kind == U_CALL)
+        b->link[0].pc = tail->imm;
+    if(tail->kind != U_CALL && tail->kind != U_RET && tail->kind != U_HALT
+            && tail->kind != U_SLOW)
+        b->link[1].pc = tail->valP;
+
+    //Remember the block so it can be found by address and freed later
+    if(cache->numblocks == cache->capacity) {
+        int capacity = cache->capacity ? cache->capacity * 2 : 64;
+        block_t **all = (block_t **) realloc(cache->all, capacity * sizeof(block_t *));
+        if(all == NULL) {
+            free(b);
+            return NULL;
+        }
+        cache->all = all;
+        cache->capacity = capacity;
+    }
+    cache->all[cache->numblocks++] = b;
+    cache->map[b->start] = b;
+    stats->blocks++;
+    stats->insts += len;
+    return b;
+}
+
+//True if an 8-byte store at addr overlaps any translated instruction
+static bool hits_code (block_cache_t *cache, address_t addr) {
+    uint64_t bytes;
+    if(addr >= MEMSIZE)
+        return false;
+    memcpy(&bytes, &cache->code[addr], sizeof(bytes));
+    return bytes != 0;
+}
+
+//Check everything an instruction run by the reference pipeline stored to:
+//its one store, or all that a hypercall wrote
+static bool slow_hits_code (block_cache_t *cache, y86_t *cpu, const y86_inst_t *ins,
+        address_t store) {
+    address_t lo, hi;
+    if(hits_code(cache, store))
+        return true;
+    if(io_stored(cpu, ins, &lo, &hi)) {
+        for(address_t a = lo; a < hi; a += STORE_SIZE) {
+            if(hits_code(cache, a))
+                return true;
+        }
+    }
+    return false;
+}
+
+//Execute the micro-ops of one block. Returns the micro-op that finished the
+//block, or NULL if a slow instruction did (it is then copied into slow).
+static const block_uop_t *exec_block (block_cache_t *cache, block_t *b,
+        y86_t *cpu, byte_t *memory, int *count, y86_inst_t *slow) {
+    const block_uop_t *u = b->uops;
+    const block_uop_t *end = u + b->len;
+    address_t pc = b->start;
+    address_t store;
+    y86_reg_t valA;
+    y86_reg_t valB;
+    y86_reg_t valE;
+    int n = 0;
+
+    for(; u < end; pc = u->valP, u++) {
+        switch(u->kind) {
+            case(U_HALT):
+                cpu->stat = HLT;
+                cpu->pc = u->valP;
+                *count += n + 1;
+                return u;
+            case(U_NOP):
+                break;
+            case(U_CMOV):
+                if(check_cond(cpu, u->cond))
+                    cpu->reg[u->rb] = cpu->reg[u->ra];
+                break;
+            case(U_IRMOVQ):
+                cpu->reg[u->rb] = u->imm;
+                break;
+            case(U_RMMOVQ):
+                valE = u->imm + cpu->reg[u->rb];
+                if(valE >= MEMSIZE)
+                    goto fault;
+                *((uint64_t *)&memory[valE]) = cpu->reg[u->ra];
+                if(hits_code(cache, valE)) {
+                    cache->stale = true;
+                    cpu->pc = u->valP;
+                    *count += n + 1;
+                    return u;
+                }
+                break;
+            case(U_MRMOVQ):
+                valE = u->imm + cpu->reg[u->rb];
+                if(valE >= MEMSIZE)
+                    goto fault;
+                cpu->reg[u->ra] = *((uint64_t *)&memory[valE]);
+                break;
+
+            //OPq flags follow decode_execute(): only add and sub set overflow
+            case(U_ADDQ):
+                valA = cpu->reg[u->ra];
+                valB = cpu->reg[u->rb];
+                valE = valB + valA;
+                cpu->of = (((int64_t)valB < 0) == ((int64_t)valA < 0)) &&
+                          (((int64_t)valE < 0) != ((int64_t)valB < 0));
+                goto setflags;
+            case(U_SUBQ):
+                valA = cpu->reg[u->ra];
+                valB = cpu->reg[u->rb];
+                valE = valB - valA;
+                cpu->of = (((int64_t)valB < 0) != ((int64_t)valA < 0)) &&
+                          (((int64_t)valE < 0) != ((int64_t)valB < 0));
+                goto setflags;
+            case(U_ANDQ):
+                valE = cpu->reg[u->rb] & cpu->reg[u->ra];
+                goto setflags;
+            case(U_XORQ):
+                valE = cpu->reg[u->rb] ^ cpu->reg[u->ra];
+            setflags:
+                cpu->sf = ((int64_t)valE < 0);
+                cpu->zf = (valE == 0);
+                cpu->reg[u->rb] = valE;
+                break;
+
+            case(U_JUMP):
+                cpu->pc = check_cond(cpu, u->cond) ? (address_t) u->imm : u->valP;
+                goto branch;
+            case(U_CALL):
+                valE = cpu->reg[RSP] - 8;
+                //A failed call still moves the PC to the destination
+                if(valE >= MEMSIZE) {
+                    cpu->stat = ADR;
+                    cpu->pc = u->imm;
+                    *count += n + 1;
+                    return u;
+                }
+                *((uint64_t *)&memory[valE]) = u->valP;
+                cpu->reg[RSP] = valE;
+                cpu->pc = u->imm;
+                cache->stale = hits_code(cache, valE);
+                goto branch;
+            case(U_RET):
+                if(cpu->reg[RSP] >= MEMSIZE)
+                    goto fault;
+                cpu->pc = *((uint64_t *)&memory[cpu->reg[RSP]]);
+                cpu->reg[RSP] += 8;
+                goto branch;
+            case(U_PUSHQ):
+                valE = cpu->reg[RSP] - 8;
+                if(valE >= MEMSIZE)
+                    goto fault;
+                *((uint64_t *)&memory[valE]) = cpu->reg[u->ra];
+                cpu->reg[RSP] = valE;
+                if(hits_code(cache, valE)) {
+                    cache->stale = true;
+                    cpu->pc = u->valP;
+                    *count += n + 1;
+                    return u;
+                }
+                break;
+            //Popping into %rsp keeps the loaded value, as in memory_wb_pc()
+            case(U_POPQ):
+                if(cpu->reg[RSP] >= MEMSIZE)
+                    goto fault;
+                valE = *((uint64_t *)&memory[cpu->reg[RSP]]);
+                cpu->reg[RSP] += 8;
+                cpu->reg[u->ra] = valE;
+                break;
+
+            //Anything unusual runs through the reference pipeline
+            case(U_SLOW):
+                cpu->pc = pc;
+                *count += n;
+                *slow = step_reference(cpu, memory, count, &store);
+                cache->stale = slow_hits_code(cache, cpu, slow, store);
+                return NULL;
+        }
+        n++;
+    }
+
+    //Block was cut off at BLOCK_MAXLEN; carry on at the next instruction
+    cpu->pc = (u - 1)->valP;
+    *count += n;
+    return u - 1;
+
+branch:
+    //Control transfers can leave memory, which the -e loop reports as ADR
+    if(cpu->pc >= MEMSIZE)
+        cpu->stat = ADR;
+    *count += n + 1;
+    return u;
+
+fault:
+    //Memory errors leave the PC on the faulting instruction
+    cpu->stat = ADR;
+    cpu->pc = pc;
+    *count += n + 1;
+    return u;
+}
+
+//Run the compiled form of a block. Instructions it cannot finish (faults and
+//anything unusual) are handed to the reference pipeline.
+static y86_inst_t run_native (block_cache_t *cache, block_t *b, y86_t *cpu,
+        byte_t *memory, int *count) {
+    address_t store;
+    uint32_t result = b->native(cpu, memory);
+    int retired = result & JIT_RETIRED_MASK;
+    jit_exit_t reason = result >> JIT_EXIT_SHIFT;
+
+    *count += retired;
+    if(reason == JIT_EXIT_FALLBACK) {
+        y86_inst_t ins = step_reference(cpu, memory, count, &store);
+        cache->stale = slow_hits_code(cache, cpu, &ins, store);
+        return ins;
+    }
+    if(reason == JIT_EXIT_STALE)
+        cache->stale = true;
+    //Control transfers can leave memory, which the -e loop reports as ADR
+    if(cpu->stat == AOK && cpu->pc >= MEMSIZE)
+        cpu->stat = ADR;
+    return uop_to_inst(&b->uops[retired - 1]);
+}
+
+//Rebuild the instruction a micro-op was translated from
+static y86_inst_t uop_to_inst (const block_uop_t *u) {
+    static const y86_icode_t icodes[] = {
+        HALT, NOP, CMOV, IRMOVQ, RMMOVQ, MRMOVQ, OPQ, OPQ, OPQ, OPQ,
+        JUMP, CALL, RET, PUSHQ, POPQ, INVALID
+    };
+    y86_inst_t ins;
+    memset(&ins, 0x00, sizeof(ins));
+    ins.icode = icodes[u->kind];
+    ins.ifun.b = u->cond;
+    ins.ra = u->ra;
+    ins.rb = u->rb;
+    ins.valC.v = u->imm;
+    ins.valP = u->valP;
+    return ins;
+}
+
+//Drop every translated block
+static void flush (block_cache_t *cache) {
+    for(int i = 0; i < cache->numblocks; i++)
+        free(cache->all[i]);
+    cache->numblocks = 0;
+    memset(cache->map, 0x00, sizeof(cache->map));
+    memset(cache->code, 0x00, sizeof(cache->code));
+    cache->stale = false;
+}
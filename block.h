@@ -0,0 +1,92 @@
+#ifndef __CS261_BLOCK__
+#define __CS261_BLOCK__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "y86.h"
+
+/* Longest block that will be translated before it is cut off */
+#define BLOCK_MAXLEN 64
+
+/* Micro-op kinds; one per operation, with conditions kept in the operand */
+typedef enum {
+    U_HALT = 0, U_NOP, U_CMOV, U_IRMOVQ, U_RMMOVQ, U_MRMOVQ,
+    U_ADDQ, U_SUBQ, U_ANDQ, U_XORQ, U_JUMP, U_CALL, U_RET, U_PUSHQ, U_POPQ,
+    U_SLOW
+} block_uop_kind_t;
+
+/* Compact translated form of one Y86 instruction */
+typedef struct block_uop {
+    uint8_t kind;               // block_uop_kind_t
+    uint8_t cond;               // ifun for cmovXX/jXX
+    uint8_t ra;                 // rA
+    uint8_t rb;                 // rB
+    int64_t imm;                // valC
+    address_t valP;             // address of next instruction
+} block_uop_t;
+
+/* Compiled form of a block (see jit.h): runs it natively on the CPU and
+   guest memory and returns the retired instruction count and exit reason */
+typedef uint32_t (*block_native_t) (y86_t *cpu, byte_t *memory);
+
+/* Direct link from the end of one block to a block that followed it */
+typedef struct block_link {
+    address_t pc;               // successor start address (MEMSIZE if unused)
+    struct block *next;         // successor block
+} block_link_t;
+
+/* A translated basic block: straight-line code ending at a jump, call, ret,
+   halt, iotrap, anything unusual, or after BLOCK_MAXLEN instructions. */
+typedef struct block {
+    address_t start;            // address of the first instruction
+    int len;                    // number of micro-ops
+    block_link_t link[2];       // taken and fall-through (or last ret target)
+    uint32_t execs;             // interpreted executions so far
+    block_native_t native;      // compiled code, once the block is hot
+    block_uop_t uops[];         // translated instructions
+} block_t;
+
+/* Counters describing how well the translation cache is working */
+typedef struct block_stats {
+    uint64_t blocks;            // blocks translated
+    uint64_t insts;             // instructions translated into those blocks
+    uint64_t execs;             // block executions
+    uint64_t chained;           // executions entered through a direct link
+    uint64_t found;             // executions found by address in the cache
+    uint64_t flushes;           // cache flushes caused by stores into code
+    uint64_t compiled;          // blocks compiled to native code
+    uint64_t native;            // block executions that ran native code
+} block_stats_t;
+
+/**
+ * @brief Run a Y86 program to completion with the basic-block engine
+ *
+ * Blocks are translated once into micro-op arrays, cached by start address
+ * and linked directly to the blocks that follow them. A store into the bytes
+ * of any translated block flushes the cache. With the JIT enabled, blocks
+ * that get hot are compiled to native code. Results (final CPU state and
+ * execution count) always match the -e loop.
+ *
+ * @param cpu Y86 CPU structure, already pointed at the entry address
+ * @param memory Pointer to the beginning of the Y86 address space
+ * @param count Pointer to the running execution count to be updated
+ * @param jit True to compile hot blocks to native code where supported
+ * @param stats Pointer to counters to fill in (may be NULL)
+ * @returns The last instruction executed (needed to fix up the PC after ADR)
+ */
+y86_inst_t block_run (y86_t *cpu, byte_t *memory, int *count, bool jit,
+        block_stats_t *stats);
+
+/**
+ * @brief Print block cache statistics
+ *
+ * @param out Stream to print to
+ * @param stats Counters filled in by block_run()
+ */
+void dump_block_stats (FILE *out, block_stats_t *stats);
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * CS 261: Memory-mapped device bus
+ *
+ * Name: Ben Berry
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "bus.h"
+
+static uint64_t uart_read (void *state, address_t offset, size_t len);
+static void uart_write (void *state, address_t offset, uint64_t value, size_t len);
+static uint64_t timer_read (void *state, address_t offset, size_t len);
+static uint64_t cycles_read (void *state, address_t offset, size_t len);
+static void ignore_write (void *state, address_t offset, uint64_t value, size_t len);
+static uint64_t register_bytes (uint64_t value, address_t offset, size_t len);
+
+/**********************************************************************
+ *                         BUS FUNCTIONS
+ *********************************************************************/
+
+bus_t *bus_create (y86_vm_t *vm, address_t base) {
+    if(vm == NULL || vm->pmem == NULL || base < MEMSIZE || base % PMEM_PAGESIZE != 0
+            || base > UINT64_MAX - (BUS_CYCLES + PMEM_PAGESIZE - 1))
+        return NULL;
+    bus_t *bus = (bus_t *) calloc(1, sizeof(bus_t));
+    if(bus == NULL)
+        return NULL;
+    bus->vm = vm;
+    bus->base = base;
+    clock_gettime(CLOCK_MONOTONIC, &bus->start);
+    if(!bus_claim(bus, base + BUS_UART, PMEM_PAGESIZE, uart_read, uart_write, bus)
+            || !bus_claim(bus, base + BUS_TIMER, PMEM_PAGESIZE, timer_read, ignore_write, bus)
+            || !bus_claim(bus, base + BUS_CYCLES, PMEM_PAGESIZE, cycles_read, ignore_write,
+                bus)) {
+        bus_free(bus);
+        return NULL;
+    }
+    return bus;
+}
+
+bool bus_claim (bus_t *bus, address_t base, uint64_t size,
+        uint64_t (*read) (void *state, address_t offset, size_t len),
+        void (*write) (void *state, address_t offset, uint64_t value, size_t len),
+        void *state) {
+    if(bus == NULL || bus->nregions == BUS_MAX || read == NULL || write == NULL)
+        return false;
+    pmem_region_t *region = &bus->regions[bus->nregions];
+    region->base = base;
+    region->size = size;
+    region->read = read;
+    region->write = write;
+    region->state = state;
+    if(!y86_vm_claim(bus->vm, region))
+        return false;
+    bus->nregions++;
+    return true;
+}
+
+void dump_bus_stats (FILE *out, bus_t *bus) {
+    fprintf(out, "Device bus at 0x%lx: %lu bytes out and %lu in through the UART, "
+            "%lu clock reads\n", bus->base, bus->output, bus->input, bus->ticks);
+}
+
+void bus_free (bus_t *bus) {
+    free(bus);
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+//UART data register: characters in and out through the VM's channels
+static uint64_t uart_read (void *state, address_t offset, size_t len) {
+    bus_t *bus = (bus_t *) state;
+    (void) len;
+    if(offset >= sizeof(uint64_t))
+        return 0;
+    int c = io_getc(bus->vm->io);
+    if(c < 0)
+        return UINT64_MAX;
+    bus->input++;
+    return (uint64_t) c;
+}
+
+static void uart_write (void *state, address_t offset, uint64_t value, size_t len) {
+    bus_t *bus = (bus_t *) state;
+    (void) len;
+    //Only a store that reaches the register's low byte sends anything
+    if(offset != 0)
+        return;
+    io_putc(bus->vm->io, (byte_t) value);
+    bus->output++;
+}
+
+//Timer: nanoseconds of host time since the bus was created
+static uint64_t timer_read (void *state, address_t offset, size_t len) {
+    bus_t *bus = (bus_t *) state;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    bus->ticks++;
+    return register_bytes((uint64_t) (now.tv_sec - bus->start.tv_sec) * 1000000000
+            + (uint64_t) now.tv_nsec - (uint64_t) bus->start.tv_nsec, offset, len);
+}
+
+//Cycle counter: the instructions the VM has executed before this one
+static uint64_t cycles_read (void *state, address_t offset, size_t len) {
+    bus_t *bus = (bus_t *) state;
+    bus->ticks++;
+    return register_bytes((uint64_t) bus->vm->count, offset, len);
+}
+
+static void ignore_write (void *state, address_t offset, uint64_t value, size_t len) {
+    (void) state;
+    (void) offset;
+    (void) value;
+    (void) len;
+}
+
+//The bytes of a quad register a load of len bytes at offset sees (the rest
+//of the page reads as zero)
+static uint64_t register_bytes (uint64_t value, address_t offset, size_t len) {
+    if(offset >= sizeof(uint64_t))
+        return 0;
+    value >>= offset * 8;
+    if(len < sizeof(uint64_t))
+        value &= ((uint64_t) 1 << (len * 8)) - 1;
+    return value;
+}
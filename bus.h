@@ -0,0 +1,94 @@
+#ifndef __CS261_BUS__
+#define __CS261_BUS__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "y86.h"
+#include "y86vm.h"
+#include "pmem.h"
+
+/* Where the bus goes unless told otherwise, and how many regions it holds */
+#define BUS_BASE 0xf0000000
+#define BUS_MAX  8
+
+/* Offsets of the standard devices from the bus base, one page each */
+#define BUS_UART   0x0000
+#define BUS_TIMER  0x1000
+#define BUS_CYCLES 0x2000
+
+/* Memory-mapped devices on a paged VM. Each device claims whole pages (see
+   pmem_claim()), so loads and stores anywhere else never look at the bus;
+   only accesses to a device's pages are dispatched to it, and those are
+   found from the page table rather than by searching the regions.
+
+   The standard devices, at the bus base:
+     UART    quad 0: a store writes its low byte as output, as CHAROUT
+             does; a load reads the next byte of input, as CHARIN does
+             (all ones at the end of input)
+     TIMER   quad 0: nanoseconds since the bus was created
+     CYCLES  quad 0: instructions executed so far
+   Loads of part of a register see those bytes of it. Stores to the timer
+   and the counter are ignored, and so is the rest of each page (which
+   reads as zero). */
+typedef struct bus {
+
+    y86_vm_t *vm;               // VM the devices are attached to
+    address_t base;             // where the standard devices start
+    pmem_region_t regions[BUS_MAX];
+    int nregions;
+    struct timespec start;      // when the timer reads zero
+
+    uint64_t output;            // bytes written through the UART
+    uint64_t input;             // bytes read through the UART
+    uint64_t ticks;             // timer and counter reads
+
+} bus_t;
+
+/**
+ * @brief Attach the standard devices to a VM
+ *
+ * @param vm VM with paged memory and the program loaded
+ * @param base Where the devices go (a multiple of PMEM_PAGESIZE, at or
+ * above MEMSIZE)
+ * @returns New bus, or NULL if the pages could not be claimed
+ */
+bus_t *bus_create (y86_vm_t *vm, address_t base);
+
+/**
+ * @brief Attach another device to the bus
+ *
+ * @param bus Bus to attach to
+ * @param base First guest address of the device (a multiple of PMEM_PAGESIZE)
+ * @param size Bytes it takes up (a multiple of PMEM_PAGESIZE)
+ * @param read Called for guest loads from the device
+ * @param write Called for guest stores to the device
+ * @param state Passed to read and write
+ * @returns True if the device was attached, false if the bus is full or the
+ * pages could not be claimed
+ */
+bool bus_claim (bus_t *bus, address_t base, uint64_t size,
+        uint64_t (*read) (void *state, address_t offset, size_t len),
+        void (*write) (void *state, address_t offset, uint64_t value, size_t len),
+        void *state);
+
+/**
+ * @brief Print what went through the standard devices
+ *
+ * @param out Stream to print to
+ * @param bus Bus to describe
+ */
+void dump_bus_stats (FILE *out, bus_t *bus);
+
+/**
+ * @brief Release a bus (after the VM using it is freed)
+ *
+ * @param bus Bus to be freed (may be NULL)
+ */
+void bus_free (bus_t *bus);
+
+#endif
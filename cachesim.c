@@ -0,0 +1,131 @@
+/*
+ * CS 261: Data cache simulation
+ *
+ * Name: Ben Berry
+ */
+
+#include "cachesim.h"
+
+static void access_line (cachesim_t *cs, address_t line, bool store);
+static void access_bytes (cachesim_t *cs, address_t addr, bool store);
+static void consume (void *state, const y86_event_t *ev);
+static void finish (void *state, FILE *out);
+
+/**********************************************************************
+ *                         CACHE FUNCTIONS
+ *********************************************************************/
+
+cachesim_t *cachesim_create (int sets, int ways, int line) {
+    if(sets <= 0 || (sets & (sets - 1)) != 0 || ways <= 0
+            || line < (int) sizeof(uint64_t) || (line & (line - 1)) != 0)
+        return NULL;
+    cachesim_t *cs = (cachesim_t *) calloc(1, sizeof(cachesim_t));
+    if(cs == NULL)
+        return NULL;
+    cs->sets = sets;
+    cs->ways = ways;
+    while((1 << cs->lineshift) < line)
+        cs->lineshift++;
+    cs->tags = (address_t *) calloc(sets * ways, sizeof(address_t));
+    cs->used = (uint64_t *) calloc(sets * ways, sizeof(uint64_t));
+    cs->dirty = (bool *) calloc(sets * ways, sizeof(bool));
+    if(cs->tags == NULL || cs->used == NULL || cs->dirty == NULL) {
+        cachesim_free(cs);
+        return NULL;
+    }
+    return cs;
+}
+
+void cachesim_record (cachesim_t *cs, const y86_event_t *ev) {
+    //No Y86 instruction both loads and stores
+    if(ev->loaded) {
+        cs->loads++;
+        access_bytes(cs, ev->load, false);
+    }
+    if(ev->stored) {
+        cs->stores++;
+        access_bytes(cs, ev->store, true);
+    }
+}
+
+pipe_consumer_t cachesim_consumer (cachesim_t *cs) {
+    pipe_consumer_t c = { "cache", cs, consume, finish };
+    return c;
+}
+
+void dump_cachesim (FILE *out, cachesim_t *cs) {
+    uint64_t accesses = cs->loads + cs->stores;
+    uint64_t misses = cs->load_misses + cs->store_misses;
+    fprintf(out, "Cache: %d sets x %d ways x %d-byte lines (%d bytes)\n",
+            cs->sets, cs->ways, 1 << cs->lineshift, (cs->sets * cs->ways) << cs->lineshift);
+    fprintf(out, "  Loads:  %14lu, %lu misses\n", cs->loads, cs->load_misses);
+    fprintf(out, "  Stores: %14lu, %lu misses\n", cs->stores, cs->store_misses);
+    fprintf(out, "  Hit rate: %.2f%%, %lu writebacks\n",
+            accesses ? 100.0 * (accesses - misses) / accesses : 0.0, cs->writebacks);
+}
+
+void cachesim_free (cachesim_t *cs) {
+    if(cs == NULL)
+        return;
+    free(cs->tags);
+    free(cs->used);
+    free(cs->dirty);
+    free(cs);
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+//Touch every line an eight-byte access covers (a miss counts once)
+static void access_bytes (cachesim_t *cs, address_t addr, bool store) {
+    address_t first = addr >> cs->lineshift;
+    address_t last = (addr + sizeof(uint64_t) - 1) >> cs->lineshift;
+    uint64_t before = cs->load_misses + cs->store_misses;
+    access_line(cs, first, store);
+    if(last != first) {
+        access_line(cs, last, store);
+        //Straddling two lines is still one access
+        if(cs->load_misses + cs->store_misses == before + 2) {
+            if(store)
+                cs->store_misses--;
+            else
+                cs->load_misses--;
+        }
+    }
+}
+
+//Look a line up in its set, filling the least recently used way on a miss
+static void access_line (cachesim_t *cs, address_t line, bool store) {
+    int set = (int) (line & (cs->sets - 1));
+    int base = set * cs->ways;
+    int victim = base;
+    cs->clock++;
+    for(int i = base; i < base + cs->ways; i++) {
+        if(cs->used[i] != 0 && cs->tags[i] == line) {
+            cs->used[i] = cs->clock;
+            cs->dirty[i] |= store;
+            return;
+        }
+        if(cs->used[i] < cs->used[victim])
+            victim = i;
+    }
+    if(store)
+        cs->store_misses++;
+    else
+        cs->load_misses++;
+    if(cs->used[victim] != 0 && cs->dirty[victim])
+        cs->writebacks++;
+    cs->tags[victim] = line;
+    cs->used[victim] = cs->clock;
+    cs->dirty[victim] = store;
+}
+
+//Pipeline callbacks
+static void consume (void *state, const y86_event_t *ev) {
+    cachesim_record((cachesim_t *) state, ev);
+}
+
+static void finish (void *state, FILE *out) {
+    dump_cachesim(out, (cachesim_t *) state);
+}
@@ -0,0 +1,81 @@
+#ifndef __CS261_CACHESIM__
+#define __CS261_CACHESIM__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "y86.h"
+#include "y86vm.h"
+#include "pipeline.h"
+
+/* Default geometry: 4 sets of 4 ways of 64-byte lines (1 KiB) */
+#define CACHE_SETS 4
+#define CACHE_WAYS 4
+#define CACHE_LINE 64
+
+/* Simulated set-associative data cache (write-back, write-allocate, LRU) */
+typedef struct cachesim {
+
+    int sets;                   // sets (a power of two)
+    int ways;                   // lines per set
+    int lineshift;              // log2 of the line size
+    address_t *tags;            // line address held by each way, by set
+    uint64_t *used;             // when each way was last touched (0 = empty)
+    bool *dirty;                // each way was written since it was filled
+    uint64_t clock;             // accesses so far, for LRU
+
+    uint64_t loads;             // loads seen
+    uint64_t stores;            // stores seen
+    uint64_t load_misses;       // line fills for loads
+    uint64_t store_misses;      // line fills for stores
+    uint64_t writebacks;        // dirty lines evicted
+
+} cachesim_t;
+
+/**
+ * @brief Create an empty (cold) cache
+ *
+ * @param sets Number of sets (a power of two)
+ * @param ways Lines in each set
+ * @param line Bytes in each line (a power of two, at least 8)
+ * @returns New cache, or NULL on failure or a bad geometry
+ */
+cachesim_t *cachesim_create (int sets, int ways, int line);
+
+/**
+ * @brief Simulate the memory accesses of one instruction
+ *
+ * Each access is eight bytes; one that straddles two lines touches both.
+ *
+ * @param cs Cache
+ * @param ev What the instruction did
+ */
+void cachesim_record (cachesim_t *cs, const y86_event_t *ev);
+
+/**
+ * @brief Wrap a cache as a pipeline consumer
+ *
+ * @param cs Cache (still freed with cachesim_free())
+ * @returns Consumer that simulates every event and reports hit rates
+ */
+pipe_consumer_t cachesim_consumer (cachesim_t *cs);
+
+/**
+ * @brief Print cache geometry and counters
+ *
+ * @param out Stream to print to
+ * @param cs Cache to describe
+ */
+void dump_cachesim (FILE *out, cachesim_t *cs);
+
+/**
+ * @brief Release a cache
+ *
+ * @param cs Cache to be freed (may be NULL)
+ */
+void cachesim_free (cachesim_t *cs);
+
+#endif
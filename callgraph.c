@@ -0,0 +1,390 @@
+/*
+ * CS 261: Call graph profiles from a shadow stack
+ *
+ * Name: Ben Berry
+ */
+
+#include "callgraph.h"
+
+/* Starting sizes of the arrays and maps (they double as needed) */
+#define CG_INITIAL 64
+
+static void on_call (callgraph_t *cg, address_t target, address_t ret);
+static void on_ret (callgraph_t *cg, address_t pc, address_t target);
+static void charge (callgraph_t *cg);
+static void pop (callgraph_t *cg);
+static bool push (callgraph_t *cg, int node, int edge, address_t ret);
+static int func_of (callgraph_t *cg, address_t addr);
+static int edge_of (callgraph_t *cg, int caller, int callee);
+static int node_of (callgraph_t *cg, int parent, int func);
+static bool grow (void **array, int n, int *max, size_t size);
+static bool map_init (cg_map_t *map, size_t size);
+static int map_find (cg_map_t *map, uint64_t key);
+static bool map_put (cg_map_t *map, uint64_t key, int val);
+static void map_free (cg_map_t *map);
+static void print_stack (FILE *out, callgraph_t *cg, symtab_t *st, int node);
+static int by_inclusive (const void *a, const void *b);
+static int by_edge (const void *a, const void *b);
+
+/**********************************************************************
+ *                         CALL GRAPH FUNCTIONS
+ *********************************************************************/
+
+callgraph_t *callgraph_create (y86_vm_t *vm) {
+    if(vm == NULL || !vm->loaded)
+        return NULL;
+    callgraph_t *cg = (callgraph_t *) calloc(1, sizeof(callgraph_t));
+    if(cg == NULL)
+        return NULL;
+    //The entry point is the root function, already running
+    int root = -1;
+    int node = -1;
+    if(map_init(&cg->byaddr, CG_INITIAL) && map_init(&cg->byedge, CG_INITIAL)
+            && map_init(&cg->bynode, CG_INITIAL))
+        root = func_of(cg, vm->cpu.pc);
+    if(root >= 0)
+        node = node_of(cg, -1, root);
+    if(node < 0 || !push(cg, node, -1, 0)) {
+        callgraph_free(cg);
+        return NULL;
+    }
+    cg->funcs[root].calls = 1;
+    cg->funcs[root].active = 1;
+    return cg;
+}
+
+y86_stat_t callgraph_run (callgraph_t *cg, y86_vm_t *vm, long budget) {
+    if(cg == NULL || vm == NULL)
+        return INS;
+    y86_t *cpu = &vm->cpu;
+    y86_inst_t *ins = &vm->last;
+    for(long i = 0; cpu->stat == AOK && (budget < 0 || i < budget); i++) {
+        address_t pc = cpu->pc;
+        y86_vm_step(vm);
+        cg->instructions++;
+        //Only completed calls and returns move the shadow stack
+        if(ins->icode == CALL && cpu->stat == AOK)
+            on_call(cg, ins->valC.dest, ins->valP);
+        else if(ins->icode == RET && cpu->stat == AOK)
+            on_ret(cg, pc, cpu->pc);
+    }
+    //Close every frame once the CPU stops
+    if(cpu->stat != AOK && cg->depth > 0) {
+        charge(cg);
+        while(cg->depth > 0)
+            pop(cg);
+    }
+    //No more instructions: just the -e fix-up of the PC after ADR
+    return y86_vm_run(vm, 0);
+}
+
+void dump_callgraph (FILE *out, callgraph_t *cg, symtab_t *st) {
+    uint64_t total = cg->instructions ? cg->instructions : 1;
+    uint64_t calls = 0;
+    for(int i = 0; i < cg->nedges; i++)
+        calls += cg->edges[i].calls;
+    fprintf(out, "\nCall graph: %lu instructions, %d functions, %lu calls, deepest stack %d%s\n",
+            cg->instructions, cg->nfuncs, calls, cg->maxdepth,
+            cg->failed ? " (out of memory: partial)" : "");
+
+    //Functions, most inclusive first
+    cg_func_t *funcs = (cg_func_t *) malloc(cg->nfuncs * sizeof(cg_func_t));
+    if(funcs != NULL) {
+        memcpy(funcs, cg->funcs, cg->nfuncs * sizeof(cg_func_t));
+        qsort(funcs, cg->nfuncs, sizeof(cg_func_t), by_inclusive);
+        fprintf(out, "\n  %-24s %10s %14s %7s %14s %7s\n", "Function", "Calls",
+                "Self", "%", "Inclusive", "%");
+        for(int i = 0; i < cg->nfuncs; i++) {
+            char name[64];
+            fprintf(out, "  %-24s %10lu %14lu %6.2f%% %14lu %6.2f%%\n",
+                    symtab_describe(st, funcs[i].addr, name, sizeof(name)), funcs[i].calls,
+                    funcs[i].self, 100.0 * funcs[i].self / total,
+                    funcs[i].inclusive, 100.0 * funcs[i].inclusive / total);
+        }
+        free(funcs);
+    }
+
+    //Edges, most inclusive first
+    cg_edge_t *edges = (cg_edge_t *) malloc((cg->nedges + 1) * sizeof(cg_edge_t));
+    if(edges != NULL && cg->nedges > 0) {
+        memcpy(edges, cg->edges, cg->nedges * sizeof(cg_edge_t));
+        qsort(edges, cg->nedges, sizeof(cg_edge_t), by_edge);
+        fprintf(out, "\n  %-24s %-24s %10s %14s\n", "Caller", "Callee", "Calls", "Inclusive");
+        for(int i = 0; i < cg->nedges; i++) {
+            char caller[64];
+            char callee[64];
+            fprintf(out, "  %-24s %-24s %10lu %14lu\n",
+                    symtab_describe(st, cg->funcs[edges[i].caller].addr, caller, sizeof(caller)),
+                    symtab_describe(st, cg->funcs[edges[i].callee].addr, callee, sizeof(callee)),
+                    edges[i].calls, edges[i].inclusive);
+        }
+    }
+    free(edges);
+
+    //Returns the shadow stack could not account for
+    if(cg->mismatches > 0) {
+        fprintf(out, "\nMismatched returns: %lu\n", cg->mismatches);
+        for(uint64_t i = 0; i < cg->mismatches && i < CALLGRAPH_SHOWN; i++) {
+            cg_mismatch_t *m = &cg->shown[i];
+            fprintf(out, "  ret at 0x%04lx went to 0x%04lx, expected 0x%04lx: ",
+                    m->pc, m->target, m->expected);
+            if(m->unwound > 0)
+                fprintf(out, "unwound %d frame(s)\n", m->unwound);
+            else
+                fprintf(out, "no caller matches, stack kept\n");
+        }
+    }
+}
+
+bool write_stacks (FILE *out, callgraph_t *cg, symtab_t *st) {
+    for(int i = 0; i < cg->nnodes; i++) {
+        if(cg->nodes[i].self == 0)
+            continue;
+        print_stack(out, cg, st, i);
+        fprintf(out, " %lu\n", cg->nodes[i].self);
+    }
+    return !ferror(out);
+}
+
+void callgraph_free (callgraph_t *cg) {
+    if(cg == NULL)
+        return;
+    free(cg->funcs);
+    free(cg->edges);
+    free(cg->nodes);
+    free(cg->stack);
+    map_free(&cg->byaddr);
+    map_free(&cg->byedge);
+    map_free(&cg->bynode);
+    free(cg);
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+//A call pushed its return address: enter the callee
+static void on_call (callgraph_t *cg, address_t target, address_t ret) {
+    //The call itself was the caller's instruction
+    charge(cg);
+    int caller = cg->nodes[cg->stack[cg->depth - 1].node].func;
+    int callee = func_of(cg, target);
+    int edge = (callee >= 0) ? edge_of(cg, caller, callee) : -1;
+    int node = (edge >= 0) ? node_of(cg, cg->stack[cg->depth - 1].node, callee) : -1;
+    if(node < 0 || !push(cg, node, edge, ret)) {
+        cg->failed = true;
+        return;
+    }
+    cg->edges[edge].calls++;
+    cg->funcs[callee].calls++;
+    cg->funcs[callee].active++;
+    cg->edges[edge].active++;
+}
+
+//A ret popped its target: leave the frame that expected it
+static void on_ret (callgraph_t *cg, address_t pc, address_t target) {
+    //The ret itself was the callee's instruction
+    charge(cg);
+    int top = cg->depth - 1;
+    if(top > 0 && cg->stack[top].ret == target) {
+        pop(cg);
+        return;
+    }
+    //Otherwise the stack was changed behind the calls' backs: unwind to a
+    //frame that expects this target if there is one, or leave it alone
+    int match = top - 1;
+    while(match > 0 && cg->stack[match].ret != target)
+        match--;
+    if(cg->mismatches < CALLGRAPH_SHOWN) {
+        cg_mismatch_t *m = &cg->shown[cg->mismatches];
+        m->pc = pc;
+        m->target = target;
+        m->expected = (top > 0) ? cg->stack[top].ret : 0;
+        m->unwound = (match > 0) ? top - match + 1 : 0;
+    }
+    cg->mismatches++;
+    if(match > 0) {
+        while(cg->depth > match)
+            pop(cg);
+    }
+}
+
+//Charge the instructions since the last charge to the top frame
+static void charge (callgraph_t *cg) {
+    cg_node_t *node = &cg->nodes[cg->stack[cg->depth - 1].node];
+    uint64_t spent = cg->instructions - cg->mark;
+    node->self += spent;
+    cg->funcs[node->func].self += spent;
+    cg->mark = cg->instructions;
+}
+
+//Leave the top frame (charge() first)
+static void pop (callgraph_t *cg) {
+    cg_frame_t *frame = &cg->stack[--cg->depth];
+    cg_func_t *func = &cg->funcs[cg->nodes[frame->node].func];
+    uint64_t spent = cg->instructions - frame->start;
+    //Only the outermost frame of a recursive function counts, so nothing
+    //is counted twice; an edge is guarded the same way by its own frames
+    //(for B -> C -> B the inner B still counts for the C -> B edge)
+    if(--func->active == 0)
+        func->inclusive += spent;
+    if(frame->edge >= 0 && --cg->edges[frame->edge].active == 0)
+        cg->edges[frame->edge].inclusive += spent;
+}
+
+static bool push (callgraph_t *cg, int node, int edge, address_t ret) {
+    if(!grow((void **) &cg->stack, cg->depth, &cg->stackmax, sizeof(cg_frame_t)))
+        return false;
+    cg_frame_t *frame = &cg->stack[cg->depth++];
+    frame->node = node;
+    frame->edge = edge;
+    frame->ret = ret;
+    frame->start = cg->instructions;
+    if(cg->depth > cg->maxdepth)
+        cg->maxdepth = cg->depth;
+    return true;
+}
+
+//Find (or add) the function entered at an address
+static int func_of (callgraph_t *cg, address_t addr) {
+    int i = map_find(&cg->byaddr, addr);
+    if(i >= 0)
+        return i;
+    if(!grow((void **) &cg->funcs, cg->nfuncs, &cg->funcmax, sizeof(cg_func_t))
+            || !map_put(&cg->byaddr, addr, cg->nfuncs))
+        return -1;
+    memset(&cg->funcs[cg->nfuncs], 0x00, sizeof(cg_func_t));
+    cg->funcs[cg->nfuncs].addr = addr;
+    return cg->nfuncs++;
+}
+
+static int edge_of (callgraph_t *cg, int caller, int callee) {
+    uint64_t key = (uint64_t) caller << 32 | (uint32_t) callee;
+    int i = map_find(&cg->byedge, key);
+    if(i >= 0)
+        return i;
+    if(!grow((void **) &cg->edges, cg->nedges, &cg->edgemax, sizeof(cg_edge_t))
+            || !map_put(&cg->byedge, key, cg->nedges))
+        return -1;
+    memset(&cg->edges[cg->nedges], 0x00, sizeof(cg_edge_t));
+    cg->edges[cg->nedges].caller = caller;
+    cg->edges[cg->nedges].callee = callee;
+    return cg->nedges++;
+}
+
+static int node_of (callgraph_t *cg, int parent, int func) {
+    uint64_t key = (uint64_t) (uint32_t) parent << 32 | (uint32_t) func;
+    int i = map_find(&cg->bynode, key);
+    if(i >= 0)
+        return i;
+    if(!grow((void **) &cg->nodes, cg->nnodes, &cg->nodemax, sizeof(cg_node_t))
+            || !map_put(&cg->bynode, key, cg->nnodes))
+        return -1;
+    cg->nodes[cg->nnodes].func = func;
+    cg->nodes[cg->nnodes].parent = parent;
+    cg->nodes[cg->nnodes].self = 0;
+    return cg->nnodes++;
+}
+
+//Make room for one more element in a growable array
+static bool grow (void **array, int n, int *max, size_t size) {
+    if(n < *max)
+        return true;
+    int bigger = (*max > 0) ? *max * 2 : CG_INITIAL;
+    void *p = realloc(*array, bigger * size);
+    if(p == NULL)
+        return false;
+    *array = p;
+    *max = bigger;
+    return true;
+}
+
+static bool map_init (cg_map_t *map, size_t size) {
+    map->keys = (uint64_t *) calloc(size, sizeof(uint64_t));
+    map->vals = (int *) malloc(size * sizeof(int));
+    map->size = size;
+    map->used = 0;
+    if(map->keys == NULL || map->vals == NULL)
+        return false;
+    for(size_t i = 0; i < size; i++)
+        map->vals[i] = -1;
+    return true;
+}
+
+static int map_find (cg_map_t *map, uint64_t key) {
+    size_t i = (key * 0x9e3779b97f4a7c15ULL) & (map->size - 1);
+    while(map->vals[i] >= 0 && map->keys[i] != key)
+        i = (i + 1) & (map->size - 1);
+    return map->vals[i];
+}
+
+//Add a key that is not in the map yet, doubling it first if half full
+static bool map_put (cg_map_t *map, uint64_t key, int val) {
+    if(map->used * 2 >= map->size) {
+        cg_map_t bigger;
+        if(!map_init(&bigger, map->size * 2)) {
+            map_free(&bigger);
+            return false;
+        }
+        for(size_t i = 0; i < map->size; i++) {
+            if(map->vals[i] >= 0)
+                map_put(&bigger, map->keys[i], map->vals[i]);
+        }
+        map_free(map);
+        *map = bigger;
+    }
+    size_t i = (key * 0x9e3779b97f4a7c15ULL) & (map->size - 1);
+    while(map->vals[i] >= 0)
+        i = (i + 1) & (map->size - 1);
+    map->keys[i] = key;
+    map->vals[i] = val;
+    map->used++;
+    return true;
+}
+
+static void map_free (cg_map_t *map) {
+    free(map->keys);
+    free(map->vals);
+    map->keys = NULL;
+    map->vals = NULL;
+}
+
+//Print a calling context root first, separated by semicolons (walked
+//without recursion, since guest stacks can be deeper than ours)
+static void print_stack (FILE *out, callgraph_t *cg, symtab_t *st, int node) {
+    char name[64];
+    int depth = 0;
+    for(int n = node; n >= 0; n = cg->nodes[n].parent)
+        depth++;
+    int *path = (int *) malloc(depth * sizeof(int));
+    if(path == NULL)
+        return;
+    for(int n = node, i = depth - 1; n >= 0; n = cg->nodes[n].parent)
+        path[i--] = n;
+    for(int i = 0; i < depth; i++) {
+        if(i > 0)
+            fputc(';', out);
+        fputs(symtab_describe(st, cg->funcs[cg->nodes[path[i]].func].addr, name, sizeof(name)), out);
+    }
+    free(path);
+}
+
+//Most inclusive first, then lowest address
+static int by_inclusive (const void *a, const void *b) {
+    const cg_func_t *x = (const cg_func_t *) a;
+    const cg_func_t *y = (const cg_func_t *) b;
+    if(x->inclusive != y->inclusive)
+        return x->inclusive > y->inclusive ? -1 : 1;
+    return x->addr < y->addr ? -1 : (x->addr > y->addr);
+}
+
+//Most inclusive first, then most calls
+static int by_edge (const void *a, const void *b) {
+    const cg_edge_t *x = (const cg_edge_t *) a;
+    const cg_edge_t *y = (const cg_edge_t *) b;
+    if(x->inclusive != y->inclusive)
+        return x->inclusive > y->inclusive ? -1 : 1;
+    if(x->calls != y->calls)
+        return x->calls > y->calls ? -1 : 1;
+    return 0;
+}
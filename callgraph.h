@@ -0,0 +1,142 @@
+#ifndef __CS261_CALLGRAPH__
+#define __CS261_CALLGRAPH__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "y86.h"
+#include "y86vm.h"
+#include "symtab.h"
+
+/* Mismatched returns the report describes one by one */
+#define CALLGRAPH_SHOWN 10
+
+/* A function: the target of some call (or the entry point) */
+typedef struct cg_func {
+    address_t addr;             // entry address
+    uint64_t calls;             // times called
+    uint64_t self;              // instructions executed in it
+    uint64_t inclusive;         // ... and in what it called (recursion
+                                // counted once)
+    int active;                 // frames of it on the shadow stack
+} cg_func_t;
+
+/* A caller -> callee edge */
+typedef struct cg_edge {
+    int caller;                 // function indices
+    int callee;
+    uint64_t calls;             // calls made along it
+    uint64_t inclusive;         // instructions spent in the callee for them
+                                // (calls made again inside one count once)
+    int active;                 // frames called along it on the shadow stack
+} cg_edge_t;
+
+/* A node of the calling context tree: one distinct stack of functions */
+typedef struct cg_node {
+    int func;                   // function at the top of this stack
+    int parent;                 // node for the stack below it, or -1
+    uint64_t self;              // instructions executed with exactly this stack
+} cg_node_t;
+
+/* A shadow stack frame */
+typedef struct cg_frame {
+    int node;                   // calling context (and so function) of the frame
+    int edge;                   // edge it was called along, or -1 for the root
+    address_t ret;              // return address the call pushed
+    uint64_t start;             // instructions executed when it was entered
+} cg_frame_t;
+
+/* A ret that did not go back to the caller the shadow stack expected */
+typedef struct cg_mismatch {
+    address_t pc;               // where the ret was
+    address_t target;           // where it went
+    address_t expected;         // where the top frame would have returned to
+    int unwound;                // frames popped to find the target (0 if none
+                                // matched and the stack was left alone)
+} cg_mismatch_t;
+
+/* Index lookups by key (open addressing, linear probing) */
+typedef struct cg_map {
+    uint64_t *keys;
+    int *vals;                  // -1 marks an empty slot
+    size_t size;                // slots (a power of two)
+    size_t used;
+} cg_map_t;
+
+/* Call graph profile state for -G */
+typedef struct callgraph {
+
+    cg_func_t *funcs;           // growable arrays, each with its length
+    int nfuncs, funcmax;        // and capacity
+    cg_edge_t *edges;
+    int nedges, edgemax;
+    cg_node_t *nodes;
+    int nnodes, nodemax;
+    cg_frame_t *stack;          // the shadow stack (stack[0] is the root)
+    int depth, stackmax;
+    int maxdepth;               // deepest stack seen
+
+    cg_map_t byaddr;            // function index by entry address
+    cg_map_t byedge;            // edge index by caller << 32 | callee
+    cg_map_t bynode;            // node index by parent << 32 | function
+    uint64_t mark;              // instructions already charged to a frame
+    uint64_t instructions;      // instructions executed
+    uint64_t mismatches;        // rets that did not match the shadow stack
+    cg_mismatch_t shown[CALLGRAPH_SHOWN];
+    bool failed;                // out of memory (the profile is partial)
+
+} callgraph_t;
+
+/**
+ * @brief Create a call graph rooted at the VM's entry point
+ *
+ * @param vm VM with the program loaded
+ * @returns New call graph, or NULL on failure
+ */
+callgraph_t *callgraph_create (y86_vm_t *vm);
+
+/**
+ * @brief Run the VM like y86_vm_run(), following calls and returns
+ *
+ * Once the CPU stops, the frames still on the shadow stack are closed as
+ * if they returned after its last instruction.
+ *
+ * @param cg Call graph to record into
+ * @param vm VM to run
+ * @param budget Maximum number of instructions to execute, or -1 for no limit
+ * @returns CPU status when the run stopped (AOK if the budget ran out)
+ */
+y86_stat_t callgraph_run (callgraph_t *cg, y86_vm_t *vm, long budget);
+
+/**
+ * @brief Print functions by inclusive cost, the call edges and any
+ * mismatched returns
+ *
+ * @param out Stream to print to
+ * @param cg Call graph to describe
+ * @param st Symbols to name functions by (may be NULL)
+ */
+void dump_callgraph (FILE *out, callgraph_t *cg, symtab_t *st);
+
+/**
+ * @brief Write collapsed stacks ("root;caller;callee count" lines) for
+ * flame graph tools
+ *
+ * @param out Stream to write to
+ * @param cg Call graph to describe
+ * @param st Symbols to name functions by (may be NULL)
+ * @returns True if every line was written
+ */
+bool write_stacks (FILE *out, callgraph_t *cg, symtab_t *st);
+
+/**
+ * @brief Release a call graph
+ *
+ * @param cg Call graph to be freed (may be NULL)
+ */
+void callgraph_free (callgraph_t *cg);
+
+#endif
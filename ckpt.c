@@ -0,0 +1,504 @@
+/*
+ * CS 261: Incremental on-disk checkpoints
+ *
+ * Name: Ben Berry
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "ckpt.h"
+
+/* A record being built, or waiting for the writer thread */
+typedef struct ckpt_buf {
+    byte_t *data;               // header, chunks and the trailer
+    size_t size;                // bytes used
+    size_t cap;                 // bytes allocated
+    size_t last;                // offset of the last chunk header (0 = none)
+    uint32_t nchunks;           // chunks so far
+    bool full;                  // starts a new chain
+    struct ckpt_buf *next;
+} ckpt_buf_t;
+
+/* Header of one chunk of memory in a record */
+typedef struct __attribute__((__packed__)) ckpt_chunk {
+    uint64_t addr;              // guest address of the first byte
+    uint32_t len;               // bytes that follow
+} ckpt_chunk_t;
+
+/* Starting value of the FNV-1a checksum */
+#define FNV_BASIS 2166136261u
+
+/* Set by the signal handlers; checked between slices of a run */
+static volatile sig_atomic_t requested = 0;
+static volatile sig_atomic_t stopping = 0;
+
+static void *writer_main (void *arg);
+static bool write_record (ckpt_t *ck, ckpt_buf_t *buf);
+static bool write_all (int fd, const byte_t *data, size_t size);
+static bool resume_chain (ckpt_t *ck, y86_vm_t *vm);
+static bool apply_record (y86_vm_t *vm, const ckpt_rec_t *rec, const byte_t *chunks);
+static void fill_header (ckpt_rec_t *rec, y86_vm_t *vm, uint32_t seq);
+static bool append (ckpt_buf_t *buf, const void *data, size_t len);
+static bool add_chunk (ckpt_buf_t *buf, address_t addr, const byte_t *bytes, size_t len);
+static bool add_page (address_t addr, const byte_t *page, void *arg);
+static void free_buf (ckpt_buf_t *buf);
+static uint32_t checksum (uint32_t hash, const byte_t *data, size_t size);
+static void on_signal (int sig);
+
+/**********************************************************************
+ *                         CHECKPOINT FUNCTIONS
+ *********************************************************************/
+
+ckpt_t *ckpt_open (const char *path, y86_vm_t *vm, bool resume) {
+    if(path == NULL || vm == NULL || !vm->loaded)
+        return NULL;
+    ckpt_t *ck = (ckpt_t *) calloc(1, sizeof(ckpt_t));
+    if(ck == NULL)
+        return NULL;
+    ck->fd = -1;
+    ck->path = strdup(path);
+    ck->shadow = (byte_t *) malloc(MEMSIZE);
+    if(vm->pmem != NULL)
+        ck->pshadow = pmem_create();
+    if(ck->path == NULL || ck->shadow == NULL || (vm->pmem != NULL && ck->pshadow == NULL)) {
+        ckpt_free(ck);
+        return NULL;
+    }
+
+    //Replay the chain, then carry on appending to it from its intact end
+    if(resume) {
+        bool ok = resume_chain(ck, vm);
+        if(ok) {
+            ck->fd = open(ck->path, O_WRONLY | O_APPEND);
+            ok = ck->fd >= 0 && ftruncate(ck->fd, ck->length) == 0;
+        }
+        //The next delta is taken against memory as it was just restored
+        if(ok && vm->pmem != NULL)
+            ok = pmem_copy(ck->pshadow, vm->pmem);
+        memcpy(ck->shadow, vm->memory, MEMSIZE);
+        if(!ok || !y86_vm_snapshot(vm)) {
+            ckpt_free(ck);
+            return NULL;
+        }
+    }
+
+    pthread_mutex_init(&ck->lock, NULL);
+    pthread_cond_init(&ck->ready, NULL);
+    if(pthread_create(&ck->writer, NULL, writer_main, ck) != 0) {
+        pthread_mutex_destroy(&ck->lock);
+        pthread_cond_destroy(&ck->ready);
+        ck->closing = true;
+        ckpt_free(ck);
+        return NULL;
+    }
+    ck->running = true;
+    return ck;
+}
+
+bool ckpt_take (ckpt_t *ck, y86_vm_t *vm) {
+    if(ck == NULL || vm == NULL || !ck->running || ck->closing)
+        return false;
+    ckpt_buf_t *buf = (ckpt_buf_t *) calloc(1, sizeof(ckpt_buf_t));
+    if(buf == NULL)
+        return false;
+
+    //After a failed write the chain on disk has a gap: start a new one
+    pthread_mutex_lock(&ck->lock);
+    if(ck->failed)
+        ck->seq = 0;
+    pthread_mutex_unlock(&ck->lock);
+    buf->full = ck->seq == 0;
+    ckpt_rec_t rec;
+    fill_header(&rec, vm, ck->seq);
+    bool ok = append(buf, &rec, sizeof(rec));
+
+    if(vm->pmem != NULL && buf->full) {
+        //Every page the program can see, whether written or borrowed
+        ok = ok && pmem_copy(ck->pshadow, vm->pmem) && pmem_walk(vm->pmem, add_page, buf);
+    } else if(vm->pmem != NULL) {
+        //Of the pages written since the snapshot, only those that changed
+        byte_t now[PMEM_PAGESIZE];
+        byte_t then[PMEM_PAGESIZE];
+        for(size_t i = 0; ok && i < vm->pmem->ndirty; i++) {
+            address_t addr = vm->pmem->dirty[i] << PMEM_PAGEBITS;
+            pmem_read(vm->pmem, addr, now, PMEM_PAGESIZE);
+            pmem_read(ck->pshadow, addr, then, PMEM_PAGESIZE);
+            if(memcmp(now, then, PMEM_PAGESIZE) != 0)
+                ok = add_chunk(buf, addr, now, PMEM_PAGESIZE)
+                        && pmem_write(ck->pshadow, addr, now, PMEM_PAGESIZE);
+        }
+    } else {
+        //Of the blocks stored to since the snapshot, only those that changed
+        uint64_t dirty = buf->full ? DIRTY_ALL : vm->cpu.dirty;
+        for(int b = 0; ok && b < DIRTY_BLOCKS; b++) {
+            byte_t *block = &vm->memory[b * DIRTY_BLOCK];
+            if(((dirty >> b) & 1) == 0
+                    || (!buf->full && memcmp(block, &ck->shadow[b * DIRTY_BLOCK], DIRTY_BLOCK) == 0))
+                continue;
+            ok = add_chunk(buf, b * DIRTY_BLOCK, block, DIRTY_BLOCK);
+            memcpy(&ck->shadow[b * DIRTY_BLOCK], block, DIRTY_BLOCK);
+        }
+    }
+
+    //Room for the trailer, which the writer fills in
+    ckpt_end_t end;
+    memset(&end, 0x00, sizeof(end));
+    ok = ok && append(buf, &end, sizeof(end));
+    if(!ok) {
+        //The shadow may be ahead of the disk now, so start over next time
+        free_buf(buf);
+        ck->seq = 0;
+        return false;
+    }
+    ckpt_rec_t *hdr = (ckpt_rec_t *) buf->data;
+    hdr->nchunks = buf->nchunks;
+    hdr->size = buf->size - sizeof(ckpt_rec_t) - sizeof(ckpt_end_t);
+    ck->seq++;
+
+    //Hand the record over; the run carries on while it is written
+    pthread_mutex_lock(&ck->lock);
+    if(ck->tail != NULL)
+        ck->tail->next = buf;
+    else
+        ck->head = buf;
+    ck->tail = buf;
+    pthread_cond_signal(&ck->ready);
+    pthread_mutex_unlock(&ck->lock);
+    return true;
+}
+
+y86_stat_t ckpt_run (ckpt_t *ck, y86_vm_t *vm, long every) {
+    if(ck == NULL || vm == NULL || every <= 0)
+        return INS;
+
+    //Catch the checkpoint signals for the length of the run only
+    struct sigaction action;
+    struct sigaction oldusr1, oldint, oldterm;
+    memset(&action, 0x00, sizeof(action));
+    action.sa_handler = on_signal;
+    sigemptyset(&action.sa_mask);
+    requested = 0;
+    stopping = 0;
+    sigaction(SIGUSR1, &action, &oldusr1);
+    sigaction(SIGINT, &action, &oldint);
+    sigaction(SIGTERM, &action, &oldterm);
+
+    //Run in slices short enough that a signal is answered promptly
+    long left = every;
+    while(true) {
+        long slice = (left < CKPT_SLICE) ? left : CKPT_SLICE;
+        if(y86_vm_run(vm, slice) != AOK)
+            break;
+        left -= slice;
+        if(left == 0 || requested || stopping) {
+            ckpt_take(ck, vm);
+            requested = 0;
+            left = every;
+        }
+        if(stopping)
+            break;
+    }
+
+    sigaction(SIGUSR1, &oldusr1, NULL);
+    sigaction(SIGINT, &oldint, NULL);
+    sigaction(SIGTERM, &oldterm, NULL);
+    return vm->cpu.stat;
+}
+
+bool ckpt_close (ckpt_t *ck) {
+    if(ck == NULL)
+        return false;
+    if(ck->running) {
+        //The writer drains the queue before it notices closing
+        pthread_mutex_lock(&ck->lock);
+        ck->closing = true;
+        pthread_cond_signal(&ck->ready);
+        pthread_mutex_unlock(&ck->lock);
+        pthread_join(ck->writer, NULL);
+        pthread_mutex_destroy(&ck->lock);
+        pthread_cond_destroy(&ck->ready);
+        ck->running = false;
+    }
+    ck->closing = true;
+    return !ck->failed;
+}
+
+void ckpt_free (ckpt_t *ck) {
+    if(ck == NULL)
+        return;
+    ckpt_close(ck);
+    if(ck->fd >= 0)
+        close(ck->fd);
+    free(ck->path);
+    free(ck->shadow);
+    pmem_free(ck->pshadow);
+    free(ck);
+}
+
+void dump_ckpt_stats (FILE *out, ckpt_t *ck) {
+    fprintf(out, "Checkpoints: %lu written (%lu KiB), chain at record %u%s\n",
+            ck->records, ck->bytes / 1024, ck->seq, ck->failed ? ", last write failed" : "");
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+//Write queued records in order until closed and drained
+static void *writer_main (void *arg) {
+    ckpt_t *ck = (ckpt_t *) arg;
+    //Leave the checkpoint signals to the thread running the VM
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    pthread_mutex_lock(&ck->lock);
+    while(true) {
+        while(ck->head == NULL && !ck->closing)
+            pthread_cond_wait(&ck->ready, &ck->lock);
+        ckpt_buf_t *buf = ck->head;
+        if(buf == NULL)
+            break;
+        ck->head = buf->next;
+        if(ck->head == NULL)
+            ck->tail = NULL;
+        //A delta is useless once a record before it is lost
+        bool skip = ck->failed && !buf->full;
+        pthread_mutex_unlock(&ck->lock);
+
+        bool ok = !skip && write_record(ck, buf);
+
+        pthread_mutex_lock(&ck->lock);
+        if(ok) {
+            ck->records++;
+            ck->bytes += buf->size;
+            ck->failed = false;
+        } else {
+            ck->failed = true;
+        }
+        free_buf(buf);
+    }
+    pthread_mutex_unlock(&ck->lock);
+    return NULL;
+}
+
+//Seal a record with its checksum and put it on disk: a full record replaces
+//the file in one rename, a delta is appended; either is flushed before the
+//next record is written
+static bool write_record (ckpt_t *ck, ckpt_buf_t *buf) {
+    ckpt_end_t end;
+    end.checksum = checksum(FNV_BASIS, buf->data, buf->size - sizeof(end));
+    end.magic = CKPT_END;
+    memcpy(&buf->data[buf->size - sizeof(end)], &end, sizeof(end));
+
+    if(!buf->full) {
+        if(ck->fd < 0)
+            return false;
+        if(write_all(ck->fd, buf->data, buf->size) && fsync(ck->fd) == 0) {
+            ck->length += buf->size;
+            return true;
+        }
+        //Cut off whatever part of the record made it, so later ones still chain
+        if(ftruncate(ck->fd, ck->length) != 0) {
+            close(ck->fd);
+            ck->fd = -1;
+        }
+        return false;
+    }
+
+    size_t len = strlen(ck->path);
+    char *tmp = (char *) malloc(len + 5);
+    if(tmp == NULL)
+        return false;
+    memcpy(tmp, ck->path, len);
+    memcpy(&tmp[len], ".tmp", 5);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0 && write_all(fd, buf->data, buf->size) && fsync(fd) == 0;
+    if(fd >= 0)
+        close(fd);
+    ok = ok && rename(tmp, ck->path) == 0;
+    if(!ok)
+        unlink(tmp);
+    free(tmp);
+    if(!ok)
+        return false;
+
+    //Later deltas go on the end of the new chain
+    if(ck->fd >= 0)
+        close(ck->fd);
+    ck->fd = open(ck->path, O_WRONLY | O_APPEND);
+    ck->length = buf->size;
+    return ck->fd >= 0;
+}
+
+//Write a whole buffer, retrying short and interrupted writes
+static bool write_all (int fd, const byte_t *data, size_t size) {
+    while(size > 0) {
+        ssize_t n = write(fd, data, size);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+//Apply every intact record of the chain in ck->path to the VM, noting how
+//much of the file they cover
+static bool resume_chain (ckpt_t *ck, y86_vm_t *vm) {
+    FILE *file = fopen(ck->path, "rb");
+    if(file == NULL)
+        return false;
+    fseek(file, 0, SEEK_END);
+    long filesize = ftell(file);
+    rewind(file);
+
+    ckpt_rec_t rec;
+    ckpt_end_t end;
+    byte_t *chunks = NULL;
+    while(fread(&rec, sizeof(rec), 1, file) == 1) {
+        //The record must follow on from the last and belong to this program
+        if(rec.magic != CKPT_MAGIC || rec.seq != ck->seq
+                || memcmp(&rec.elf, &vm->hdr, sizeof(elf_hdr_t)) != 0
+                || rec.paged != (vm->pmem != NULL) || rec.size > (uint64_t) filesize)
+            break;
+        byte_t *grown = (byte_t *) realloc(chunks, rec.size + 1);
+        if(grown == NULL)
+            break;
+        chunks = grown;
+        if((rec.size > 0 && fread(chunks, rec.size, 1, file) != 1)
+                || fread(&end, sizeof(end), 1, file) != 1 || end.magic != CKPT_END)
+            break;
+        uint32_t sum = checksum(checksum(FNV_BASIS, (byte_t *) &rec, sizeof(rec)), chunks, rec.size);
+        if(sum != end.checksum || !apply_record(vm, &rec, chunks))
+            break;
+        ck->seq++;
+        ck->length = ftell(file);
+    }
+    free(chunks);
+    fclose(file);
+    return ck->seq > 0;
+}
+
+//Check that a record's chunks are well formed, then copy them into memory
+//and take on its CPU state
+static bool apply_record (y86_vm_t *vm, const ckpt_rec_t *rec, const byte_t *chunks) {
+    ckpt_chunk_t chunk;
+    uint32_t n = 0;
+    uint64_t offset = 0;
+    for(; offset + sizeof(chunk) <= rec->size; n++) {
+        memcpy(&chunk, &chunks[offset], sizeof(chunk));
+        offset += sizeof(chunk);
+        if(chunk.len > rec->size - offset)
+            return false;
+        if(vm->pmem == NULL && (chunk.addr > MEMSIZE || chunk.len > MEMSIZE - chunk.addr))
+            return false;
+        if(vm->pmem != NULL && chunk.len > 0 && chunk.len - 1 > UINT64_MAX - chunk.addr)
+            return false;
+        offset += chunk.len;
+    }
+    if(offset != rec->size || n != rec->nchunks)
+        return false;
+
+    for(offset = 0; offset < rec->size; offset += chunk.len) {
+        memcpy(&chunk, &chunks[offset], sizeof(chunk));
+        offset += sizeof(chunk);
+        if(!y86_vm_write_mem(vm, chunk.addr, &chunks[offset], chunk.len))
+            return false;
+    }
+    y86_t cpu;
+    memset(&cpu, 0x00, sizeof(cpu));
+    memcpy(cpu.reg, rec->reg, sizeof(cpu.reg));
+    cpu.pc = rec->pc;
+    cpu.zf = rec->zf;
+    cpu.sf = rec->sf;
+    cpu.of = rec->of;
+    cpu.stat = (y86_stat_t) rec->stat;
+    y86_vm_set_state(vm, &cpu, (int) rec->count);
+    return true;
+}
+
+//Describe the VM's CPU in a record header (memory follows separately)
+static void fill_header (ckpt_rec_t *rec, y86_vm_t *vm, uint32_t seq) {
+    memset(rec, 0x00, sizeof(ckpt_rec_t));
+    rec->magic = CKPT_MAGIC;
+    rec->seq = seq;
+    rec->elf = vm->hdr;
+    for(int i = 0; i < NUMREGS; i++)
+        rec->reg[i] = vm->cpu.reg[i];
+    rec->pc = vm->cpu.pc;
+    rec->count = vm->count;
+    rec->zf = vm->cpu.zf;
+    rec->sf = vm->cpu.sf;
+    rec->of = vm->cpu.of;
+    rec->stat = vm->cpu.stat;
+    rec->paged = vm->pmem != NULL;
+}
+
+//Add bytes to the end of a record, growing it as needed
+static bool append (ckpt_buf_t *buf, const void *data, size_t len) {
+    if(buf->size + len > buf->cap) {
+        size_t cap = (buf->cap == 0) ? PMEM_PAGESIZE : buf->cap;
+        while(cap < buf->size + len)
+            cap *= 2;
+        byte_t *grown = (byte_t *) realloc(buf->data, cap);
+        if(grown == NULL)
+            return false;
+        buf->data = grown;
+        buf->cap = cap;
+    }
+    memcpy(&buf->data[buf->size], data, len);
+    buf->size += len;
+    return true;
+}
+
+//Add memory to a record, extending the last chunk when the bytes follow on
+static bool add_chunk (ckpt_buf_t *buf, address_t addr, const byte_t *bytes, size_t len) {
+    ckpt_chunk_t chunk;
+    if(buf->last != 0) {
+        memcpy(&chunk, &buf->data[buf->last], sizeof(chunk));
+        if(chunk.addr + chunk.len == addr && chunk.len + len <= UINT32_MAX) {
+            chunk.len += len;
+            memcpy(&buf->data[buf->last], &chunk, sizeof(chunk));
+            return append(buf, bytes, len);
+        }
+    }
+    chunk.addr = addr;
+    chunk.len = len;
+    buf->last = buf->size;
+    buf->nchunks++;
+    return append(buf, &chunk, sizeof(chunk)) && append(buf, bytes, len);
+}
+
+//pmem_walk() visitor for full records
+static bool add_page (address_t addr, const byte_t *page, void *arg) {
+    return add_chunk((ckpt_buf_t *) arg, addr, page, PMEM_PAGESIZE);
+}
+
+static void free_buf (ckpt_buf_t *buf) {
+    free(buf->data);
+    free(buf);
+}
+
+//FNV-1a, continued from an earlier hash (FNV_BASIS to start)
+static uint32_t checksum (uint32_t hash, const byte_t *data, size_t size) {
+    for(size_t i = 0; i < size; i++)
+        hash = (hash ^ data[i]) * 16777619u;
+    return hash;
+}
+
+static void on_signal (int sig) {
+    if(sig == SIGUSR1)
+        requested = 1;
+    else
+        stopping = 1;
+}
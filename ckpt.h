@@ -0,0 +1,158 @@
+#ifndef __CS261_CKPT__
+#define __CS261_CKPT__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "elf.h"
+#include "y86.h"
+#include "pmem.h"
+#include "y86vm.h"
+
+/* Default number of instructions between checkpoints */
+#define CKPT_EVERY (1L << 24)
+
+/* Instructions run between checks for a checkpoint signal */
+#define CKPT_SLICE (1L << 16)
+
+/* Record markers ("Y86C" and "DONE" read as little-endian text) */
+#define CKPT_MAGIC 0x43363859
+#define CKPT_END   0x454e4f44
+
+/*
+   Checkpoint file format: a chain of records, each appended whole and
+   flushed to disk before the next. The first record (seq 0) holds all of
+   guest memory; every later one holds only the chunks that changed since
+   the record before it. Resuming replays the chain up to the last record
+   that is complete and intact.
+
+   +-------------------------------------------------+
+   | record header (ckpt_rec_t) - 192 bytes          |
+   +-------------------------------------------------+
+   | chunks: address (8), length (4), then the bytes |
+   +-------------------------------------------------+
+   | trailer (ckpt_end_t) - 8 bytes                  |
+   +-------------------------------------------------+
+*/
+typedef struct __attribute__((__packed__)) ckpt_rec {
+    uint32_t magic;             // CKPT_MAGIC
+    uint32_t seq;               // position in the chain (0 = full checkpoint)
+    elf_hdr_t elf;              // header of the program being run
+    uint64_t reg[NUMREGS];      // general-purpose registers
+    uint64_t pc;                // program counter
+    uint64_t count;             // instructions executed (as -e counts them)
+    uint8_t zf, sf, of;         // flags
+    uint8_t stat;               // CPU status
+    uint8_t paged;              // 1 if memory is paged (see pmem.h)
+    uint8_t pad[3];
+    uint32_t nchunks;           // chunks that follow
+    uint64_t size;              // bytes of chunk data (headers included)
+    uint8_t unused[12];
+} ckpt_rec_t;
+
+typedef struct __attribute__((__packed__)) ckpt_end {
+    uint32_t checksum;          // FNV-1a of the header and chunk data
+    uint32_t magic;             // CKPT_END
+} ckpt_end_t;
+
+struct ckpt_buf;
+
+/* Checkpointing state for one VM. Records are built by the thread running
+   the VM and handed to a writer thread, so the run never waits on the disk. */
+typedef struct ckpt {
+
+    char *path;                 // checkpoint file
+    uint32_t seq;               // seq of the next record (0 = none written yet)
+    byte_t *shadow;             // flat memory as of the last record
+    pmem_t *pshadow;            // paged memory as of the last record
+
+    pthread_t writer;           // background thread doing all file I/O
+    pthread_mutex_t lock;
+    pthread_cond_t ready;       // signalled when a record is queued or on close
+    struct ckpt_buf *head;      // records waiting to be written, oldest first
+    struct ckpt_buf *tail;
+    bool running;               // the writer thread has not been joined yet
+    bool closing;               // no more records will be queued
+    bool failed;                // a write failed (deltas are dropped until the
+                                // next full record starts a new chain)
+    int fd;                     // the chain being appended to, or -1
+    off_t length;               // bytes of the chain that are intact
+
+    uint64_t records;           // records written (protected by lock)
+    uint64_t bytes;             // bytes written (protected by lock)
+
+} ckpt_t;
+
+/**
+ * @brief Start checkpointing a loaded VM
+ *
+ * With resume set, the VM is first brought to the state of the last intact
+ * record in the file, and later records continue that chain. Otherwise the
+ * first checkpoint taken starts a new chain. The VM must not be reset while
+ * it is being checkpointed.
+ *
+ * @param path Checkpoint file
+ * @param vm VM with the program loaded (and not yet run)
+ * @param resume True to pick up from the checkpoints already in path
+ * @returns Checkpointing state, or NULL if the file could not be resumed
+ * (missing, damaged from the first record or for another program) or the
+ * writer thread could not be started
+ */
+ckpt_t *ckpt_open (const char *path, y86_vm_t *vm, bool resume);
+
+/**
+ * @brief Queue a checkpoint of the VM's current state
+ *
+ * The first checkpoint holds all of memory. Later ones compare the memory
+ * stored to since the VM's snapshot (cpu.dirty blocks, or the pages pmem
+ * lists as written) against the last checkpoint and keep only what changed.
+ * Only that copy happens here; the writer thread does the I/O.
+ *
+ * @param ck Checkpointing state
+ * @param vm VM to checkpoint
+ * @returns True if the record was queued
+ */
+bool ckpt_take (ckpt_t *ck, y86_vm_t *vm);
+
+/**
+ * @brief Run the VM like y86_vm_run(vm, -1), checkpointing as it goes
+ *
+ * A checkpoint is taken every `every` instructions and whenever SIGUSR1
+ * arrives. SIGINT and SIGTERM take one last checkpoint and stop the run.
+ *
+ * @param ck Checkpointing state
+ * @param vm VM to run
+ * @param every Instructions between checkpoints
+ * @returns CPU status when the run stopped (AOK if it was interrupted)
+ */
+y86_stat_t ckpt_run (ckpt_t *ck, y86_vm_t *vm, long every);
+
+/**
+ * @brief Wait for queued checkpoints to reach the disk, then stop the writer
+ *
+ * @param ck Checkpointing state
+ * @returns True if every record was written
+ */
+bool ckpt_close (ckpt_t *ck);
+
+/**
+ * @brief Release checkpointing state (closing it first if need be)
+ *
+ * @param ck Checkpointing state to be freed (may be NULL)
+ */
+void ckpt_free (ckpt_t *ck);
+
+/**
+ * @brief Print checkpoint counters
+ *
+ * @param out Stream to print to
+ * @param ck Checkpointing state to describe
+ */
+void dump_ckpt_stats (FILE *out, ckpt_t *ck);
+
+#endif
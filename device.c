@@ -0,0 +1,133 @@
+/*
+ * CS 261: Host files mapped into guest memory
+ *
+ * Name: Ben Berry
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "device.h"
+#include "pmem.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static bool place (device_t *dev, const char *spec, y86_vm_t *vm, int *segment, uint64_t *size);
+static uint64_t round_up (uint64_t bytes);
+
+/**********************************************************************
+ *                         DEVICE FUNCTIONS
+ *********************************************************************/
+
+device_t *device_open (const char *spec, y86_vm_t *vm, int *segment) {
+    if(spec == NULL || vm == NULL || segment == NULL)
+        return NULL;
+    device_t *dev = (device_t *) calloc(1, sizeof(device_t));
+    if(dev == NULL)
+        return NULL;
+    dev->fd = -1;
+    uint64_t size = 0;
+    if(!place(dev, spec, vm, segment, &size)) {
+        device_close(dev);
+        return NULL;
+    }
+
+    //Read-only files still work; the guest just cannot change them
+    dev->fd = open(dev->path, O_RDWR);
+    dev->writable = dev->fd >= 0;
+    if(dev->fd < 0 && (errno == EACCES || errno == EROFS || errno == EPERM))
+        dev->fd = open(dev->path, O_RDONLY);
+    struct stat st;
+    if(dev->fd < 0 || fstat(dev->fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        device_close(dev);
+        return NULL;
+    }
+
+    //A segment says how big the device is; otherwise the file does
+    uint64_t have = (uint64_t) st.st_size;
+    if(size > have && dev->writable && ftruncate(dev->fd, (off_t) size) == 0)
+        have = size;
+    if(size == 0 || size > have)
+        size = have;
+    dev->len = round_up(size);
+    //An empty file only makes sense as a segment, which then reads as zeros
+    if(dev->len == 0 && strrchr(spec, '@') != NULL) {
+        device_close(dev);
+        return NULL;
+    }
+    if(dev->len > 0) {
+        void *map = mmap(NULL, dev->len, PROT_READ | (dev->writable ? PROT_WRITE : 0),
+                dev->writable ? MAP_SHARED : MAP_PRIVATE, dev->fd, 0);
+        dev->map = (map != MAP_FAILED) ? (byte_t *) map : NULL;
+        //Datasets are mostly streamed through, so read well ahead
+        if(dev->map != NULL)
+            madvise(dev->map, dev->len, MADV_SEQUENTIAL);
+        if(dev->map == NULL || !y86_vm_map(vm, dev->addr, dev->map, dev->len, dev->writable)) {
+            device_close(dev);
+            return NULL;
+        }
+    }
+    return dev;
+}
+
+void dump_device_stats (FILE *out, device_t *dev) {
+    fprintf(out, "Device %s: %lu KiB at 0x%lx%s\n", dev->path, dev->len / 1024,
+            dev->addr, dev->writable ? "" : " (read-only)");
+}
+
+void device_close (device_t *dev) {
+    if(dev == NULL)
+        return;
+    //Stores already went to the page cache; the file gets them from there
+    if(dev->map != NULL)
+        munmap(dev->map, dev->len);
+    if(dev->fd >= 0)
+        close(dev->fd);
+    free((char *) dev->path);
+    free(dev);
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+//Work out the file and where it goes from the spec: after an '@', an
+//address; with none, the next DEVICE segment (which also gives the size)
+static bool place (device_t *dev, const char *spec, y86_vm_t *vm, int *segment, uint64_t *size) {
+    const char *at = strrchr(spec, '@');
+    size_t pathlen = (at != NULL) ? (size_t) (at - spec) : strlen(spec);
+    char *path = (char *) malloc(pathlen + 1);
+    if(path == NULL || pathlen == 0) {
+        free(path);
+        return false;
+    }
+    memcpy(path, spec, pathlen);
+    path[pathlen] = '\0';
+    dev->path = path;
+
+    if(at != NULL) {
+        char *end = NULL;
+        errno = 0;
+        dev->addr = strtoull(at + 1, &end, 0);
+        *size = 0;
+        return at[1] != '\0' && *end == '\0' && errno == 0;
+    }
+    for(; *segment < vm->hdr.e_num_phdr; (*segment)++) {
+        elf_phdr_t *ph = &vm->phdrs[*segment];
+        if(ph->p_type == DEVICE) {
+            dev->addr = ph->p_vaddr;
+            *size = ph->p_size;
+            (*segment)++;
+            return true;
+        }
+    }
+    return false;
+}
+
+//Bytes covered by whole guest pages
+static uint64_t round_up (uint64_t bytes) {
+    return (bytes + PMEM_PAGESIZE - 1) & ~((uint64_t) PMEM_PAGESIZE - 1);
+}
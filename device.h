@@ -0,0 +1,66 @@
+#ifndef __CS261_DEVICE__
+#define __CS261_DEVICE__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "y86.h"
+#include "y86vm.h"
+
+/* Devices that can be given on the command line */
+#define DEVICE_MAX 8
+
+/* A host file mapped into the guest address space. The guest reads the
+   file's pages straight from the page cache, and its stores go back into
+   them, with no traps and no copies; a file that cannot be opened for
+   writing is mapped read-only, and stores to it only change private copies
+   of its pages. The region is the file rounded up to whole pages: bytes
+   past the end of the file read as zero and are not saved.
+
+   A device is placed either at an address given with it ("file@addr") or
+   at the next DEVICE segment of the program, which gives the address and
+   the size (a writable file shorter than the segment is lengthened). */
+typedef struct device {
+
+    const char *path;           // host file
+    int fd;                     // open on the file
+    byte_t *map;                // mapping of the file, or NULL if empty
+    size_t len;                 // bytes mapped (whole pages)
+    address_t addr;             // where the guest sees them
+    bool writable;              // guest stores reach the file
+
+} device_t;
+
+/**
+ * @brief Map a file into a VM's (paged) address space
+ *
+ * @param spec "file" to use the next DEVICE segment, or "file@addr" to
+ * place the whole file at addr (a multiple of PMEM_PAGESIZE, at or above
+ * MEMSIZE)
+ * @param vm VM with paged memory and the program loaded
+ * @param segment Index of the first program header to look at for a DEVICE
+ * segment; moved past the one used
+ * @returns New device, or NULL if the spec, the segment or the file is no
+ * good
+ */
+device_t *device_open (const char *spec, y86_vm_t *vm, int *segment);
+
+/**
+ * @brief Print where a device is and how much of it there is
+ *
+ * @param out Stream to print to
+ * @param dev Device to describe
+ */
+void dump_device_stats (FILE *out, device_t *dev);
+
+/**
+ * @brief Unmap and close a device (after the VM using it is freed)
+ *
+ * @param dev Device to be closed (may be NULL)
+ */
+void device_close (device_t *dev);
+
+#endif
@@ -55,7 +55,7 @@ typedef struct __attribute__((__packed__)) elf {
 } elf_hdr_t;
 
 typedef enum {
-    DATA, CODE, STACK, HEAP, UNKNOWN
+    DATA, CODE, STACK, HEAP, DEVICE, UNKNOWN
 } elf_segtype_t;
 
 /*
@@ -95,4 +95,19 @@ typedef struct __attribute__((__packed__)) elf_phdr {
     uint32_t magic;         /* DEADBEEF */
 } elf_phdr_t;
 
+/*
+   ELF symbol table entry (from e_symtab up to e_strtab):
+   +-------------------------+
+   |  0  1       |  2  3     |
+   | name        | value     |
+   +-------------------------+
+
+   name = offset of the symbol's NUL-terminated name from e_strtab
+   value = address the symbol labels
+*/
+typedef struct __attribute__((__packed__)) elf_sym {
+    uint16_t s_name;        /* offset of the name in the string table */
+    uint16_t s_value;       /* address of the symbol */
+} elf_sym_t;
+
 #endif
@@ -0,0 +1,133 @@
+/*
+ * CS 261: Zero-copy Mini-ELF loader
+ *
+ * Name: Ben Berry
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "elfmap.h"
+
+static const byte_t *segment_bytes (elf_image_t *img, const elf_phdr_t *phdr);
+
+/**********************************************************************
+ *                         LOADER FUNCTIONS
+ *********************************************************************/
+
+bool elf_map_file (const char *filename, elf_image_t *img) {
+    if(filename == NULL || img == NULL)
+        return false;
+    memset(img, 0x00, sizeof(elf_image_t));
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    //Only regular, non-empty files can be mapped
+    struct stat info;
+    void *base = MAP_FAILED;
+    if(fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+        base = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    //The mapping stays valid after the descriptor is closed
+    close(fd);
+    if(base == MAP_FAILED)
+        return false;
+
+    img->base = (const byte_t *) base;
+    img->size = info.st_size;
+    img->mapped = true;
+    return true;
+}
+
+void elf_view_buffer (const byte_t *buf, size_t size, elf_image_t *img) {
+    if(img == NULL)
+        return;
+    img->base = buf;
+    img->size = (buf == NULL) ? 0 : size;
+    img->mapped = false;
+}
+
+void elf_unmap (elf_image_t *img) {
+    if(img == NULL)
+        return;
+    if(img->mapped)
+        munmap((void *) img->base, img->size);
+    memset(img, 0x00, sizeof(elf_image_t));
+}
+
+const elf_hdr_t *elf_header (elf_image_t *img) {
+    //The header must fit in the file and carry the magic number
+    if(img == NULL || img->base == NULL || img->size < sizeof(elf_hdr_t))
+        return NULL;
+    const elf_hdr_t *hdr = (const elf_hdr_t *) img->base;
+    return (hdr->magic == 4607045) ? hdr : NULL;
+}
+
+const elf_phdr_t *elf_phdr (elf_image_t *img, uint16_t offset) {
+    //Offset zero is the file header, never a program header
+    if(img == NULL || img->base == NULL || offset == 0
+            || offset + sizeof(elf_phdr_t) > img->size)
+        return NULL;
+    const elf_phdr_t *phdr = (const elf_phdr_t *) &img->base[offset];
+    return (phdr->magic == 0xDEADBEEF) ? phdr : NULL;
+}
+
+bool elf_copy_segment (elf_image_t *img, byte_t *memory, const elf_phdr_t *phdr) {
+    //Check for null parameters and an invalid virtual address
+    if(img == NULL || memory == NULL || phdr == NULL || phdr->p_vaddr > 4096)
+        return false;
+    const byte_t *bytes = segment_bytes(img, phdr);
+    if(bytes == NULL)
+        return false;
+
+    //Never write past the end of guest memory
+    size_t size = phdr->p_size;
+    if(size > MEMSIZE - phdr->p_vaddr)
+        size = MEMSIZE - phdr->p_vaddr;
+    memcpy(&memory[phdr->p_vaddr], bytes, size);
+    return true;
+}
+
+bool elf_map_segment (elf_image_t *img, pmem_t *pm, const elf_phdr_t *phdr, bool borrow) {
+    if(img == NULL || pm == NULL || phdr == NULL)
+        return false;
+    const byte_t *bytes = segment_bytes(img, phdr);
+    if(bytes == NULL)
+        return false;
+
+    //Go a page at a time, borrowing the pages the segment fills completely
+    address_t addr = phdr->p_vaddr;
+    address_t end = addr + phdr->p_size;
+    while(addr < end) {
+        address_t offset = addr & (PMEM_PAGESIZE - 1);
+        address_t chunk = PMEM_PAGESIZE - offset;
+        if(chunk > end - addr)
+            chunk = end - addr;
+        const byte_t *src = &bytes[addr - phdr->p_vaddr];
+        bool whole = chunk == PMEM_PAGESIZE;
+        if(!(borrow && whole && pmem_map(pm, addr, src)) && !pmem_write(pm, addr, src, chunk))
+            return false;
+        addr += chunk;
+    }
+    return true;
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+//Find a segment's bytes in the image, or NULL if they run past its end
+static const byte_t *segment_bytes (elf_image_t *img, const elf_phdr_t *phdr) {
+    if(img->base == NULL)
+        return NULL;
+    //An empty segment loads nothing, wherever it claims to be
+    if(phdr->p_size == 0)
+        return img->base;
+    if(phdr->p_offset > img->size || phdr->p_size > img->size - phdr->p_offset)
+        return NULL;
+    return &img->base[phdr->p_offset];
+}
@@ -0,0 +1,100 @@
+#ifndef __CS261_ELFMAP__
+#define __CS261_ELFMAP__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elf.h"
+#include "y86.h"
+#include "pmem.h"
+
+/* A whole Mini-ELF file held in memory, either mapped from disk or in a
+   caller's buffer. Headers are validated where they lie and segments are
+   copied (or borrowed) straight out of it, with no stdio in between. */
+typedef struct elf_image {
+    const byte_t *base;         // first byte of the file
+    size_t size;                // length of the file in bytes
+    bool mapped;                // base came from mmap (elf_unmap() releases it)
+} elf_image_t;
+
+/**
+ * @brief Map a file read-only
+ *
+ * The mapping is private but never written, so it keeps showing the file:
+ * anything else writing to the file changes what the VM reads (pages
+ * borrowed into paged memory included, until the guest writes them), and
+ * truncating it makes later reads fault with SIGBUS. The file must not
+ * change while the image is in use.
+ *
+ * @param filename Path of the Mini-ELF file
+ * @param img Image to fill in
+ * @returns True if the file was mapped, false if it could not be opened or
+ * mapped (e.g. it is empty or not a regular file); use the FILE*-based
+ * loaders then
+ */
+bool elf_map_file (const char *filename, elf_image_t *img);
+
+/**
+ * @brief View a caller's buffer as a Mini-ELF file (nothing is copied)
+ *
+ * @param buf Bytes of the file, which must outlive the image
+ * @param size Number of bytes in buf
+ * @param img Image to fill in
+ */
+void elf_view_buffer (const byte_t *buf, size_t size, elf_image_t *img);
+
+/**
+ * @brief Release an image (unmapping it if it was mapped)
+ *
+ * @param img Image to release; it is left empty and may be released again
+ */
+void elf_unmap (elf_image_t *img);
+
+/**
+ * @brief Validate the Mini-ELF header in place (same checks as read_header())
+ *
+ * @param img Image to check
+ * @returns Pointer to the header inside the image, or NULL if it is invalid
+ */
+const elf_hdr_t *elf_header (elf_image_t *img);
+
+/**
+ * @brief Validate a program header in place (same checks as read_phdr())
+ *
+ * @param img Image to check
+ * @param offset Offset of the program header in the file
+ * @returns Pointer to the program header inside the image, or NULL if it is
+ * invalid
+ */
+const elf_phdr_t *elf_phdr (elf_image_t *img, uint16_t offset);
+
+/**
+ * @brief Copy a segment into flat memory (same checks as load_segment())
+ *
+ * @param img Image holding the segment
+ * @param memory Pointer to the beginning of the Y86 address space
+ * @param phdr Program header describing the segment
+ * @returns True if the segment was loaded
+ */
+bool elf_copy_segment (elf_image_t *img, byte_t *memory, const elf_phdr_t *phdr);
+
+/**
+ * @brief Load a segment into paged memory (same checks as pmem_load_segment())
+ *
+ * With borrow set, every guest page the segment covers completely is mapped
+ * to the image's bytes instead of being copied (see pmem_map()); only the
+ * partial pages at either end are copied. The image must then stay alive
+ * until the address space is cleared or freed.
+ *
+ * @param img Image holding the segment
+ * @param pm Address space to load into
+ * @param phdr Program header describing the segment
+ * @param borrow True to borrow whole pages from the image
+ * @returns True if the segment was loaded
+ */
+bool elf_map_segment (elf_image_t *img, pmem_t *pm, const elf_phdr_t *phdr, bool borrow);
+
+#endif
@@ -0,0 +1,195 @@
+/*
+ * CS 261: Flat execution profiles with symbol attribution
+ *
+ * Name: Ben Berry
+ */
+
+#include "flatprof.h"
+
+/* Mnemonics by ifun for the icodes that have several */
+static const char *cmovs[] = { "rrmovq", "cmovle", "cmovl", "cmove", "cmovne", "cmovge", "cmovg" };
+static const char *ops[] = { "addq", "subq", "andq", "xorq" };
+static const char *jumps[] = { "jmp", "jle", "jl", "je", "jne", "jge", "jg" };
+static const char *names[] = Y86_ICODE_NAMES;
+
+static size_t collect (flatprof_t *fp, profile_row_t **rows);
+static void by_symbol (FILE *out, profile_row_t *rows, size_t n, uint64_t total, symtab_t *st);
+static void by_address (FILE *out, profile_row_t *rows, size_t n, uint64_t total, symtab_t *st);
+static void by_opcode (FILE *out, flatprof_t *fp, uint64_t total);
+static int by_key (const void *a, const void *b);
+
+/**********************************************************************
+ *                         PROFILE FUNCTIONS
+ *********************************************************************/
+
+flatprof_t *flatprof_create (void) {
+    flatprof_t *fp = (flatprof_t *) calloc(1, sizeof(flatprof_t));
+    if(fp == NULL)
+        return NULL;
+    fp->counts = (uint64_t *) calloc(MEMSIZE, sizeof(uint64_t));
+    if(fp->counts == NULL || !profile_table_init(&fp->high, PROFILE_SLOTS)) {
+        flatprof_free(fp);
+        return NULL;
+    }
+    return fp;
+}
+
+y86_stat_t flatprof_run (flatprof_t *fp, y86_vm_t *vm, long budget) {
+    if(fp == NULL || vm == NULL)
+        return INS;
+    y86_t *cpu = &vm->cpu;
+    y86_inst_t *ins = &vm->last;
+    for(long i = 0; cpu->stat == AOK && (budget < 0 || i < budget); i++) {
+        address_t pc = cpu->pc;
+        int count = vm->count;
+        y86_vm_step(vm);
+        //Count what -e counts (an invalid instruction is not executed)
+        if(vm->count == count)
+            continue;
+        fp->mix[ins->icode & 0x0f][ins->ifun.b & 0x0f]++;
+        if(pc < MEMSIZE)
+            fp->counts[pc]++;
+        else if(!profile_table_add(&fp->high, pc))
+            fp->failed = true;
+    }
+    //No more instructions: just the -e fix-up of the PC after ADR
+    return y86_vm_run(vm, 0);
+}
+
+void dump_flatprof (FILE *out, flatprof_t *fp, symtab_t *st) {
+    uint64_t total = 0;
+    for(int i = 0; i < 16; i++) {
+        for(int j = 0; j < 16; j++)
+            total += fp->mix[i][j];
+    }
+    profile_row_t *rows = NULL;
+    size_t n = collect(fp, &rows);
+    fprintf(out, "\nFlat profile: %lu instructions at %lu addresses%s\n", total,
+            (uint64_t) n, fp->failed ? " (out of memory: partial)" : "");
+    if(rows == NULL || total == 0) {
+        free(rows);
+        return;
+    }
+    by_symbol(out, rows, n, total, st);
+    by_address(out, rows, n, total, st);
+    by_opcode(out, fp, total);
+    free(rows);
+}
+
+const char *flatprof_mnemonic (int icode, int ifun, char *buf, size_t len) {
+    if(icode == CMOV && ifun < BADCMOV)
+        return cmovs[ifun];
+    if(icode == OPQ && ifun < BADOP)
+        return ops[ifun];
+    if(icode == JUMP && ifun < BADJUMP)
+        return jumps[ifun];
+    if(icode == IOTRAP || icode == CMOV || icode == OPQ || icode == JUMP) {
+        snprintf(buf, len, "%s %d", names[icode], ifun);
+        return buf;
+    }
+    return names[icode <= INVALID ? icode : INVALID];
+}
+
+void flatprof_free (flatprof_t *fp) {
+    if(fp == NULL)
+        return;
+    free(fp->counts);
+    profile_table_free(&fp->high);
+    free(fp);
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+//Gather every address with a count, in address order
+static size_t collect (flatprof_t *fp, profile_row_t **rows) {
+    size_t n = 0;
+    for(size_t i = 0; i < MEMSIZE; i++)
+        n += fp->counts[i] != 0;
+    *rows = (profile_row_t *) malloc((n + fp->high.used + 1) * sizeof(profile_row_t));
+    if(*rows == NULL)
+        return 0;
+    n = 0;
+    for(size_t i = 0; i < MEMSIZE; i++) {
+        if(fp->counts[i] != 0) {
+            (*rows)[n].key = i;
+            (*rows)[n++].count = fp->counts[i];
+        }
+    }
+    //The high table is unordered, but every key in it is past MEMSIZE
+    size_t first = n;
+    for(size_t i = 0; i < fp->high.size; i++) {
+        if(fp->high.counts[i] != 0) {
+            (*rows)[n].key = fp->high.keys[i];
+            (*rows)[n++].count = fp->high.counts[i];
+        }
+    }
+    qsort(&(*rows)[first], n - first, sizeof(profile_row_t), by_key);
+    return n;
+}
+
+//Instructions per symbol (the symbol at or below each address), hottest first
+static void by_symbol (FILE *out, profile_row_t *rows, size_t n, uint64_t total, symtab_t *st) {
+    int nsyms = (st != NULL) ? st->nsyms : 0;
+    //One row per symbol, and a last one for addresses below every symbol
+    profile_row_t *syms = (profile_row_t *) calloc(nsyms + 1, sizeof(profile_row_t));
+    if(syms == NULL)
+        return;
+    for(int i = 0; i <= nsyms; i++)
+        syms[i].key = i;
+    for(size_t i = 0; i < n; i++) {
+        syms[symtab_index(st, rows[i].key)].count += rows[i].count;
+    }
+    qsort(syms, nsyms + 1, sizeof(profile_row_t), profile_by_count);
+
+    fprintf(out, "\n  %-24s %14s %8s %8s\n", "Symbol", "Instructions", "%", "Cum %");
+    uint64_t cumulative = 0;
+    for(int i = 0; i <= nsyms && syms[i].count > 0; i++) {
+        cumulative += syms[i].count;
+        fprintf(out, "  %-24s %14lu %7.2f%% %7.2f%%\n",
+                symtab_name(st, syms[i].key), syms[i].count, 100.0 * syms[i].count / total, 100.0 * cumulative / total);
+    }
+    free(syms);
+}
+
+//The FLATPROF_TOP hottest addresses, as symbol+offset
+static void by_address (FILE *out, profile_row_t *rows, size_t n, uint64_t total, symtab_t *st) {
+    qsort(rows, n, sizeof(profile_row_t), profile_by_count);
+    fprintf(out, "\n  %-10s %-24s %14s %8s\n", "Address", "Location", "Instructions", "%");
+    for(size_t i = 0; i < n && i < FLATPROF_TOP; i++) {
+        char where[64];
+        fprintf(out, "  0x%08lx %-24s %14lu %7.2f%%\n", rows[i].key,
+                symtab_describe(st, rows[i].key, where, sizeof(where)),
+                rows[i].count, 100.0 * rows[i].count / total);
+    }
+}
+
+//Instruction mix by icode and ifun, commonest first
+static void by_opcode (FILE *out, flatprof_t *fp, uint64_t total) {
+    profile_row_t rows[256];
+    int n = 0;
+    for(int i = 0; i < 16; i++) {
+        for(int j = 0; j < 16; j++) {
+            if(fp->mix[i][j] != 0) {
+                rows[n].key = (i << 4) | j;
+                rows[n++].count = fp->mix[i][j];
+            }
+        }
+    }
+    qsort(rows, n, sizeof(profile_row_t), profile_by_count);
+    fprintf(out, "\n  %-10s %14s %8s\n", "Opcode", "Instructions", "%");
+    for(int i = 0; i < n; i++) {
+        char name[16];
+        fprintf(out, "  %-10s %14lu %7.2f%%\n",
+                flatprof_mnemonic(rows[i].key >> 4, rows[i].key & 0x0f, name, sizeof(name)),
+                rows[i].count, 100.0 * rows[i].count / total);
+    }
+}
+
+//Lowest key first
+static int by_key (const void *a, const void *b) {
+    const profile_row_t *x = (const profile_row_t *) a;
+    const profile_row_t *y = (const profile_row_t *) b;
+    return x->key < y->key ? -1 : (x->key > y->key);
+}
@@ -0,0 +1,76 @@
+#ifndef __CS261_FLATPROF__
+#define __CS261_FLATPROF__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "y86.h"
+#include "y86vm.h"
+#include "profile.h"
+#include "symtab.h"
+
+/* Hot addresses the report lists */
+#define FLATPROF_TOP 20
+
+/* Per-address execution counts for -P. The counters sit in the run loop
+   itself: one array increment per instruction for PCs in the first MEMSIZE
+   bytes, a hash table only for the rest (paged memory). */
+typedef struct flatprof {
+
+    uint64_t *counts;           // instructions started at each PC < MEMSIZE
+    profile_table_t high;       // and at each PC beyond that
+    uint64_t mix[16][16];       // instructions by icode and ifun
+    bool failed;                // high could not grow (counts are partial)
+
+} flatprof_t;
+
+/**
+ * @brief Create an empty flat profile
+ *
+ * @returns New profile, or NULL on failure
+ */
+flatprof_t *flatprof_create (void);
+
+/**
+ * @brief Run the VM like y86_vm_run(), counting every instruction
+ *
+ * @param fp Profile to count into
+ * @param vm VM to run
+ * @param budget Maximum number of instructions to execute, or -1 for no limit
+ * @returns CPU status when the run stopped (AOK if the budget ran out)
+ */
+y86_stat_t flatprof_run (flatprof_t *fp, y86_vm_t *vm, long budget);
+
+/**
+ * @brief Print the profile: instructions per symbol, the hottest addresses
+ * and the instruction mix
+ *
+ * @param out Stream to print to
+ * @param fp Profile to describe
+ * @param st Symbols to attribute addresses to (may be NULL)
+ */
+void dump_flatprof (FILE *out, flatprof_t *fp, symtab_t *st);
+
+/**
+ * @brief Name an opcode the way the disassembler would (bad ifuns keep
+ * their number)
+ *
+ * @param icode Instruction code
+ * @param ifun Instruction function
+ * @param buf Space for names that have to be built
+ * @param len Size of buf
+ * @returns Mnemonic (a constant string or buf)
+ */
+const char *flatprof_mnemonic (int icode, int ifun, char *buf, size_t len);
+
+/**
+ * @brief Release a flat profile
+ *
+ * @param fp Profile to be freed (may be NULL)
+ */
+void flatprof_free (flatprof_t *fp);
+
+#endif
@@ -0,0 +1,235 @@
+/*
+ * CS 261: Edge-coverage fuzzing in a persistent loop
+ *
+ * Name: Ben Berry
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "fuzz.h"
+
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+
+/* Bucket bit for each hit count (AFL's classes) */
+static byte_t buckets[256];
+
+static bool find_input (fuzz_t *fz, y86_vm_t *vm, symtab_t *st);
+static inline void edge (fuzz_t *fz, address_t from, address_t to);
+static void classify (fuzz_t *fz, fuzz_result_t *res);
+static bool read_record (FILE *in, byte_t *buf, size_t *len, bool *eof);
+static double now (void);
+
+/**********************************************************************
+ *                         FUZZING FUNCTIONS
+ *********************************************************************/
+
+fuzz_t *fuzz_create (y86_vm_t *vm, symtab_t *st) {
+    if(vm == NULL || !vm->loaded)
+        return NULL;
+    fuzz_t *fz = (fuzz_t *) calloc(1, sizeof(fuzz_t));
+    if(fz == NULL)
+        return NULL;
+    fz->seen = (byte_t *) calloc(FUZZ_MAP_SIZE, sizeof(byte_t));
+    fz->touched = (uint32_t *) malloc(FUZZ_MAP_SIZE * sizeof(uint32_t));
+    //Use the driver's segment if it made one, else a shared mapping of
+    //our own (so forked helpers would see it too)
+    const char *id = getenv(FUZZ_SHM_ENV);
+    if(id != NULL) {
+        struct shmid_ds ds;
+        int shmid = atoi(id);
+        void *map = (void *) -1;
+        if(shmctl(shmid, IPC_STAT, &ds) == 0 && ds.shm_segsz >= FUZZ_MAP_SIZE)
+            map = shmat(shmid, NULL, 0);
+        fz->map = (map != (void *) -1) ? (byte_t *) map : NULL;
+        fz->attached = fz->map != NULL;
+    } else {
+        void *map = mmap(NULL, FUZZ_MAP_SIZE, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        fz->map = (map != MAP_FAILED) ? (byte_t *) map : NULL;
+    }
+    //A driver's map may hold counts from before we started
+    if(fz->map != NULL)
+        memset(fz->map, 0x00, FUZZ_MAP_SIZE);
+    if(fz->seen == NULL || fz->touched == NULL || fz->map == NULL || !find_input(fz, vm, st)
+            || !y86_vm_snapshot(vm)) {
+        fuzz_free(fz);
+        return NULL;
+    }
+    //Guest output would only slow the loop down
+    io_set_output(vm->io, NULL);
+    if(buckets[1] == 0) {
+        for(int i = 1; i < 256; i++) {
+            buckets[i] = (i <= 3) ? 1 << (i - 1) : (i < 8) ? 8 : (i < 16) ? 16
+                    : (i < 32) ? 32 : (i < 128) ? 64 : 128;
+        }
+    }
+    return fz;
+}
+
+void fuzz_one (fuzz_t *fz, y86_vm_t *vm, const byte_t *data, size_t len, fuzz_result_t *res) {
+    //Clear what the last input hit (the rest of the map is still clear)
+    y86_vm_reset(vm);
+    for(size_t i = 0; i < fz->ntouched; i++)
+        fz->map[fz->touched[i]] = 0;
+    fz->ntouched = 0;
+    //The whole input is also there to read with iotrap
+    io_set_input_buffer(vm->io, data, len);
+    if(len > fz->capacity)
+        len = fz->capacity;
+    y86_vm_write_mem(vm, fz->input, data, len);
+    y86_vm_set_reg(vm, RDI, fz->input);
+    y86_vm_set_reg(vm, RSI, len);
+
+    //The -e loop, noting where each taken jump, call and return went
+    y86_t *cpu = &vm->cpu;
+    for(long i = 0; cpu->stat == AOK && i < FUZZ_BUDGET; i++) {
+        address_t pc = cpu->pc;
+        y86_vm_step(vm);
+        y86_icode_t icode = vm->last.icode;
+        if(icode == CALL || icode == RET || (icode == JUMP && cpu->pc != vm->last.valP))
+            edge(fz, pc, cpu->pc);
+    }
+    //No more instructions: just the -e fix-up of the PC after ADR
+    y86_vm_run(vm, 0);
+
+    res->stat = cpu->stat;
+    res->pc = cpu->pc;
+    res->count = vm->count;
+    res->outcome = (cpu->stat == HLT) ? FUZZ_OK : (cpu->stat == AOK) ? FUZZ_HANG : FUZZ_CRASH;
+    classify(fz, res);
+    fz->stats.execs++;
+    fz->stats.newcov += res->newedge || res->newcount;
+    fz->stats.adr += cpu->stat == ADR;
+    fz->stats.ins += cpu->stat == INS;
+    fz->stats.hangs += res->outcome == FUZZ_HANG;
+}
+
+bool fuzz_serve (fuzz_t *fz, y86_vm_t *vm, FILE *in, FILE *out) {
+    static const char *stats[] = { "HANG", "AOK", "HLT", "ADR", "INS" };
+    byte_t *buf = (byte_t *) malloc(FUZZ_MAXINPUT);
+    if(buf == NULL)
+        return false;
+    size_t len = 0;
+    bool eof = false;
+    bool ok = true;
+    double start = now();
+    while(ok && read_record(in, buf, &len, &eof)) {
+        fuzz_result_t res;
+        fuzz_one(fz, vm, buf, len, &res);
+        fprintf(out, "%s %d 0x%04lx%s\n", stats[res.outcome == FUZZ_HANG ? 0 : res.stat],
+                res.count, res.pc, res.newedge ? " new-edge" : res.newcount ? " new-count" : "");
+        //The driver waits for each reply before sending the next input
+        ok = fflush(out) == 0;
+    }
+    fz->stats.seconds += now() - start;
+    free(buf);
+    return ok && eof;
+}
+
+void dump_fuzz_stats (FILE *out, fuzz_t *fz) {
+    fuzz_stats_t *s = &fz->stats;
+    fprintf(out, "Fuzzing: %lu executions in %.2f s (%.0f/s), %lu edges, "
+            "%lu inputs with new coverage\n", s->execs, s->seconds,
+            s->seconds > 0 ? s->execs / s->seconds : 0.0, s->edges, s->newcov);
+    fprintf(out, "  crashes: %lu ADR, %lu INS; hangs: %lu\n", s->adr, s->ins, s->hangs);
+}
+
+void fuzz_free (fuzz_t *fz) {
+    if(fz == NULL)
+        return;
+    if(fz->map != NULL && fz->attached)
+        shmdt(fz->map);
+    else if(fz->map != NULL)
+        munmap(fz->map, FUZZ_MAP_SIZE);
+    free(fz->seen);
+    free(fz->touched);
+    free(fz);
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+//Locate the input buffer: the FUZZ_INPUT symbol up to the next symbol or
+//the end of the segment holding it, whichever is first
+static bool find_input (fuzz_t *fz, y86_vm_t *vm, symtab_t *st) {
+    int found = -1;
+    for(int i = 0; st != NULL && i < st->nsyms && found < 0; i++) {
+        if(strcmp(st->syms[i].name, FUZZ_INPUT) == 0)
+            found = i;
+    }
+    if(found < 0)
+        return false;
+    fz->input = st->syms[found].addr;
+    address_t end = fz->input;
+    for(int i = 0; i < vm->hdr.e_num_phdr; i++) {
+        elf_phdr_t *ph = &vm->phdrs[i];
+        if(fz->input >= ph->p_vaddr && fz->input < (address_t) ph->p_vaddr + ph->p_size)
+            end = (address_t) ph->p_vaddr + ph->p_size;
+    }
+    //Symbols are sorted, so the next one with a higher address bounds it
+    for(int i = found + 1; i < st->nsyms; i++) {
+        if(st->syms[i].addr > fz->input) {
+            if(st->syms[i].addr < end)
+                end = st->syms[i].addr;
+            break;
+        }
+    }
+    if(vm->pmem == NULL && end > MEMSIZE)
+        end = MEMSIZE;
+    fz->capacity = end - fz->input;
+    return fz->capacity > 0;
+}
+
+//Count an edge: the source hash is shifted so A->B and B->A differ (counts
+//stick at 255 rather than wrap back to looking untouched)
+static inline void edge (fuzz_t *fz, address_t from, address_t to) {
+    uint64_t a = (from * 0x9e3779b97f4a7c15ULL) >> 48;
+    uint64_t b = (to * 0x9e3779b97f4a7c15ULL) >> 48;
+    uint32_t i = ((a >> 1) ^ b) & (FUZZ_MAP_SIZE - 1);
+    if(fz->map[i] == 0)
+        fz->touched[fz->ntouched++] = i;
+    if(fz->map[i] != 255)
+        fz->map[i]++;
+}
+
+//Compare the last input's buckets with everything seen
+static void classify (fuzz_t *fz, fuzz_result_t *res) {
+    res->newedge = false;
+    res->newcount = false;
+    for(size_t t = 0; t < fz->ntouched; t++) {
+        uint32_t i = fz->touched[t];
+        byte_t bucket = buckets[fz->map[i]];
+        if((bucket & ~fz->seen[i]) == 0)
+            continue;
+        if(fz->seen[i] == 0) {
+            res->newedge = true;
+            fz->stats.edges++;
+        } else {
+            res->newcount = true;
+        }
+        fz->seen[i] |= bucket;
+    }
+}
+
+//Read one length-prefixed input; false at the end of the stream (eof set
+//if it ended cleanly between records)
+static bool read_record (FILE *in, byte_t *buf, size_t *len, bool *eof) {
+    byte_t prefix[4];
+    size_t got = fread(prefix, 1, sizeof(prefix), in);
+    if(got != sizeof(prefix)) {
+        *eof = got == 0 && feof(in);
+        return false;
+    }
+    *len = prefix[0] | prefix[1] << 8 | prefix[2] << 16 | (size_t) prefix[3] << 24;
+    return *len <= FUZZ_MAXINPUT && fread(buf, 1, *len, in) == *len;
+}
+
+//Seconds on a monotonic clock
+static double now (void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
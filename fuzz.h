@@ -0,0 +1,139 @@
+#ifndef __CS261_FUZZ__
+#define __CS261_FUZZ__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "y86.h"
+#include "y86vm.h"
+#include "symtab.h"
+
+/* Coverage bitmap size in bytes (AFL's, so its tools can read the map) */
+#define FUZZ_MAP_SIZE (1 << 16)
+
+/* Environment variable naming a SysV shared memory segment to use as the
+   bitmap (as AFL passes it); without it the map is private */
+#define FUZZ_SHM_ENV "__AFL_SHM_ID"
+
+/* Symbol marking the guest buffer inputs are copied into */
+#define FUZZ_INPUT "input"
+
+/* Largest input record accepted, in bytes */
+#define FUZZ_MAXINPUT (1 << 20)
+
+/* Instructions an input may run before it counts as a hang */
+#define FUZZ_BUDGET (1L << 20)
+
+/* How one input ended */
+typedef enum {
+    FUZZ_OK,                    // halted
+    FUZZ_CRASH,                 // stopped with ADR or INS
+    FUZZ_HANG                   // ran out of budget
+} fuzz_outcome_t;
+
+/* What one execution did */
+typedef struct fuzz_result {
+    fuzz_outcome_t outcome;
+    y86_stat_t stat;            // CPU status at the end (AOK for a hang)
+    address_t pc;               // PC at the end (as -e reports it)
+    int count;                  // instructions executed
+    bool newedge;               // an edge no earlier input took
+    bool newcount;              // or a known edge taken a new number of times
+} fuzz_result_t;
+
+/* Counters for a fuzzing session */
+typedef struct fuzz_stats {
+    uint64_t execs;             // inputs run
+    uint64_t newcov;            // inputs that found new coverage
+    uint64_t adr;               // crashes by status
+    uint64_t ins;
+    uint64_t hangs;
+    uint64_t edges;             // map entries hit so far
+    double seconds;             // time spent running inputs
+} fuzz_stats_t;
+
+/* Edge coverage for --fuzz. Taken jumps, calls and returns hash their
+   (source, target) PCs AFL-style into a byte map of hit counts; after each
+   input the counts are bucketed (1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+)
+   and compared with every bucket seen before; only the entries an input
+   touched are visited, never the whole map. Between inputs the VM is
+   reset to its snapshot, which copies back only the memory the last input
+   dirtied. */
+typedef struct fuzz {
+
+    byte_t *map;                // FUZZ_MAP_SIZE hit counts for the last input
+    byte_t *seen;               // FUZZ_MAP_SIZE bucket bits seen so far
+    uint32_t *touched;          // map entries the last input hit, in order
+    size_t ntouched;            // hit (only these are classified and cleared)
+    bool attached;              // map is a shmat()ed segment, not an mmap()
+    address_t input;            // guest buffer inputs go to
+    size_t capacity;            // and its size (longer inputs are cut short)
+    fuzz_stats_t stats;
+
+} fuzz_t;
+
+/**
+ * @brief Set up coverage for a loaded program and snapshot it
+ *
+ * Inputs are copied to the FUZZ_INPUT symbol, which extends to the next
+ * symbol (or the end of its segment).
+ *
+ * @param vm VM with the program loaded (and nothing run yet)
+ * @param st Symbols of the program
+ * @returns New fuzzing state, or NULL if there is no input buffer or the
+ * map could not be set up
+ */
+fuzz_t *fuzz_create (y86_vm_t *vm, symtab_t *st);
+
+/**
+ * @brief Run one input from the snapshot
+ *
+ * The input is copied into the guest buffer, with %rdi pointing at it and
+ * %rsi holding its length (as copied); the whole input can also be read
+ * with iotrap CHARIN and DECIN. The program runs to a stop or FUZZ_BUDGET
+ * instructions, recording its edges in the map (its output is discarded).
+ *
+ * @param fz Fuzzing state
+ * @param vm VM to run
+ * @param data Input bytes
+ * @param len Number of bytes in data
+ * @param res What the execution did
+ */
+void fuzz_one (fuzz_t *fz, y86_vm_t *vm, const byte_t *data, size_t len, fuzz_result_t *res);
+
+/**
+ * @brief Run inputs from a driver until it closes its end
+ *
+ * Each input is a 4-byte little-endian length followed by that many bytes.
+ * Each reply is one line, flushed at once: the status (HLT, ADR, INS, or
+ * HANG), the instruction count, the final PC, and then "new-edge" or
+ * "new-count" if the input found new coverage.
+ *
+ * @param fz Fuzzing state
+ * @param vm VM to run
+ * @param in Stream to read inputs from
+ * @param out Stream to reply on
+ * @returns True if the driver closed cleanly, false on a bad record or a
+ * failed write
+ */
+bool fuzz_serve (fuzz_t *fz, y86_vm_t *vm, FILE *in, FILE *out);
+
+/**
+ * @brief Print the counters for a session
+ *
+ * @param out Stream to print to
+ * @param fz Fuzzing state
+ */
+void dump_fuzz_stats (FILE *out, fuzz_t *fz);
+
+/**
+ * @brief Release fuzzing state (detaching from a shared map)
+ *
+ * @param fz Fuzzing state to be freed (may be NULL)
+ */
+void fuzz_free (fuzz_t *fz);
+
+#endif
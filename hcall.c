@@ -0,0 +1,212 @@
+/*
+ * CS 261: Hypercalls from guest code into native host routines
+ *
+ * Name: Ben Berry
+ */
+
+#include "hcall.h"
+#include "io.h"
+#include "pmem.h"
+#include "icache.h"
+
+static bool hc_memcpy (y86_t *cpu, byte_t *memory, uint64_t dst, uint64_t src, uint64_t len,
+        uint64_t *result);
+static bool hc_memset (y86_t *cpu, byte_t *memory, uint64_t dst, uint64_t value, uint64_t len,
+        uint64_t *result);
+static bool hc_memcmp (y86_t *cpu, byte_t *memory, uint64_t a, uint64_t b, uint64_t len,
+        uint64_t *result);
+static bool hc_sort (y86_t *cpu, byte_t *memory, uint64_t base, uint64_t count, uint64_t unused,
+        uint64_t *result);
+static void stored (y86_t *cpu, address_t addr, uint64_t len);
+static int compare_quads (const void *a, const void *b);
+
+/**********************************************************************
+ *                         HYPERCALL FUNCTIONS
+ *********************************************************************/
+
+void hcall_defaults (hcall_t *table) {
+    memset(table, 0x00, HCALL_SLOTS * sizeof(hcall_t));
+    table[HCALL_MEMCPY - HCALL_BASE] = hc_memcpy;
+    table[HCALL_MEMSET - HCALL_BASE] = hc_memset;
+    table[HCALL_MEMCMP - HCALL_BASE] = hc_memcmp;
+    table[HCALL_SORT - HCALL_BASE] = hc_sort;
+}
+
+void hcall_run (y86_t *cpu, byte_t *memory, hcall_t fn) {
+    uint64_t result = 0;
+    if(cpu->io != NULL) {
+        cpu->io->span[0] = MEMSIZE;
+        cpu->io->span[1] = 0;
+    }
+    if(!fn(cpu, memory, cpu->reg[RDI], cpu->reg[RSI], cpu->reg[RDX], &result)) {
+        cpu->stat = ADR;
+        return;
+    }
+    cpu->reg[RAX] = result;
+}
+
+bool hcall_check (y86_t *cpu, address_t addr, uint64_t len) {
+    if(len == 0)
+        return true;
+    if(cpu->pmem != NULL)
+        return len - 1 <= UINT64_MAX - addr;
+    return addr < MEMSIZE && len <= MEMSIZE - addr;
+}
+
+bool hcall_read (y86_t *cpu, byte_t *memory, address_t addr, void *buf, uint64_t len) {
+    if(!hcall_check(cpu, addr, len))
+        return false;
+    if(len == 0)
+        return true;
+    if(cpu->pmem != NULL)
+        pmem_read(cpu->pmem, addr, buf, len);
+    else
+        memcpy(buf, &memory[addr], len);
+    return true;
+}
+
+bool hcall_write (y86_t *cpu, byte_t *memory, address_t addr, const void *buf, uint64_t len) {
+    if(!hcall_check(cpu, addr, len))
+        return false;
+    if(len == 0)
+        return true;
+    if(cpu->pmem != NULL) {
+        //Decodes are cached for the low pages too
+        if(addr < MEMSIZE + INST_MAXLEN - 1)
+            stored(cpu, addr, len);
+        return pmem_write(cpu->pmem, addr, buf, len);
+    }
+    memcpy(&memory[addr], buf, len);
+    stored(cpu, addr, len);
+    return true;
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+//Built-in routines: flat memory is worked on in place, paged memory
+//HCALL_CHUNK bytes at a time
+static bool hc_memcpy (y86_t *cpu, byte_t *memory, uint64_t dst, uint64_t src, uint64_t len,
+        uint64_t *result) {
+    if(!hcall_check(cpu, dst, len) || !hcall_check(cpu, src, len))
+        return false;
+    *result = dst;
+    if(cpu->pmem == NULL) {
+        if(len > 0) {
+            memmove(&memory[dst], &memory[src], len);
+            stored(cpu, dst, len);
+        }
+        return true;
+    }
+    //Copy from the end when the destination overlaps the source's tail
+    byte_t chunk[HCALL_CHUNK];
+    bool backwards = dst > src && dst - src < len;
+    for(uint64_t done = 0; done < len; ) {
+        uint64_t n = (len - done < HCALL_CHUNK) ? len - done : HCALL_CHUNK;
+        uint64_t at = backwards ? len - done - n : done;
+        if(!hcall_read(cpu, memory, src + at, chunk, n)
+                || !hcall_write(cpu, memory, dst + at, chunk, n))
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+static bool hc_memset (y86_t *cpu, byte_t *memory, uint64_t dst, uint64_t value, uint64_t len,
+        uint64_t *result) {
+    if(!hcall_check(cpu, dst, len))
+        return false;
+    *result = dst;
+    if(cpu->pmem == NULL) {
+        if(len > 0) {
+            memset(&memory[dst], (byte_t) value, len);
+            stored(cpu, dst, len);
+        }
+        return true;
+    }
+    byte_t chunk[HCALL_CHUNK];
+    memset(chunk, (byte_t) value, sizeof(chunk));
+    for(uint64_t done = 0; done < len; ) {
+        uint64_t n = (len - done < HCALL_CHUNK) ? len - done : HCALL_CHUNK;
+        if(!hcall_write(cpu, memory, dst + done, chunk, n))
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+static bool hc_memcmp (y86_t *cpu, byte_t *memory, uint64_t a, uint64_t b, uint64_t len,
+        uint64_t *result) {
+    if(!hcall_check(cpu, a, len) || !hcall_check(cpu, b, len))
+        return false;
+    int diff = 0;
+    if(cpu->pmem == NULL && len > 0) {
+        diff = memcmp(&memory[a], &memory[b], len);
+    } else {
+        byte_t left[HCALL_CHUNK];
+        byte_t right[HCALL_CHUNK];
+        for(uint64_t done = 0; diff == 0 && done < len; ) {
+            uint64_t n = (len - done < HCALL_CHUNK) ? len - done : HCALL_CHUNK;
+            hcall_read(cpu, memory, a + done, left, n);
+            hcall_read(cpu, memory, b + done, right, n);
+            diff = memcmp(left, right, n);
+            done += n;
+        }
+    }
+    *result = (uint64_t) (int64_t) ((diff > 0) - (diff < 0));
+    return true;
+}
+
+static bool hc_sort (y86_t *cpu, byte_t *memory, uint64_t base, uint64_t count, uint64_t unused,
+        uint64_t *result) {
+    (void) unused;
+    if(count > UINT64_MAX / sizeof(uint64_t))
+        return false;
+    uint64_t len = count * sizeof(uint64_t);
+    if(!hcall_check(cpu, base, len))
+        return false;
+    *result = count;
+    if(count < 2)
+        return true;
+    if(cpu->pmem == NULL) {
+        qsort(&memory[base], count, sizeof(uint64_t), compare_quads);
+        stored(cpu, base, len);
+        return true;
+    }
+    //Paged memory is gathered into one buffer, which bounds how much fits
+    uint64_t *quads = (count <= HCALL_MAXSORT) ? (uint64_t *) malloc(len) : NULL;
+    bool ok = quads != NULL && hcall_read(cpu, memory, base, quads, len);
+    if(ok) {
+        qsort(quads, count, sizeof(uint64_t), compare_quads);
+        ok = hcall_write(cpu, memory, base, quads, len);
+    }
+    free(quads);
+    return ok;
+}
+
+//Note a store to low memory: flat snapshots copy its blocks back, and the
+//engines drop decodes of its bytes (only those that can be cached are
+//kept in the span)
+static void stored (y86_t *cpu, address_t addr, uint64_t len) {
+    if(cpu->pmem == NULL) {
+        for(uint64_t b = addr / DIRTY_BLOCK; b <= (addr + len - 1) / DIRTY_BLOCK; b++)
+            cpu->dirty |= (uint64_t) 1 << b;
+    }
+    if(len > MEMSIZE + INST_MAXLEN - 1 - addr)
+        len = MEMSIZE + INST_MAXLEN - 1 - addr;
+    if(cpu->io == NULL)
+        return;
+    if(addr < cpu->io->span[0])
+        cpu->io->span[0] = addr;
+    if(addr + len > cpu->io->span[1])
+        cpu->io->span[1] = addr + len;
+}
+
+//Signed quads, which need not be aligned in guest memory
+static int compare_quads (const void *a, const void *b) {
+    int64_t x, y;
+    memcpy(&x, a, sizeof(x));
+    memcpy(&y, b, sizeof(y));
+    return (x > y) - (x < y);
+}
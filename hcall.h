@@ -0,0 +1,94 @@
+#ifndef __CS261_HCALL__
+#define __CS261_HCALL__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "y86.h"
+
+/* Bytes staged through the host at a time when paged memory is copied */
+#define HCALL_CHUNK 4096
+
+/* Most quads HCALL_SORT takes on in paged memory (they are sorted in one
+   host buffer) */
+#define HCALL_MAXSORT ((uint64_t) 1 << 27)
+
+/* A native routine behind an iotrap hypercall. It gets %rdi, %rsi and %rdx
+   and leaves its result (which goes into %rax); it must reach guest memory
+   only through hcall_read() and hcall_write(), and returns false as soon
+   as either refuses an address (the guest then stops with ADR).
+
+   The built-in routines:
+     HCALL_MEMCPY  copy %rdx bytes from %rsi to %rdi (they may overlap);
+                   returns %rdi
+     HCALL_MEMSET  set %rdx bytes at %rdi to the low byte of %rsi; returns %rdi
+     HCALL_MEMCMP  compare %rdx bytes at %rdi and %rsi; returns -1, 0 or 1
+                   as the first that differ is lower, the same or higher
+                   (unsigned)
+     HCALL_SORT    sort %rsi quads at %rdi into ascending (signed) order;
+                   returns %rsi
+   Each checks all of its operands before it writes anything. */
+typedef bool (*hcall_t) (y86_t *cpu, byte_t *memory, uint64_t a, uint64_t b, uint64_t c,
+        uint64_t *result);
+
+/**
+ * @brief Fill in a hypercall table with the built-in routines
+ *
+ * @param table HCALL_SLOTS entries, indexed by function minus HCALL_BASE
+ * (slots without a built-in are set to NULL)
+ */
+void hcall_defaults (hcall_t *table);
+
+/**
+ * @brief Run a hypercall for the CPU: ADR if the routine refused an
+ * address, otherwise its result goes into %rax
+ *
+ * The low memory it stored to is left in the CPU's channels (see
+ * io_stored()).
+ *
+ * @param cpu CPU whose registers, status and channels are used
+ * @param memory Flat guest memory (paged memory is reached through the CPU)
+ * @param fn Routine to run
+ */
+void hcall_run (y86_t *cpu, byte_t *memory, hcall_t fn);
+
+/**
+ * @brief Check that a range of bytes lies in guest memory
+ *
+ * @param cpu CPU whose memory is meant
+ * @param addr First guest address
+ * @param len Number of bytes (0 is always fine)
+ * @returns True if every byte has an address
+ */
+bool hcall_check (y86_t *cpu, address_t addr, uint64_t len);
+
+/**
+ * @brief Copy bytes out of guest memory for a hypercall
+ *
+ * @param cpu CPU whose memory is read
+ * @param memory Flat guest memory
+ * @param addr First guest address
+ * @param buf Where the bytes go
+ * @param len Number of bytes
+ * @returns True if the bytes were read, false if they are not all in guest
+ * memory (nothing is read)
+ */
+bool hcall_read (y86_t *cpu, byte_t *memory, address_t addr, void *buf, uint64_t len);
+
+/**
+ * @brief Copy bytes into guest memory for a hypercall
+ *
+ * @param cpu CPU whose memory is written
+ * @param memory Flat guest memory
+ * @param addr First guest address
+ * @param buf Bytes to write
+ * @param len Number of bytes
+ * @returns True if the bytes were written, false if they are not all in
+ * guest memory (nothing is written) or a page could not be allocated
+ */
+bool hcall_write (y86_t *cpu, byte_t *memory, address_t addr, const void *buf, uint64_t len);
+
+#endif
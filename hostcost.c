@@ -0,0 +1,279 @@
+/*
+ * CS 261: Host cost of guest instructions
+ *
+ * Name: Ben Berry
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "hostcost.h"
+#include "flatprof.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HOSTCOST_X86 1
+#else
+#define HOSTCOST_X86 0
+#endif
+
+/* Hardware events opened in perf mode, in the order they are reported */
+static const uint64_t events[HOSTCOST_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES
+};
+
+/* One row of the report: an opcode and the host cycles spent on it */
+typedef struct hostcost_row {
+    int key;
+    uint64_t cost;
+} hostcost_row_t;
+
+static bool open_perf (hostcost_t *hc);
+static void close_perf (hostcost_t *hc);
+static void calibrate (hostcost_t *hc);
+static inline void sample (hostcost_t *hc, hostcost_sample_t *s);
+static inline uint64_t read_event (hostcost_t *hc, int i);
+static inline uint64_t read_tsc (void);
+static uint64_t net (hostcost_t *hc, int icode, int ifun, int k);
+static int by_cost (const void *a, const void *b);
+
+/**********************************************************************
+ *                         COST FUNCTIONS
+ *********************************************************************/
+
+hostcost_t *hostcost_create (void) {
+    hostcost_t *hc = (hostcost_t *) calloc(1, sizeof(hostcost_t));
+    if(hc == NULL)
+        return NULL;
+    for(int i = 0; i < HOSTCOST_COUNTERS; i++)
+        hc->fds[i] = -1;
+    hc->pagesize = (size_t) sysconf(_SC_PAGESIZE);
+    //Hardware counters if the kernel lets user space read them directly,
+    //otherwise whatever clock is cheapest to read
+    if(open_perf(hc)) {
+        hc->source = HOSTCOST_PERF;
+        hc->ncounters = HOSTCOST_COUNTERS;
+    } else {
+        close_perf(hc);
+        hc->source = HOSTCOST_X86 ? HOSTCOST_TSC : HOSTCOST_CLOCK;
+        hc->ncounters = 1;
+    }
+    calibrate(hc);
+    return hc;
+}
+
+y86_stat_t hostcost_run (hostcost_t *hc, y86_vm_t *vm, long budget) {
+    if(hc == NULL || vm == NULL)
+        return INS;
+    y86_t *cpu = &vm->cpu;
+    y86_inst_t *ins = &vm->last;
+    hostcost_sample_t before, after;
+    for(long i = 0; cpu->stat == AOK && (budget < 0 || i < budget); i++) {
+        sample(hc, &before);
+        y86_vm_step(vm);
+        sample(hc, &after);
+        int icode = ins->icode & 0x0f;
+        int ifun = ins->ifun.b & 0x0f;
+        hc->count[icode][ifun]++;
+        for(int k = 0; k < hc->ncounters; k++)
+            hc->totals[icode][ifun][k] += after.v[k] - before.v[k];
+    }
+    //No more instructions: just the -e fix-up of the PC after ADR
+    return y86_vm_run(vm, 0);
+}
+
+void dump_hostcost (FILE *out, hostcost_t *hc) {
+    static const char *sources[] = {
+        "hardware counters (rdpmc)", "time stamp counter", "monotonic clock"
+    };
+    static const char *units[] = { "cycles", "cycles", "ns" };
+    hostcost_row_t rows[256];
+    int n = 0;
+    uint64_t instructions = 0, cost = 0;
+    for(int i = 0; i < 16; i++) {
+        for(int j = 0; j < 16; j++) {
+            if(hc->count[i][j] == 0)
+                continue;
+            rows[n].key = (i << 4) | j;
+            rows[n++].cost = net(hc, i, j, 0);
+            instructions += hc->count[i][j];
+            cost += net(hc, i, j, 0);
+        }
+    }
+    qsort(rows, n, sizeof(hostcost_row_t), by_cost);
+
+    fprintf(out, "\nHost cost: %lu instructions, %lu %s from the %s\n", instructions,
+            cost, units[hc->source], sources[hc->source]);
+    fprintf(out, "  (%lu %s per reading subtracted from each instruction)\n",
+            hc->overhead[0], units[hc->source]);
+    if(n == 0)
+        return;
+    fprintf(out, "\n  %-10s %14s %12s %8s", "Opcode", "Instructions", units[hc->source], "%");
+    if(hc->source == HOSTCOST_PERF)
+        fprintf(out, " %12s %12s", "host ins", "misses/1k");
+    fprintf(out, "\n");
+    for(int i = 0; i < n; i++) {
+        int icode = rows[i].key >> 4, ifun = rows[i].key & 0x0f;
+        double count = (double) hc->count[icode][ifun];
+        char name[16];
+        fprintf(out, "  %-10s %14lu %12.1f %7.2f%%",
+                flatprof_mnemonic(icode, ifun, name, sizeof(name)), hc->count[icode][ifun],
+                rows[i].cost / count, cost != 0 ? 100.0 * rows[i].cost / cost : 0.0);
+        if(hc->source == HOSTCOST_PERF)
+            fprintf(out, " %12.1f %12.2f", net(hc, icode, ifun, 1) / count,
+                    1000.0 * net(hc, icode, ifun, 2) / count);
+        fprintf(out, "\n");
+    }
+}
+
+void hostcost_free (hostcost_t *hc) {
+    if(hc == NULL)
+        return;
+    close_perf(hc);
+    free(hc);
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+//Open every event on this thread (user mode only) and map its control page;
+//false unless all of them can be read with rdpmc
+static bool open_perf (hostcost_t *hc) {
+#if HOSTCOST_X86 && defined(SYS_perf_event_open)
+    for(int i = 0; i < HOSTCOST_COUNTERS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = events[i];
+        attr.pinned = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        hc->fds[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if(hc->fds[i] < 0)
+            return false;
+        void *page = mmap(NULL, hc->pagesize, PROT_READ, MAP_SHARED, hc->fds[i], 0);
+        if(page == MAP_FAILED)
+            return false;
+        hc->pages[i] = page;
+        if(!((struct perf_event_mmap_page *) page)->cap_user_rdpmc)
+            return false;
+    }
+    return true;
+#else
+    (void) hc;
+    return false;
+#endif
+}
+
+//Close whatever open_perf() managed to open
+static void close_perf (hostcost_t *hc) {
+    for(int i = 0; i < HOSTCOST_COUNTERS; i++) {
+        if(hc->pages[i] != NULL)
+            munmap(hc->pages[i], hc->pagesize);
+        if(hc->fds[i] >= 0)
+            close(hc->fds[i]);
+        hc->pages[i] = NULL;
+        hc->fds[i] = -1;
+    }
+}
+
+//What a back-to-back pair of readings costs with nothing between them (the
+//least seen, so interrupts and misses during calibration do not count)
+static void calibrate (hostcost_t *hc) {
+    hostcost_sample_t before, after;
+    for(int k = 0; k < HOSTCOST_COUNTERS; k++)
+        hc->overhead[k] = UINT64_MAX;
+    for(int i = 0; i < HOSTCOST_CALIBRATE; i++) {
+        sample(hc, &before);
+        sample(hc, &after);
+        for(int k = 0; k < hc->ncounters; k++) {
+            uint64_t delta = after.v[k] - before.v[k];
+            if(delta < hc->overhead[k])
+                hc->overhead[k] = delta;
+        }
+    }
+    for(int k = hc->ncounters; k < HOSTCOST_COUNTERS; k++)
+        hc->overhead[k] = 0;
+}
+
+//Read every counter in use
+static inline void sample (hostcost_t *hc, hostcost_sample_t *s) {
+    if(hc->source == HOSTCOST_PERF) {
+        for(int k = 0; k < HOSTCOST_COUNTERS; k++)
+            s->v[k] = read_event(hc, k);
+    } else if(hc->source == HOSTCOST_TSC) {
+        s->v[0] = read_tsc();
+    } else {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        s->v[0] = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+}
+
+//Read one perf event from user space: the kernel's running offset plus the
+//live hardware counter, retried if the kernel updated the page meanwhile
+//(falls back to read() while the event is not on a counter)
+static inline uint64_t read_event (hostcost_t *hc, int i) {
+#if HOSTCOST_X86
+    struct perf_event_mmap_page *page = (struct perf_event_mmap_page *) hc->pages[i];
+    uint32_t seq = 0, index = 0;
+    int64_t count = 0;
+    do {
+        seq = page->lock;
+        __asm__ __volatile__("" ::: "memory");
+        index = page->index;
+        count = page->offset;
+        if(index != 0) {
+            uint32_t lo = 0, hi = 0;
+            __asm__ __volatile__("rdpmc" : "=a"(lo), "=d"(hi) : "c"(index - 1));
+            //Sign-extend from the counter's width
+            int shift = 64 - page->pmc_width;
+            count += (int64_t) ((((uint64_t) hi << 32) | lo) << shift) >> shift;
+        }
+        __asm__ __volatile__("" ::: "memory");
+    } while(page->lock != seq);
+    if(index == 0) {
+        uint64_t value = 0;
+        if(read(hc->fds[i], &value, sizeof(value)) == sizeof(value))
+            return value;
+    }
+    return (uint64_t) count;
+#else
+    (void) hc;
+    (void) i;
+    return 0;
+#endif
+}
+
+//Read the time stamp counter once earlier instructions have finished
+static inline uint64_t read_tsc (void) {
+#if HOSTCOST_X86
+    uint32_t lo = 0, hi = 0;
+    __asm__ __volatile__("lfence\n\trdtsc" : "=a"(lo), "=d"(hi) :: "memory");
+    return ((uint64_t) hi << 32) | lo;
+#else
+    return 0;
+#endif
+}
+
+//Counter k's total for an opcode less the cost of reading it (never below 0)
+static uint64_t net (hostcost_t *hc, int icode, int ifun, int k) {
+    uint64_t raw = hc->totals[icode][ifun][k];
+    uint64_t reading = hc->overhead[k] * hc->count[icode][ifun];
+    return raw > reading ? raw - reading : 0;
+}
+
+//Costliest first, then lowest opcode
+static int by_cost (const void *a, const void *b) {
+    const hostcost_row_t *x = (const hostcost_row_t *) a;
+    const hostcost_row_t *y = (const hostcost_row_t *) b;
+    if(x->cost != y->cost)
+        return x->cost > y->cost ? -1 : 1;
+    return x->key - y->key;
+}
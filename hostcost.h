@@ -0,0 +1,81 @@
+#ifndef __CS261_HOSTCOST__
+#define __CS261_HOSTCOST__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "y86.h"
+#include "y86vm.h"
+
+/* Host counters read around each guest instruction */
+#define HOSTCOST_COUNTERS 3
+
+/* Empty readings taken to measure what a reading itself costs */
+#define HOSTCOST_CALIBRATE 10000
+
+/* Where the counts come from, best first */
+typedef enum {
+    HOSTCOST_PERF,              // hardware counters (perf_event_open, read
+                                // with rdpmc): cycles, instructions, branch misses
+    HOSTCOST_TSC,               // time stamp counter only (reference cycles)
+    HOSTCOST_CLOCK              // monotonic clock only (nanoseconds)
+} hostcost_source_t;
+
+/* One reading of the counters */
+typedef struct hostcost_sample {
+    uint64_t v[HOSTCOST_COUNTERS];
+} hostcost_sample_t;
+
+/* What the host spent on the guest's instructions, by icode and ifun */
+typedef struct hostcost {
+
+    hostcost_source_t source;
+    int ncounters;              // counters in use (1 without perf)
+    int fds[HOSTCOST_COUNTERS]; // perf events, or -1
+    void *pages[HOSTCOST_COUNTERS];     // their mmap()ed control pages
+    size_t pagesize;
+
+    uint64_t count[16][16];     // guest instructions
+    uint64_t totals[16][16][HOSTCOST_COUNTERS];     // counter deltas, raw
+    uint64_t overhead[HOSTCOST_COUNTERS];   // cost of one empty reading
+
+} hostcost_t;
+
+/**
+ * @brief Set up the best counters this host offers and calibrate them
+ *
+ * @returns New cost profile, or NULL on failure
+ */
+hostcost_t *hostcost_create (void);
+
+/**
+ * @brief Run the VM like y86_vm_run(), reading the counters around every
+ * instruction
+ *
+ * @param hc Cost profile to add to
+ * @param vm VM to run
+ * @param budget Maximum number of instructions to execute, or -1 for no limit
+ * @returns CPU status when the run stopped (AOK if the budget ran out)
+ */
+y86_stat_t hostcost_run (hostcost_t *hc, y86_vm_t *vm, long budget);
+
+/**
+ * @brief Print host cost per guest instruction for each opcode, costliest
+ * first (the calibrated cost of a reading is subtracted)
+ *
+ * @param out Stream to print to
+ * @param hc Cost profile to describe
+ */
+void dump_hostcost (FILE *out, hostcost_t *hc);
+
+/**
+ * @brief Release a cost profile and its counters
+ *
+ * @param hc Cost profile to be freed (may be NULL)
+ */
+void hostcost_free (hostcost_t *hc);
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * CS 261: Predecoded instruction cache
+ *
+ * Name: Ben Berry
+ */
+
+#include "icache.h"
+#include "p3-disas.h"
+
+/**********************************************************************
+ *                         CACHE FUNCTIONS
+ *********************************************************************/
+
+icache_t *icache_create (void) {
+    //calloc leaves every slot invalid and every counter at zero
+    return (icache_t *) calloc(1, sizeof(icache_t));
+}
+
+void icache_free (icache_t *cache) {
+    free(cache);
+}
+
+y86_inst_t icache_fetch (icache_t *cache, y86_t *cpu, byte_t *memory) {
+    //Nothing to cache against, so just decode normally
+    if(cache == NULL || cpu == NULL || cpu->pc >= MEMSIZE)
+        return fetch(cpu, memory);
+
+    //Hit: the bytes at this address have not changed since they were decoded
+    if(cache->valid[cpu->pc]) {
+        cache->hits++;
+        return cache->inst[cpu->pc];
+    }
+
+    //Miss: decode from memory and keep the result only if it was clean
+    cache->misses++;
+    y86_stat_t before = cpu->stat;
+    y86_inst_t ins = fetch(cpu, memory);
+    if(cpu->stat == before && ins.icode != INVALID) {
+        cache->inst[cpu->pc] = ins;
+        cache->valid[cpu->pc] = true;
+    }
+    return ins;
+}
+
+void icache_invalidate (icache_t *cache, address_t addr) {
+    //With paged memory a store just past MEMSIZE can still reach the last
+    //instructions below it
+    if(cache == NULL || addr >= MEMSIZE + INST_MAXLEN - 1)
+        return;
+
+    //Any instruction starting up to INST_MAXLEN - 1 bytes before the store
+    //can reach into it, as can any instruction starting inside it.
+    address_t first = (addr >= INST_MAXLEN - 1) ? addr - (INST_MAXLEN - 1) : 0;
+    address_t last = addr + STORE_SIZE;
+    if(last > MEMSIZE)
+        last = MEMSIZE;
+
+    bool dropped = false;
+    for(address_t a = first; a < last; a++) {
+        dropped |= cache->valid[a];
+        cache->valid[a] = false;
+    }
+    if(dropped)
+        cache->invalidations++;
+}
+
+void icache_flush (icache_t *cache) {
+    if(cache == NULL)
+        return;
+    memset(cache->valid, 0x00, sizeof(cache->valid));
+}
@@ -0,0 +1,72 @@
+#ifndef __CS261_ICACHE__
+#define __CS261_ICACHE__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "y86.h"
+
+/* Longest Y86 instruction (irmovq/rmmovq/mrmovq) and widest store, in bytes */
+#define INST_MAXLEN 10
+#define STORE_SIZE  8
+
+/* Predecoded instruction cache storage structure. Every address in the Y86
+   address space has one slot; a slot is filled the first time the instruction
+   at that address is fetched and reused until a store overlaps its bytes. */
+typedef struct icache {
+
+    y86_inst_t inst[MEMSIZE];   // predecoded instruction at each address
+    bool valid[MEMSIZE];        // true if inst[addr] can be reused
+
+    uint64_t hits;              // fetches served from the cache
+    uint64_t misses;            // fetches that had to decode from memory
+    uint64_t invalidations;     // stores that dropped at least one entry
+
+} icache_t;
+
+/**
+ * @brief Allocate an empty instruction cache
+ *
+ * @returns Pointer to the new cache, or NULL if allocation failed
+ */
+icache_t *icache_create (void);
+
+/**
+ * @brief Release an instruction cache
+ *
+ * @param cache Cache to be freed (may be NULL)
+ */
+void icache_free (icache_t *cache);
+
+/**
+ * @brief Load a Y86 instruction, reusing an earlier decode when possible
+ *
+ * Behaves exactly like fetch(). Only instructions that decoded cleanly (the
+ * CPU status was left untouched) are cached, so invalid opcodes and address
+ * errors are always re-reported by fetch() itself.
+ *
+ * @param cache Instruction cache
+ * @param cpu Pointer to Y86 CPU structure with the PC address to be loaded
+ * @param memory Pointer to the beginning of the Y86 address space
+ * @returns Populated Y86 instruction structure
+ */
+y86_inst_t icache_fetch (icache_t *cache, y86_t *cpu, byte_t *memory);
+
+/**
+ * @brief Drop every cached instruction that overlaps an 8-byte store
+ *
+ * @param cache Instruction cache
+ * @param addr Address of the first byte written
+ */
+void icache_invalidate (icache_t *cache, address_t addr);
+
+/**
+ * @brief Drop every cached instruction
+ *
+ * @param cache Instruction cache
+ */
+void icache_flush (icache_t *cache);
+
+#endif
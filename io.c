@@ -0,0 +1,365 @@
+/*
+ * CS 261: Buffered guest I/O channels for iotrap
+ *
+ * Name: Ben Berry
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "io.h"
+#include "pmem.h"
+#include "p4-interp.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+static void close_input (y86_io_t *io);
+static void put (y86_io_t *io, const void *bytes, size_t len);
+static int peek (y86_io_t *io);
+static bool read_decimal (y86_io_t *io, int64_t *value);
+static bool next_input (y86_io_t *io, iolog_kind_t kind, int64_t *value);
+static bool load_byte (y86_t *cpu, byte_t *memory, address_t addr, byte_t *value);
+static bool load_quad (y86_t *cpu, byte_t *memory, address_t addr, uint64_t *value);
+static bool can_store (y86_t *cpu, address_t addr, size_t len);
+static void store (y86_t *cpu, byte_t *memory, address_t addr, const void *bytes, size_t len);
+static void write_string (y86_t *cpu, byte_t *memory, address_t addr);
+
+/**********************************************************************
+ *                         CHANNEL FUNCTIONS
+ *********************************************************************/
+
+y86_io_t *io_create (void) {
+    y86_io_t *io = (y86_io_t *) calloc(1, sizeof(y86_io_t));
+    if(io == NULL)
+        return NULL;
+    io->out = (byte_t *) malloc(IO_BUFSIZE);
+    io->buf = (byte_t *) malloc(IO_BUFSIZE);
+    if(io->out == NULL || io->buf == NULL) {
+        io_free(io);
+        return NULL;
+    }
+    io->sink = stdout;
+    io->fd = -1;
+    hcall_defaults(io->hcalls);
+    return io;
+}
+
+void io_set_output (y86_io_t *io, FILE *sink) {
+    io_flush(io);
+    io->sink = sink;
+}
+
+void io_set_input_fd (y86_io_t *io, int fd) {
+    close_input(io);
+    io->fd = fd;
+    io->in = NULL;
+    io->inlen = io->inpos = 0;
+    io->mem = NULL;
+    io->memlen = 0;
+}
+
+bool io_set_input_file (y86_io_t *io, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return false;
+    io_set_input_fd(io, fd);
+    io->owned = true;
+    return true;
+}
+
+void io_set_input_buffer (y86_io_t *io, const byte_t *buf, size_t len) {
+    close_input(io);
+    io->in = io->mem = buf;
+    io->inlen = io->memlen = len;
+    io->inpos = 0;
+}
+
+void io_set_log (y86_io_t *io, iolog_t *log) {
+    io->log = log;
+}
+
+bool io_register_hcall (y86_io_t *io, y86_iotrap_t trap, hcall_t fn) {
+    if(io == NULL || trap < HCALL_BASE || trap >= HCALL_BASE + HCALL_SLOTS)
+        return false;
+    io->hcalls[trap - HCALL_BASE] = fn;
+    return true;
+}
+
+void io_trap (y86_t *cpu, byte_t *memory, y86_iotrap_t trap) {
+    y86_io_t *io = cpu->io;
+    address_t src = cpu->reg[RSI];
+    address_t dst = cpu->reg[RDI];
+    byte_t c = 0;
+    uint64_t quad = 0;
+    int64_t number = 0;
+    char text[24];
+    switch(trap) {
+        case(CHAROUT):
+            if(!load_byte(cpu, memory, src, &c)) {
+                cpu->stat = ADR;
+                break;
+            }
+            put(io, &c, 1);
+            break;
+        case(CHARIN):
+            //Check the destination before any input is used up
+            if(!can_store(cpu, dst, 1)) {
+                cpu->stat = ADR;
+                break;
+            }
+            if(!next_input(io, IOLOG_CHAR, &number)) {
+                cpu->stat = HLT;
+                break;
+            }
+            c = (byte_t) number;
+            store(cpu, memory, dst, &c, 1);
+            break;
+        case(DECOUT):
+            if(!load_quad(cpu, memory, src, &quad)) {
+                cpu->stat = ADR;
+                break;
+            }
+            put(io, text, snprintf(text, sizeof(text), "%" PRId64, (int64_t) quad));
+            break;
+        case(DECIN):
+            if(!can_store(cpu, dst, sizeof(number))) {
+                cpu->stat = ADR;
+                break;
+            }
+            if(!next_input(io, IOLOG_DEC, &number)) {
+                cpu->stat = HLT;
+                break;
+            }
+            store(cpu, memory, dst, &number, sizeof(number));
+            break;
+        case(STROUT): write_string(cpu, memory, src); break;
+        case(FLUSH): io_flush(io); break;
+        default:
+            if(trap >= HCALL_BASE && trap < HCALL_BASE + HCALL_SLOTS
+                    && io->hcalls[trap - HCALL_BASE] != NULL)
+                hcall_run(cpu, memory, io->hcalls[trap - HCALL_BASE]);
+            else
+                cpu->stat = INS;
+            break;
+    }
+    //Output reaches the sink when the guest stops, whatever the reason
+    if(cpu->stat != AOK)
+        io_flush(io);
+}
+
+void io_putc (y86_io_t *io, byte_t c) {
+    put(io, &c, 1);
+}
+
+int io_getc (y86_io_t *io) {
+    int c = peek(io);
+    if(c >= 0) {
+        io->inpos++;
+        io->read++;
+    }
+    return c;
+}
+
+bool io_flush (y86_io_t *io) {
+    if(io == NULL)
+        return true;
+    if(io->outlen > 0 && io->sink != NULL) {
+        if(fwrite(io->out, 1, io->outlen, io->sink) != io->outlen || fflush(io->sink) != 0)
+            io->failed = true;
+        io->written += io->outlen;
+        io->flushes++;
+    }
+    io->outlen = 0;
+    return !io->failed;
+}
+
+void io_reset (y86_io_t *io) {
+    if(io == NULL)
+        return;
+    io->outlen = 0;
+    if(io->mem != NULL) {
+        io->in = io->mem;
+        io->inlen = io->memlen;
+        io->inpos = 0;
+    }
+    iolog_rewind(io->log);
+}
+
+void io_free (y86_io_t *io) {
+    if(io == NULL)
+        return;
+    if(io->out != NULL)
+        io_flush(io);
+    close_input(io);
+    free(io->out);
+    free(io->buf);
+    free(io);
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+//Stop reading from the descriptor (closing it if it is ours)
+static void close_input (y86_io_t *io) {
+    if(io->owned)
+        close(io->fd);
+    io->owned = false;
+    io->fd = -1;
+}
+
+//Append output, writing the buffer out each time it fills
+static void put (y86_io_t *io, const void *bytes, size_t len) {
+    const byte_t *from = (const byte_t *) bytes;
+    while(len > 0) {
+        if(io->outlen == IO_BUFSIZE)
+            io_flush(io);
+        size_t n = IO_BUFSIZE - io->outlen;
+        if(n > len)
+            n = len;
+        memcpy(&io->out[io->outlen], from, n);
+        io->outlen += n;
+        from += n;
+        len -= n;
+    }
+}
+
+//The next input byte without taking it, or -1 at the end of input (one
+//read() refills the buffer with whatever is ready, at least a byte)
+static int peek (y86_io_t *io) {
+    if(io->inpos < io->inlen)
+        return io->in[io->inpos];
+    if(io->fd < 0)
+        return -1;
+    ssize_t n = 0;
+    do {
+        n = read(io->fd, io->buf, IO_BUFSIZE);
+    } while(n < 0 && errno == EINTR);
+    if(n <= 0) {
+        close_input(io);
+        return -1;
+    }
+    io->in = io->buf;
+    io->inlen = (size_t) n;
+    io->inpos = 0;
+    return io->in[0];
+}
+
+//Read an optionally signed decimal after any whitespace, leaving the first
+//byte after it unread (false if there are no digits)
+static bool read_decimal (y86_io_t *io, int64_t *value) {
+    int c = peek(io);
+    while(c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f') {
+        io->inpos++;
+        io->read++;
+        c = peek(io);
+    }
+    bool negative = c == '-';
+    if(c == '-' || c == '+') {
+        io->inpos++;
+        io->read++;
+        c = peek(io);
+    }
+    if(c < '0' || c > '9')
+        return false;
+    //Wraps around on overflow, as Y86 arithmetic does
+    uint64_t n = 0;
+    while(c >= '0' && c <= '9') {
+        n = n * 10 + (uint64_t) (c - '0');
+        io->inpos++;
+        io->read++;
+        c = peek(io);
+    }
+    *value = (int64_t) (negative ? 0 - n : n);
+    return true;
+}
+
+//The input for CHARIN or DECIN, from the log when replaying (false at the
+//end of input, which is logged too)
+static bool next_input (y86_io_t *io, iolog_kind_t kind, int64_t *value) {
+    if(io->log != NULL && io->log->replaying)
+        return iolog_get(io->log, io->count, kind, value) == kind;
+    bool ok = false;
+    if(kind == IOLOG_DEC) {
+        ok = read_decimal(io, value);
+    } else if(peek(io) >= 0) {
+        *value = io->in[io->inpos++];
+        io->read++;
+        ok = true;
+    }
+    if(io->log != NULL)
+        iolog_put(io->log, io->count, ok ? kind : IOLOG_END, *value);
+    return ok;
+}
+
+//Guest memory accessors for operands of any size
+static bool load_byte (y86_t *cpu, byte_t *memory, address_t addr, byte_t *value) {
+    if(cpu->pmem != NULL) {
+        if(!pmem_valid(addr))
+            return false;
+        pmem_read(cpu->pmem, addr, value, 1);
+        return true;
+    }
+    if(addr >= MEMSIZE)
+        return false;
+    *value = memory[addr];
+    return true;
+}
+
+static bool load_quad (y86_t *cpu, byte_t *memory, address_t addr, uint64_t *value) {
+    if(cpu->pmem != NULL) {
+        if(!pmem_valid(addr))
+            return false;
+        *value = pmem_load(cpu->pmem, addr);
+        return true;
+    }
+    if(addr > MEMSIZE - sizeof(uint64_t))
+        return false;
+    memcpy(value, &memory[addr], sizeof(uint64_t));
+    return true;
+}
+
+static bool can_store (y86_t *cpu, address_t addr, size_t len) {
+    if(cpu->pmem != NULL)
+        return pmem_valid(addr);
+    return addr <= MEMSIZE - len;
+}
+
+static void store (y86_t *cpu, byte_t *memory, address_t addr, const void *bytes, size_t len) {
+    if(cpu->pmem != NULL) {
+        if(!pmem_write(cpu->pmem, addr, bytes, len))
+            cpu->stat = ADR;
+        return;
+    }
+    memcpy(&memory[addr], bytes, len);
+    mark_dirty(cpu, addr);
+}
+
+//Write a NUL-terminated string from guest memory; ADR if it runs off the
+//end (flat memory is checked first, so nothing is written then)
+static void write_string (y86_t *cpu, byte_t *memory, address_t addr) {
+    if(cpu->pmem == NULL) {
+        const byte_t *end = (addr < MEMSIZE) ? memchr(&memory[addr], 0, MEMSIZE - addr) : NULL;
+        if(end == NULL)
+            cpu->stat = ADR;
+        else
+            put(cpu->io, &memory[addr], end - &memory[addr]);
+        return;
+    }
+    //Paged memory a chunk at a time (unmapped pages read as zeros)
+    byte_t chunk[256];
+    for(;;) {
+        if(!pmem_valid(addr)) {
+            cpu->stat = ADR;
+            return;
+        }
+        pmem_read(cpu->pmem, addr, chunk, sizeof(chunk));
+        const byte_t *end = memchr(chunk, 0, sizeof(chunk));
+        put(cpu->io, chunk, (end != NULL) ? (size_t) (end - chunk) : sizeof(chunk));
+        if(end != NULL)
+            return;
+        addr += sizeof(chunk);
+    }
+}
@@ -0,0 +1,212 @@
+#ifndef __CS261_IO__
+#define __CS261_IO__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "y86.h"
+#include "iolog.h"
+#include "hcall.h"
+
+/* Bytes of guest output held before a write is forced, and of input read
+   from a file descriptor at a time */
+#define IO_BUFSIZE (1 << 16)
+
+/* Guest I/O channels for iotrap. Output collects in one buffer that is
+   written out only on iotrap FLUSH, when the guest halts (or otherwise
+   stops) or when it fills up; input is served from a buffer refilled with a
+   single read() of whatever the file or pipe has ready, or straight from
+   bytes in host memory. Which bytes a guest sees therefore depends only on
+   its input, never on how the writes and reads were batched.
+
+   The traps take their operands from registers and memory:
+     CHAROUT  write the byte at (%rsi)
+     CHARIN   read a byte into (%rdi)
+     DECOUT   write the quad at (%rsi) as a signed decimal
+     DECIN    read a signed decimal (after any whitespace) into (%rdi)
+     STROUT   write the NUL-terminated string at (%rsi)
+     FLUSH    write out everything buffered
+   An operand outside guest memory is ADR. Reading at the end of input, or
+   anything that is not a number for DECIN, halts the guest (HLT).
+
+   With a log attached, what CHARIN and DECIN take is either written down
+   as it is read or, in replay, served from the log instead of the input
+   (see iolog.h).
+
+   The channels also hold the hypercall table: functions from HCALL_BASE
+   up run the native routine registered for them (the built-ins to begin
+   with, see hcall.h), and are INS when there is none. */
+typedef struct y86_io {
+
+    byte_t *out;                // pending output
+    size_t outlen;
+    FILE *sink;                 // where output goes, or NULL to discard it
+
+    byte_t *buf;                // refill buffer for fd input
+    const byte_t *in;           // input ready to be read
+    size_t inlen, inpos;
+    int fd;                     // refilled from here, or -1
+    bool owned;                 // fd was opened here (and is closed here)
+    const byte_t *mem;          // in-memory input (what io_reset() rewinds)
+    size_t memlen;
+
+    iolog_t *log;               // input being recorded or replayed, or NULL
+    int count;                  // instruction count of the trap being run
+                                // (set by whoever runs it)
+
+    hcall_t hcalls[HCALL_SLOTS];// hypercall routines, or NULL
+    address_t span[2];          // low memory the last hypercall stored to
+                                // (from span[0] up to span[1])
+
+    uint64_t written;           // bytes written to the sink
+    uint64_t read;              // bytes taken by the guest
+    uint64_t flushes;           // writes to the sink
+    bool failed;                // a write to the sink failed
+
+} y86_io_t;
+
+/**
+ * @brief Allocate channels with output going to stdout and no input
+ *
+ * @returns New channels, or NULL if allocation failed
+ */
+y86_io_t *io_create (void);
+
+/**
+ * @brief Send output somewhere else (what is pending is flushed first)
+ *
+ * @param io Channels
+ * @param sink Stream to write to, or NULL to discard output
+ */
+void io_set_output (y86_io_t *io, FILE *sink);
+
+/**
+ * @brief Read input from a file descriptor (a file or a pipe)
+ *
+ * @param io Channels
+ * @param fd Descriptor to read from (not closed by the channels), or -1 for
+ * no input
+ */
+void io_set_input_fd (y86_io_t *io, int fd);
+
+/**
+ * @brief Read input from a file, which the channels open and close
+ *
+ * @param io Channels
+ * @param path File to read
+ * @returns True if the file could be opened
+ */
+bool io_set_input_file (y86_io_t *io, const char *path);
+
+/**
+ * @brief Serve input from bytes in host memory, without any system calls
+ *
+ * @param io Channels
+ * @param buf Input bytes (must outlive their use; not copied)
+ * @param len Number of bytes in buf
+ */
+void io_set_input_buffer (y86_io_t *io, const byte_t *buf, size_t len);
+
+/**
+ * @brief Record input to a log, or replay it from one
+ *
+ * @param io Channels
+ * @param log Log to use (owned by the caller), or NULL for none
+ */
+void io_set_log (y86_io_t *io, iolog_t *log);
+
+/**
+ * @brief Write one byte of output, as CHAROUT would (for devices)
+ *
+ * @param io Channels
+ * @param c Byte to write
+ */
+void io_putc (y86_io_t *io, byte_t c);
+
+/**
+ * @brief Read one byte of input, as CHARIN would, but never from or to a log
+ * (for devices)
+ *
+ * @param io Channels
+ * @returns The byte, or -1 at the end of input
+ */
+int io_getc (y86_io_t *io);
+
+/**
+ * @brief Put a native routine behind a hypercall
+ *
+ * @param io Channels
+ * @param trap Function to use (HCALL_BASE or above)
+ * @param fn Routine to run, or NULL to make the function INS
+ * @returns True if trap is a hypercall slot
+ */
+bool io_register_hcall (y86_io_t *io, y86_iotrap_t trap, hcall_t fn);
+
+/**
+ * @brief Carry out an iotrap for the CPU (see above)
+ *
+ * The channels' count must be the instruction count before the trap.
+ *
+ * @param cpu CPU whose channels, registers and status are used
+ * @param memory Flat guest memory (paged memory is reached through the CPU)
+ * @param trap Which trap
+ */
+void io_trap (y86_t *cpu, byte_t *memory, y86_iotrap_t trap);
+
+/**
+ * @brief Write out all pending output
+ *
+ * @param io Channels (may be NULL)
+ * @returns True unless a write to the sink has failed
+ */
+bool io_flush (y86_io_t *io);
+
+/**
+ * @brief Start over for a fresh run: pending output is dropped and
+ * in-memory input and replay rewound (input from a descriptor carries on)
+ *
+ * @param io Channels (may be NULL)
+ */
+void io_reset (y86_io_t *io);
+
+/**
+ * @brief Flush and release channels
+ *
+ * @param io Channels to be freed (may be NULL)
+ */
+void io_free (y86_io_t *io);
+
+/**
+ * @brief Tell whether an instruction writes guest memory through its channels
+ *
+ * @param ins Instruction that was executed
+ * @returns True for CHARIN and DECIN, which store at %rdi
+ */
+static inline bool io_stores (const y86_inst_t *ins) {
+    return ins->icode == IOTRAP && (ins->ifun.trap == CHARIN || ins->ifun.trap == DECIN);
+}
+
+/**
+ * @brief Tell which low memory (where decodes are cached, flat or paged) a
+ * hypercall stored to, for the engines to drop decodes of
+ *
+ * @param cpu CPU that executed the instruction
+ * @param ins Instruction that was executed
+ * @param lo Set to the first byte stored to
+ * @param hi Set to the byte after the last one
+ * @returns True if ins was a hypercall that stored to low memory
+ */
+static inline bool io_stored (const y86_t *cpu, const y86_inst_t *ins, address_t *lo,
+        address_t *hi) {
+    if(ins->icode != IOTRAP || ins->ifun.trap < HCALL_BASE || cpu->io == NULL
+            || cpu->io->span[0] >= cpu->io->span[1])
+        return false;
+    *lo = cpu->io->span[0];
+    *hi = cpu->io->span[1];
+    return true;
+}
+
+#endif
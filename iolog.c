@@ -0,0 +1,158 @@
+/*
+ * CS 261: Record and replay of guest input
+ *
+ * Name: Ben Berry
+ */
+
+#include "iolog.h"
+#include "varint.h"
+
+static void flush (iolog_t *lg);
+
+/**********************************************************************
+ *                         LOG FUNCTIONS
+ *********************************************************************/
+
+iolog_t *iolog_record (const char *path) {
+    if(path == NULL)
+        return NULL;
+    iolog_t *lg = (iolog_t *) calloc(1, sizeof(iolog_t));
+    if(lg == NULL)
+        return NULL;
+    lg->buf = (byte_t *) malloc(IOLOG_BUFSIZE);
+    lg->out = fopen(path, "wb");
+    if(lg->buf == NULL || lg->out == NULL) {
+        iolog_close(lg);
+        return NULL;
+    }
+    iolog_hdr_t hdr = { IOLOG_MAGIC, IOLOG_VERSION, 0 };
+    memcpy(lg->buf, &hdr, sizeof(hdr));
+    lg->used = sizeof(hdr);
+    return lg;
+}
+
+iolog_t *iolog_replay (const char *path) {
+    if(path == NULL)
+        return NULL;
+    FILE *in = fopen(path, "rb");
+    if(in == NULL)
+        return NULL;
+    iolog_t *lg = (iolog_t *) calloc(1, sizeof(iolog_t));
+    long size = -1;
+    if(fseek(in, 0, SEEK_END) == 0)
+        size = ftell(in);
+    rewind(in);
+
+    //All of it, so replay never has to go back to the file
+    iolog_hdr_t hdr;
+    bool ok = lg != NULL && size >= (long) sizeof(hdr)
+            && (lg->buf = (byte_t *) malloc(size)) != NULL
+            && fread(lg->buf, size, 1, in) == 1;
+    fclose(in);
+    if(ok) {
+        memcpy(&hdr, lg->buf, sizeof(hdr));
+        ok = hdr.magic == IOLOG_MAGIC && hdr.version == IOLOG_VERSION;
+    }
+    if(!ok) {
+        iolog_close(lg);
+        return NULL;
+    }
+    lg->replaying = true;
+    lg->used = (size_t) size;
+    lg->pos = sizeof(hdr);
+    return lg;
+}
+
+void iolog_put (iolog_t *lg, int count, iolog_kind_t kind, int64_t value) {
+    if(lg->used > IOLOG_BUFSIZE - IOLOG_MAXRECORD)
+        flush(lg);
+    byte_t *p = &lg->buf[lg->used];
+    p = varint_put(p, (uint64_t) (count - lg->last) << IOLOG_KINDBITS | kind);
+    if(kind == IOLOG_CHAR)
+        *p++ = (byte_t) value;
+    else if(kind == IOLOG_DEC)
+        p = varint_put(p, varint_zigzag((uint64_t) value));
+    lg->used = p - lg->buf;
+    lg->last = count;
+    lg->records++;
+}
+
+iolog_kind_t iolog_get (iolog_t *lg, int count, iolog_kind_t kind, int64_t *value) {
+    //Nothing moves until the record is known to fit
+    size_t start = lg->pos;
+    uint64_t tag = 0;
+    uint64_t n = 0;
+    bool ok = !lg->diverged && varint_get(lg->buf, lg->used, &lg->pos, &tag);
+    iolog_kind_t got = (iolog_kind_t) (tag & ((1 << IOLOG_KINDBITS) - 1));
+    ok = ok && lg->last + (tag >> IOLOG_KINDBITS) == (uint64_t) count
+            && (got == kind || got == IOLOG_END);
+    if(ok && got == IOLOG_CHAR) {
+        ok = lg->pos < lg->used;
+        if(ok)
+            *value = lg->buf[lg->pos++];
+    } else if(ok && got == IOLOG_DEC) {
+        ok = varint_get(lg->buf, lg->used, &lg->pos, &n);
+        *value = (int64_t) varint_unzigzag(n);
+    }
+    if(!ok) {
+        lg->pos = start;
+        if(!lg->diverged)
+            lg->where = count;
+        lg->diverged = true;
+        return IOLOG_DIVERGED;
+    }
+    lg->last = count;
+    lg->records++;
+    return got;
+}
+
+void iolog_rewind (iolog_t *lg) {
+    if(lg == NULL || !lg->replaying)
+        return;
+    lg->pos = sizeof(iolog_hdr_t);
+    lg->last = 0;
+    lg->diverged = false;
+}
+
+bool iolog_close (iolog_t *lg) {
+    if(lg == NULL)
+        return false;
+    bool ok = false;
+    if(lg->replaying) {
+        //A run that stops short of the log's end went another way too
+        ok = !lg->diverged && lg->pos == lg->used;
+    } else if(lg->out != NULL) {
+        flush(lg);
+        if(fclose(lg->out) != 0)
+            lg->failed = true;
+        ok = !lg->failed;
+    }
+    free(lg->buf);
+    free(lg);
+    return ok;
+}
+
+void dump_iolog_stats (FILE *out, iolog_t *lg) {
+    if(!lg->replaying) {
+        fprintf(out, "Input log: %lu inputs recorded, %lu bytes\n", lg->records,
+                lg->bytes + lg->used);
+    } else if(lg->diverged) {
+        fprintf(out, "Input log: %lu inputs replayed, then diverged at instruction %d\n",
+                lg->records, lg->where);
+    } else {
+        fprintf(out, "Input log: %lu inputs replayed, %lu bytes of the log unused\n",
+                lg->records, lg->used - lg->pos);
+    }
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+//Write out the buffered records
+static void flush (iolog_t *lg) {
+    if(lg->used > 0 && fwrite(lg->buf, lg->used, 1, lg->out) != 1)
+        lg->failed = true;
+    lg->bytes += lg->used;
+    lg->used = 0;
+}
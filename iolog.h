@@ -0,0 +1,136 @@
+#ifndef __CS261_IOLOG__
+#define __CS261_IOLOG__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "y86.h"
+
+/* Input log file marker ("Y86I" read as little-endian text) and format version */
+#define IOLOG_MAGIC   0x49363859
+#define IOLOG_VERSION 1
+
+/* Bytes buffered by the writer before each fwrite() */
+#define IOLOG_BUFSIZE (1 << 16)
+
+/* Longest record: a tag and a value (varints take at most 10 bytes) */
+#define IOLOG_MAXRECORD 20
+
+/* What the guest got from one CHARIN or DECIN, kept in a record tag's low
+   bits (the rest of the tag is the instruction count since the last one) */
+typedef enum {
+    IOLOG_CHAR = 0,             // a byte follows
+    IOLOG_DEC = 1,              // a zigzag varint follows
+    IOLOG_END = 2,              // input ended (the guest halted)
+    IOLOG_DIVERGED = 3          // replay only: the guest asked for something else
+} iolog_kind_t;
+
+#define IOLOG_KINDBITS 2
+
+/*
+   Log of guest input, for replaying a run exactly.
+
+   +--------------------------------------------------------+
+   | header (iolog_hdr_t) - 8 bytes                         |
+   +--------------------------------------------------------+
+   | records: varint tag, then the value its kind asks for  |
+   +--------------------------------------------------------+
+
+   A tag is (count << IOLOG_KINDBITS) | kind, where count is the number of
+   instructions between the last input and this one (or the start of the
+   run). Replay serves the values from memory with no system calls, and
+   checks that each is asked for at the same instruction count and by the
+   same trap, so a run that goes another way (a different program, or a
+   bug in an engine) stops rather than quietly reading the wrong input.
+*/
+typedef struct __attribute__((__packed__)) iolog_hdr {
+    uint32_t magic;             // IOLOG_MAGIC
+    uint16_t version;           // IOLOG_VERSION
+    uint16_t pad;
+} iolog_hdr_t;
+
+/* Recording or replay state */
+typedef struct iolog {
+
+    bool replaying;             // serving input rather than writing it down
+    FILE *out;                  // log file being written (recording)
+    byte_t *buf;                // the whole log (replay), or IOLOG_BUFSIZE
+                                // bytes waiting to be written (recording)
+    size_t used;                // bytes of buf in use (the log's length)
+    size_t pos;                 // next record to replay
+    int last;                   // instruction count at the last input
+    bool failed;                // a write failed
+    bool diverged;              // replay went off the log
+    int where;                  // and the instruction count where it did
+
+    uint64_t records;           // inputs logged or served
+    uint64_t bytes;             // bytes written (header included)
+
+} iolog_t;
+
+/**
+ * @brief Start recording input to a new log
+ *
+ * @param path Log file to create
+ * @returns Recording state, or NULL if the file could not be created
+ */
+iolog_t *iolog_record (const char *path);
+
+/**
+ * @brief Read a whole log into memory for replay
+ *
+ * @param path Log file to read
+ * @returns Replay state, or NULL if the file could not be read or is not a log
+ */
+iolog_t *iolog_replay (const char *path);
+
+/**
+ * @brief Write down one input (recording)
+ *
+ * @param lg Recording state
+ * @param count Instruction count when the guest asked for it
+ * @param kind IOLOG_CHAR, IOLOG_DEC or IOLOG_END
+ * @param value What the guest got (a byte for IOLOG_CHAR; ignored for IOLOG_END)
+ */
+void iolog_put (iolog_t *lg, int count, iolog_kind_t kind, int64_t value);
+
+/**
+ * @brief Serve the next input (replay)
+ *
+ * @param lg Replay state
+ * @param count Instruction count when the guest asks for it
+ * @param kind IOLOG_CHAR or IOLOG_DEC, whichever the guest asks for
+ * @param value Set to the input
+ * @returns kind if the log has that input at count, IOLOG_END if input
+ * ended there, or IOLOG_DIVERGED if the log has neither (or has run out)
+ */
+iolog_kind_t iolog_get (iolog_t *lg, int count, iolog_kind_t kind, int64_t *value);
+
+/**
+ * @brief Go back to the start of the run (replay only; a recording carries on)
+ *
+ * @param lg Log state (may be NULL)
+ */
+void iolog_rewind (iolog_t *lg);
+
+/**
+ * @brief Finish the log (flushing a recording) and release it
+ *
+ * @param lg Log state
+ * @returns True if a recording was written in full, or a replay used the
+ * whole log without diverging
+ */
+bool iolog_close (iolog_t *lg);
+
+/**
+ * @brief Print what was recorded or replayed
+ *
+ * @param out Stream to print to
+ * @param lg Log state
+ */
+void dump_iolog_stats (FILE *out, iolog_t *lg);
+
+#endif
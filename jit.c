@@ -0,0 +1,585 @@
+/*
+ * CS 261: x86-64 JIT for hot basic blocks
+ *
+ * Name: Ben Berry
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "jit.h"
+#include "icache.h"
+
+#if JIT_SUPPORTED
+#include <sys/mman.h>
+
+/* Host register numbers as used in x86-64 instruction encodings */
+enum {
+    H_RAX = 0, H_RCX, H_RDX, H_RBX, H_RSP, H_RBP, H_RSI, H_RDI,
+    H_R8, H_R9, H_R10, H_R11, H_R12, H_R13, H_R14, H_R15
+};
+
+/* x86 condition codes (the low nibble of jcc/setcc/cmovcc opcodes). Flipping
+   the lowest bit gives the opposite condition. */
+enum {
+    CC_O = 0x0, CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5,
+    CC_S = 0x8, CC_L = 0xc, CC_GE = 0xd, CC_LE = 0xe, CC_G = 0xf
+};
+
+/* Compiled code calling convention: %rdi holds the y86_t, %rsi the guest
+   memory, %rax/%rcx/%rdx are scratch and the rest can hold guest registers. */
+#define CPU_REG H_RDI
+#define MEM_REG H_RSI
+#define NUMHOSTREGS 10
+static const int hostregs[NUMHOSTREGS] = {
+    H_RBX, H_RBP, H_R12, H_R13, H_R14, H_R15, H_R8, H_R9, H_R10, H_R11
+};
+static const int savedregs[] = { H_RBX, H_RBP, H_R12, H_R13, H_R14, H_R15 };
+#define NUMSAVED ((int) (sizeof(savedregs) / sizeof(savedregs[0])))
+
+/* Worst-case bytes of native code for one block */
+#define JIT_MAXBLOCK (BLOCK_MAXLEN * 160 + 256)
+
+/* Operand of an instruction with a ModRM byte */
+typedef enum { LOC_REG, LOC_DISP, LOC_INDEX } jit_lockind_t;
+typedef struct jit_loc {
+    jit_lockind_t kind;
+    int reg;                    // LOC_REG: register; otherwise base register
+    int index;                  // LOC_INDEX: index register (scale 1)
+    int32_t disp;               // LOC_DISP: displacement from the base
+} jit_loc_t;
+
+/* Per-block code generation state */
+typedef struct jit_gen {
+    byte_t *p;                  // next byte to emit
+    byte_t *epilogue;           // shared exit path, emitted before the entry point
+    int host[NUMREGS];          // host register holding each guest register, or -1
+    bool written[NUMREGS];      // guest registers the block may write
+    int flags;                  // micro-op kind whose host flags are still live, or -1
+    byte_t *codemap;            // translated-code byte map for store checks
+} jit_gen_t;
+
+static byte_t *compile_block (jit_gen_t *g, block_t *b);
+
+/**********************************************************************
+ *                         JIT FUNCTIONS
+ *********************************************************************/
+
+jit_t *jit_create (void) {
+    jit_t *jit = (jit_t *) calloc(1, sizeof(jit_t));
+    if(jit == NULL)
+        return NULL;
+    //The buffer starts out writable but not executable
+    jit->size = JIT_BUFSIZE;
+    jit->buf = mmap(NULL, jit->size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(jit->buf == MAP_FAILED) {
+        free(jit);
+        return NULL;
+    }
+    return jit;
+}
+
+void jit_free (jit_t *jit) {
+    if(jit == NULL)
+        return;
+    munmap(jit->buf, jit->size);
+    free(jit);
+}
+
+void jit_reset (jit_t *jit) {
+    if(jit != NULL)
+        jit->used = 0;
+}
+
+block_native_t jit_compile (jit_t *jit, block_t *b, byte_t *codemap) {
+    if(jit == NULL || b == NULL || codemap == NULL)
+        return NULL;
+    if(jit->used + JIT_MAXBLOCK > jit->size)
+        return NULL;
+
+    //W^X: the buffer is writable only while this block is emitted
+    if(mprotect(jit->buf, jit->size, PROT_READ | PROT_WRITE) != 0)
+        return NULL;
+    jit_gen_t g;
+    memset(&g, 0x00, sizeof(g));
+    g.p = jit->buf + jit->used;
+    g.codemap = codemap;
+    byte_t *entry = compile_block(&g, b);
+    jit->used = g.p - jit->buf;
+    jit->compiled++;
+    if(mprotect(jit->buf, jit->size, PROT_READ | PROT_EXEC) != 0)
+        return NULL;
+
+    //Object and function pointers are the same size on every supported host
+    block_native_t fn;
+    memcpy(&fn, &entry, sizeof(fn));
+    return fn;
+}
+
+/**********************************************************************
+ *                         INSTRUCTION ENCODING
+ *********************************************************************/
+
+static void emit8 (jit_gen_t *g, uint8_t v) {
+    *g->p++ = v;
+}
+
+static void emit32 (jit_gen_t *g, uint32_t v) {
+    memcpy(g->p, &v, sizeof(v));
+    g->p += sizeof(v);
+}
+
+static void emit64 (jit_gen_t *g, uint64_t v) {
+    memcpy(g->p, &v, sizeof(v));
+    g->p += sizeof(v);
+}
+
+static jit_loc_t loc_reg (int reg) {
+    jit_loc_t loc = { LOC_REG, reg, 0, 0 };
+    return loc;
+}
+
+static jit_loc_t loc_disp (int base, int32_t disp) {
+    jit_loc_t loc = { LOC_DISP, base, 0, disp };
+    return loc;
+}
+
+static jit_loc_t loc_index (int base, int index) {
+    jit_loc_t loc = { LOC_INDEX, base, index, 0 };
+    return loc;
+}
+
+//Where a guest register lives while the block runs
+static jit_loc_t guest_loc (jit_gen_t *g, int r) {
+    if(r < NUMREGS && g->host[r] >= 0)
+        return loc_reg(g->host[r]);
+    return loc_disp(CPU_REG, r * sizeof(y86_reg_t));
+}
+
+//Emit [REX] opcode ModRM [SIB] [disp32]. The base of LOC_INDEX operands must
+//not be %rbp/%r13, which is fine for the registers this file uses.
+static void emit_op (jit_gen_t *g, bool wide, const uint8_t *opcode, int oplen,
+        int reg, jit_loc_t rm) {
+    int rmreg = rm.reg;
+    int index = (rm.kind == LOC_INDEX) ? rm.index : 0;
+    uint8_t rex = 0x40 | (wide << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1)
+            | (rmreg >> 3);
+    if(rex != 0x40)
+        emit8(g, rex);
+    for(int i = 0; i < oplen; i++)
+        emit8(g, opcode[i]);
+    switch(rm.kind) {
+        case(LOC_REG):
+            emit8(g, 0xc0 | ((reg & 7) << 3) | (rmreg & 7));
+            break;
+        case(LOC_DISP):
+            emit8(g, 0x80 | ((reg & 7) << 3) | (rmreg & 7));
+            emit32(g, (uint32_t) rm.disp);
+            break;
+        case(LOC_INDEX):
+            emit8(g, 0x04 | ((reg & 7) << 3));
+            emit8(g, ((index & 7) << 3) | (rmreg & 7));
+            break;
+    }
+}
+
+static void emit_op1 (jit_gen_t *g, bool wide, uint8_t op, int reg, jit_loc_t rm) {
+    emit_op(g, wide, &op, 1, reg, rm);
+}
+
+static void emit_op2 (jit_gen_t *g, bool wide, uint8_t op, int reg, jit_loc_t rm) {
+    uint8_t opcode[2] = { 0x0f, op };
+    emit_op(g, wide, opcode, 2, reg, rm);
+}
+
+//mov reg, imm64
+static void emit_movabs (jit_gen_t *g, int reg, uint64_t imm) {
+    emit8(g, 0x48 | (reg >> 3));
+    emit8(g, 0xb8 | (reg & 7));
+    emit64(g, imm);
+}
+
+//Copy between two operands, at most one of which is in memory
+static void emit_mov (jit_gen_t *g, jit_loc_t dst, jit_loc_t src) {
+    if(dst.kind == LOC_REG)
+        emit_op1(g, true, 0x8b, dst.reg, src);
+    else
+        emit_op1(g, true, 0x89, src.reg, dst);
+}
+
+//Jump forward by a distance that is filled in later by patch_here()
+static byte_t *emit_jcc_fwd (jit_gen_t *g, int cc) {
+    emit8(g, 0x0f);
+    emit8(g, 0x80 | cc);
+    emit32(g, 0);
+    return g->p;
+}
+
+static void patch_here (jit_gen_t *g, byte_t *after) {
+    uint32_t rel = (uint32_t) (g->p - after);
+    memcpy(after - 4, &rel, sizeof(rel));
+}
+
+//Leave the block with the PC in %rcx and the given return value
+static void emit_exit_rcx (jit_gen_t *g, int retired, jit_exit_t reason) {
+    emit_op1(g, true, 0x89, H_RCX, loc_disp(CPU_REG, offsetof(y86_t, pc)));
+    emit8(g, 0xb8);
+    emit32(g, ((uint32_t) reason << JIT_EXIT_SHIFT) | (uint32_t) retired);
+    emit8(g, 0xe9);
+    emit32(g, (uint32_t) (g->epilogue - (g->p + 4)));
+}
+
+static void emit_exit (jit_gen_t *g, address_t pc, int retired, jit_exit_t reason) {
+    emit_movabs(g, H_RCX, pc);
+    emit_exit_rcx(g, retired, reason);
+}
+
+//Bounds check on the guest address in %rax; out of range falls back to the
+//interpreter at this instruction so it can raise ADR exactly as -e does
+static void emit_addr_check (jit_gen_t *g, address_t pc, int done) {
+    emit8(g, 0x48);
+    emit8(g, 0x3d);
+    emit32(g, MEMSIZE);
+    byte_t *ok = emit_jcc_fwd(g, CC_B);
+    emit_exit(g, pc, done, JIT_EXIT_FALLBACK);
+    patch_here(g, ok);
+}
+
+//After a store to the guest address in %rax, leave the block if the bytes
+//written overlap translated code
+static void emit_code_check (jit_gen_t *g, address_t next, int retired) {
+    emit_movabs(g, H_RDX, (uint64_t) (uintptr_t) g->codemap);
+    emit_op1(g, true, 0x83, 7, loc_index(H_RDX, H_RAX));
+    emit8(g, 0);
+    byte_t *ok = emit_jcc_fwd(g, CC_E);
+    emit_exit(g, next, retired, JIT_EXIT_STALE);
+    patch_here(g, ok);
+}
+
+/**********************************************************************
+ *                         CODE GENERATION
+ *********************************************************************/
+
+//Pick the host condition that is true exactly when the guest condition is.
+//Flags left by a preceding addq/subq are used directly; otherwise the guest
+//flags are reloaded from the y86_t.
+static int emit_cond (jit_gen_t *g, int cond) {
+    static const int native[] = { 0, CC_LE, CC_L, CC_E, CC_NE, CC_GE, CC_G };
+    if(g->flags == U_ADDQ || g->flags == U_SUBQ)
+        return native[cond];
+    //andq/xorq clear the host overflow flag but leave the guest one alone
+    if((g->flags == U_ANDQ || g->flags == U_XORQ) && (cond == JE || cond == JNE))
+        return native[cond];
+
+    emit_op2(g, false, 0xb6, H_RAX, loc_disp(CPU_REG, offsetof(y86_t, zf)));
+    emit_op2(g, false, 0xb6, H_RCX, loc_disp(CPU_REG, offsetof(y86_t, sf)));
+    emit_op2(g, false, 0xb6, H_RDX, loc_disp(CPU_REG, offsetof(y86_t, of)));
+    g->flags = -1;
+    switch(cond) {
+        case(JLE):
+            emit_op1(g, false, 0x31, H_RDX, loc_reg(H_RCX));   //ecx = sf ^ of
+            emit_op1(g, false, 0x09, H_RCX, loc_reg(H_RAX));   //eax = zf | ecx
+            return CC_NE;
+        case(JL):
+            emit_op1(g, false, 0x31, H_RDX, loc_reg(H_RCX));
+            return CC_NE;
+        case(JE):
+            emit_op1(g, false, 0x85, H_RAX, loc_reg(H_RAX));
+            return CC_NE;
+        case(JNE):
+            emit_op1(g, false, 0x85, H_RAX, loc_reg(H_RAX));
+            return CC_E;
+        case(JGE):
+            emit_op1(g, false, 0x31, H_RDX, loc_reg(H_RCX));
+            return CC_E;
+        default:
+            emit_op1(g, false, 0x31, H_RDX, loc_reg(H_RCX));
+            emit_op1(g, false, 0x09, H_RCX, loc_reg(H_RAX));
+            return CC_E;
+    }
+}
+
+//Give the most-used guest registers of the block a host register each
+static void allocate_registers (jit_gen_t *g, block_t *b) {
+    int uses[NUMREGS];
+    memset(uses, 0x00, sizeof(uses));
+    for(int r = 0; r < NUMREGS; r++)
+        g->host[r] = -1;
+
+    for(int i = 0; i < b->len; i++) {
+        block_uop_t *u = &b->uops[i];
+        switch(u->kind) {
+            case(U_CMOV): case(U_ADDQ): case(U_SUBQ): case(U_ANDQ): case(U_XORQ):
+                uses[u->ra]++;
+                uses[u->rb]++;
+                g->written[u->rb] = true;
+                break;
+            case(U_IRMOVQ):
+                uses[u->rb]++;
+                g->written[u->rb] = true;
+                break;
+            case(U_RMMOVQ):
+                uses[u->ra]++;
+                uses[u->rb]++;
+                break;
+            case(U_MRMOVQ):
+                uses[u->rb]++;
+                uses[u->ra]++;
+                g->written[u->ra] = true;
+                break;
+            case(U_PUSHQ):
+                uses[u->ra]++;
+                uses[RSP] += 2;
+                g->written[RSP] = true;
+                break;
+            case(U_POPQ):
+                uses[u->ra]++;
+                uses[RSP] += 2;
+                g->written[RSP] = true;
+                g->written[u->ra] = true;
+                break;
+            case(U_CALL): case(U_RET):
+                uses[RSP] += 2;
+                g->written[RSP] = true;
+                break;
+            default:
+                break;
+        }
+    }
+
+    for(int h = 0; h < NUMHOSTREGS; h++) {
+        int best = -1;
+        for(int r = 0; r < NUMREGS; r++) {
+            if(g->host[r] < 0 && uses[r] > 0 && (best < 0 || uses[r] > uses[best]))
+                best = r;
+        }
+        if(best < 0)
+            break;
+        g->host[best] = hostregs[h];
+    }
+}
+
+//Emit one micro-op. Returns false once the block has been left for good.
+static bool compile_uop (jit_gen_t *g, block_uop_t *u, address_t pc, int done) {
+    jit_loc_t ra = guest_loc(g, u->ra);
+    jit_loc_t rb = guest_loc(g, u->rb);
+    jit_loc_t rsp = guest_loc(g, RSP);
+    jit_loc_t addr = loc_index(MEM_REG, H_RAX);
+    int cc;
+
+    switch(u->kind) {
+        case(U_HALT):
+            emit_op1(g, false, 0xc7, 0, loc_disp(CPU_REG, offsetof(y86_t, stat)));
+            emit32(g, HLT);
+            emit_exit(g, u->valP, done + 1, JIT_EXIT_NORMAL);
+            return false;
+
+        case(U_NOP):
+            return true;
+
+        case(U_CMOV):
+            if(u->cond == RRMOVQ) {
+                if(rb.kind == LOC_REG)
+                    emit_mov(g, rb, ra);
+                else {
+                    emit_mov(g, loc_reg(H_RAX), ra);
+                    emit_mov(g, rb, loc_reg(H_RAX));
+                }
+                return true;
+            }
+            cc = emit_cond(g, u->cond);
+            if(rb.kind == LOC_REG)
+                emit_op2(g, true, 0x40 | cc, rb.reg, ra);
+            else {
+                //mov leaves the host flags alone, so cmov can still use them
+                emit_mov(g, loc_reg(H_RAX), rb);
+                emit_op2(g, true, 0x40 | cc, H_RAX, ra);
+                emit_mov(g, rb, loc_reg(H_RAX));
+            }
+            return true;
+
+        case(U_IRMOVQ):
+            if(rb.kind == LOC_REG)
+                emit_movabs(g, rb.reg, u->imm);
+            else {
+                emit_movabs(g, H_RAX, u->imm);
+                emit_mov(g, rb, loc_reg(H_RAX));
+            }
+            return true;
+
+        case(U_RMMOVQ):
+            g->flags = -1;
+            emit_movabs(g, H_RAX, u->imm);
+            emit_op1(g, true, 0x03, H_RAX, rb);
+            emit_addr_check(g, pc, done);
+            if(ra.kind == LOC_REG)
+                emit_mov(g, addr, ra);
+            else {
+                emit_mov(g, loc_reg(H_RCX), ra);
+                emit_mov(g, addr, loc_reg(H_RCX));
+            }
+            emit_code_check(g, u->valP, done + 1);
+            return true;
+
+        case(U_MRMOVQ):
+            g->flags = -1;
+            emit_movabs(g, H_RAX, u->imm);
+            emit_op1(g, true, 0x03, H_RAX, rb);
+            emit_addr_check(g, pc, done);
+            if(ra.kind == LOC_REG)
+                emit_mov(g, ra, addr);
+            else {
+                emit_mov(g, loc_reg(H_RCX), addr);
+                emit_mov(g, ra, loc_reg(H_RCX));
+            }
+            return true;
+
+        //OPq runs natively on rB; the guest flags are copied from the host ones
+        case(U_ADDQ): case(U_SUBQ): case(U_ANDQ): case(U_XORQ): {
+            static const uint8_t ops[] = { 0x01, 0x29, 0x21, 0x31 };
+            int src = H_RAX;
+            if(ra.kind == LOC_REG)
+                src = ra.reg;
+            else
+                emit_mov(g, loc_reg(H_RAX), ra);
+            emit_op1(g, true, ops[u->kind - U_ADDQ], src, rb);
+            emit_op2(g, false, 0x90 | CC_E, 0, loc_disp(CPU_REG, offsetof(y86_t, zf)));
+            emit_op2(g, false, 0x90 | CC_S, 0, loc_disp(CPU_REG, offsetof(y86_t, sf)));
+            if(u->kind == U_ADDQ || u->kind == U_SUBQ)
+                emit_op2(g, false, 0x90 | CC_O, 0, loc_disp(CPU_REG, offsetof(y86_t, of)));
+            g->flags = u->kind;
+            return true;
+        }
+
+        case(U_JUMP): {
+            if(u->cond == JMP) {
+                emit_exit(g, u->imm, done + 1, JIT_EXIT_NORMAL);
+                return false;
+            }
+            cc = emit_cond(g, u->cond);
+            byte_t *skip = emit_jcc_fwd(g, cc ^ 1);
+            emit_exit(g, u->imm, done + 1, JIT_EXIT_NORMAL);
+            patch_here(g, skip);
+            emit_exit(g, u->valP, done + 1, JIT_EXIT_NORMAL);
+            return false;
+        }
+
+        case(U_CALL):
+            g->flags = -1;
+            emit_mov(g, loc_reg(H_RAX), rsp);
+            emit8(g, 0x48); emit8(g, 0x83); emit8(g, 0xe8); emit8(g, 8);
+            emit_addr_check(g, pc, done);
+            emit_movabs(g, H_RCX, u->valP);
+            emit_mov(g, addr, loc_reg(H_RCX));
+            emit_mov(g, rsp, loc_reg(H_RAX));
+            emit_code_check(g, u->imm, done + 1);
+            emit_exit(g, u->imm, done + 1, JIT_EXIT_NORMAL);
+            return false;
+
+        case(U_RET):
+            g->flags = -1;
+            emit_mov(g, loc_reg(H_RAX), rsp);
+            emit_addr_check(g, pc, done);
+            emit_mov(g, loc_reg(H_RCX), addr);
+            emit8(g, 0x48); emit8(g, 0x83); emit8(g, 0xc0); emit8(g, 8);
+            emit_mov(g, rsp, loc_reg(H_RAX));
+            emit_exit_rcx(g, done + 1, JIT_EXIT_NORMAL);
+            return false;
+
+        case(U_PUSHQ):
+            g->flags = -1;
+            emit_mov(g, loc_reg(H_RAX), rsp);
+            emit8(g, 0x48); emit8(g, 0x83); emit8(g, 0xe8); emit8(g, 8);
+            emit_addr_check(g, pc, done);
+            if(ra.kind == LOC_REG)
+                emit_mov(g, addr, ra);
+            else {
+                emit_mov(g, loc_reg(H_RCX), ra);
+                emit_mov(g, addr, loc_reg(H_RCX));
+            }
+            emit_mov(g, rsp, loc_reg(H_RAX));
+            emit_code_check(g, u->valP, done + 1);
+            return true;
+
+        //Popping into %rsp keeps the loaded value, as in memory_wb_pc()
+        case(U_POPQ):
+            g->flags = -1;
+            emit_mov(g, loc_reg(H_RAX), rsp);
+            emit_addr_check(g, pc, done);
+            emit_mov(g, loc_reg(H_RCX), addr);
+            emit8(g, 0x48); emit8(g, 0x83); emit8(g, 0xc0); emit8(g, 8);
+            emit_mov(g, rsp, loc_reg(H_RAX));
+            emit_mov(g, ra, loc_reg(H_RCX));
+            return true;
+
+        //Anything unusual is left to the interpreter
+        default:
+            emit_exit(g, pc, done, JIT_EXIT_FALLBACK);
+            return false;
+    }
+}
+
+//Lay out [epilogue][entry: prologue, body]; exits jump back to the epilogue
+static byte_t *compile_block (jit_gen_t *g, block_t *b) {
+    allocate_registers(g, b);
+    g->flags = -1;
+
+    //Epilogue: write back guest registers, restore host ones, return
+    g->epilogue = g->p;
+    for(int r = 0; r < NUMREGS; r++) {
+        if(g->host[r] >= 0 && g->written[r])
+            emit_mov(g, loc_disp(CPU_REG, r * sizeof(y86_reg_t)), loc_reg(g->host[r]));
+    }
+    for(int i = NUMSAVED - 1; i >= 0; i--) {
+        if(savedregs[i] >= 8)
+            emit8(g, 0x41);
+        emit8(g, 0x58 | (savedregs[i] & 7));
+    }
+    emit8(g, 0xc3);
+
+    //Prologue: save host registers and load the guest ones the block uses
+    byte_t *entry = g->p;
+    for(int i = 0; i < NUMSAVED; i++) {
+        if(savedregs[i] >= 8)
+            emit8(g, 0x41);
+        emit8(g, 0x50 | (savedregs[i] & 7));
+    }
+    for(int r = 0; r < NUMREGS; r++) {
+        if(g->host[r] >= 0)
+            emit_mov(g, loc_reg(g->host[r]), loc_disp(CPU_REG, r * sizeof(y86_reg_t)));
+    }
+
+    //Body
+    address_t pc = b->start;
+    int i;
+    for(i = 0; i < b->len; i++) {
+        if(!compile_uop(g, &b->uops[i], pc, i))
+            return entry;
+        pc = b->uops[i].valP;
+    }
+
+    //Block was cut off at BLOCK_MAXLEN; carry on at the next instruction
+    emit_exit(g, pc, i, JIT_EXIT_NORMAL);
+    return entry;
+}
+
+#else
+
+jit_t *jit_create (void) {
+    return NULL;
+}
+
+void jit_free (jit_t *jit) {
+    free(jit);
+}
+
+void jit_reset (jit_t *jit) {
+    if(jit != NULL)
+        jit->used = 0;
+}
+
+block_native_t jit_compile (jit_t *jit, block_t *b, byte_t *codemap) {
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef __CS261_JIT__
+#define __CS261_JIT__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "y86.h"
+#include "block.h"
+
+/* Native code is only generated on x86-64 Linux; elsewhere the JIT reports
+   itself unavailable and blocks stay in the interpreter. */
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+/* Number of interpreted executions before a block is compiled */
+#define JIT_THRESHOLD 16
+
+/* Size of the executable code buffer */
+#define JIT_BUFSIZE (1 << 20)
+
+/* Compiled blocks return the number of instructions they retired in the low
+   bits and one of these exit reasons above JIT_EXIT_SHIFT. */
+#define JIT_EXIT_SHIFT 24
+#define JIT_RETIRED_MASK ((1u << JIT_EXIT_SHIFT) - 1)
+typedef enum {
+    JIT_EXIT_NORMAL = 0,        // block finished; cpu->pc is the successor
+    JIT_EXIT_FALLBACK,          // interpret the instruction at cpu->pc next
+    JIT_EXIT_STALE              // a store hit translated code; flush caches
+} jit_exit_t;
+
+/* JIT code buffer storage structure */
+typedef struct jit {
+
+    byte_t *buf;                // mmap'd code buffer (never writable and executable at once)
+    size_t size;                // bytes in buf
+    size_t used;                // bytes of buf holding compiled blocks
+    uint64_t compiled;          // number of blocks compiled
+
+} jit_t;
+
+/**
+ * @brief Map an empty code buffer
+ *
+ * @returns Pointer to the new JIT, or NULL if native code is not supported
+ * on this host or the buffer could not be mapped
+ */
+jit_t *jit_create (void);
+
+/**
+ * @brief Unmap the code buffer and release the JIT
+ *
+ * @param jit JIT to be freed (may be NULL)
+ */
+void jit_free (jit_t *jit);
+
+/**
+ * @brief Forget every compiled block (used when the block cache is flushed)
+ *
+ * @param jit JIT to be reset
+ */
+void jit_reset (jit_t *jit);
+
+/**
+ * @brief Compile a translated block into native x86-64 code
+ *
+ * Guest registers used by the block are held in host registers while it
+ * runs and the guest flags are set from the host flags. Memory accesses keep
+ * the ADR checks of memory_wb_pc(): a faulting instruction exits with
+ * JIT_EXIT_FALLBACK so the interpreter can run it, and a store that lands on
+ * translated code exits with JIT_EXIT_STALE.
+ *
+ * @param jit JIT with room in its code buffer
+ * @param b Block to be compiled
+ * @param codemap Byte map of translated code (nonzero where code lives)
+ * @returns Entry point of the compiled block, or NULL if it could not be compiled
+ */
+block_native_t jit_compile (jit_t *jit, block_t *b, byte_t *codemap);
+
+#endif
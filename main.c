@@ -8,6 +8,27 @@
 #include "p2-load.h"
 #include "p3-disas.h"
 #include "p4-interp.h"
+#include "threaded.h"
+#include "block.h"
+#include "aot.h"
+#include "batch.h"
+#include "server.h"
+#include "y86vm.h"
+#include "ckpt.h"
+#include "trace.h"
+#include "pipeline.h"
+#include "profile.h"
+#include "cachesim.h"
+#include "plugin.h"
+#include "flatprof.h"
+#include "symtab.h"
+#include "callgraph.h"
+#include "hostcost.h"
+#include "sampler.h"
+#include "fuzz.h"
+#include "iolog.h"
+#include "device.h"
+#include "bus.h"
 
 int main (int argc, char **argv)
 {
@@ -21,46 +42,110 @@ int main (int argc, char **argv)
     bool disas_data = false;
     bool exec_normal = false;
     bool exec_debug = false;
+    bool exec_threaded = false;
+    bool exec_blocks = false;
+    bool exec_jit = false;
+    bool exec_profile = false;
+    bool exec_callgraph = false;
+    bool exec_cost = false;
+    bool translate_c = false;
+    bool run_batch = false;
+    bool run_server = false;
+    bool run_fuzz = false;
+    bool large_memory = false;
+    char *checkpoint = NULL;
+    long checkpoint_every = CKPT_EVERY;
+    bool resume = false;
+    char *trace_file = NULL;
+    bool profile = false;
+    bool cache_sim = false;
+    bool drop_events = false;
+    char *plugins[PLUGIN_MAX];
+    int nplugins = 0;
+    char *stacks_file = NULL;
+    long sample_hz = 0;
+    bool sample_stacks = false;
+    char *input_file = NULL;
+    char *record_file = NULL;
+    char *replay_file = NULL;
+    char *devices[DEVICE_MAX];
+    int ndevices = 0;
+    device_t *devs[DEVICE_MAX] = { NULL };
+    address_t mmio_base = 0;
+    bus_t *bus = NULL;
+    sampler_t *sp = NULL;
+    symtab_t *st = NULL;
+    ckpt_t *ck = NULL;
+    trace_t *tr = NULL;
+    profile_t *pr = NULL;
+    cachesim_t *cs = NULL;
+    pipeline_t *pl = NULL;
+    flatprof_t *fp = NULL;
+    callgraph_t *cg = NULL;
+    hostcost_t *hc = NULL;
+    iolog_t *lg = NULL;
+    int status = EXIT_SUCCESS;
 
     //Parse command line arguments
      if(!parse_command_line_p4 ( argc,  argv, &print_header,  &print_phdrs, &print_membrief,  
-     &print_memfull, &disas_code,  &disas_data, &exec_normal,  &exec_debug,  &filename))
+     &print_memfull, &disas_code,  &disas_data, &exec_normal,  &exec_debug,  &exec_threaded,
+     &exec_blocks, &exec_jit, &exec_profile, &exec_callgraph, &exec_cost, &translate_c, &run_batch,
+     &run_server, &run_fuzz, &large_memory, &checkpoint, &checkpoint_every, &resume,
+     &trace_file, &profile, &cache_sim, &drop_events, plugins, &nplugins, &stacks_file,
+     &sample_hz, &sample_stacks, &input_file, &record_file,
+     &replay_file, devices, &ndevices, &mmio_base, &filename))
         return EXIT_FAILURE;
 
-    //Open file
-    FILE *input = fopen(filename, "r");
-
-    //Initialize an elf struct to store the header.
-    struct elf hdr;
-
-    bool headerRead = read_header(input, &hdr);
-    if(!headerRead){
-        printf("Failed to read file\n");
-        return EXIT_FAILURE;
+    //Batch mode: the "file" names a directory or list of images
+    if(run_batch) {
+        batch_stats_t batchStats;
+        if(!batch_run(filename, stdout, &batchStats)) {
+            printf("Failed to read batch\n");
+            return EXIT_FAILURE;
+        }
+        dump_batch_stats(stdout, &batchStats);
+        return EXIT_SUCCESS;
     }
 
-    //Initialize an array with size equal to the number of program headers for program headers.
-    struct elf_phdr phdrs[hdr.e_num_phdr]; 
-
-    //Read each program header into the struct.
-    for(int i = 0; i < hdr.e_num_phdr; i++)  {
-        int offset = hdr.e_phdr_start + (i * sizeof(elf_phdr_t));   
-        if(!(read_phdr(input, offset, &phdrs[i]))){
-	        printf("Failed to read file\n");
+    //Server mode: the "file" names the socket to listen on
+    if(run_server) {
+        if(!serve(filename)) {
+            printf("Failed to start server\n");
             return EXIT_FAILURE;
         }
+        return EXIT_SUCCESS;
     }
 
-    //Create "virtual memory" in the heap.
-    byte_t* memory = (byte_t*) calloc(MEMSIZE, sizeof(byte_t));  
-    //Load each segment into the allocated memory.
-    for(int i = 0; i < hdr.e_num_phdr; i++) {
-        if(!(load_segment(input, memory, &phdrs[i]))) {
-	        printf("Failed to read file\n");
-            free(memory);
-            return EXIT_FAILURE;
+    //Load the program into a fresh VM (the whole file is read at once)
+    y86_vm_t *vm = large_memory ? y86_vm_create_paged() : y86_vm_create();
+    if(vm == NULL || !y86_vm_load_file(vm, filename)) {
+        printf("Failed to read file\n");
+        goto fail;
+    }
+    struct elf hdr = vm->hdr;
+    elf_phdr_t *phdrs = vm->phdrs;
+    byte_t *memory = vm->memory;
+
+    //Fuzzing mode: stdin and stdout belong to the driver, so nothing else
+    //is printed there
+    if(run_fuzz) {
+        st = symtab_load(filename, &hdr);
+        fuzz_t *fz = fuzz_create(vm, st);
+        if(fz == NULL) {
+            printf("Failed to start fuzzing\n");
+            goto fail;
+        }
+        if(!fuzz_serve(fz, vm, stdin, stdout)) {
+            fprintf(stderr, "Bad input record\n");
+            status = EXIT_FAILURE;
         }
+        dump_fuzz_stats(stderr, fz);
+        fuzz_free(fz);
+        symtab_free(st);
+        y86_vm_free(vm);
+        return status;
     }
+
     //Print output based on what flags are set.
     //Note that print_memfull and print_membrief cannot be active at the same time.
     if(print_header)
@@ -70,112 +155,272 @@ int main (int argc, char **argv)
     if(print_memfull)
         dump_memory(memory, 0, MEMSIZE); 
     else if(print_membrief) {
-        for(int i = 0; i < hdr.e_num_phdr; i++)
+        for(int i = 0; i < hdr.e_num_phdr; i++) {
+            //With paged memory only the first MEMSIZE bytes can be shown (and
+            //devices are never in them)
+            if(phdrs[i].p_type == DEVICE || (large_memory
+                        && phdrs[i].p_vaddr + (uint64_t) phdrs[i].p_size > MEMSIZE))
+                continue;
             dump_memory(memory, phdrs[i].p_vaddr, phdrs[i].p_vaddr + phdrs[i].p_size); 
+        }
+    }
+    //Disassemble code and/or data
+    y86_vm_disassemble(vm, stdout, disas_code, disas_data);
+    //Translate to C source for the AOT runtime instead of executing
+    if(translate_c && !aot_translate(stdout, filename, memory, &hdr, phdrs)) {
+        printf("Failed to translate file\n");
+        goto fail;
+    }
+    //Guest input (iotrap) comes from stdin unless a file was named (or it
+    //is replayed); its output goes to stdout with ours
+    if(replay_file != NULL)
+        io_set_input_fd(vm->io, -1);
+    else if(input_file == NULL)
+        io_set_input_fd(vm->io, 0);
+    else if(!io_set_input_file(vm->io, input_file)) {
+        printf("Failed to open input\n");
+        goto fail;
+    }
+    //Host files go into the address space before anything runs
+    int segment = 0;
+    for(int i = 0; i < ndevices; i++) {
+        devs[i] = device_open(devices[i], vm, &segment);
+        if(devs[i] == NULL) {
+            printf("Failed to open device\n");
+            goto fail;
+        }
+    }
+    //And so does the device bus
+    if(mmio_base != 0 && (bus = bus_create(vm, mmio_base)) == NULL) {
+        printf("Failed to attach devices\n");
+        goto fail;
     }
-    //Disassemble code
-    int header;
-    if(disas_code) {
-        printf("Disassembly of executable contents:\n");
-        for(header = 0; header < hdr.e_num_phdr; header++) {
-            //Print each code header
-            if(phdrs[header].p_type == CODE)
-                disassemble_code(memory, &phdrs[header], &hdr);
-        }  
-    }
-    //Disassemble data or rodata if applicable
-    if(disas_data) {
-        printf("Disassembly of data contents:\n");
-      for(header = 0; header < hdr.e_num_phdr; header++) {
-            //Disassemble data
-            if(phdrs[header].p_type == DATA && phdrs[header].p_flags == 6)
-                 disassemble_data(memory, &phdrs[header]);  
-            //Disassemble rodata
-            else if(phdrs[header].p_type == DATA && phdrs[header].p_flags == 4)
-                disassemble_rodata(memory, &phdrs[header]);
-      }  
-    }
-    //Initialize some variables needed for p4
-    y86_t cpu;
-    memset(&cpu, 0x00, sizeof(cpu));
-    cpu.pc = hdr.e_entry;
-    cpu.stat = AOK;
-    int numInstructions = 0;
-    bool cnd = false; 
-    y86_reg_t valA = 0;
-    y86_reg_t valE = 0;
-    y86_inst_t ins;
-    
     //Normal execution, cpu state printed only after cpu status changes from AOK
-    if(exec_normal) {
+    //Threaded, block and JIT execution produce the same output through faster engines
+    //Checkpointed runs (and resumed ones) start from the checkpoint file
+    //Sampled runs are interrupted by a timer rather than instrumented; the
+    //samples are only symbolized once the run is over
+    if(sample_hz != 0) {
+        sp = sampler_create(sample_hz, sample_stacks);
+        if(sp == NULL) {
+            printf("Failed to start sampling\n");
+            goto fail;
+        }
+        st = symtab_load(filename, &hdr);
+    }
+    if(checkpoint != NULL) {
+        ck = ckpt_open(checkpoint, vm, resume);
+        if(ck == NULL) {
+            printf(resume ? "Failed to resume from checkpoint\n" : "Failed to start checkpointing\n");
+            goto fail;
+        }
+    }
+    //Events carry one store each, so what a hypercall writes in bulk would
+    //be missing from traces and plugins; they run with every slot empty
+    //(hypercalls are then INS) rather than see memory go wrong
+    if(trace_file != NULL || nplugins > 0) {
+        for(int i = HCALL_BASE; i < HCALL_BASE + HCALL_SLOTS; i++)
+            io_register_hcall(vm->io, (y86_iotrap_t) i, NULL);
+    }
+    //Plugins hook into the run loop itself
+    for(int i = 0; i < nplugins; i++) {
+        if(!plugin_load(vm, plugins[i])) {
+            printf("Failed to load plugin\n");
+            goto fail;
+        }
+    }
+    //Analyses (the trace among them) are fed from the run by a pipeline
+    //and do their work on its thread
+    if(trace_file != NULL || profile || cache_sim) {
+        bool ok = true;
+        pl = pipeline_create(drop_events ? PIPE_DROP : PIPE_BLOCK);
+        if(trace_file != NULL) {
+            tr = trace_open(trace_file, vm);
+            ok = tr != NULL && pipeline_add(pl, trace_consumer(tr));
+        }
+        if(ok && profile) {
+            pr = profile_create();
+            ok = pr != NULL && pipeline_add(pl, profile_consumer(pr));
+        }
+        if(ok && cache_sim) {
+            cs = cachesim_create(CACHE_SETS, CACHE_WAYS, CACHE_LINE);
+            ok = cs != NULL && pipeline_add(pl, cachesim_consumer(cs));
+        }
+        if(!ok || !pipeline_start(pl)) {
+            printf(trace_file != NULL && tr == NULL ? "Failed to create trace\n"
+                    : "Failed to start analysis\n");
+            goto fail;
+        }
+    }
+    //Profiled runs count every instruction by address and opcode; symbols
+    //only label the report, so a file without them still profiles
+    //(-G follows calls and returns the same way, and -c times each one)
+    if(exec_profile || exec_callgraph || exec_cost) {
+        fp = exec_profile ? flatprof_create() : NULL;
+        cg = exec_callgraph ? callgraph_create(vm) : NULL;
+        hc = exec_cost ? hostcost_create() : NULL;
+        if((exec_profile && fp == NULL) || (exec_callgraph && cg == NULL)
+                || (exec_cost && hc == NULL)) {
+            printf("Failed to start profiling\n");
+            goto fail;
+        }
+        //Sampling may have loaded them already
+        if(st == NULL)
+            st = symtab_load(filename, &hdr);
+    }
+    //Input is logged as the guest reads it, or served from a log instead
+    if(record_file != NULL || replay_file != NULL) {
+        lg = (replay_file != NULL) ? iolog_replay(replay_file) : iolog_record(record_file);
+        if(lg == NULL) {
+            printf(replay_file != NULL ? "Failed to read input log\n"
+                    : "Failed to create input log\n");
+            goto fail;
+        }
+        io_set_log(vm->io, lg);
+    }
+    block_stats_t blockStats;
+    if(exec_normal || exec_threaded || exec_blocks || exec_jit || exec_profile || exec_callgraph
+            || exec_cost) {
         printf("Beginning execution at 0x%04x\n", hdr.e_entry);
-        while(cpu.stat == AOK) {
-            //Fetch
-            ins = fetch(&cpu, memory);
-            //Disinclude invalid instructions in total count
-            if(cpu.stat == INS)
-                numInstructions --;
-            cnd = false;
-            //Decode and execute
-            valE = decode_execute(&cpu, ins, &cnd, &valA);
-            //Memory, writeback, program counter increment
-            memory_wb_pc(&cpu, ins, memory, cnd, valA, valE);
-            numInstructions++;
-            //Change cpu status to ADR if program counter leaves allocated memory
-            if(cpu.pc >= MEMSIZE)
-                cpu.stat = ADR;
-        }
-        //Update program counter if bad address was given
-        if(cpu.stat == ADR){
-            cpu.pc = ins.valP;
-            //Increment by 1 extra for failed call intructions
-            if(ins.icode == CALL)
-                cpu.pc ++;
-        }
-        //Print final state of cpu
-        dump_cpu_state(&cpu);
-        printf("Total execution count: %d\n", numInstructions);
+        if(sp != NULL && !sampler_start(sp, vm)) {
+            fprintf(stderr, "Failed to start sampling\n");
+            status = EXIT_FAILURE;
+        }
+        if(exec_threaded)
+            vm->last = threaded_run(&vm->cpu, memory, &vm->count);
+        if(exec_blocks || exec_jit)
+            vm->last = block_run(&vm->cpu, memory, &vm->count, exec_jit, &blockStats);
+        //Run (or finish) with the reference pipeline and fix up the PC after ADR
+        if(ck != NULL)
+            ckpt_run(ck, vm, checkpoint_every);
+        else if(pl != NULL)
+            pipeline_run(pl, vm, -1);
+        else if(fp != NULL)
+            flatprof_run(fp, vm, -1);
+        else if(cg != NULL)
+            callgraph_run(cg, vm, -1);
+        else if(hc != NULL)
+            hostcost_run(hc, vm, -1);
+        else
+            y86_vm_run(vm, -1);
+        sampler_stop(sp);
+        if(vm->cpu.stat == AOK) {
+            //Stopped by a signal after its last checkpoint
+            fprintf(stderr, "Stopped after %d instructions; continue with --resume\n", vm->count);
+            status = EXIT_FAILURE;
+        } else {
+            //Print final state of cpu
+            dump_cpu_state(&vm->cpu);
+            printf("Total execution count: %d\n", vm->count);
+        }
+        //Block statistics go to stderr so stdout still matches -e
+        if(exec_blocks || exec_jit)
+            dump_block_stats(stderr, &blockStats);
+        //The profile is what -P, -G and -c are for, so it follows on stdout
+        if(fp != NULL)
+            dump_flatprof(stdout, fp, st);
+        if(cg != NULL)
+            dump_callgraph(stdout, cg, st);
+        if(hc != NULL)
+            dump_hostcost(stdout, hc);
+        //Samples are an analysis of the -e run, so they go to stderr
+        if(sp != NULL)
+            dump_sampler(stderr, sp, st);
+        if(stacks_file != NULL) {
+            FILE *stacks = fopen(stacks_file, "w");
+            bool written = stacks != NULL && (cg != NULL ? write_stacks(stacks, cg, st)
+                    : write_sampled_stacks(stacks, sp, st));
+            if(stacks != NULL && fclose(stacks) != 0)
+                written = false;
+            if(!written) {
+                fprintf(stderr, "Failed to write stacks\n");
+                status = EXIT_FAILURE;
+            }
+        }
+        flatprof_free(fp);
+        callgraph_free(cg);
+        hostcost_free(hc);
+        sampler_free(sp);
+        symtab_free(st);
     }
 
     //Debug execution, print cpu state after each intruction
     //and print full memory dump after execution
-    if(exec_debug) {
-        printf("Beginning execution at 0x%04x\n", hdr.e_entry);
-        while(cpu.stat == AOK) {
-            //Print current cpu state
-            dump_cpu_state(&cpu);
-            //fetch
-            ins = fetch(&cpu, memory);
-            //Handle invalid instructions
-            if(cpu.stat == INS){
-                printf("\nInvalid instruction at 0x%04lx\n", cpu.pc);
-                numInstructions --;
-            //Otherwise, continue with diassembly
-            } else {
-                printf("\nExecuting: ");  
-                disassemble(&ins); 
-                printf("\n");
-            }
-            cnd = false;
-            //Decode and execute
-            valE = decode_execute(&cpu, ins, &cnd, &valA);
-            //memory, writeback, program counter increment
-            memory_wb_pc(&cpu, ins, memory, cnd, valA, valE);
-            numInstructions++;
-            //Change cpu status to ADR if program counter leaves allocated memory
-            if(cpu.pc >= MEMSIZE)
-                cpu.stat = ADR;
-        }
-        if(cpu.stat == ADR)
-            cpu.pc = ins.valP;
-        //Dump final cpu state
-        dump_cpu_state(&cpu);
-        printf("Total execution count: %d\n\n", numInstructions);
-        //Dump full memory
-        dump_memory(memory, 0, MEMSIZE); 
+    if(exec_debug)
+        y86_vm_trace(vm, stdout, -1);
+    //Paging statistics also go to stderr
+    if(large_memory && (exec_normal || exec_debug || exec_profile || exec_callgraph
+            || exec_cost))
+        dump_pmem_stats(stderr, vm->pmem);
+    for(int i = 0; i < ndevices; i++)
+        dump_device_stats(stderr, devs[i]);
+    if(bus != NULL)
+        dump_bus_stats(stderr, bus);
+    //Checkpoint statistics too (after the last record is on disk)
+    if(ck != NULL) {
+        if(!ckpt_close(ck)) {
+            fprintf(stderr, "Failed to write checkpoint\n");
+            status = EXIT_FAILURE;
+        }
+        dump_ckpt_stats(stderr, ck);
+        ckpt_free(ck);
     }
-    //Free allocated memory to prevent memory leaks.
-    free(memory);
-    return EXIT_SUCCESS;
-}
+    //So does what happened to the input log
+    if(lg != NULL) {
+        bool replaying = lg->replaying;
+        dump_iolog_stats(stderr, lg);
+        io_set_log(vm->io, NULL);
+        if(!iolog_close(lg)) {
+            fprintf(stderr, replaying ? "Replay diverged from the input log\n"
+                    : "Failed to write input log\n");
+            status = EXIT_FAILURE;
+        }
+    }
+    //Plugin reports go there as well
+    plugin_finish(vm, stderr);
+    //And the analyses' reports, once they have seen every event (the trace
+    //is flushed on close)
+    if(pl != NULL) {
+        pipeline_finish(pl, stderr);
+        dump_pipeline_stats(stderr, pl);
+        pipeline_free(pl);
+        profile_free(pr);
+        cachesim_free(cs);
+    }
+    if(tr != NULL) {
+        dump_trace_stats(stderr, tr);
+        if(!trace_close(tr)) {
+            fprintf(stderr, "Failed to write trace\n");
+            status = EXIT_FAILURE;
+        }
+    }
+    if(!io_flush(vm->io)) {
+        fprintf(stderr, "Failed to write output\n");
+        status = EXIT_FAILURE;
+    }
+    //Free allocated memory to prevent memory leaks (devices once nothing
+    //maps them).
+    y86_vm_free(vm);
+    for(int i = 0; i < ndevices; i++)
+        device_close(devs[i]);
+    bus_free(bus);
+    return status;
 
+    //Anything that fails before the run releases whatever was set up so far
+fail:
+    flatprof_free(fp);
+    callgraph_free(cg);
+    hostcost_free(hc);
+    ckpt_free(ck);
+    pipeline_free(pl);
+    trace_close(tr);
+    profile_free(pr);
+    cachesim_free(cs);
+    sampler_free(sp);
+    symtab_free(st);
+    y86_vm_free(vm);
+    for(int i = 0; i < ndevices; i++)
+        device_close(devs[i]);
+    bus_free(bus);
+    return EXIT_FAILURE;
+}
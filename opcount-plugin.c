@@ -0,0 +1,94 @@
+/*
+ * CS 261: Example instrumentation plugin
+ *
+ * Name: Ben Berry
+ */
+
+/* Build with "make opcount-plugin.so" and load it with
+   "./y86 -e --plugin ./opcount-plugin.so prog.o" */
+
+#include "plugin.h"
+
+/* Instruction names by icode */
+static const char *names[] = Y86_ICODE_NAMES;
+
+/* What the plugin counts */
+typedef struct opcount {
+    uint64_t byicode[INVALID + 1];      // instructions retired
+    uint64_t taken;                     // jumps taken
+    uint64_t untaken;                   // jumps not taken
+    uint64_t calls;                     // calls that pushed
+    uint64_t rets;                      // rets that popped
+    int depth;                          // deepest call nesting seen
+    int nesting;                        // current call nesting
+} opcount_t;
+
+static void retire (void *state, const y86_event_t *ev);
+static void branch (void *state, address_t pc, address_t target, bool taken);
+static void call (void *state, address_t pc, address_t target, address_t ret);
+static void ret (void *state, address_t pc, address_t target);
+static void finish (void *state, FILE *out);
+
+bool y86_plugin_init (y86_plugin_t *plugin, const char *args) {
+    (void) args;
+    opcount_t *oc = (opcount_t *) calloc(1, sizeof(opcount_t));
+    if(oc == NULL)
+        return false;
+    plugin->name = "opcount";
+    plugin->state = oc;
+    plugin->retire = retire;
+    plugin->branch = branch;
+    plugin->call = call;
+    plugin->ret = ret;
+    plugin->finish = finish;
+    plugin->unload = free;
+    return true;
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+static void retire (void *state, const y86_event_t *ev) {
+    int icode = ev->opcode >> 4;
+    ((opcount_t *) state)->byicode[icode <= INVALID ? icode : INVALID]++;
+}
+
+static void branch (void *state, address_t pc, address_t target, bool taken) {
+    (void) pc;
+    (void) target;
+    if(taken)
+        ((opcount_t *) state)->taken++;
+    else
+        ((opcount_t *) state)->untaken++;
+}
+
+static void call (void *state, address_t pc, address_t target, address_t ret) {
+    opcount_t *oc = (opcount_t *) state;
+    (void) pc;
+    (void) target;
+    (void) ret;
+    oc->calls++;
+    if(++oc->nesting > oc->depth)
+        oc->depth = oc->nesting;
+}
+
+static void ret (void *state, address_t pc, address_t target) {
+    opcount_t *oc = (opcount_t *) state;
+    (void) pc;
+    (void) target;
+    oc->rets++;
+    oc->nesting--;
+}
+
+static void finish (void *state, FILE *out) {
+    opcount_t *oc = (opcount_t *) state;
+    fprintf(out, "opcount:\n");
+    for(int i = 0; i <= INVALID; i++) {
+        if(oc->byicode[i] > 0)
+            fprintf(out, "  %-8s %12lu\n", names[i], oc->byicode[i]);
+    }
+    fprintf(out, "  Jumps: %lu taken, %lu not taken\n", oc->taken, oc->untaken);
+    fprintf(out, "  Calls: %lu, returns: %lu, deepest nesting: %d\n",
+            oc->calls, oc->rets, oc->depth);
+}
@@ -12,8 +12,7 @@
 
 bool read_header (FILE *file, elf_hdr_t *hdr) {
 
-    //Fail to read file if file is null, the header information could not be read, or the magic number is incorrect
-    if(file == NULL ||(fread(hdr, 16, 1, file) != 1) ||  hdr->magic != 4607045) {
+    if(!read_header_quiet(file, hdr)) {
         printf("Failed to read file\n");
         return false;
     }
@@ -24,6 +23,11 @@ bool read_header (FILE *file, elf_hdr_t *hdr) {
  *                         OPTIONAL FUNCTIONS
  *********************************************************************/
 
+bool read_header_quiet (FILE *file, elf_hdr_t *hdr) {
+    //Fail to read file if file is null, the header information could not be read, or the magic number is incorrect
+    return file != NULL && fread(hdr, 16, 1, file) == 1 && hdr->magic == 4607045;
+}
+
 void usage_p1 (char **argv) {
     printf("Usage: %s <option(s)> mini-elf-file\n", argv[0]);
     printf(" Options are:\n");
@@ -19,6 +19,15 @@
  */
 bool read_header (FILE *file, elf_hdr_t *hdr);
 
+/**
+ * @brief Load a Mini-ELF header without printing anything on failure
+ *
+ * @param file File stream to use for input
+ * @param hdr Pointer to region where the Mini-ELF header should be loaded
+ * @returns True if the header was successfully loaded and verified, false otherwise
+ */
+bool read_header_quiet (FILE *file, elf_hdr_t *hdr);
+
 /**
  * @brief Print the program usage text
  *
@@ -92,6 +92,8 @@ char* getType(int typeVal) {
         return"STACK     ";
     else if (typeVal == 3)
         return "HEAP      ";
+    else if (typeVal == 4)
+        return "DEVICE    ";
     else    
         return "UNKNOWN";
 }
@@ -185,6 +187,10 @@ void dump_phdrs (uint16_t numphdrs, elf_phdr_t *phdrs) {
 }
 
 void dump_memory (byte_t *memory, uint16_t start, uint16_t end) {
+    fdump_memory(stdout, memory, start, end);
+}
+
+void fdump_memory (FILE *out, byte_t *memory, uint16_t start, uint16_t end) {
     
     //Total number of bytes printed.
     //Used to add an extra space after the 8th byte and determine when to start a new line.
@@ -198,10 +204,10 @@ void dump_memory (byte_t *memory, uint16_t start, uint16_t end) {
     //Ex. If the start was 0x0118, it will be changed to 0x0110 for printing values.
     uint16_t mask = 0xfff0;
     uint16_t newStart = mask&start;
-    printf("Contents of memory from %04x to %04x:\n",start,end);
+    fprintf(out, "Contents of memory from %04x to %04x:\n",start,end);
     if(start == end)
 	    return;
-    printf("  %04x ", newStart);
+    fprintf(out, "  %04x ", newStart);
     
     //Traverses each byte in memory from the start location to the end location and prints them according to the format.
     for(int i = newStart; i < end; i++) {
@@ -209,12 +215,12 @@ void dump_memory (byte_t *memory, uint16_t start, uint16_t end) {
         //Prints an extra space after the 8th byte.
         //Also checks if the current byte is the last one to be printed in this row to omit trailing spaces.
         if((total % 8) == 0 && printedCount <= 15)
-            printf(" ");
+            fprintf(out, " ");
         
         //Creates a newline and prints the start location of the next line.
         if((total % 16) == 0 && total != 0) {
-            printf("\n");
-            printf("  %04x  ", i);
+            fprintf(out, "\n");
+            fprintf(out, "  %04x  ", i);
 
             //Reset printedCount as a new line has started.
             printedCount = 0;
@@ -222,15 +228,15 @@ void dump_memory (byte_t *memory, uint16_t start, uint16_t end) {
 
         //Print empty bytes before the true start value as spaces for unaligned data.
         if(memory[i] == 0x0000 && i < start)
-            printf("  ");
+            fprintf(out, "  ");
         else
-            printf("%02x", memory[i]);
+            fprintf(out, "%02x", memory[i]);
 
         //Check whether to add a trailing space after the current byte or not.
         if(printedCount != 15 && i + 1 != end)
-            printf(" ");   
+            fprintf(out, " ");   
         printedCount++;
         total++;
     }
-    printf("\n");
+    fprintf(out, "\n");
 }
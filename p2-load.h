@@ -73,4 +73,14 @@ void dump_phdrs (uint16_t numphdrs, elf_phdr_t *phdrs);
  */
 void dump_memory (byte_t *memory, uint16_t start, uint16_t end);
 
+/**
+ * @brief Print a portion of a Y86 address space to a stream (see dump_memory)
+ *
+ * @param out Stream to print to
+ * @param memory Pointer to the beginning of the Y86 address space
+ * @param start Byte offset where printing should begin
+ * @param end Byte offset where printing should end
+ */
+void fdump_memory (FILE *out, byte_t *memory, uint16_t start, uint16_t end);
+
 #endif
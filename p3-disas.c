@@ -5,9 +5,12 @@
  */
 
 #include "p3-disas.h"
+#include "icache.h"
+#include "pmem.h"
 
-void printRegister(uint32_t reg);
-void printSpaces(int num);
+void printRegister(FILE *out, uint32_t reg);
+void printSpaces(FILE *out, int num);
+static bool past_end(y86_t *cpu, address_t valP);
 /**********************************************************************
  *                         REQUIRED FUNCTIONS
  *********************************************************************/
@@ -19,9 +22,19 @@ y86_inst_t fetch (y86_t *cpu, byte_t *memory) {
         instruction.icode = INVALID;
         return instruction;
     }
+    //Decode from the bytes at the PC, which for paged memory are copied out
+    //first (an instruction may straddle two pages)
+    byte_t window[INST_MAXLEN];
+    byte_t *at = &memory[cpu->pc];
+    if(cpu->pmem != NULL) {
+        memset(window, 0x00, INST_MAXLEN);
+        if(!past_end(cpu, 0))
+            pmem_fetch(cpu->pmem, cpu->pc, window, INST_MAXLEN);
+        at = window;
+    }
     uint64_t *ptr;
-    uint8_t code = (memory[cpu->pc] & 0xF0) >> 4;
-    uint8_t fun = (memory[cpu->pc]& 0x0F);
+    uint8_t code = (at[0] & 0xF0) >> 4;
+    uint8_t fun = (at[0]& 0x0F);
     uint8_t b2;
 
     //populate ins with 0s
@@ -37,7 +50,7 @@ y86_inst_t fetch (y86_t *cpu, byte_t *memory) {
             instruction.valP = cpu->pc + 1;
             if(fun != 0)
                 instruction.icode = INVALID;
-            if(cpu->pc + instruction.valP >= MEMSIZE)
+            if(past_end(cpu, instruction.valP))
                 instruction.icode = INVALID;
             break;
 
@@ -48,7 +61,7 @@ y86_inst_t fetch (y86_t *cpu, byte_t *memory) {
             instruction.valP = cpu->pc + 1;
             if(fun != 0)
                 instruction.icode = INVALID;
-            if(cpu->pc + instruction.valP >= MEMSIZE)
+            if(past_end(cpu, instruction.valP))
                 instruction.icode = INVALID;
             break;
 
@@ -58,7 +71,7 @@ y86_inst_t fetch (y86_t *cpu, byte_t *memory) {
             instruction.ifun.b = fun; 
             instruction.ifun.cmov = instruction.ifun.b; 
             instruction.valP = cpu->pc + 2;
-            b2 = memory[cpu->pc + 1];    
+            b2 = at[1];    
             instruction.ra = ((b2 & 0xF0) >> 4); 
             instruction.rb = (b2 & 0x0F);
             //Check for out of bounds registers or instruction code
@@ -73,7 +86,7 @@ y86_inst_t fetch (y86_t *cpu, byte_t *memory) {
             instruction.icode = IRMOVQ;
             instruction.ifun.b = fun;
             instruction.valP = cpu->pc + 10;
-            b2 = memory[cpu->pc + 1];
+            b2 = at[1];
             instruction.rb = (b2 & 0x0F);
             //Check that first register is equal to NOREG
             //Since IRMOVQ has an immediate value as the source
@@ -84,7 +97,7 @@ y86_inst_t fetch (y86_t *cpu, byte_t *memory) {
             }
             //Store the address of the bytes representing the value location in p
             //This is cast to a int pointer since byte_t objects are char pointers.
-            ptr = (uint64_t *) &memory[cpu->pc + 2];
+            ptr = (uint64_t *) &at[2];
             //Dereference p and assign it to the value field of the instruction
             instruction.valC.v = *ptr;
             break;  
@@ -94,7 +107,7 @@ y86_inst_t fetch (y86_t *cpu, byte_t *memory) {
             instruction.icode = RMMOVQ; 
             instruction.valP = cpu->pc + 10;
             instruction.ifun.b = fun;
-            b2 = memory[cpu->pc + 1];
+            b2 = at[1];
             instruction.ra = ((b2 & 0xF0) >> 4);
             instruction.rb = (b2 & 0x0F);
             //Check for out of bounds registers
@@ -105,7 +118,7 @@ y86_inst_t fetch (y86_t *cpu, byte_t *memory) {
             }
             //Store the address of the bytes representing the destination location in p
             //This is cast to a int pointer since byte_t objects are char pointers.
-            ptr = (uint64_t *) &memory[cpu->pc + 2];
+            ptr = (uint64_t *) &at[2];
             //Dereference p and assign it to the destination field of the instruction
             instruction.valC.d = *ptr;
             break;  
@@ -115,7 +128,7 @@ y86_inst_t fetch (y86_t *cpu, byte_t *memory) {
             instruction.icode = MRMOVQ; 
             instruction.valP = cpu->pc + 10;
             instruction.ifun.b = fun;
-            b2 = memory[cpu->pc + 1];
+            b2 = at[1];
             instruction.ra = ((b2 & 0xF0) >> 4);
             instruction.rb = (b2 & 0x0F);
             //Check for out of bounds registers
@@ -127,7 +140,7 @@ y86_inst_t fetch (y86_t *cpu, byte_t *memory) {
 
             //Store the address of the bytes representing the destination location in p
             //This is cast to a int pointer since byte_t objects are char pointers.
-            ptr = (uint64_t *) &memory[cpu->pc + 2];
+            ptr = (uint64_t *) &at[2];
             //Dereference p and assign it to the destination field of the instruction
             instruction.valC.d = *ptr;
             break;  
@@ -137,7 +150,7 @@ y86_inst_t fetch (y86_t *cpu, byte_t *memory) {
             instruction.icode = OPQ; 
             instruction.ifun.op = fun; 
             instruction.valP = cpu->pc + 2;
-            b2 = memory[cpu->pc + 1];
+            b2 = at[1];
             instruction.ra = ((b2 & 0xF0) >> 4);
             instruction.rb = (b2 & 0x0F);
             //Check for out of bounds registers or instruction code
@@ -156,7 +169,7 @@ y86_inst_t fetch (y86_t *cpu, byte_t *memory) {
             if (instruction.ifun.jump >= BADJUMP)
                 instruction.icode = INVALID;
             //Save jump desitination to p in the same way as above
-            ptr = (uint64_t *) &memory[cpu->pc + 1];
+            ptr = (uint64_t *) &at[1];
             //If p is null, set cpu stat to ADR
             if (!ptr)
                 cpu->stat=ADR;
@@ -171,7 +184,7 @@ y86_inst_t fetch (y86_t *cpu, byte_t *memory) {
             if(fun != 0)
                 instruction.icode = INVALID;
             //Save call desitination to p in the same way as above
-            ptr = (uint64_t *) &memory[cpu->pc + 1];
+            ptr = (uint64_t *) &at[1];
             //If p is null, set cpu stat to ADR
             if (!ptr)
                 cpu->stat=ADR;
@@ -192,7 +205,7 @@ y86_inst_t fetch (y86_t *cpu, byte_t *memory) {
             instruction.icode = PUSHQ; 
             instruction.valP = cpu->pc + 2;
 
-            b2 = memory[cpu->pc + 1];
+            b2 = at[1];
             instruction.ra = ((b2 & 0xF0) >> 4);
             //Check that first register is equal to NOREG
             //Also checks that destination register is not out of bounds 
@@ -207,7 +220,7 @@ y86_inst_t fetch (y86_t *cpu, byte_t *memory) {
             instruction.icode = POPQ;
             instruction.valP = cpu->pc + 2;
 
-            b2 = memory[cpu->pc + 1];
+            b2 = at[1];
             instruction.ra = ((b2 & 0xF0) >> 4);
             //Check that first register is equal to NOREG
             //Also checks that destination register is not out of bounds 
@@ -223,7 +236,8 @@ y86_inst_t fetch (y86_t *cpu, byte_t *memory) {
             instruction.valP = cpu->pc + 1; 
             instruction.ifun.b = fun;
             instruction.ifun.trap = instruction.ifun.b;
-            if (instruction.ifun.trap >= BADTRAP)
+            //Every hypercall slot decodes, registered or not
+            if (instruction.ifun.trap >= BADTRAP && instruction.ifun.trap < HCALL_BASE)
                 instruction.icode = INVALID;
             break;
 
@@ -239,7 +253,7 @@ y86_inst_t fetch (y86_t *cpu, byte_t *memory) {
         cpu->stat = INS;
     
     //If the instruction is too large to fit in memory, set cpu status to ADR
-    if(cpu->pc + instruction.valP >= MEMSIZE){
+    if(past_end(cpu, instruction.valP)){
         instruction.icode = INVALID;
         cpu->stat = ADR;
     }
@@ -318,117 +332,133 @@ bool parse_command_line_p3 (int argc, char **argv, bool *print_header, bool *pri
 }
 
 void disassemble (y86_inst_t *inst) {
+    fdisassemble(stdout, inst);
+}
+
+void disassemble_code (byte_t *memory, elf_phdr_t *phdr, elf_hdr_t *hdr) {
+    fdisassemble_code(stdout, memory, phdr, hdr);
+}
+
+void disassemble_data (byte_t *memory, elf_phdr_t *phdr) {
+    fdisassemble_data(stdout, memory, phdr);
+}
+
+void disassemble_rodata (byte_t *memory, elf_phdr_t *phdr) {
+    fdisassemble_rodata(stdout, memory, phdr);
+}
+
+void fdisassemble (FILE *out, y86_inst_t *inst) {
     //switch over the instruction code
     switch(inst->icode) {
 
-        case HALT: printf("halt"); break;
-        case NOP: printf("nop"); break;
+        case HALT: fprintf(out, "halt"); break;
+        case NOP: fprintf(out, "nop"); break;
         case CMOV: 
             //Multiple options for CMOV
             switch(inst->ifun.cmov) {
-                case RRMOVQ: printf("rrmovq "); break; 
-                case CMOVLE: printf("cmovle "); break;
-                case CMOVL: printf("cmovl "); break;
-                case CMOVE: printf("cmove "); break;
-                case CMOVNE: printf("cmovne "); break;
-                case CMOVGE: printf("cmovge " ); break;
-                case CMOVG: printf("cmovg "); break;
+                case RRMOVQ: fprintf(out, "rrmovq "); break; 
+                case CMOVLE: fprintf(out, "cmovle "); break;
+                case CMOVL: fprintf(out, "cmovl "); break;
+                case CMOVE: fprintf(out, "cmove "); break;
+                case CMOVNE: fprintf(out, "cmovne "); break;
+                case CMOVGE: fprintf(out, "cmovge " ); break;
+                case CMOVG: fprintf(out, "cmovg "); break;
                 case BADCMOV: return; 
             } 
             //Print registers
-            printRegister(inst->ra);
-            printf(", ");
-            printRegister(inst->rb);
+            printRegister(out, inst->ra);
+            fprintf(out, ", ");
+            printRegister(out, inst->rb);
             break;
             
         case IRMOVQ: 
-            printf("irmovq ");
+            fprintf(out, "irmovq ");
             //Print memory location and register 
-            printf("0x%lx, ", inst->valC.v);
-            printRegister(inst->rb);
+            fprintf(out, "0x%lx, ", inst->valC.v);
+            printRegister(out, inst->rb);
             break;
             
         case RMMOVQ: 
-            printf("rmmovq "); 
+            fprintf(out, "rmmovq "); 
             //Print registers, and check destination is offset or absolute
-            printRegister(inst->ra);
+            printRegister(out, inst->ra);
             //Offset
             if(inst->rb != 0xf) {
-                printf(", 0x%lx(", inst->valC.d); 
-                printRegister(inst->rb);
-                printf(")");
+                fprintf(out, ", 0x%lx(", inst->valC.d); 
+                printRegister(out, inst->rb);
+                fprintf(out, ")");
             //Absolute
             } else
-                printf(", %#lx", inst->valC.d); 
+                fprintf(out, ", %#lx", inst->valC.d); 
             break;
             
         case MRMOVQ: 
-            printf("mrmovq "); 
+            fprintf(out, "mrmovq "); 
             //Check source is offset or absolute
             //Offset
             if(inst->rb != 0xF) {
-                printf("0x%lx(", inst->valC.d); 
-                printRegister(inst->rb);
-                printf("), ");
+                fprintf(out, "0x%lx(", inst->valC.d); 
+                printRegister(out, inst->rb);
+                fprintf(out, "), ");
             //Absolute
             } else
-                printf("%#lx, ", inst->valC.d);
+                fprintf(out, "%#lx, ", inst->valC.d);
             //Print the destination register
-            printRegister(inst->ra);
+            printRegister(out, inst->ra);
             break;
             
         case OPQ:
             //Multiple options for OPQ 
             switch(inst->ifun.op) {
-                case ADD: printf("addq "); break;
-                case SUB: printf("subq "); break;
-                case AND: printf("andq "); break;
-                case XOR: printf("xorq "); break;
+                case ADD: fprintf(out, "addq "); break;
+                case SUB: fprintf(out, "subq "); break;
+                case AND: fprintf(out, "andq "); break;
+                case XOR: fprintf(out, "xorq "); break;
                 case BADOP:return;  
             }
             //Print registers
-            printRegister(inst->ra);
-            printf(", ");
-            printRegister(inst->rb);
+            printRegister(out, inst->ra);
+            fprintf(out, ", ");
+            printRegister(out, inst->rb);
             break;
             
         case JUMP: 
             //Multiple options for JUMP
             switch(inst->ifun.jump) {
-                case JMP: printf("jmp "); break;
-                case JLE: printf("jle "); break;
-                case JL: printf("jl "); break;
-                case JE: printf("je "); break;
-                case JNE: printf("jne "); break;
-                case JGE: printf("jge "); break;
-                case JG: printf("jg "); break;
+                case JMP: fprintf(out, "jmp "); break;
+                case JLE: fprintf(out, "jle "); break;
+                case JL: fprintf(out, "jl "); break;
+                case JE: fprintf(out, "je "); break;
+                case JNE: fprintf(out, "jne "); break;
+                case JGE: fprintf(out, "jge "); break;
+                case JG: fprintf(out, "jg "); break;
                 case BADJUMP: return;
 
             }
             //Print memory destination
-            printf("%#lx", inst->valC.dest); 
+            fprintf(out, "%#lx", inst->valC.dest); 
             break;
             
         case CALL: 
-            printf("call "); 
+            fprintf(out, "call "); 
             //Print memory destination
-            printf("%#lx", inst->valC.dest); 
+            fprintf(out, "%#lx", inst->valC.dest); 
             break;
         case RET: 
-            printf("ret"); 
+            fprintf(out, "ret"); 
             break;
         case PUSHQ: 
-            printf("pushq "); 
+            fprintf(out, "pushq "); 
             //Print register
-            printRegister(inst->ra); 
+            printRegister(out, inst->ra); 
             break;
         case POPQ: 
-            printf("popq ");
+            fprintf(out, "popq ");
             //Print register 
-            printRegister(inst->ra); 
+            printRegister(out, inst->ra); 
             break;
         case IOTRAP: 
-            printf("iotrap %d", inst->ifun.trap); 
+            fprintf(out, "iotrap %d", inst->ifun.trap); 
             break;
         case INVALID: 
             break;
@@ -438,7 +468,7 @@ void disassemble (y86_inst_t *inst) {
 
 }
 
-void disassemble_code (byte_t *memory, elf_phdr_t *phdr, elf_hdr_t *hdr) {
+void fdisassemble_code (FILE *out, byte_t *memory, elf_phdr_t *phdr, elf_hdr_t *hdr) {
 
     //Check for null parameters
     if(memory == NULL || phdr == NULL || hdr == NULL) 
@@ -448,13 +478,14 @@ void disassemble_code (byte_t *memory, elf_phdr_t *phdr, elf_hdr_t *hdr) {
     y86_inst_t isntruction;
     uint32_t addr = phdr->p_vaddr;
     cpu.pc = addr;
+    cpu.pmem = NULL;
    
     //Print the start of the segment at the given virtual address
-    printf("  0x%03lx", cpu.pc);
-    printf(":%30s","");
-    printf(" | .pos 0x");
-    printf("%03lx code",  cpu.pc);
-    printf("\n");
+    fprintf(out, "  0x%03lx", cpu.pc);
+    fprintf(out, ":%30s","");
+    fprintf(out, " | .pos 0x");
+    fprintf(out, "%03lx code",  cpu.pc);
+    fprintf(out, "\n");
     
     //Loops until the program counter reaches the end of the current program header
     while(cpu.pc < addr + phdr->p_size) {
@@ -464,39 +495,39 @@ void disassemble_code (byte_t *memory, elf_phdr_t *phdr, elf_hdr_t *hdr) {
 
         //Print the start of the code segment
         if(cpu.pc == hdr->e_entry){
-            printf("  0x%03lx", cpu.pc);
-            printf(":%31s", "");
-            printf("| _start:\n");
+            fprintf(out, "  0x%03lx", cpu.pc);
+            fprintf(out, ":%31s", "");
+            fprintf(out, "| _start:\n");
         }
         isntruction = fetch(&cpu, memory);
         //End dissassembly if invalid instruction is found.
         if(isntruction.icode == INVALID) {
-            printf("Invalid opcode: 0x%x%x\n\n", isntruction.ifun.b, isntruction.icode);
+            fprintf(out, "Invalid opcode: 0x%x%x\n\n", isntruction.ifun.b, isntruction.icode);
             cpu.pc += isntruction.valP;
             return;
         }
         //Print the program counter
-        printf("  0x%03lx: ", cpu.pc);
+        fprintf(out, "  0x%03lx: ", cpu.pc);
         //Print the hex for current instruction
         for(int i = cpu.pc; i < isntruction.valP; i++) {
-            printf("%02x ", memory[i]);
+            fprintf(out, "%02x ", memory[i]);
             //Decrement total spaces for each byte that is printed.
             totalSpaces -= 1; 
         }
         
         //Print the number of spaces required to fill the rest of the space
-        printSpaces(totalSpaces);
-        printf("|   ");
+        printSpaces(out, totalSpaces);
+        fprintf(out, "|   ");
         //Disassemble the instruction code
-        disassemble(&isntruction);
-        printf("\n");
+        fdisassemble(out, &isntruction);
+        fprintf(out, "\n");
         //Increment the program counter, move to the next line and loop back
         cpu.pc += isntruction.valP - cpu.pc;
     }
-    printf("\n");
+    fprintf(out, "\n");
 }
 
-void disassemble_data (byte_t *memory, elf_phdr_t *phdr) {
+void fdisassemble_data (FILE *out, byte_t *memory, elf_phdr_t *phdr) {
 
     //Check for null parameters
     if(memory == NULL || phdr == NULL )
@@ -507,35 +538,35 @@ void disassemble_data (byte_t *memory, elf_phdr_t *phdr) {
     cpu.pc = addr;
     
     //Print the program counter and the start of the data segment
-    printf("  0x%03lx:", cpu.pc);
-    printf("%30s","");
-    printf(" | .pos 0x");
-    printf("%03lx data\n", cpu.pc);
+    fprintf(out, "  0x%03lx:", cpu.pc);
+    fprintf(out, "%30s","");
+    fprintf(out, " | .pos 0x");
+    fprintf(out, "%03lx data\n", cpu.pc);
     //Loop until the program counter reaches the end of the program header
     while(cpu.pc <  addr + phdr->p_size) {
         //Print the program counter
-        printf("  0x%03lx: ", cpu.pc);
+        fprintf(out, "  0x%03lx: ", cpu.pc);
         //Print each byte stored in the data location (8 total as they are quads)
         //Use a temporary value 'i' instead of incrementing program counter
         //so it can be used again later
         for(int i = cpu.pc; i < cpu.pc + 8; i++)
-            printf("%02x ", memory[i]);
-        printf("%6s",""); 
-        printf("|   .quad ");
+            fprintf(out, "%02x ", memory[i]);
+        fprintf(out, "%6s",""); 
+        fprintf(out, "|   .quad ");
         
         //Assign p to the location in memory where the 8 bytes of data starts
         uint64_t *data;
         data = (uint64_t *) &memory[cpu.pc];
         //Print p
-        printf("0x%lx\n", *data);
+        fprintf(out, "0x%lx\n", *data);
         //Increment the program counter to move to the next data entry 
         cpu.pc += 8;
          
     }
-    printf("\n");
+    fprintf(out, "\n");
 }
 
-void disassemble_rodata (byte_t *memory, elf_phdr_t *phdr) {
+void fdisassemble_rodata (FILE *out, byte_t *memory, elf_phdr_t *phdr) {
     //Keeps track of the amount of spaces needed to fill gaps if not enough bytes are entered.
     int totalSpaces = 8;
 
@@ -551,39 +582,39 @@ void disassemble_rodata (byte_t *memory, elf_phdr_t *phdr) {
     //become misaligned with what is currently happening
     int counter;
     //Print starting information
-    printf("  0x%03lx:  ", cpu.pc);
-    printf("%28s","");
-    printf(" | .pos 0x%03lx rodata\n", cpu.pc);
+    fprintf(out, "  0x%03lx:  ", cpu.pc);
+    fprintf(out, "%28s","");
+    fprintf(out, " | .pos 0x%03lx rodata\n", cpu.pc);
     
     //Loops until the program counter reaches the end of the header
     while(cpu.pc <  addr + phdr->p_size) {
         finished = false;
-        printf("  0x%03lx: ", cpu.pc);
+        fprintf(out, "  0x%03lx: ", cpu.pc);
 
         //Prints up to 10 bytes of data
         //Breaks out of the loop if the end of the string is reached
         for(counter = cpu.pc; counter < cpu.pc + 10; counter++) {
-            printf("%02x ", memory[counter]);
+            fprintf(out, "%02x ", memory[counter]);
             totalSpaces --;
             //End of string is reached
             if(memory[counter] == 0x00) {
                 finished = true;
-                printSpaces(totalSpaces);
+                printSpaces(out, totalSpaces);
                 totalSpaces = 8;
                 break;
             }  
         }
         //Move the counter back to the program counter (start of the data)
         counter = cpu.pc;
-        printf("|   .string \"");
+        fprintf(out, "|   .string \"");
         //Prints the bytes as chars to repesent the string at the end of the line
         //NOTE: This is the entire string up until the 0x00 instance, 
         //not just the 10 bytes printed in this line.
         while(memory[counter] != 0x00)
-            printf("%c", memory[counter++]);
+            fprintf(out, "%c", memory[counter++]);
         //Stores the total number of bytes in the string
         int bytes = (counter - cpu.pc) + 1;
-        printf("\"");
+        fprintf(out, "\"");
 
         //If the string has more bytes to print, continue here
         if(!finished) {
@@ -592,32 +623,32 @@ void disassemble_rodata (byte_t *memory, elf_phdr_t *phdr) {
             //Increment counter to the 
             counter = cpu.pc + 10;
             int j = 0;
-            printf("\n  0x%03x: ", counter);
+            fprintf(out, "\n  0x%03x: ", counter);
             
             //Loop until end byte found
             while(memory[counter] != 0x00) {
-                printf("%02x ", memory[counter++]);
+                fprintf(out, "%02x ", memory[counter++]);
                 totalSpaces --;
 
                 //10 bytes printed, move to next line
                 if(++j % 10 == 0) {
-                    printf("| \n  ");
-                    printf("0x%03x: ", counter);
+                    fprintf(out, "| \n  ");
+                    fprintf(out, "0x%03x: ", counter);
                     totalSpaces = 7;
                 }
             }
             //Prints the 0x00 byte
-            printf("%02x", memory[counter++]);
+            fprintf(out, "%02x", memory[counter++]);
             //Prints spaces as needed to fill remaining space
-            printSpaces(totalSpaces);
-            printf(" | ");
+            printSpaces(out, totalSpaces);
+            fprintf(out, " | ");
         }
-        printf("\n"); 
+        fprintf(out, "\n"); 
         //Move program counter to the end of the current string.
         cpu.pc += bytes; 
             
     }
-    printf("\n");
+    fprintf(out, "\n");
 }
 
 
@@ -626,26 +657,34 @@ void disassemble_rodata (byte_t *memory, elf_phdr_t *phdr) {
  *                         HELPER METHODS
  *********************************************************************/
 
+//Check whether an instruction at the PC ending at valP runs off the end of
+//memory. Paged memory ends at 2^64, so there only the last INST_MAXLEN bytes
+//are off limits.
+static bool past_end(y86_t *cpu, address_t valP) {
+    if(cpu->pmem != NULL)
+        return cpu->pc > UINT64_MAX - INST_MAXLEN;
+    return cpu->pc + valP >= MEMSIZE;
+}
 
 //Prints register name based on the given register
-void printRegister(uint32_t reg) {
+void printRegister(FILE *out, uint32_t reg) {
 
     switch(reg) {
-        case 0x0: printf("%%rax"); break;
-        case 0x1: printf("%%rcx"); break;
-        case 0x2: printf("%%rdx"); break;
-        case 0x3: printf("%%rbx"); break;
-        case 0x4: printf("%%rsp"); break;
-        case 0x5: printf("%%rbp"); break;
-        case 0x6: printf("%%rsi"); break;
-        case 0x7: printf("%%rdi"); break;
-        case 0x8: printf("%%r8"); break;
-        case 0x9: printf("%%r9"); break;
-        case 0xa: printf("%%r10"); break;
-        case 0xb: printf("%%r11"); break;
-        case 0xc: printf("%%r12"); break;
-        case 0xd: printf("%%r13"); break;
-        case 0xe: printf("%%r14"); break;
+        case 0x0: fprintf(out, "%%rax"); break;
+        case 0x1: fprintf(out, "%%rcx"); break;
+        case 0x2: fprintf(out, "%%rdx"); break;
+        case 0x3: fprintf(out, "%%rbx"); break;
+        case 0x4: fprintf(out, "%%rsp"); break;
+        case 0x5: fprintf(out, "%%rbp"); break;
+        case 0x6: fprintf(out, "%%rsi"); break;
+        case 0x7: fprintf(out, "%%rdi"); break;
+        case 0x8: fprintf(out, "%%r8"); break;
+        case 0x9: fprintf(out, "%%r9"); break;
+        case 0xa: fprintf(out, "%%r10"); break;
+        case 0xb: fprintf(out, "%%r11"); break;
+        case 0xc: fprintf(out, "%%r12"); break;
+        case 0xd: fprintf(out, "%%r13"); break;
+        case 0xe: fprintf(out, "%%r14"); break;
         //NOREG
         case 0xf: break;
         //Any other case, nothing will happen
@@ -654,9 +693,9 @@ void printRegister(uint32_t reg) {
 }
 //Prints x number of spaces to fill x missing bytes at the end of a line
 //Each byte equates to 3 spaces (ex: if num = 8, 24 spaces will be printed)
-void printSpaces(int num) {
+void printSpaces(FILE *out, int num) {
     for(int i = 0; i <= num + 1; i++)
-        printf("   ");
+        fprintf(out, "   ");
 }
 
 
@@ -78,4 +78,11 @@ void disassemble_data   (byte_t *memory, elf_phdr_t *phdr);
  */
 void disassemble_rodata (byte_t *memory, elf_phdr_t *phdr);
 
+/* Variants of the functions above that print to a stream instead of
+   standard out (the plain versions call these with stdout) */
+void fdisassemble        (FILE *out, y86_inst_t *inst);
+void fdisassemble_code   (FILE *out, byte_t *memory, elf_phdr_t *phdr, elf_hdr_t *hdr);
+void fdisassemble_data   (FILE *out, byte_t *memory, elf_phdr_t *phdr);
+void fdisassemble_rodata (FILE *out, byte_t *memory, elf_phdr_t *phdr);
+
 #endif
@@ -5,7 +5,36 @@
  */
 
 #include "p4-interp.h"
-void printCpuState(y86_t *cpu);
+#include "p3-disas.h"
+#include "pmem.h"
+#include "ckpt.h"
+#include "cachesim.h"
+#include "plugin.h"
+#include "sampler.h"
+#include "io.h"
+#include "device.h"
+#include "bus.h"
+void printCpuState(FILE *out, y86_t *cpu);
+
+//Guest memory accessors: the flat MEMSIZE array, or the paged address space
+//when one is attached to the CPU
+static inline bool mem_valid (y86_t *cpu, address_t addr) {
+    return cpu->pmem != NULL ? pmem_valid(addr) : addr < MEMSIZE;
+}
+
+static inline uint64_t mem_load (y86_t *cpu, byte_t *memory, address_t addr) {
+    if(cpu->pmem != NULL)
+        return pmem_load(cpu->pmem, addr);
+    return *((uint64_t *)&memory[addr]);
+}
+
+static inline bool mem_store (y86_t *cpu, byte_t *memory, address_t addr, uint64_t value) {
+    if(cpu->pmem != NULL)
+        return pmem_store(cpu->pmem, addr, value);
+    *((uint64_t *)&memory[addr]) = value;
+    mark_dirty(cpu, addr);
+    return true;
+}
 /**********************************************************************
  *                         REQUIRED FUNCTIONS
  *********************************************************************/
@@ -19,8 +48,8 @@ y86_reg_t decode_execute (y86_t *cpu, y86_inst_t inst, bool *cnd, y86_reg_t *val
         cpu->stat = INS;
         return 0;
     }
-    //Check for out of bounds program counter
-    if(cpu->pc >= MEMSIZE || cpu->pc < 0) {
+    //Check for out of bounds program counter (paged memory has no such bound)
+    if(cpu->pmem == NULL && (cpu->pc >= MEMSIZE || cpu->pc < 0)) {
         cpu->stat = ADR;
         return 0;
     }
@@ -112,6 +141,8 @@ y86_reg_t decode_execute (y86_t *cpu, y86_inst_t inst, bool *cnd, y86_reg_t *val
         case(PUSHQ): *valA = cpu->reg[inst.ra]; valB = cpu->reg[RSP]; valE = valB - 8;  break;
         //Pop the value at the top of the stack and assign to valE
         case(POPQ): *valA = cpu->reg[RSP]; valB = cpu->reg[RSP]; valE = valB + 8; break;
+        //Traps read their own operands in memory_wb_pc
+        case(IOTRAP): break;
         //Invalid instruction case
         case(INVALID): cpu->stat = INS; break;
         default: cpu->stat = INS; break;
@@ -122,7 +153,6 @@ y86_reg_t decode_execute (y86_t *cpu, y86_inst_t inst, bool *cnd, y86_reg_t *val
 void memory_wb_pc (y86_t *cpu, y86_inst_t inst, byte_t *memory,
         bool cnd, y86_reg_t valA, y86_reg_t valE) {
     y86_reg_t valM;
-    //char buf[100];
 
     //Check for null cpu
     if(cpu == NULL)
@@ -134,14 +164,14 @@ void memory_wb_pc (y86_t *cpu, y86_inst_t inst, byte_t *memory,
     }
     //Check for out of bounds program counter or invalid valE or valA
     //Note that a valE or valA will be checked against an upper bound later if needed.
-    if(cpu->pc >= MEMSIZE || cpu->pc < 0 || valA < 0 || valE < 0) {
+    if((cpu->pmem == NULL && cpu->pc >= MEMSIZE) || cpu->pc < 0 || valA < 0 || valE < 0) {
         cpu->stat = ADR;
         return;
     }
     
     //Switch over the instruction code
     switch(inst.icode) {
-        case(HALT): cpu->pc = inst.valP; break;
+        case(HALT): cpu->pc = inst.valP; io_flush(cpu->io); break;
         case(NOP):  cpu->pc = inst.valP; break;
         case(CMOV):
             //Only move data if the move condition is true.
@@ -152,22 +182,25 @@ void memory_wb_pc (y86_t *cpu, y86_inst_t inst, byte_t *memory,
         case(IRMOVQ): cpu->reg[inst.rb] = valE;  cpu->pc = inst.valP; break;
         case(RMMOVQ): 
             //Check for invalid memory address
-            if(valE >=MEMSIZE) {
+            if(!mem_valid(cpu, valE)) {
                 cpu->stat = ADR; 
                 break;
             }
             //Set 8 bytes of memory at address valE to the value in valA
-            *((uint64_t *)&memory[valE]) = valA;
+            if(!mem_store(cpu, memory, valE, valA)) {
+                cpu->stat = ADR;
+                break;
+            }
             cpu->pc = inst.valP;
             break;
         case(MRMOVQ): 
             //Check for invalid memory address
-            if(valE >=MEMSIZE) {
+            if(!mem_valid(cpu, valE)) {
                 cpu->stat = ADR; 
                 break; 
             }
             //Assign 8 bytes of memory at address valE to valM
-            valM = *((uint64_t *)&memory[valE]);
+            valM = mem_load(cpu, memory, valE);
             //Store valM in register A.
             cpu->reg[inst.ra] = valM;
             cpu->pc = inst.valP;
@@ -187,25 +220,29 @@ void memory_wb_pc (y86_t *cpu, y86_inst_t inst, byte_t *memory,
             break;
         case(CALL):  
             //Check for invalid memory address
-            if(valE >=MEMSIZE){ 
+            if(!mem_valid(cpu, valE)){ 
                 cpu->stat = ADR;
                 cpu->pc = inst.valC.dest;
                 break;  
             }
             //Set 8 bytes of memory at address valE to valP
-            *((uint64_t *)&memory[valE]) = inst.valP;
+            if(!mem_store(cpu, memory, valE, inst.valP)) {
+                cpu->stat = ADR;
+                cpu->pc = inst.valC.dest;
+                break;
+            }
             //Change the value at the top of the stack to valE
             cpu->reg[RSP] = valE; 
             cpu->pc = inst.valC.dest;
             break;
         case(RET): 
             //Check for invalid memory address
-            if(valA >=MEMSIZE) { 
+            if(!mem_valid(cpu, valA)) { 
                 cpu->stat = ADR; 
                 break; 
             }
             //Assign valM to 8 bytes of memory at address valA
-            valM = *((uint64_t *)&memory[valA]);
+            valM = mem_load(cpu, memory, valA);
             //Change the value at the top of the stack to valE
             cpu->reg[RSP] = valE;
             cpu->pc = valM; 
@@ -213,12 +250,15 @@ void memory_wb_pc (y86_t *cpu, y86_inst_t inst, byte_t *memory,
             
         case(PUSHQ): 
             //Check for invalid memory address
-            if(valE >=MEMSIZE) { 
+            if(!mem_valid(cpu, valE)) { 
                 cpu->stat = ADR;
                 break; 
             }
             //Assign 8 bytes of memory at address valE to valE
-            *((uint64_t *)&memory[valE]) = valA;
+            if(!mem_store(cpu, memory, valE, valA)) {
+                cpu->stat = ADR;
+                break;
+            }
             //Change the value at the top of the stack to valE
             cpu->reg[RSP] = valE; 
             cpu->pc = inst.valP;
@@ -226,12 +266,12 @@ void memory_wb_pc (y86_t *cpu, y86_inst_t inst, byte_t *memory,
             
         case(POPQ):
             //Check for invalid memory address
-            if(valA >=MEMSIZE) { 
+            if(!mem_valid(cpu, valA)) { 
                 cpu->stat = ADR;
                 break; 
             }
             //Set valM to 8 bytes of memory at address valA
-            valM = *((uint64_t *)&memory[valA]);
+            valM = mem_load(cpu, memory, valA);
             //Change the value at the top of the stack to valE
             cpu->reg[RSP] = valE; 
             //Assign valM to register A
@@ -239,30 +279,18 @@ void memory_wb_pc (y86_t *cpu, y86_inst_t inst, byte_t *memory,
             cpu->pc = inst.valP;
             break;
         
-        //Unimplemented :(
-        case (IOTRAP): break;
-        //     switch(inst.ifun.trap){
-        //         case(CHAROUT):
-        //             printf("CHAROUT0");
-        //             snprintf(buf, 1, "%s", stdin);
-        //             printf("[BUF:%s]", buf);
-        //             break;
-        //         case(CHARIN):
-        //             snprintf(buf, 1, "%s", stdin);
-        //             printf("[BUF:%s]", buf);
-        //             printf("CHARIN1"); break;
-        //         case(DECOUT):
-        //             printf("DECOUT2"); break;
-        //         case(DECIN):
-        //             printf("DECIN3"); break;
-        //         case(STROUT):
-        //             printf("STROUT4"); break;
-        //         case(FLUSH):
-        //             printf("FLUSH5"); break;
-        //         case(BADTRAP):
-        //             printf("BADTRAP6"); break;
-        //     }
-        //     break;
+        case(IOTRAP):
+            //Without channels there is nowhere for the I/O to go
+            if(cpu->io == NULL) {
+                cpu->stat = INS;
+                break;
+            }
+            io_trap(cpu, memory, inst.ifun.trap);
+            //A trap that stops at the end of input still completes (an
+            //empty hypercall slot does not, as with any bad instruction)
+            if(cpu->stat == AOK || cpu->stat == HLT)
+                cpu->pc = inst.valP;
+            break;
         case(INVALID): cpu->stat = INS; break;
     }
 
@@ -273,6 +301,36 @@ void memory_wb_pc (y86_t *cpu, y86_inst_t inst, byte_t *memory,
  *                         OPTIONAL FUNCTIONS
  *********************************************************************/
 
+y86_inst_t step_reference (y86_t *cpu, byte_t *memory, int *count, address_t *store) {
+    bool cnd = false;
+    y86_reg_t valA = 0;
+    y86_reg_t valE = 0;
+
+    //Fetch
+    y86_inst_t ins = fetch(cpu, memory);
+    //Disinclude invalid instructions in total count
+    if(cpu->stat == INS)
+        (*count)--;
+    //Decode and execute
+    valE = decode_execute(cpu, ins, &cnd, &valA);
+    //Input is logged by when it was read
+    if(ins.icode == IOTRAP && cpu->io != NULL)
+        cpu->io->count = *count;
+    //Memory, writeback, program counter increment
+    memory_wb_pc(cpu, ins, memory, cnd, valA, valE);
+    //Report the address of any store so callers can drop stale decodes
+    *store = MEMSIZE;
+    if(ins.icode == RMMOVQ || ins.icode == PUSHQ || ins.icode == CALL)
+        *store = valE;
+    else if(io_stores(&ins))
+        *store = cpu->reg[RDI];
+    (*count)++;
+    //Change cpu status to ADR if program counter leaves allocated memory
+    if(cpu->pmem == NULL && cpu->pc >= MEMSIZE)
+        cpu->stat = ADR;
+    return ins;
+}
+
 void usage_p4 (char **argv) {
     printf("Usage: %s <option(s)> mini-elf-file\n", argv[0]);
     printf(" Options are:\n");
@@ -287,29 +345,111 @@ void usage_p4 (char **argv) {
     printf("  -D      Disassemble data contents\n");
     printf("  -e      Execute program\n");
     printf("  -E      Execute program (trace mode)\n");
+    printf("  -t      Execute program (threaded dispatch)\n");
+    printf("  -b      Execute program (basic-block cache)\n");
+    printf("  -j      Execute program (x86-64 JIT)\n");
+    printf("  -P      Execute program and print a flat profile by symbol and opcode\n");
+    printf("  -G      Execute program and print a call graph profile\n");
+    printf("  -c      Execute program and print host cost per opcode\n");
+    printf("  -C      Translate program to C (ahead-of-time)\n");
+    printf("  -B      Execute a batch of programs (directory or list file)\n");
+    printf("  -L      Use paged memory covering the 64-bit address space (-e/-E only)\n");
+    printf("  --serve Serve jobs on a Unix socket (named in place of the file)\n");
+    printf("  --fuzz  Run length-prefixed inputs from stdin with edge coverage,\n");
+    printf("          one status line per input on stdout\n");
+    printf("  --checkpoint <file>  Checkpoint execution to a file (-e only; SIGUSR1\n");
+    printf("                       checkpoints now, SIGINT/SIGTERM checkpoints and stops)\n");
+    printf("  --every <n>          Instructions between checkpoints (default %ld)\n", CKPT_EVERY);
+    printf("  --resume             Continue from the checkpoint file\n");
+    printf("  --trace <file>       Record a binary trace of execution (-e only; decode\n");
+    printf("                       it with y86-trace; hypercalls are INS)\n");
+    printf("  --profile            Report the hottest PCs and call targets (-e only)\n");
+    printf("  --cache              Simulate a %d-byte data cache (-e only)\n",
+            CACHE_SETS * CACHE_WAYS * CACHE_LINE);
+    printf("  --drop               Drop analysis events rather than slow the run down\n");
+    printf("                       (--profile/--cache only)\n");
+    printf("  --plugin <so>[,args] Load an instrumentation plugin (-e only; up to %d;\n",
+            PLUGIN_MAX);
+    printf("                       hypercalls are INS)\n");
+    printf("  --stacks <file>      Write collapsed stacks for flame graphs (-G or\n");
+    printf("                       --sample-stacks only)\n");
+    printf("  --sample[=<hz>]      Sample the guest PC on a CPU time timer (-e only;\n");
+    printf("                       default %d Hz)\n", SAMPLER_HZ);
+    printf("  --sample-stacks      Sample callers with each PC (implies --sample;\n");
+    printf("                       not with -L)\n");
+    printf("  --input <file>       Read guest input (iotrap) from a file, not stdin\n");
+    printf("                       (execution modes only)\n");
+    printf("  --record <log>       Log the guest's input with when it was read\n");
+    printf("  --replay <log>       Serve the guest's input from a log, from memory\n");
+    printf("                       (neither with --resume)\n");
+    printf("  --device <file>[@<addr>]  Map a file into guest memory at addr, or at\n");
+    printf("                       the program's next DEVICE segment (-L only; up\n");
+    printf("                       to %d; not with --checkpoint or --trace)\n", DEVICE_MAX);
+    printf("  --mmio[=<addr>]      Put a UART, timer and cycle counter at addr (-L\n");
+    printf("                       only; default 0x%x; not with --checkpoint,\n", BUS_BASE);
+    printf("                       analyses, plugins or input logs)\n");
 }
 
 bool parse_command_line_p4 (int argc, char **argv,
         bool *print_header, bool *print_phdrs,
         bool *print_membrief, bool *print_memfull,
         bool *disas_code, bool *disas_data,
-        bool *exec_normal, bool *exec_debug, char **filename) {
+        bool *exec_normal, bool *exec_debug, bool *exec_threaded,
+        bool *exec_blocks, bool *exec_jit, bool *exec_profile, bool *exec_callgraph, bool *exec_cost, bool *translate_c, bool *run_batch,
+        bool *run_server, bool *run_fuzz, bool *large_memory, char **checkpoint,
+        long *checkpoint_every, bool *resume, char **trace_file, bool *profile,
+        bool *cache_sim, bool *drop_events, char **plugins, int *nplugins,
+        char **stacks_file, long *sample_hz, bool *sample_stacks, char **input_file,
+        char **record_file, char **replay_file, char **devices, int *ndevices,
+        address_t *mmio_base, char **filename) {
 
     //Check for null params or too many arguments
     if(argc <= 1 ||argv == NULL || print_header == NULL || 
     print_phdrs == NULL || print_membrief == NULL || print_memfull == NULL || disas_code == NULL 
-    || disas_data == NULL || exec_normal == NULL || exec_debug == NULL) {
+    || disas_data == NULL || exec_normal == NULL || exec_debug == NULL
+    || exec_threaded == NULL || exec_blocks == NULL || exec_jit == NULL || exec_profile == NULL
+    || exec_callgraph == NULL || exec_cost == NULL || stacks_file == NULL
+    || translate_c == NULL || run_batch == NULL || run_server == NULL || run_fuzz == NULL
+    || large_memory == NULL || checkpoint == NULL || checkpoint_every == NULL
+    || resume == NULL || trace_file == NULL || profile == NULL || cache_sim == NULL
+    || drop_events == NULL || plugins == NULL || nplugins == NULL
+    || sample_hz == NULL || sample_stacks == NULL || input_file == NULL
+    || record_file == NULL || replay_file == NULL || devices == NULL || ndevices == NULL
+    || mmio_base == NULL) {
         usage_p4(argv);
         return false;
     }
 
     //Create variables needed for command line parsing with getopt
-    char *optionStr = "hHafsmMDdeE";
+    char *optionStr = "hHafsmMDdeEtbjPGcCBL";
+    static struct option longOptions[] = {
+        { "serve", no_argument, NULL, 'S' },
+        { "checkpoint", required_argument, NULL, 'K' },
+        { "every", required_argument, NULL, 'N' },
+        { "resume", no_argument, NULL, 'R' },
+        { "trace", required_argument, NULL, 'T' },
+        { "profile", no_argument, NULL, 'F' },
+        { "cache", no_argument, NULL, 'Q' },
+        { "drop", no_argument, NULL, 'X' },
+        { "plugin", required_argument, NULL, 'U' },
+        { "stacks", required_argument, NULL, 'Y' },
+        { "sample", optional_argument, NULL, 'Z' },
+        { "sample-stacks", no_argument, NULL, 'W' },
+        { "fuzz", no_argument, NULL, 'V' },
+        { "input", required_argument, NULL, 'I' },
+        { "record", required_argument, NULL, 'O' },
+        { "replay", required_argument, NULL, 'A' },
+        { "device", required_argument, NULL, 'J' },
+        { "mmio", optional_argument, NULL, 'k' },
+        { NULL, 0, NULL, 0 }
+    };
     int opt = -1;
     bool printHelp = false;
+    bool everyGiven = false;
+    char *end = NULL;
     
     //Parse each command line option
-    while((opt = getopt(argc, argv, optionStr))!= -1) {
+    while((opt = getopt_long(argc, argv, optionStr, longOptions, NULL))!= -1) {
         //Switch over individual command line options
         switch(opt) {
             case 'h': printHelp = true; break;
@@ -323,10 +463,78 @@ bool parse_command_line_p4 (int argc, char **argv,
             case 'D': *disas_data = true; break;
             case 'E': *exec_debug = true; break;
             case 'e': *exec_normal = true; break;
+            case 't': *exec_threaded = true; break;
+            case 'b': *exec_blocks = true; break;
+            case 'j': *exec_jit = true; break;
+            case 'P': *exec_profile = true; break;
+            case 'G': *exec_callgraph = true; break;
+            case 'c': *exec_cost = true; break;
+            case 'C': *translate_c = true; break;
+            case 'B': *run_batch = true; break;
+            case 'S': *run_server = true; break;
+            case 'V': *run_fuzz = true; break;
+            case 'L': *large_memory = true; break;
+            case 'K': *checkpoint = optarg; break;
+            case 'N':
+                *checkpoint_every = strtol(optarg, &end, 10);
+                if(*end != '\0' || *checkpoint_every <= 0) {
+                    usage_p4(argv);
+                    return false;
+                }
+                everyGiven = true;
+                break;
+            case 'R': *resume = true; break;
+            case 'T': *trace_file = optarg; break;
+            case 'F': *profile = true; break;
+            case 'Q': *cache_sim = true; break;
+            case 'X': *drop_events = true; break;
+            case 'U':
+                if(*nplugins == PLUGIN_MAX) {
+                    usage_p4(argv);
+                    return false;
+                }
+                plugins[(*nplugins)++] = optarg;
+                break;
+            case 'Y': *stacks_file = optarg; break;
+            case 'Z':
+                *sample_hz = SAMPLER_HZ;
+                if(optarg != NULL)
+                    *sample_hz = strtol(optarg, &end, 10);
+                if((optarg != NULL && *end != '\0') || *sample_hz < 1
+                        || *sample_hz > SAMPLER_MAXHZ) {
+                    usage_p4(argv);
+                    return false;
+                }
+                break;
+            case 'W': *sample_stacks = true; break;
+            case 'I': *input_file = optarg; break;
+            case 'O': *record_file = optarg; break;
+            case 'A': *replay_file = optarg; break;
+            case 'J':
+                if(*ndevices == DEVICE_MAX) {
+                    usage_p4(argv);
+                    return false;
+                }
+                devices[(*ndevices)++] = optarg;
+                break;
+            case 'k':
+                *mmio_base = BUS_BASE;
+                if(optarg != NULL)
+                    *mmio_base = strtoull(optarg, &end, 0);
+                if((optarg != NULL && (*optarg == '\0' || *end != '\0'))
+                        || *mmio_base < MEMSIZE || *mmio_base % PMEM_PAGESIZE != 0) {
+                    usage_p4(argv);
+                    return false;
+                }
+                break;
             default: usage_p4(argv); return false;
         }
     }
     
+    //Sampling callers means sampling
+    if(*sample_stacks && *sample_hz == 0)
+        *sample_hz = SAMPLER_HZ;
+
     //Print help message
     if(printHelp) {
         *print_header = false;
@@ -338,8 +546,72 @@ bool parse_command_line_p4 (int argc, char **argv,
         usage_p4(argv);
         return false;
     }
-    //Exec normal and exec debug cannot be run at the same time
-    else if( *exec_normal && *exec_debug){
+    //Only one execution mode can be run at a time (translation counts as one)
+    else if((*exec_normal + *exec_debug + *exec_threaded + *exec_blocks
+            + *exec_jit + *exec_profile + *exec_callgraph + *exec_cost + *translate_c + *run_batch + *run_server
+            + *run_fuzz) > 1){
+        usage_p4(argv);
+        return false;
+    }
+    //Paged memory is only implemented by the reference pipeline (which -P,
+    //-G and -c profile)
+    else if(*large_memory && (*exec_threaded || *exec_blocks || *exec_jit
+            || *translate_c || *run_batch || *run_server)) {
+        usage_p4(argv);
+        return false;
+    }
+    //Checkpoints and analyses (traces included) are only taken by the -e
+    //loop, not both at once, and only with a file to write. Dropping events
+    //would leave holes in a trace, so only the other analyses allow it.
+    else if(((*checkpoint != NULL || *trace_file != NULL || *profile || *cache_sim)
+                && !*exec_normal)
+            || (*checkpoint != NULL && (*trace_file != NULL || *profile || *cache_sim))
+            || ((everyGiven || *resume) && *checkpoint == NULL)
+            || (*drop_events && (*trace_file != NULL || !(*profile || *cache_sim)))) {
+        usage_p4(argv);
+        return false;
+    }
+    //Plugins hook the -e loop, which the analyses' pipeline replaces
+    else if(*nplugins > 0 && (!*exec_normal || *trace_file != NULL || *profile || *cache_sim)) {
+        usage_p4(argv);
+        return false;
+    }
+    //Collapsed stacks come from the call graph or from sampled stacks
+    else if(*stacks_file != NULL && !*exec_callgraph && !*sample_stacks) {
+        usage_p4(argv);
+        return false;
+    }
+    //The sampler interrupts the -e loop; it finds callers in flat memory only
+    else if(*sample_hz != 0 && (!*exec_normal
+                || (*sample_stacks && *large_memory))) {
+        usage_p4(argv);
+        return false;
+    }
+    //Guest input is only read by a program being run here; a replay stands
+    //in for it, and only lines up with a run from the start
+    else if((*input_file != NULL || *record_file != NULL || *replay_file != NULL)
+            && (!(*exec_normal || *exec_debug || *exec_threaded
+                || *exec_blocks || *exec_jit || *exec_profile || *exec_callgraph
+                || *exec_cost)
+                || (*replay_file != NULL && (*input_file != NULL || *record_file != NULL))
+                || *resume)) {
+        usage_p4(argv);
+        return false;
+    }
+    //Devices live in paged memory, and in their files rather than in
+    //checkpoints or traces
+    else if(*ndevices > 0 && (!*large_memory || !(*exec_normal || *exec_debug
+                || *exec_profile || *exec_callgraph || *exec_cost)
+                || *checkpoint != NULL || *trace_file != NULL)) {
+        usage_p4(argv);
+        return false;
+    }
+    //So does the device bus; its loads have side effects that the analyses'
+    //second look at each store would repeat, and its input is not logged
+    else if(*mmio_base != 0 && (!*large_memory || !(*exec_normal || *exec_debug
+                || *exec_profile || *exec_callgraph || *exec_cost)
+                || *checkpoint != NULL || *trace_file != NULL || *profile || *cache_sim
+                || *nplugins > 0 || *record_file != NULL || *replay_file != NULL)) {
         usage_p4(argv);
         return false;
     }
@@ -355,20 +627,24 @@ bool parse_command_line_p4 (int argc, char **argv,
 }
 
 void dump_cpu_state (y86_t *cpu) {
-    printf("Y86 CPU state:\n");
+    fdump_cpu_state(stdout, cpu);
+}
+
+void fdump_cpu_state (FILE *out, y86_t *cpu) {
+    fprintf(out, "Y86 CPU state:\n");
     //Print program counter and flags
-    printf("    PC: %016lx   flags: Z%d S%d O%d     ",  cpu->pc, cpu->zf, cpu->sf, cpu->of);
-    printCpuState(cpu);
+    fprintf(out, "    PC: %016lx   flags: Z%d S%d O%d     ",  cpu->pc, cpu->zf, cpu->sf, cpu->of);
+    printCpuState(out, cpu);
     
     //Print registers and associated values
-    printf("  %%rax: %016lx    %%rcx: %016lx\n",  cpu->reg[RAX],  cpu->reg[RCX]);
-    printf("  %%rdx: %016lx    %%rbx: %016lx\n", cpu->reg[RDX], cpu->reg[RBX]);
-    printf("  %%rsp: %016lx    %%rbp: %016lx\n",   cpu->reg[RSP],  cpu->reg[RBP]);
-    printf("  %%rsi: %016lx    %%rdi: %016lx\n",  cpu->reg[RSI], cpu->reg[RDI]);
-    printf("   %%r8: %016lx     %%r9: %016lx\n",  cpu->reg[R8], cpu->reg[R9]);
-    printf("  %%r10: %016lx    %%r11: %016lx\n",  cpu->reg[R10], cpu->reg[R11]);
-    printf("  %%r12: %016lx    %%r13: %016lx\n",  cpu->reg[R12], cpu->reg[R13]);
-    printf("  %%r14: %016lx\n",  cpu->reg[R14]);
+    fprintf(out, "  %%rax: %016lx    %%rcx: %016lx\n",  cpu->reg[RAX],  cpu->reg[RCX]);
+    fprintf(out, "  %%rdx: %016lx    %%rbx: %016lx\n", cpu->reg[RDX], cpu->reg[RBX]);
+    fprintf(out, "  %%rsp: %016lx    %%rbp: %016lx\n",   cpu->reg[RSP],  cpu->reg[RBP]);
+    fprintf(out, "  %%rsi: %016lx    %%rdi: %016lx\n",  cpu->reg[RSI], cpu->reg[RDI]);
+    fprintf(out, "   %%r8: %016lx     %%r9: %016lx\n",  cpu->reg[R8], cpu->reg[R9]);
+    fprintf(out, "  %%r10: %016lx    %%r11: %016lx\n",  cpu->reg[R10], cpu->reg[R11]);
+    fprintf(out, "  %%r12: %016lx    %%r13: %016lx\n",  cpu->reg[R12], cpu->reg[R13]);
+    fprintf(out, "  %%r14: %016lx\n",  cpu->reg[R14]);
 }
 
 /**********************************************************************
@@ -376,12 +652,12 @@ void dump_cpu_state (y86_t *cpu) {
  *********************************************************************/
 
 //Print the current cpu state in text form
-void printCpuState(y86_t *cpu) {
+void printCpuState(FILE *out, y86_t *cpu) {
     switch(cpu->stat) {
-        case(AOK): printf("AOK\n"); break;
-        case(HLT): printf("HLT\n"); break;
-        case(ADR): printf("ADR\n"); break;
-        case(INS): printf("INS\n"); break;
+        case(AOK): fprintf(out, "AOK\n"); break;
+        case(HLT): fprintf(out, "HLT\n"); break;
+        case(ADR): fprintf(out, "ADR\n"); break;
+        case(INS): fprintf(out, "INS\n"); break;
     }
     return;
 }
@@ -37,6 +37,55 @@ y86_reg_t decode_execute (y86_t *cpu, y86_inst_t inst, bool *cnd, y86_reg_t *val
 void memory_wb_pc (y86_t *cpu, y86_inst_t inst, byte_t *memory,
         bool cnd, y86_reg_t valA, y86_reg_t valE);
 
+/**
+ * @brief Run one instruction through fetch, decode_execute and memory_wb_pc
+ *
+ * This is exactly one iteration of the -e loop, including its instruction
+ * count adjustment for invalid instructions and the ADR check on the new PC.
+ * Faster execution engines use it for anything they do not handle themselves.
+ *
+ * @param cpu Y86 CPU structure
+ * @param memory Pointer to beginning of the Y86 address space
+ * @param count Pointer to the running execution count to be updated
+ * @param store Set to the address written by the instruction, or MEMSIZE if
+ * it did not write memory
+ * @returns The instruction that was executed
+ */
+y86_inst_t step_reference (y86_t *cpu, byte_t *memory, int *count, address_t *store);
+
+/**
+ * @brief Evaluate a cmovXX/jXX condition against the CPU flags
+ *
+ * @param cpu Y86 CPU structure holding the flags
+ * @param ifun Condition (instruction function) of the cmov or jump
+ * @returns True if the move or jump should happen
+ */
+static inline bool check_cond (y86_t *cpu, int ifun) {
+    switch(ifun) {
+        case(JMP): return true;
+        case(JLE): return cpu->zf || (cpu->sf && !cpu->of) || (!cpu->sf && cpu->of);
+        case(JL):  return (cpu->sf && !cpu->of) || (!cpu->sf && cpu->of);
+        case(JE):  return cpu->zf;
+        case(JNE): return !cpu->zf;
+        case(JGE): return cpu->sf == cpu->of;
+        case(JG):  return !cpu->zf && cpu->sf == cpu->of;
+        default:   return false;
+    }
+}
+
+/**
+ * @brief Record an 8-byte store to flat memory in the CPU's dirty blocks
+ *
+ * @param cpu Y86 CPU structure holding the dirty bits
+ * @param addr Address of the store (below MEMSIZE)
+ */
+static inline void mark_dirty (y86_t *cpu, address_t addr) {
+    cpu->dirty |= (uint64_t) 1 << (addr / DIRTY_BLOCK);
+    //The last byte may fall in the next block
+    if(addr + sizeof(uint64_t) - 1 < MEMSIZE)
+        cpu->dirty |= (uint64_t) 1 << ((addr + sizeof(uint64_t) - 1) / DIRTY_BLOCK);
+}
+
 /**
  * @brief Print the program usage text
  *
@@ -57,6 +106,35 @@ void usage_p4 (char **argv);
  * @param disas_data Pointer to boolean flag for disassembling data segments
  * @param exec_normal Pointer to boolean flag for executing the program normally
  * @param exec_debug Pointer to boolean flag for executing the program w/ debug tracing
+ * @param exec_threaded Pointer to boolean flag for executing the program w/ threaded dispatch
+ * @param exec_blocks Pointer to boolean flag for executing the program w/ the block cache
+ * @param exec_jit Pointer to boolean flag for executing the program w/ the JIT
+ * @param exec_profile Pointer to boolean flag for executing the program w/ a flat profile
+ * @param exec_callgraph Pointer to boolean flag for executing the program w/ a call graph profile
+ * @param exec_cost Pointer to boolean flag for executing the program w/ a host cost profile
+ * @param translate_c Pointer to boolean flag for translating the program to C
+ * @param run_batch Pointer to boolean flag for running a batch of programs
+ * @param run_server Pointer to boolean flag for serving jobs on a socket
+ * @param run_fuzz Pointer to boolean flag for fuzzing inputs from stdin
+ * @param large_memory Pointer to boolean flag for paged 64-bit guest memory
+ * @param checkpoint Pointer to string buffer for the checkpoint file (NULL if none)
+ * @param checkpoint_every Pointer to the number of instructions between checkpoints
+ * @param resume Pointer to boolean flag for resuming from the checkpoint file
+ * @param trace_file Pointer to string buffer for the binary trace file (NULL if none)
+ * @param profile Pointer to boolean flag for profiling PCs and call targets
+ * @param cache_sim Pointer to boolean flag for simulating a data cache
+ * @param drop_events Pointer to boolean flag for dropping analysis events when behind
+ * @param plugins Array (PLUGIN_MAX long) of plugin specs to fill in
+ * @param nplugins Pointer to the number of plugin specs given
+ * @param stacks_file Pointer to string buffer for the collapsed stacks file (NULL if none)
+ * @param sample_hz Pointer to the PC sampling rate (0 if not sampling)
+ * @param sample_stacks Pointer to boolean flag for sampling callers too
+ * @param input_file Pointer to string buffer for the guest input file (NULL for stdin)
+ * @param record_file Pointer to string buffer for the input log to record (NULL if none)
+ * @param replay_file Pointer to string buffer for the input log to replay (NULL if none)
+ * @param devices Array (DEVICE_MAX long) of device specs to fill in
+ * @param ndevices Pointer to the number of device specs given
+ * @param mmio_base Pointer to where the device bus goes (0 for no bus)
  * @param filename Pointer to string buffer for Mini-ELF filename
  * @returns True if the command-line options were valid, false if not
  */
@@ -64,7 +142,14 @@ bool parse_command_line_p4 (int argc, char **argv,
         bool *print_header, bool *print_phdrs,
         bool *print_membrief, bool *print_memfull,
         bool *disas_code, bool *disas_data,
-        bool *exec_normal, bool *exec_debug, char **filename);
+        bool *exec_normal, bool *exec_debug, bool *exec_threaded,
+        bool *exec_blocks, bool *exec_jit, bool *exec_profile, bool *exec_callgraph, bool *exec_cost, bool *translate_c, bool *run_batch,
+        bool *run_server, bool *run_fuzz, bool *large_memory, char **checkpoint,
+        long *checkpoint_every, bool *resume, char **trace_file, bool *profile,
+        bool *cache_sim, bool *drop_events, char **plugins, int *nplugins,
+        char **stacks_file, long *sample_hz, bool *sample_stacks, char **input_file,
+        char **record_file, char **replay_file, char **devices, int *ndevices,
+        address_t *mmio_base, char **filename);
 
 /**
  * @brief Print info about a Y86 CPU to standard out
@@ -73,4 +158,12 @@ bool parse_command_line_p4 (int argc, char **argv,
  */
 void dump_cpu_state (y86_t *cpu);
 
+/**
+ * @brief Print info about a Y86 CPU to a stream (same format as dump_cpu_state)
+ *
+ * @param out Stream to print to
+ * @param cpu Pointer to Y86 CPU structure to print
+ */
+void fdump_cpu_state (FILE *out, y86_t *cpu);
+
 #endif
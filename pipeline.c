@@ -0,0 +1,146 @@
+/*
+ * CS 261: Asynchronous event pipeline for analyses of a run
+ *
+ * Name: Ben Berry
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sched.h>
+
+#include "pipeline.h"
+
+static void *drain (void *arg);
+static void deliver (pipeline_t *pl, const y86_event_t *ev);
+static y86_event_t *claim (pipeline_t *pl, bool must);
+
+/**********************************************************************
+ *                         PIPELINE FUNCTIONS
+ *********************************************************************/
+
+pipeline_t *pipeline_create (pipe_policy_t policy) {
+    pipeline_t *pl = (pipeline_t *) calloc(1, sizeof(pipeline_t));
+    if(pl == NULL)
+        return NULL;
+    pl->ring = (y86_event_t *) calloc(PIPE_SLOTS, sizeof(y86_event_t));
+    if(pl->ring == NULL) {
+        free(pl);
+        return NULL;
+    }
+    pl->policy = policy;
+    pl->limit = PIPE_SLOTS;
+    return pl;
+}
+
+bool pipeline_add (pipeline_t *pl, pipe_consumer_t c) {
+    if(pl == NULL || pl->running || c.event == NULL || pl->nconsumers == PIPE_CONSUMERS)
+        return false;
+    pl->consumers[pl->nconsumers++] = c;
+    return true;
+}
+
+bool pipeline_start (pipeline_t *pl) {
+    if(pl == NULL || pl->running)
+        return false;
+    pl->running = pthread_create(&pl->thread, NULL, drain, pl) == 0;
+    return pl->running;
+}
+
+y86_stat_t pipeline_run (pipeline_t *pl, y86_vm_t *vm, long budget) {
+    if(pl == NULL || vm == NULL || !pl->running)
+        return INS;
+    y86_t *cpu = &vm->cpu;
+    for(long i = 0; cpu->stat == AOK && (budget < 0 || i < budget); i++) {
+        address_t pc = cpu->pc;
+        y86_vm_step(vm);
+        //The event is built straight into its slot, then published
+        y86_event_t *ev = claim(pl, cpu->stat != AOK);
+        if(ev == NULL)
+            continue;
+        y86_vm_event(vm, pc, ev);
+        __atomic_store_n(&pl->head, pl->head + 1, __ATOMIC_RELEASE);
+        pl->published++;
+    }
+    //No more instructions: just the -e fix-up of the PC after ADR
+    return y86_vm_run(vm, 0);
+}
+
+void pipeline_finish (pipeline_t *pl, FILE *out) {
+    if(pl == NULL)
+        return;
+    if(pl->running) {
+        __atomic_store_n(&pl->done, true, __ATOMIC_RELEASE);
+        pthread_join(pl->thread, NULL);
+        pl->running = false;
+    }
+    for(int i = 0; out != NULL && i < pl->nconsumers; i++) {
+        if(pl->consumers[i].finish != NULL)
+            pl->consumers[i].finish(pl->consumers[i].state, out);
+    }
+}
+
+void pipeline_free (pipeline_t *pl) {
+    if(pl == NULL)
+        return;
+    pipeline_finish(pl, NULL);
+    free(pl->ring);
+    free(pl);
+}
+
+void dump_pipeline_stats (FILE *out, pipeline_t *pl) {
+    fprintf(out, "Pipeline: %lu events to %d consumer(s), %lu dropped, %lu stalls\n",
+            pl->published, pl->nconsumers, pl->dropped, pl->stalls);
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+//Find the slot for the next event, or NULL to drop it
+static y86_event_t *claim (pipeline_t *pl, bool must) {
+    //Only re-read tail (the consumer's cache line) when the last reading
+    //has been used up
+    if(pl->head == pl->limit) {
+        pl->limit = __atomic_load_n(&pl->tail, __ATOMIC_ACQUIRE) + PIPE_SLOTS;
+        while(pl->head == pl->limit) {
+            if(pl->policy == PIPE_DROP && !must) {
+                pl->dropped++;
+                return NULL;
+            }
+            pl->stalls++;
+            sched_yield();
+            pl->limit = __atomic_load_n(&pl->tail, __ATOMIC_ACQUIRE) + PIPE_SLOTS;
+        }
+    }
+    return &pl->ring[pl->head & (PIPE_SLOTS - 1)];
+}
+
+//Consumer thread: hand every published event to each consumer in turn
+static void *drain (void *arg) {
+    pipeline_t *pl = (pipeline_t *) arg;
+    uint64_t tail = pl->tail;
+    for(;;) {
+        //Check done before head, so nothing published before done is missed
+        bool done = __atomic_load_n(&pl->done, __ATOMIC_ACQUIRE);
+        uint64_t head = __atomic_load_n(&pl->head, __ATOMIC_ACQUIRE);
+        if(tail == head) {
+            if(done)
+                break;
+            sched_yield();
+            continue;
+        }
+        while(tail != head) {
+            deliver(pl, &pl->ring[tail & (PIPE_SLOTS - 1)]);
+            tail++;
+            if((tail & (PIPE_BATCH - 1)) == 0)
+                __atomic_store_n(&pl->tail, tail, __ATOMIC_RELEASE);
+        }
+        __atomic_store_n(&pl->tail, tail, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void deliver (pipeline_t *pl, const y86_event_t *ev) {
+    for(int i = 0; i < pl->nconsumers; i++)
+        pl->consumers[i].event(pl->consumers[i].state, ev);
+}
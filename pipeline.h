@@ -0,0 +1,130 @@
+#ifndef __CS261_PIPELINE__
+#define __CS261_PIPELINE__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "y86.h"
+#include "y86vm.h"
+
+/* Events the ring holds (a power of two) */
+#define PIPE_SLOTS (1 << 14)
+
+/* Events the consumer handles before handing their slots back */
+#define PIPE_BATCH 1024
+
+/* Most consumers one pipeline can feed */
+#define PIPE_CONSUMERS 8
+
+/* Bytes kept between the producer's and the consumer's fields, so the two
+   threads never write to the same cache line */
+#define PIPE_LINE 64
+
+/* What the producer does when the ring is full */
+typedef enum { PIPE_BLOCK, PIPE_DROP } pipe_policy_t;
+
+/* An analysis fed every event of a run, on the pipeline's thread */
+typedef struct pipe_consumer {
+    const char *name;           // for reports
+    void *state;                // passed to both callbacks
+    void (*event)(void *state, const y86_event_t *ev);
+    void (*finish)(void *state, FILE *out);     // report once the run is over
+                                                // (may be NULL)
+} pipe_consumer_t;
+
+/* Single-producer, single-consumer event ring. The thread running the VM
+   is the only one to move head and the pipeline's thread the only one to
+   move tail, so neither needs a lock: each slot is filled before head is
+   published past it and read before tail is published past it. */
+typedef struct pipeline {
+
+    y86_event_t *ring;          // PIPE_SLOTS events
+    pipe_policy_t policy;
+    pipe_consumer_t consumers[PIPE_CONSUMERS];
+    int nconsumers;
+    pthread_t thread;
+    bool running;               // the thread has not been joined yet
+
+    byte_t pad0[PIPE_LINE];
+    uint64_t head;              // events published (producer writes)
+    uint64_t limit;             // head may go this far before tail is read again
+    uint64_t published;         // events handed to the ring
+    uint64_t dropped;           // events lost to a full ring (PIPE_DROP)
+    uint64_t stalls;            // times the producer waited (PIPE_BLOCK)
+    bool done;                  // no more events will be published
+
+    byte_t pad1[PIPE_LINE];
+    uint64_t tail;              // events consumed (consumer writes)
+
+    byte_t pad2[PIPE_LINE];
+
+} pipeline_t;
+
+/**
+ * @brief Create an empty pipeline
+ *
+ * @param policy What to do when the ring is full: wait for the consumers
+ * (PIPE_BLOCK) or count the event as dropped and carry on (PIPE_DROP)
+ * @returns New pipeline, or NULL on failure
+ */
+pipeline_t *pipeline_create (pipe_policy_t policy);
+
+/**
+ * @brief Register a consumer (before pipeline_start())
+ *
+ * @param pl Pipeline
+ * @param c Consumer to feed, after those added before it
+ * @returns True if there was room for it
+ */
+bool pipeline_add (pipeline_t *pl, pipe_consumer_t c);
+
+/**
+ * @brief Start the thread that feeds events to the consumers
+ *
+ * @param pl Pipeline
+ * @returns True if the thread was started
+ */
+bool pipeline_start (pipeline_t *pl);
+
+/**
+ * @brief Run the VM like y86_vm_run(), publishing an event per instruction
+ *
+ * The event for the instruction that stops the CPU is never dropped.
+ *
+ * @param pl Started pipeline
+ * @param vm VM to run
+ * @param budget Maximum number of instructions to execute, or -1 for no limit
+ * @returns CPU status when the run stopped (AOK if the budget ran out)
+ */
+y86_stat_t pipeline_run (pipeline_t *pl, y86_vm_t *vm, long budget);
+
+/**
+ * @brief Wait for the consumers to drain the ring, then have them report
+ *
+ * @param pl Pipeline (no more events may be published)
+ * @param out Stream for the consumers' reports
+ */
+void pipeline_finish (pipeline_t *pl, FILE *out);
+
+/**
+ * @brief Release a pipeline (finishing it first, silently, if need be)
+ *
+ * Consumer state belongs to whoever registered it and is not freed.
+ *
+ * @param pl Pipeline to be freed (may be NULL)
+ */
+void pipeline_free (pipeline_t *pl);
+
+/**
+ * @brief Print pipeline counters
+ *
+ * @param out Stream to print to
+ * @param pl Pipeline to describe
+ */
+void dump_pipeline_stats (FILE *out, pipeline_t *pl);
+
+#endif
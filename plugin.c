@@ -0,0 +1,189 @@
+/*
+ * CS 261: Instrumentation plugins for the run loop
+ *
+ * Name: Ben Berry
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <dlfcn.h>
+
+#include "plugin.h"
+#include "p4-interp.h"
+
+static void dispatch (y86_hooks_t *hooks, y86_vm_t *vm, address_t pc);
+static void memory_hooks (y86_hooks_t *hooks, y86_vm_t *vm, address_t pc);
+static void control_hooks (y86_hooks_t *hooks, y86_vm_t *vm, address_t pc);
+static bool readable (y86_vm_t *vm, address_t addr, uint64_t *value);
+
+/**********************************************************************
+ *                         PLUGIN FUNCTIONS
+ *********************************************************************/
+
+bool plugin_register (y86_vm_t *vm, const y86_plugin_t *plugin) {
+    if(vm == NULL || plugin == NULL)
+        return false;
+    if(vm->hooks == NULL) {
+        vm->hooks = (y86_hooks_t *) calloc(1, sizeof(y86_hooks_t));
+        if(vm->hooks == NULL)
+            return false;
+    }
+    y86_hooks_t *hooks = vm->hooks;
+    if(hooks->nplugins == PLUGIN_MAX)
+        return false;
+    hooks->handles[hooks->nplugins] = NULL;
+    hooks->plugins[hooks->nplugins++] = *plugin;
+    hooks->events |= plugin->retire != NULL;
+    hooks->memory |= plugin->mem_read != NULL || plugin->mem_write != NULL;
+    hooks->control |= plugin->branch != NULL || plugin->call != NULL || plugin->ret != NULL;
+    hooks->status |= plugin->status != NULL;
+    return true;
+}
+
+bool plugin_load (y86_vm_t *vm, const char *spec) {
+    if(vm == NULL || spec == NULL)
+        return false;
+    //Split "path,args" (the path is copied to end it at the comma)
+    const char *comma = strchr(spec, ',');
+    size_t len = (comma != NULL) ? (size_t) (comma - spec) : strlen(spec);
+    char *path = (char *) malloc(len + 1);
+    if(path == NULL)
+        return false;
+    memcpy(path, spec, len);
+    path[len] = '\0';
+
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    free(path);
+    if(handle == NULL) {
+        fprintf(stderr, "%s\n", dlerror());
+        return false;
+    }
+    //POSIX's way round C forbidding object-to-function pointer casts
+    plugin_init_t init = NULL;
+    *(void **) (&init) = dlsym(handle, PLUGIN_ENTRY);
+    y86_plugin_t plugin;
+    memset(&plugin, 0x00, sizeof(plugin));
+    if(init == NULL || !init(&plugin, (comma != NULL) ? comma + 1 : "")) {
+        dlclose(handle);
+        return false;
+    }
+    if(!plugin_register(vm, &plugin)) {
+        if(plugin.unload != NULL)
+            plugin.unload(plugin.state);
+        dlclose(handle);
+        return false;
+    }
+    vm->hooks->handles[vm->hooks->nplugins - 1] = handle;
+    return true;
+}
+
+void plugin_run (y86_vm_t *vm, long budget) {
+    if(vm == NULL || vm->hooks == NULL)
+        return;
+    y86_hooks_t *hooks = vm->hooks;
+    y86_t *cpu = &vm->cpu;
+    for(long i = 0; cpu->stat == AOK && (budget < 0 || i < budget); i++) {
+        address_t pc = cpu->pc;
+        y86_vm_step(vm);
+        dispatch(hooks, vm, pc);
+    }
+}
+
+void plugin_finish (y86_vm_t *vm, FILE *out) {
+    if(vm == NULL || vm->hooks == NULL || out == NULL)
+        return;
+    for(int i = 0; i < vm->hooks->nplugins; i++) {
+        y86_plugin_t *p = &vm->hooks->plugins[i];
+        if(p->finish != NULL)
+            p->finish(p->state, out);
+    }
+}
+
+void plugin_release (y86_vm_t *vm) {
+    if(vm == NULL || vm->hooks == NULL)
+        return;
+    //Newest first, so a plugin never outlives one it was added after
+    for(int i = vm->hooks->nplugins - 1; i >= 0; i--) {
+        y86_plugin_t *p = &vm->hooks->plugins[i];
+        if(p->unload != NULL)
+            p->unload(p->state);
+        if(vm->hooks->handles[i] != NULL)
+            dlclose(vm->hooks->handles[i]);
+    }
+    free(vm->hooks);
+    vm->hooks = NULL;
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+//Call the hooks for the instruction just stepped, kind by kind, skipping
+//the kinds no plugin asked for
+static void dispatch (y86_hooks_t *hooks, y86_vm_t *vm, address_t pc) {
+    if(hooks->events) {
+        y86_event_t ev;
+        y86_vm_event(vm, pc, &ev);
+        for(int i = 0; i < hooks->nplugins; i++) {
+            if(hooks->plugins[i].retire != NULL)
+                hooks->plugins[i].retire(hooks->plugins[i].state, &ev);
+        }
+    }
+    if(hooks->memory)
+        memory_hooks(hooks, vm, pc);
+    if(hooks->control)
+        control_hooks(hooks, vm, pc);
+    if(hooks->status && vm->cpu.stat != AOK) {
+        for(int i = 0; i < hooks->nplugins; i++) {
+            if(hooks->plugins[i].status != NULL)
+                hooks->plugins[i].status(hooks->plugins[i].state, pc, vm->cpu.stat);
+        }
+    }
+}
+
+static void memory_hooks (y86_hooks_t *hooks, y86_vm_t *vm, address_t pc) {
+    y86_icode_t icode = vm->last.icode;
+    uint64_t value;
+    if((icode == MRMOVQ || icode == POPQ || icode == RET) && readable(vm, vm->load, &value)) {
+        for(int i = 0; i < hooks->nplugins; i++) {
+            if(hooks->plugins[i].mem_read != NULL)
+                hooks->plugins[i].mem_read(hooks->plugins[i].state, pc, vm->load, value);
+        }
+    } else if((icode == RMMOVQ || icode == PUSHQ || icode == CALL || io_stores(&vm->last))
+            && readable(vm, vm->store, &value)) {
+        for(int i = 0; i < hooks->nplugins; i++) {
+            if(hooks->plugins[i].mem_write != NULL)
+                hooks->plugins[i].mem_write(hooks->plugins[i].state, pc, vm->store, value);
+        }
+    }
+}
+
+static void control_hooks (y86_hooks_t *hooks, y86_vm_t *vm, address_t pc) {
+    y86_inst_t *ins = &vm->last;
+    uint64_t value;
+    //A bad jump condition is INS, not a branch
+    if(ins->icode == JUMP && vm->cpu.stat != INS) {
+        //Jumps leave the flags alone, so the condition still says what happened
+        //(the PC cannot tell when the target is the next instruction)
+        bool taken = check_cond(&vm->cpu, ins->ifun.jump);
+        for(int i = 0; i < hooks->nplugins; i++) {
+            if(hooks->plugins[i].branch != NULL)
+                hooks->plugins[i].branch(hooks->plugins[i].state, pc, ins->valC.dest, taken);
+        }
+    } else if(ins->icode == CALL && readable(vm, vm->store, &value)) {
+        for(int i = 0; i < hooks->nplugins; i++) {
+            if(hooks->plugins[i].call != NULL)
+                hooks->plugins[i].call(hooks->plugins[i].state, pc, ins->valC.dest, ins->valP);
+        }
+    } else if(ins->icode == RET && readable(vm, vm->load, &value)) {
+        for(int i = 0; i < hooks->nplugins; i++) {
+            if(hooks->plugins[i].ret != NULL)
+                hooks->plugins[i].ret(hooks->plugins[i].state, pc, value);
+        }
+    }
+}
+
+//Read the eight bytes an access covered, if they lie in guest memory
+static bool readable (y86_vm_t *vm, address_t addr, uint64_t *value) {
+    return y86_vm_read_mem(vm, addr, value, sizeof(uint64_t));
+}
@@ -0,0 +1,114 @@
+#ifndef __CS261_PLUGIN__
+#define __CS261_PLUGIN__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "y86.h"
+#include "y86vm.h"
+
+/* Most plugins one VM can have */
+#define PLUGIN_MAX 8
+
+/* Symbol a shared-object plugin exports (see plugin_init_t) */
+#define PLUGIN_ENTRY "y86_plugin_init"
+
+/* Instrumentation callbacks, each called right after the instruction that
+   caused it has executed. Any callback may be NULL; the run loop only pays
+   for the kinds some plugin asked for. */
+typedef struct y86_plugin {
+    const char *name;           // for messages
+    void *state;                // passed to every callback
+
+    //Every instruction
+    void (*retire)(void *state, const y86_event_t *ev);
+    //mrmovq, popq and ret reads, and rmmovq, pushq and call writes (only
+    //accesses of eight bytes inside guest memory)
+    void (*mem_read)(void *state, address_t pc, address_t addr, uint64_t value);
+    void (*mem_write)(void *state, address_t pc, address_t addr, uint64_t value);
+    //Conditional and unconditional jumps
+    void (*branch)(void *state, address_t pc, address_t target, bool taken);
+    //Calls that pushed their return address, and rets that popped one
+    void (*call)(void *state, address_t pc, address_t target, address_t ret);
+    void (*ret)(void *state, address_t pc, address_t target);
+    //The CPU left AOK (stat is HLT, ADR or INS)
+    void (*status)(void *state, address_t pc, y86_stat_t stat);
+
+    void (*finish)(void *state, FILE *out);     // report once the run is over
+    void (*unload)(void *state);                // release state
+} y86_plugin_t;
+
+/**
+ * @brief Entry point of a shared-object plugin
+ *
+ * @param plugin Zeroed plugin to fill in
+ * @param args Text after the first ',' in --plugin, or "" if none
+ * @returns True if the plugin is ready to use
+ */
+typedef bool (*plugin_init_t) (y86_plugin_t *plugin, const char *args);
+
+/* A VM's plugins, split by callback so the run loop walks short lists */
+typedef struct y86_hooks {
+
+    y86_plugin_t plugins[PLUGIN_MAX];
+    void *handles[PLUGIN_MAX];  // dlopen() handle of each, or NULL if built in
+    int nplugins;
+
+    bool events;                // some plugin wants retire (needs a full event)
+    bool memory;                // some plugin wants mem_read or mem_write
+    bool control;               // some plugin wants branch, call or ret
+    bool status;                // some plugin wants status
+
+} y86_hooks_t;
+
+/**
+ * @brief Add a plugin to a VM
+ *
+ * Once a VM has plugins, y86_vm_run() switches to its instrumented loop.
+ * VMs without them keep the plain loop, which has no hooks compiled in.
+ *
+ * @param vm VM to instrument
+ * @param plugin Callbacks to add (copied)
+ * @returns True if there was room for it
+ */
+bool plugin_register (y86_vm_t *vm, const y86_plugin_t *plugin);
+
+/**
+ * @brief Load a plugin from a shared object and add it to a VM
+ *
+ * @param vm VM to instrument
+ * @param spec Path of the shared object, optionally followed by ',' and
+ * arguments for its entry point
+ * @returns True if the object was loaded, its PLUGIN_ENTRY succeeded and
+ * there was room for it
+ */
+bool plugin_load (y86_vm_t *vm, const char *spec);
+
+/**
+ * @brief Run the VM's instrumented loop (y86_vm_run() does this for VMs
+ * with plugins)
+ *
+ * @param vm VM with plugins
+ * @param budget Maximum number of instructions to execute, or -1 for no limit
+ */
+void plugin_run (y86_vm_t *vm, long budget);
+
+/**
+ * @brief Have every plugin report
+ *
+ * @param vm VM whose plugins should report
+ * @param out Stream for the reports
+ */
+void plugin_finish (y86_vm_t *vm, FILE *out);
+
+/**
+ * @brief Unload every plugin (y86_vm_free() does this)
+ *
+ * @param vm VM whose plugins should be released
+ */
+void plugin_release (y86_vm_t *vm);
+
+#endif
@@ -0,0 +1,570 @@
+/*
+ * CS 261: Sparse paged guest memory
+ *
+ * Name: Ben Berry
+ */
+
+#include "pmem.h"
+
+/* What every untouched page reads as */
+static const byte_t zero_page[PMEM_PAGESIZE];
+
+/* Low bits of a last-level table entry: the page is borrowed (pmem_map), it
+   has been written since tracking began (pmem_track), or it is borrowed and
+   written in place (pmem_map_shared). Borrowed pages are never marked as
+   written, so that pair instead tags a device's claim on the page
+   (pmem_claim), whose entry points at the region rather than at bytes. */
+#define BORROWED ((uintptr_t) 1)
+#define DIRTY    ((uintptr_t) 2)
+#define SHARED   ((uintptr_t) 4)
+#define TAGS     (BORROWED | DIRTY | SHARED)
+#define REGION   (BORROWED | DIRTY)
+
+static bool map_page (pmem_t *pm, address_t addr, const byte_t *page, uintptr_t tags);
+static void **slot (pmem_t *pm, address_t addr, bool allocate);
+static byte_t *find_page (pmem_t *pm, address_t addr, bool *writable, pmem_region_t **region);
+static byte_t *own_page (pmem_t *pm, address_t addr, pmem_region_t **region);
+static void copy_out (pmem_t *pm, address_t addr, void *buf, size_t len, bool devices);
+static void replace (pmem_t *pm, void **entry);
+static uint64_t device_read (pmem_t *pm, pmem_region_t *region, address_t addr, size_t len);
+static void device_write (pmem_t *pm, pmem_region_t *region, address_t addr, uint64_t value,
+        size_t len);
+static bool is_region (void *entry);
+static byte_t *untag (void *entry);
+static void drop_tlb (pmem_t *pm, address_t addr);
+static void free_table (void **table, int level);
+static void **copy_table (pmem_t *dst, void **src, int level);
+static bool walk_table (void **table, int level, address_t base,
+        bool (*visit) (address_t addr, const byte_t *page, void *arg), void *arg);
+static void flush_tlb (pmem_t *pm);
+
+/**********************************************************************
+ *                         PAGING FUNCTIONS
+ *********************************************************************/
+
+pmem_t *pmem_create (void) {
+    pmem_t *pm = (pmem_t *) calloc(1, sizeof(pmem_t));
+    if(pm == NULL)
+        return NULL;
+    pm->root = (void **) calloc(PMEM_FANOUT, sizeof(void *));
+    if(pm->root == NULL) {
+        free(pm);
+        return NULL;
+    }
+    pm->tables = 1;
+    flush_tlb(pm);
+    return pm;
+}
+
+void pmem_free (pmem_t *pm) {
+    if(pm == NULL)
+        return;
+    free_table(pm->root, 0);
+    free(pm->dirty);
+    free(pm);
+}
+
+void pmem_clear (pmem_t *pm) {
+    if(pm == NULL)
+        return;
+    //Free everything below the root, but keep the root itself
+    for(int i = 0; i < PMEM_FANOUT; i++) {
+        free_table((void **) pm->root[i], 1);
+        pm->root[i] = NULL;
+    }
+    pm->pages = 0;
+    pm->borrowed = 0;
+    pm->claimed = 0;
+    pm->tables = 1;
+    pm->tlbmisses = 0;
+    pm->ndirty = 0;
+    flush_tlb(pm);
+}
+
+bool pmem_copy (pmem_t *dst, pmem_t *src) {
+    if(dst == NULL || src == NULL)
+        return false;
+    pmem_clear(dst);
+    //Duplicate the tree below the root, allocating only what src has
+    for(int i = 0; i < PMEM_FANOUT; i++) {
+        if(src->root[i] == NULL)
+            continue;
+        dst->root[i] = copy_table(dst, (void **) src->root[i], 1);
+        if(dst->root[i] == NULL) {
+            pmem_clear(dst);
+            return false;
+        }
+    }
+    return true;
+}
+
+void pmem_track (pmem_t *pm) {
+    if(pm == NULL)
+        return;
+    for(size_t i = 0; i < pm->ndirty; i++) {
+        void **entry = slot(pm, pm->dirty[i] << PMEM_PAGEBITS, false);
+        if(entry != NULL && *entry != NULL && !is_region(*entry))
+            *entry = (void *) ((uintptr_t) *entry & ~DIRTY);
+    }
+    pm->ndirty = 0;
+    //Send the next store to every page through the slow path
+    for(int i = 0; i < PMEM_TLBSIZE; i++)
+        pm->tlb[i].writable = false;
+}
+
+void pmem_revert (pmem_t *pm, pmem_t *src) {
+    if(pm == NULL || src == NULL)
+        return;
+    for(size_t i = 0; i < pm->ndirty; i++) {
+        address_t addr = pm->dirty[i] << PMEM_PAGEBITS;
+        void **entry = slot(pm, addr, false);
+        //Skip pages that were since replaced by pmem_map() or pmem_claim()
+        if(entry == NULL || *entry == NULL || ((uintptr_t) *entry & DIRTY) == 0
+                || is_region(*entry))
+            continue;
+        void **from = slot(src, addr, false);
+        void *original = (from != NULL) ? *from : NULL;
+        if(original != NULL && ((uintptr_t) original & BORROWED) == 0) {
+            //src has its own copy: put its bytes back in place
+            memcpy(untag(*entry), untag(original), PMEM_PAGESIZE);
+            *entry = untag(*entry);
+        } else {
+            //src never had the page, or borrowed it: share that again
+            free(untag(*entry));
+            pm->pages--;
+            *entry = original;
+            if(original != NULL && is_region(original))
+                pm->claimed++;
+            else if(original != NULL)
+                pm->borrowed++;
+        }
+    }
+    pm->ndirty = 0;
+    flush_tlb(pm);
+}
+
+bool pmem_map (pmem_t *pm, address_t addr, const byte_t *page) {
+    return map_page(pm, addr, page, BORROWED);
+}
+
+bool pmem_map_shared (pmem_t *pm, address_t addr, byte_t *page) {
+    return map_page(pm, addr, page, BORROWED | SHARED);
+}
+
+bool pmem_claim (pmem_t *pm, pmem_region_t *region) {
+    if(pm == NULL || region == NULL || (uintptr_t) region % sizeof(uint64_t) != 0
+            || region->base % PMEM_PAGESIZE != 0 || region->size % PMEM_PAGESIZE != 0
+            || (region->size > 0 && region->size - 1 > UINT64_MAX - region->base))
+        return false;
+    for(uint64_t i = 0; i < region->size; i += PMEM_PAGESIZE) {
+        void **entry = slot(pm, region->base + i, true);
+        if(entry == NULL)
+            return false;
+        replace(pm, entry);
+        *entry = (void *) ((uintptr_t) region | REGION);
+        pm->claimed++;
+        //Claimed pages must never be reached through the TLB
+        drop_tlb(pm, region->base + i);
+    }
+    return true;
+}
+
+void pmem_read (pmem_t *pm, address_t addr, void *buf, size_t len) {
+    copy_out(pm, addr, buf, len, true);
+}
+
+void pmem_fetch_slow (pmem_t *pm, address_t addr, void *buf, size_t len) {
+    address_t offset = addr & (PMEM_PAGESIZE - 1);
+    pm->tlbmisses++;
+    if(len > PMEM_PAGESIZE - offset) {
+        copy_out(pm, addr, buf, len, false);
+        return;
+    }
+
+    //Within one page: refill the TLB entry as a load would (device pages
+    //stay out of it and read as zero)
+    bool writable = false;
+    pmem_region_t *region = NULL;
+    byte_t *page = find_page(pm, addr, &writable, &region);
+    if(region != NULL) {
+        memset(buf, 0x00, len);
+        return;
+    }
+    pmem_tlb_t *entry = &pm->tlb[(addr >> PMEM_PAGEBITS) % PMEM_TLBSIZE];
+    entry->vpn = addr >> PMEM_PAGEBITS;
+    entry->page = (page != NULL) ? page : (byte_t *) zero_page;
+    entry->writable = page != NULL && writable;
+    memcpy(buf, &entry->page[offset], len);
+}
+
+bool pmem_write (pmem_t *pm, address_t addr, const void *buf, size_t len) {
+    const byte_t *in = (const byte_t *) buf;
+    while(len > 0) {
+        address_t offset = addr & (PMEM_PAGESIZE - 1);
+        size_t chunk = PMEM_PAGESIZE - offset;
+        if(chunk > len)
+            chunk = len;
+        pmem_region_t *region = NULL;
+        byte_t *page = own_page(pm, addr, &region);
+        if(page == NULL && region == NULL)
+            return false;
+        if(page != NULL) {
+            memcpy(&page[offset], in, chunk);
+        } else {
+            for(size_t done = 0, n = 0; done < chunk; done += n) {
+                n = sizeof(uint64_t) - ((addr + done) & (sizeof(uint64_t) - 1));
+                if(n > chunk - done)
+                    n = chunk - done;
+                uint64_t value = 0;
+                memcpy(&value, &in[done], n);
+                device_write(pm, region, addr + done, value, n);
+            }
+        }
+        in += chunk;
+        addr += chunk;
+        len -= chunk;
+    }
+    return true;
+}
+
+bool pmem_walk (pmem_t *pm, bool (*visit) (address_t addr, const byte_t *page, void *arg), void *arg) {
+    if(pm == NULL || visit == NULL)
+        return false;
+    return walk_table(pm->root, 0, 0, visit, arg);
+}
+
+bool pmem_load_segment (FILE *file, pmem_t *pm, elf_phdr_t *phdr) {
+    //Check for null parameters
+    if(file == NULL || pm == NULL || phdr == NULL)
+        return false;
+
+    //Return false if seeking fails.
+    if(fseek(file, phdr->p_offset, SEEK_SET) != 0)
+        return false;
+
+    //Read the segment a page at a time, straight into the address space
+    byte_t buf[PMEM_PAGESIZE];
+    address_t addr = phdr->p_vaddr;
+    size_t left = phdr->p_size;
+    while(left > 0) {
+        size_t chunk = left < PMEM_PAGESIZE ? left : PMEM_PAGESIZE;
+        if(fread(buf, chunk, 1, file) != 1 || !pmem_write(pm, addr, buf, chunk))
+            return false;
+        addr += chunk;
+        left -= chunk;
+    }
+    return true;
+}
+
+void dump_pmem_stats (FILE *out, pmem_t *pm) {
+    fprintf(out, "Paged memory: %lu pages (%lu borrowed), %lu tables (%lu KiB), %lu TLB misses\n",
+            pm->pages + pm->borrowed, pm->borrowed, pm->tables,
+            (pm->pages * PMEM_PAGESIZE + pm->tables * PMEM_FANOUT * sizeof(void *)) / 1024,
+            pm->tlbmisses);
+    if(pm->claimed > 0)
+        fprintf(out, "Device pages: %lu, %lu accesses\n", pm->claimed, pm->accesses);
+}
+
+uint64_t pmem_load_slow (pmem_t *pm, address_t addr) {
+    address_t offset = addr & (PMEM_PAGESIZE - 1);
+    uint64_t value;
+    pm->tlbmisses++;
+
+    //Crossing into the next page: assemble the value from both
+    if(offset > PMEM_PAGESIZE - sizeof(uint64_t)) {
+        pmem_read(pm, addr, &value, sizeof(value));
+        return value;
+    }
+
+    //Refill the TLB entry, mapping untouched pages to the zero page (device
+    //pages are never entered, so every access to them comes back here)
+    pmem_tlb_t *entry = &pm->tlb[(addr >> PMEM_PAGEBITS) % PMEM_TLBSIZE];
+    bool writable = false;
+    pmem_region_t *region = NULL;
+    byte_t *page = find_page(pm, addr, &writable, &region);
+    if(region != NULL)
+        return device_read(pm, region, addr, sizeof(uint64_t));
+    entry->vpn = addr >> PMEM_PAGEBITS;
+    entry->page = (page != NULL) ? page : (byte_t *) zero_page;
+    entry->writable = page != NULL && writable;
+    return *((uint64_t *) &entry->page[offset]);
+}
+
+bool pmem_store_slow (pmem_t *pm, address_t addr, uint64_t value) {
+    address_t offset = addr & (PMEM_PAGESIZE - 1);
+    pm->tlbmisses++;
+
+    //Crossing into the next page: write both parts
+    if(offset > PMEM_PAGESIZE - sizeof(uint64_t))
+        return pmem_write(pm, addr, &value, sizeof(value));
+
+    //First write to a page allocates (or copies) it; refill the TLB entry
+    pmem_region_t *region = NULL;
+    byte_t *page = own_page(pm, addr, &region);
+    if(region != NULL) {
+        device_write(pm, region, addr, value, sizeof(uint64_t));
+        return true;
+    }
+    if(page == NULL)
+        return false;
+    pmem_tlb_t *entry = &pm->tlb[(addr >> PMEM_PAGEBITS) % PMEM_TLBSIZE];
+    entry->vpn = addr >> PMEM_PAGEBITS;
+    entry->page = page;
+    entry->writable = true;
+    *((uint64_t *) &page[offset]) = value;
+    return true;
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+//Put borrowed bytes in place of a page, whatever it held before
+static bool map_page (pmem_t *pm, address_t addr, const byte_t *page, uintptr_t tags) {
+    //The tag bits must be free, and aligned bytes keep aligned loads aligned
+    if((uintptr_t) page % sizeof(uint64_t) != 0)
+        return false;
+    void **entry = slot(pm, addr, true);
+    if(entry == NULL)
+        return false;
+    replace(pm, entry);
+    *entry = (void *) ((uintptr_t) page | tags);
+    pm->borrowed++;
+    drop_tlb(pm, addr);
+    return true;
+}
+
+//Bit position of the page table index used at a level (0 is the root)
+static int level_shift (int level) {
+    return PMEM_PAGEBITS + PMEM_LEVELBITS * (PMEM_LEVELS - 1 - level);
+}
+
+//Find the last-level table entry for an address's page. With allocate set,
+//missing tables are created on the way; otherwise NULL means "never written".
+static void **slot (pmem_t *pm, address_t addr, bool allocate) {
+    void **table = pm->root;
+    for(int level = 0; level < PMEM_LEVELS - 1; level++) {
+        int index = (addr >> level_shift(level)) & (PMEM_FANOUT - 1);
+        if(table[index] == NULL) {
+            if(!allocate)
+                return NULL;
+            table[index] = calloc(PMEM_FANOUT, sizeof(void *));
+            if(table[index] == NULL)
+                return NULL;
+            pm->tables++;
+        }
+        table = (void **) table[index];
+    }
+    return &table[(addr >> PMEM_PAGEBITS) & (PMEM_FANOUT - 1)];
+}
+
+//Find the bytes of an address's page for reading (NULL if never written,
+//or if a device claimed it, which sets region). Only pages of our own that
+//are already recorded as written, and shared pages, may be stored to in
+//place; anything else has to go through own_page() first.
+static byte_t *find_page (pmem_t *pm, address_t addr, bool *writable, pmem_region_t **region) {
+    void **entry = slot(pm, addr, false);
+    if(entry == NULL || *entry == NULL)
+        return NULL;
+    if(is_region(*entry)) {
+        *region = (pmem_region_t *) untag(*entry);
+        return NULL;
+    }
+    *writable = ((uintptr_t) *entry & TAGS) == DIRTY || ((uintptr_t) *entry & SHARED) != 0;
+    return untag(*entry);
+}
+
+//Find the bytes of an address's page for writing, allocating a zero-filled
+//page on first touch, replacing a borrowed page with a private copy, and
+//recording the page as written (shared pages are written where they are,
+//and never recorded; device pages set region instead)
+static byte_t *own_page (pmem_t *pm, address_t addr, pmem_region_t **region) {
+    void **entry = slot(pm, addr, true);
+    if(entry == NULL)
+        return NULL;
+    if(is_region(*entry)) {
+        *region = (pmem_region_t *) untag(*entry);
+        return NULL;
+    }
+    if(((uintptr_t) *entry & SHARED) != 0)
+        return untag(*entry);
+    if(*entry == NULL || ((uintptr_t) *entry & BORROWED) != 0) {
+        byte_t *page = (byte_t *) malloc(PMEM_PAGESIZE);
+        if(page == NULL)
+            return NULL;
+        if(*entry == NULL) {
+            memset(page, 0x00, PMEM_PAGESIZE);
+        } else {
+            memcpy(page, untag(*entry), PMEM_PAGESIZE);
+            pm->borrowed--;
+        }
+        *entry = page;
+        pm->pages++;
+        //A read-only mapping of this page is now stale
+        drop_tlb(pm, addr);
+    }
+    if(((uintptr_t) *entry & DIRTY) == 0) {
+        if(pm->ndirty == pm->dirtycap) {
+            size_t cap = (pm->dirtycap == 0) ? 64 : pm->dirtycap * 2;
+            address_t *list = (address_t *) realloc(pm->dirty, cap * sizeof(address_t));
+            if(list == NULL)
+                return NULL;
+            pm->dirty = list;
+            pm->dirtycap = cap;
+        }
+        pm->dirty[pm->ndirty++] = addr >> PMEM_PAGEBITS;
+        *entry = (void *) ((uintptr_t) *entry | DIRTY);
+    }
+    return untag(*entry);
+}
+
+//Free a table at some level and everything under it
+static void free_table (void **table, int level) {
+    if(table == NULL)
+        return;
+    for(int i = 0; level < PMEM_LEVELS - 1 && i < PMEM_FANOUT; i++)
+        free_table((void **) table[i], level + 1);
+    if(level == PMEM_LEVELS - 1) {
+        //Tables at the last level point at pages; borrowed ones are not ours
+        for(int i = 0; i < PMEM_FANOUT; i++) {
+            if(((uintptr_t) table[i] & BORROWED) == 0)
+                free(untag(table[i]));
+        }
+    }
+    free(table);
+}
+
+//Duplicate a table at some level (not the root) and everything under it
+static void **copy_table (pmem_t *dst, void **src, int level) {
+    void **table = (void **) calloc(PMEM_FANOUT, sizeof(void *));
+    if(table == NULL)
+        return NULL;
+    dst->tables++;
+    for(int i = 0; i < PMEM_FANOUT; i++) {
+        if(src[i] == NULL)
+            continue;
+        if(level == PMEM_LEVELS - 1 && is_region(src[i])) {
+            //So are device claims
+            table[i] = src[i];
+            dst->claimed++;
+        } else if(level == PMEM_LEVELS - 1 && ((uintptr_t) src[i] & BORROWED) != 0) {
+            //Borrowed pages are shared, not copied
+            table[i] = src[i];
+            dst->borrowed++;
+        } else if(level == PMEM_LEVELS - 1) {
+            table[i] = malloc(PMEM_PAGESIZE);
+            if(table[i] != NULL) {
+                memcpy(table[i], untag(src[i]), PMEM_PAGESIZE);
+                dst->pages++;
+            }
+        } else {
+            table[i] = copy_table(dst, (void **) src[i], level + 1);
+        }
+        if(table[i] == NULL) {
+            free_table(table, level);
+            return NULL;
+        }
+    }
+    return table;
+}
+
+//Visit the pages under a table at some level, whose first address is base
+static bool walk_table (void **table, int level, address_t base,
+        bool (*visit) (address_t addr, const byte_t *page, void *arg), void *arg) {
+    for(int i = 0; i < PMEM_FANOUT; i++) {
+        //Device pages hold no bytes of their own
+        if(table[i] == NULL || (level == PMEM_LEVELS - 1 && is_region(table[i])))
+            continue;
+        address_t addr = base | ((address_t) i << level_shift(level));
+        bool ok = (level == PMEM_LEVELS - 1) ? visit(addr, untag(table[i]), arg)
+                : walk_table((void **) table[i], level + 1, addr, visit, arg);
+        if(!ok)
+            return false;
+    }
+    return true;
+}
+
+//Copy bytes out page by page, asking devices for theirs only if devices
+//is set (otherwise their pages read as zero)
+static void copy_out (pmem_t *pm, address_t addr, void *buf, size_t len, bool devices) {
+    byte_t *out = (byte_t *) buf;
+    //Copy page by page; pages never written read as zero
+    while(len > 0) {
+        address_t offset = addr & (PMEM_PAGESIZE - 1);
+        size_t chunk = PMEM_PAGESIZE - offset;
+        if(chunk > len)
+            chunk = len;
+        bool writable;
+        pmem_region_t *region = NULL;
+        byte_t *page = find_page(pm, addr, &writable, &region);
+        if(page != NULL) {
+            memcpy(out, &page[offset], chunk);
+        } else if(region != NULL && devices) {
+            //Devices are asked for at most 8 aligned bytes at a time
+            for(size_t done = 0, n = 0; done < chunk; done += n) {
+                n = sizeof(uint64_t) - ((addr + done) & (sizeof(uint64_t) - 1));
+                if(n > chunk - done)
+                    n = chunk - done;
+                uint64_t value = device_read(pm, region, addr + done, n);
+                memcpy(&out[done], &value, n);
+            }
+        } else {
+            memset(out, 0x00, chunk);
+        }
+        out += chunk;
+        addr += chunk;
+        len -= chunk;
+    }
+}
+
+//Let go of whatever a last-level table entry holds, before it is replaced
+static void replace (pmem_t *pm, void **entry) {
+    if(*entry == NULL)
+        return;
+    if(is_region(*entry)) {
+        pm->claimed--;
+    } else if(((uintptr_t) *entry & BORROWED) == 0) {
+        free(untag(*entry));
+        pm->pages--;
+    } else {
+        pm->borrowed--;
+    }
+}
+
+//Hand an access to the device that claimed its page (len bytes, 1 to 8,
+//within one aligned quad unless len is 8)
+static uint64_t device_read (pmem_t *pm, pmem_region_t *region, address_t addr, size_t len) {
+    pm->accesses++;
+    return region->read(region->state, addr - region->base, len);
+}
+
+static void device_write (pmem_t *pm, pmem_region_t *region, address_t addr, uint64_t value,
+        size_t len) {
+    pm->accesses++;
+    region->write(region->state, addr - region->base, value, len);
+}
+
+//True if a last-level table entry is a device's claim
+static bool is_region (void *entry) {
+    return ((uintptr_t) entry & (BORROWED | DIRTY)) == REGION;
+}
+
+//Strip the tag bits from a last-level table entry
+static byte_t *untag (void *entry) {
+    return (byte_t *) ((uintptr_t) entry & ~TAGS);
+}
+
+//Forget the TLB entry for an address's page, if it holds one
+static void drop_tlb (pmem_t *pm, address_t addr) {
+    pmem_tlb_t *entry = &pm->tlb[(addr >> PMEM_PAGEBITS) % PMEM_TLBSIZE];
+    if(entry->vpn == addr >> PMEM_PAGEBITS)
+        entry->vpn = PMEM_NOVPN;
+}
+
+static void flush_tlb (pmem_t *pm) {
+    for(int i = 0; i < PMEM_TLBSIZE; i++) {
+        pm->tlb[i].vpn = PMEM_NOVPN;
+        pm->tlb[i].page = NULL;
+        pm->tlb[i].writable = false;
+    }
+}
@@ -0,0 +1,305 @@
+#ifndef __CS261_PMEM__
+#define __CS261_PMEM__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elf.h"
+#include "y86.h"
+
+/* Page size and page table shape: six levels of 512-entry tables over 4 KiB
+   pages cover all 64 address bits (the top level only uses 7 of its 9) */
+#define PMEM_PAGEBITS  12
+#define PMEM_PAGESIZE  (1 << PMEM_PAGEBITS)
+#define PMEM_LEVELBITS 9
+#define PMEM_FANOUT    (1 << PMEM_LEVELBITS)
+#define PMEM_LEVELS    6
+
+/* Entries in the software TLB (direct-mapped by virtual page number) */
+#define PMEM_TLBSIZE   64
+
+/* Virtual page number that no address has, marking an empty TLB entry */
+#define PMEM_NOVPN     UINT64_MAX
+
+/* One software TLB entry: a virtual page and where its bytes live. Pages
+   that have never been written map to a shared zero page, and borrowed pages
+   (see pmem_map()) to their owner's bytes, both read-only. */
+typedef struct pmem_tlb {
+    address_t vpn;              // virtual page number (address >> PMEM_PAGEBITS)
+    byte_t *page;               // host copy of the page
+    bool writable;              // false for the zero page and borrowed (but
+                                // not shared) pages
+} pmem_tlb_t;
+
+/* A device's claim on a range of whole pages (see pmem_claim()). Every
+   access to the range is handed to the device, 1 to 8 bytes at a time,
+   with the offset from base; the value is little-endian in the low bytes. */
+typedef struct pmem_region {
+    address_t base;             // first guest address claimed
+    uint64_t size;              // bytes claimed
+    uint64_t (*read) (void *state, address_t offset, size_t len);
+    void (*write) (void *state, address_t offset, uint64_t value, size_t len);
+    void *state;                // passed to read and write
+} pmem_region_t;
+
+/* Sparse paged guest memory. Pages are allocated (zero-filled) the first
+   time they are written; reading an untouched page sees zeros without
+   allocating anything, so the footprint follows the pages actually used.
+   A page may also be borrowed from elsewhere (e.g. a mapped file), in which
+   case the first write to it makes a private copy, or shared, in which case
+   writes go to the borrowed bytes. Pages claimed by a device are tagged as
+   such in their page table entry and never enter the TLB, so ordinary
+   accesses stay on the TLB fast path and only device accesses (which always
+   miss) pay for the dispatch. Pages written since the
+   last pmem_track() are listed so pmem_revert() can undo just those. */
+typedef struct pmem {
+
+    void **root;                // top-level page table
+    pmem_tlb_t tlb[PMEM_TLBSIZE];
+
+    uint64_t pages;             // data pages allocated
+    uint64_t borrowed;          // pages borrowed with pmem_map()
+    uint64_t claimed;           // pages claimed with pmem_claim()
+    uint64_t tables;            // page tables allocated (including the root)
+    uint64_t tlbmisses;         // accesses that had to walk the page table
+    uint64_t accesses;          // accesses handed to devices
+
+    address_t *dirty;           // numbers of the pages written since tracking began
+    size_t ndirty;              // entries in dirty
+    size_t dirtycap;            // room in dirty
+
+} pmem_t;
+
+/**
+ * @brief Allocate an empty paged address space
+ *
+ * @returns Pointer to the new address space, or NULL if allocation failed
+ */
+pmem_t *pmem_create (void);
+
+/**
+ * @brief Release a paged address space and all of its pages
+ *
+ * @param pm Address space to be freed (may be NULL)
+ */
+void pmem_free (pmem_t *pm);
+
+/**
+ * @brief Drop every page, leaving the whole address space zero
+ *
+ * @param pm Address space to clear
+ */
+void pmem_clear (pmem_t *pm);
+
+/**
+ * @brief Make one address space an exact copy of another
+ *
+ * No pages of dst count as written afterwards (see pmem_track()).
+ *
+ * @param dst Address space to overwrite
+ * @param src Address space to copy
+ * @returns True if the copy succeeded, false if allocation failed (dst is
+ * then left empty)
+ */
+bool pmem_copy (pmem_t *dst, pmem_t *src);
+
+/**
+ * @brief Forget which pages have been written, so only later writes count
+ *
+ * The TLB stops allowing stores so that the next store to each page is seen
+ * (and recorded) by the slow path.
+ *
+ * @param pm Address space to track
+ */
+void pmem_track (pmem_t *pm);
+
+/**
+ * @brief Undo every write since pm was last copied from, reverted to or
+ * tracked against src
+ *
+ * Only the pages written since then are touched: each gets src's bytes
+ * back (or is dropped if src never had it).
+ *
+ * @param pm Address space to revert
+ * @param src Address space holding the contents to go back to (unchanged
+ * since then)
+ */
+void pmem_revert (pmem_t *pm, pmem_t *src);
+
+/**
+ * @brief Borrow a page's bytes from outside the address space
+ *
+ * Nothing is copied: reads see the borrowed bytes directly, and the first
+ * write to the page replaces it with a private copy. The bytes must stay
+ * valid and unchanged until the page is written, cleared or freed (copies
+ * made with pmem_copy() borrow the same bytes). Mapping a page does not count
+ * as writing it.
+ *
+ * @param pm Address space to map into
+ * @param addr Guest address of the page (a multiple of PMEM_PAGESIZE)
+ * @param page PMEM_PAGESIZE bytes to appear at addr (8-byte aligned)
+ * @returns True if the page was mapped, false if the bytes are misaligned or
+ * a table could not be allocated (the caller should copy them instead)
+ */
+bool pmem_map (pmem_t *pm, address_t addr, const byte_t *page);
+
+/**
+ * @brief Borrow a page's bytes, writing to them in place
+ *
+ * Like pmem_map(), except that stores go straight to the borrowed bytes
+ * (e.g. a shared mapping of a file) instead of to a private copy. Such pages
+ * are never recorded as written, so pmem_revert() leaves them as they are,
+ * and copies made with pmem_copy() share them too.
+ *
+ * @param pm Address space to map into
+ * @param addr Guest address of the page (a multiple of PMEM_PAGESIZE)
+ * @param page PMEM_PAGESIZE bytes to appear at addr (8-byte aligned)
+ * @returns True if the page was mapped, false if the bytes are misaligned or
+ * a table could not be allocated
+ */
+bool pmem_map_shared (pmem_t *pm, address_t addr, byte_t *page);
+
+/**
+ * @brief Hand a range of pages to a device
+ *
+ * Whatever the pages held is dropped. pmem_copy() shares the claim, and
+ * pmem_walk() skips the pages.
+ *
+ * @param pm Address space to claim pages of
+ * @param region Device and range (8-byte aligned; base and size multiples
+ * of PMEM_PAGESIZE; must stay valid until the pages are replaced, cleared
+ * or freed)
+ * @returns True if every page was claimed, false if the region is misaligned
+ * or a table could not be allocated
+ */
+bool pmem_claim (pmem_t *pm, pmem_region_t *region);
+
+/**
+ * @brief Copy bytes out of the address space (untouched pages read as zero)
+ *
+ * @param pm Address space to read
+ * @param addr First guest address to read
+ * @param buf Destination buffer
+ * @param len Number of bytes to read; addr + len must not pass 2^64
+ */
+void pmem_read (pmem_t *pm, address_t addr, void *buf, size_t len);
+
+
+/**
+ * @brief Copy bytes into the address space, allocating pages as needed
+ *
+ * @param pm Address space to write
+ * @param addr First guest address to write
+ * @param buf Source buffer
+ * @param len Number of bytes to write; addr + len must not pass 2^64
+ * @returns True if the write succeeded, false if a page could not be allocated
+ */
+bool pmem_write (pmem_t *pm, address_t addr, const void *buf, size_t len);
+
+/**
+ * @brief Call a function on every page present in the address space
+ * (written or borrowed), in address order
+ *
+ * @param pm Address space to walk
+ * @param visit Function to call with each page's guest address and bytes
+ * @param arg Passed through to visit
+ * @returns False as soon as visit does, true if every page was visited
+ */
+bool pmem_walk (pmem_t *pm, bool (*visit) (address_t addr, const byte_t *page, void *arg), void *arg);
+
+/**
+ * @brief Load a segment of a Mini-ELF file into the address space
+ *
+ * Same checks as load_segment(), except that the segment may be placed at
+ * any 32-bit virtual address instead of only the first 4 KiB.
+ *
+ * @param file Mini-ELF file to read the segment from
+ * @param pm Address space to load into
+ * @param phdr Program header describing the segment
+ * @returns True if the segment was loaded
+ */
+bool pmem_load_segment (FILE *file, pmem_t *pm, elf_phdr_t *phdr);
+
+/**
+ * @brief Print the page and TLB counters of an address space
+ *
+ * @param out Stream to print to
+ * @param pm Address space to describe
+ */
+void dump_pmem_stats (FILE *out, pmem_t *pm);
+
+/* TLB misses, accesses that cross a page and first writes to a page */
+uint64_t pmem_load_slow (pmem_t *pm, address_t addr);
+bool pmem_store_slow (pmem_t *pm, address_t addr, uint64_t value);
+void pmem_fetch_slow (pmem_t *pm, address_t addr, void *buf, size_t len);
+
+/**
+ * @brief Check that an 8-byte access at an address fits below 2^64
+ *
+ * @param addr Guest address of the access
+ * @returns True if all eight bytes have addresses
+ */
+static inline bool pmem_valid (address_t addr) {
+    return addr <= UINT64_MAX - (sizeof(uint64_t) - 1);
+}
+
+/**
+ * @brief Load 8 bytes from the address space
+ *
+ * @param pm Address space to read
+ * @param addr Guest address (see pmem_valid())
+ * @returns The little-endian value at addr
+ */
+static inline uint64_t pmem_load (pmem_t *pm, address_t addr) {
+    address_t offset = addr & (PMEM_PAGESIZE - 1);
+    pmem_tlb_t *entry = &pm->tlb[(addr >> PMEM_PAGEBITS) % PMEM_TLBSIZE];
+    if(entry->vpn == addr >> PMEM_PAGEBITS && offset <= PMEM_PAGESIZE - sizeof(uint64_t))
+        return *((uint64_t *) &entry->page[offset]);
+    return pmem_load_slow(pm, addr);
+}
+
+/**
+ * @brief Copy bytes out of the address space without touching devices
+ *
+ * For instruction fetch and for looking at memory: pages claimed by a
+ * device read as zero rather than calling its read. Bytes within one page
+ * come straight from the TLB when it has the page.
+ *
+ * @param pm Address space to read
+ * @param addr First guest address to read
+ * @param buf Destination buffer
+ * @param len Number of bytes to read; addr + len must not pass 2^64
+ */
+static inline void pmem_fetch (pmem_t *pm, address_t addr, void *buf, size_t len) {
+    address_t offset = addr & (PMEM_PAGESIZE - 1);
+    pmem_tlb_t *entry = &pm->tlb[(addr >> PMEM_PAGEBITS) % PMEM_TLBSIZE];
+    if(entry->vpn == addr >> PMEM_PAGEBITS && len <= PMEM_PAGESIZE - offset) {
+        memcpy(buf, &entry->page[offset], len);
+        return;
+    }
+    pmem_fetch_slow(pm, addr, buf, len);
+}
+
+/**
+ * @brief Store 8 bytes into the address space
+ *
+ * @param pm Address space to write
+ * @param addr Guest address (see pmem_valid())
+ * @param value Value to store (little-endian)
+ * @returns True if the store succeeded, false if a page could not be allocated
+ */
+static inline bool pmem_store (pmem_t *pm, address_t addr, uint64_t value) {
+    address_t offset = addr & (PMEM_PAGESIZE - 1);
+    pmem_tlb_t *entry = &pm->tlb[(addr >> PMEM_PAGEBITS) % PMEM_TLBSIZE];
+    if(entry->vpn == addr >> PMEM_PAGEBITS && entry->writable
+            && offset <= PMEM_PAGESIZE - sizeof(uint64_t)) {
+        *((uint64_t *) &entry->page[offset]) = value;
+        return true;
+    }
+    return pmem_store_slow(pm, addr, value);
+}
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ * CS 261: Instruction profiles of a run
+ *
+ * Name: Ben Berry
+ */
+
+#include "profile.h"
+
+static void table_report (FILE *out, profile_table_t *t, const char *title, uint64_t total);
+static void consume (void *state, const y86_event_t *ev);
+static void finish (void *state, FILE *out);
+
+/**********************************************************************
+ *                         PROFILE FUNCTIONS
+ *********************************************************************/
+
+profile_t *profile_create (void) {
+    profile_t *pr = (profile_t *) calloc(1, sizeof(profile_t));
+    if(pr == NULL)
+        return NULL;
+    if(!profile_table_init(&pr->pcs, PROFILE_SLOTS) || !profile_table_init(&pr->calls, PROFILE_SLOTS)) {
+        profile_free(pr);
+        return NULL;
+    }
+    return pr;
+}
+
+void profile_record (profile_t *pr, const y86_event_t *ev) {
+    pr->instructions++;
+    if(!profile_table_add(&pr->pcs, ev->pc))
+        pr->failed = true;
+    //Only calls that got as far as pushing count
+    if((ev->opcode >> 4) == CALL && ev->stat == AOK) {
+        pr->ncalls++;
+        if(!profile_table_add(&pr->calls, ev->after))
+            pr->failed = true;
+    }
+}
+
+pipe_consumer_t profile_consumer (profile_t *pr) {
+    pipe_consumer_t c = { "profile", pr, consume, finish };
+    return c;
+}
+
+void dump_profile (FILE *out, profile_t *pr) {
+    fprintf(out, "Profile: %lu instructions at %lu PCs, %lu calls to %lu targets%s\n",
+            pr->instructions, (uint64_t) pr->pcs.used, pr->ncalls,
+            (uint64_t) pr->calls.used, pr->failed ? " (out of memory: partial)" : "");
+    table_report(out, &pr->pcs, "Hottest PCs", pr->instructions);
+    table_report(out, &pr->calls, "Hottest call targets", pr->ncalls);
+}
+
+void profile_free (profile_t *pr) {
+    if(pr == NULL)
+        return;
+    profile_table_free(&pr->pcs);
+    profile_table_free(&pr->calls);
+    free(pr);
+}
+
+bool profile_table_init (profile_table_t *t, size_t size) {
+    t->keys = (address_t *) calloc(size, sizeof(address_t));
+    t->counts = (uint64_t *) calloc(size, sizeof(uint64_t));
+    t->size = size;
+    t->used = 0;
+    return t->keys != NULL && t->counts != NULL;
+}
+
+bool profile_table_add (profile_table_t *t, address_t addr) {
+    if(t->used * 2 >= t->size) {
+        profile_table_t bigger;
+        //Double the table once it is half full
+        if(!profile_table_init(&bigger, t->size * 2)) {
+            profile_table_free(&bigger);
+            return false;
+        }
+        for(size_t i = 0; i < t->size; i++) {
+            if(t->counts[i] == 0)
+                continue;
+            size_t j = (t->keys[i] * 0x9e3779b97f4a7c15ULL) & (bigger.size - 1);
+            while(bigger.counts[j] != 0)
+                j = (j + 1) & (bigger.size - 1);
+            bigger.keys[j] = t->keys[i];
+            bigger.counts[j] = t->counts[i];
+        }
+        bigger.used = t->used;
+        profile_table_free(t);
+        *t = bigger;
+    }
+    size_t i = (addr * 0x9e3779b97f4a7c15ULL) & (t->size - 1);
+    while(t->counts[i] != 0 && t->keys[i] != addr)
+        i = (i + 1) & (t->size - 1);
+    if(t->counts[i] == 0) {
+        t->keys[i] = addr;
+        t->used++;
+    }
+    t->counts[i]++;
+    return true;
+}
+
+void profile_table_free (profile_table_t *t) {
+    free(t->keys);
+    free(t->counts);
+    t->keys = NULL;
+    t->counts = NULL;
+}
+
+profile_row_t *profile_table_rows (profile_table_t *t, size_t *n) {
+    *n = 0;
+    profile_row_t *rows = (profile_row_t *) malloc((t->used + 1) * sizeof(profile_row_t));
+    if(rows == NULL)
+        return NULL;
+    for(size_t i = 0; i < t->size; i++) {
+        if(t->counts[i] != 0) {
+            rows[*n].key = t->keys[i];
+            rows[(*n)++].count = t->counts[i];
+        }
+    }
+    qsort(rows, *n, sizeof(profile_row_t), profile_by_count);
+    return rows;
+}
+
+int profile_by_count (const void *a, const void *b) {
+    const profile_row_t *x = (const profile_row_t *) a;
+    const profile_row_t *y = (const profile_row_t *) b;
+    if(x->count != y->count)
+        return x->count > y->count ? -1 : 1;
+    return x->key < y->key ? -1 : (x->key > y->key);
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+//Print the PROFILE_TOP largest counts in a table
+static void table_report (FILE *out, profile_table_t *t, const char *title, uint64_t total) {
+    size_t n;
+    profile_row_t *rows = profile_table_rows(t, &n);
+    if(rows == NULL)
+        return;
+    if(n > 0)
+        fprintf(out, "%s:\n", title);
+    for(size_t i = 0; i < n && i < PROFILE_TOP; i++)
+        fprintf(out, "  0x%04lx %14lu  %5.1f%%\n", rows[i].key, rows[i].count,
+                100.0 * rows[i].count / total);
+    free(rows);
+}
+
+//Pipeline callbacks
+static void consume (void *state, const y86_event_t *ev) {
+    profile_record((profile_t *) state, ev);
+}
+
+static void finish (void *state, FILE *out) {
+    dump_profile(out, (profile_t *) state);
+}
@@ -0,0 +1,129 @@
+#ifndef __CS261_PROFILE__
+#define __CS261_PROFILE__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "y86.h"
+#include "y86vm.h"
+#include "pipeline.h"
+
+/* Entries each report lists */
+#define PROFILE_TOP 10
+
+/* Starting size of the count tables (a power of two; they double when
+   half full) */
+#define PROFILE_SLOTS 256
+
+/* Execution counts keyed by address (open addressing, linear probing) */
+typedef struct profile_table {
+    address_t *keys;
+    uint64_t *counts;           // 0 marks an empty slot
+    size_t size;                // slots
+    size_t used;                // slots in use
+} profile_table_t;
+
+/* One row of a report: an address (or symbol index) and its count */
+typedef struct profile_row {
+    address_t key;
+    uint64_t count;
+} profile_row_t;
+
+/* Where a run spent its instructions */
+typedef struct profile {
+
+    profile_table_t pcs;        // instructions executed at each PC
+    profile_table_t calls;      // calls made to each target
+    uint64_t instructions;      // instructions seen
+    uint64_t ncalls;            // calls seen
+    bool failed;                // a table could not grow (counts are partial)
+
+} profile_t;
+
+/**
+ * @brief Allocate an empty count table
+ *
+ * @param t Table to set up
+ * @param size Slots to start with (a power of two)
+ * @returns True on success (release the table with profile_table_free()
+ * either way)
+ */
+bool profile_table_init (profile_table_t *t, size_t size);
+
+/**
+ * @brief Count one more occurrence of an address
+ *
+ * @param t Table
+ * @param addr Address to count
+ * @returns True unless the table was full and could not grow
+ */
+bool profile_table_add (profile_table_t *t, address_t addr);
+
+/**
+ * @brief Release a table's slots
+ *
+ * @param t Table (left empty)
+ */
+void profile_table_free (profile_table_t *t);
+
+/**
+ * @brief List a table's counts, largest first
+ *
+ * @param t Table
+ * @param n Where the number of rows goes
+ * @returns Rows (free() them), or NULL if they could not be allocated
+ */
+profile_row_t *profile_table_rows (profile_table_t *t, size_t *n);
+
+/**
+ * @brief Order report rows for qsort(): largest count first, then lowest key
+ *
+ * @param a First profile_row_t
+ * @param b Second profile_row_t
+ * @returns Negative, zero or positive as a goes before, with or after b
+ */
+int profile_by_count (const void *a, const void *b);
+
+/**
+ * @brief Create an empty profile
+ *
+ * @returns New profile, or NULL on failure
+ */
+profile_t *profile_create (void);
+
+/**
+ * @brief Count one executed instruction
+ *
+ * @param pr Profile
+ * @param ev What the instruction did
+ */
+void profile_record (profile_t *pr, const y86_event_t *ev);
+
+/**
+ * @brief Wrap a profile as a pipeline consumer
+ *
+ * @param pr Profile (still freed with profile_free())
+ * @returns Consumer that counts every event and reports the hottest PCs and
+ * call targets
+ */
+pipe_consumer_t profile_consumer (profile_t *pr);
+
+/**
+ * @brief Print the PROFILE_TOP hottest PCs and call targets
+ *
+ * @param out Stream to print to
+ * @param pr Profile to describe
+ */
+void dump_profile (FILE *out, profile_t *pr);
+
+/**
+ * @brief Release a profile
+ *
+ * @param pr Profile to be freed (may be NULL)
+ */
+void profile_free (profile_t *pr);
+
+#endif
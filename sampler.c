@@ -0,0 +1,255 @@
+/*
+ * CS 261: Statistical sampling of the guest PC
+ *
+ * Name: Ben Berry
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "sampler.h"
+#include "profile.h"
+
+#include <signal.h>
+#include <sys/time.h>
+#include <time.h>
+
+/* The sampler the timer is running for (one per process) */
+static sampler_t *volatile running = NULL;
+static struct sigaction previous;
+
+static void on_sigprof (int sig);
+static uint8_t find_callers (y86_vm_t *vm, address_t *callers);
+static uint64_t taken (sampler_t *sp);
+static double cpu_time (void);
+static void by_symbol (FILE *out, sampler_t *sp, symtab_t *st, bool inclusive);
+static void by_address (FILE *out, sampler_t *sp, symtab_t *st);
+static const char *frame_of (symtab_t *st, address_t addr, char *buf, size_t len);
+
+/**********************************************************************
+ *                         SAMPLER FUNCTIONS
+ *********************************************************************/
+
+sampler_t *sampler_create (long hz, bool stacks) {
+    if(hz < 1 || hz > SAMPLER_MAXHZ)
+        return NULL;
+    sampler_t *sp = (sampler_t *) calloc(1, sizeof(sampler_t));
+    if(sp == NULL)
+        return NULL;
+    //Every slot is allocated up front: the handler cannot allocate
+    sp->samples = (sample_t *) calloc(SAMPLER_SLOTS, sizeof(sample_t));
+    if(sp->samples == NULL) {
+        free(sp);
+        return NULL;
+    }
+    sp->hz = hz;
+    sp->stacks = stacks;
+    return sp;
+}
+
+bool sampler_start (sampler_t *sp, y86_vm_t *vm) {
+    if(sp == NULL || vm == NULL || running != NULL)
+        return false;
+    sp->vm = vm;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigprof;
+    sigemptyset(&sa.sa_mask);
+    //Interrupted reads and writes (checkpoints, traces) carry on
+    sa.sa_flags = SA_RESTART;
+    if(sigaction(SIGPROF, &sa, &previous) != 0)
+        return false;
+    sp->cpu -= cpu_time();
+    running = sp;
+    long usec = 1000000 / sp->hz;
+    struct itimerval it;
+    it.it_interval.tv_sec = usec / 1000000;
+    it.it_interval.tv_usec = usec % 1000000;
+    it.it_value = it.it_interval;
+    if(setitimer(ITIMER_PROF, &it, NULL) != 0) {
+        sp->cpu += cpu_time();
+        running = NULL;
+        sigaction(SIGPROF, &previous, NULL);
+        return false;
+    }
+    return true;
+}
+
+void sampler_stop (sampler_t *sp) {
+    if(sp == NULL || running != sp)
+        return;
+    struct itimerval it;
+    memset(&it, 0, sizeof(it));
+    setitimer(ITIMER_PROF, &it, NULL);
+    sp->cpu += cpu_time();
+    running = NULL;
+    sigaction(SIGPROF, &previous, NULL);
+}
+
+void dump_sampler (FILE *out, sampler_t *sp, symtab_t *st) {
+    uint64_t n = taken(sp);
+    uint64_t dropped = sp->claimed - n;
+    fprintf(out, "Samples: %lu in %.2f s of CPU (%.0f Hz; %ld asked for)", n, sp->cpu,
+            sp->cpu > 0 ? sp->claimed / sp->cpu : 0.0, sp->hz);
+    if(dropped > 0)
+        fprintf(out, ", %lu dropped (buffer full)", dropped);
+    fprintf(out, "\n");
+    if(n == 0)
+        return;
+    by_symbol(out, sp, st, false);
+    if(sp->stacks)
+        by_symbol(out, sp, st, true);
+    by_address(out, sp, st);
+}
+
+bool write_sampled_stacks (FILE *out, sampler_t *sp, symtab_t *st) {
+    char name[64];
+    uint64_t n = taken(sp);
+    for(uint64_t i = 0; i < n; i++) {
+        sample_t *s = &sp->samples[i];
+        if(!__atomic_load_n(&s->ready, __ATOMIC_ACQUIRE))
+            continue;
+        //Outermost caller first; flame graph tools add up repeated lines
+        for(int j = s->depth - 1; j >= 0; j--)
+            fprintf(out, "%s;", frame_of(st, s->callers[j], name, sizeof(name)));
+        fprintf(out, "%s 1\n", frame_of(st, s->pc, name, sizeof(name)));
+    }
+    return !ferror(out);
+}
+
+void sampler_free (sampler_t *sp) {
+    if(sp == NULL)
+        return;
+    sampler_stop(sp);
+    free(sp->samples);
+    free(sp);
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+//Take a sample: claim a slot, fill it, then mark it complete (the timer
+//may fire on any thread, so slots are claimed atomically)
+static void on_sigprof (int sig) {
+    (void) sig;
+    sampler_t *sp = running;
+    if(sp == NULL)
+        return;
+    uint64_t slot = __atomic_fetch_add(&sp->claimed, 1, __ATOMIC_RELAXED);
+    if(slot >= SAMPLER_SLOTS)
+        return;
+    sample_t *s = &sp->samples[slot];
+    //The PC only moves at the end of a step: this is the instruction running
+    s->pc = sp->vm->cpu.pc;
+    s->depth = sp->stacks ? find_callers(sp->vm, s->callers) : 0;
+    __atomic_store_n(&s->ready, 1, __ATOMIC_RELEASE);
+}
+
+//Y86 has no frame pointer chain, so callers are found the way a debugger
+//without unwind tables would: stack words that point just past a call
+//instruction are taken to be return addresses (flat memory only)
+static uint8_t find_callers (y86_vm_t *vm, address_t *callers) {
+    if(vm->pmem != NULL)
+        return 0;
+    address_t top = vm->cpu.reg[RSP];
+    uint8_t depth = 0;
+    for(int i = 0; i < SAMPLER_SCAN && depth < SAMPLER_DEPTH; i++) {
+        address_t at = top + 8 * (address_t) i;
+        if(at < top || at > MEMSIZE - 8)
+            break;
+        uint64_t word = 0;
+        memcpy(&word, &vm->memory[at], sizeof(word));
+        if(word >= 9 && word <= MEMSIZE && vm->memory[word - 9] == CALL << 4)
+            callers[depth++] = word;
+    }
+    return depth;
+}
+
+//Samples in the buffer (those the buffer had room for)
+static uint64_t taken (sampler_t *sp) {
+    uint64_t n = __atomic_load_n(&sp->claimed, __ATOMIC_ACQUIRE);
+    return n < SAMPLER_SLOTS ? n : SAMPLER_SLOTS;
+}
+
+//CPU time used by the whole process so far (what ITIMER_PROF counts)
+static double cpu_time (void) {
+    struct timespec ts;
+    if(clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0)
+        return 0.0;
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//Samples per symbol, most first: where the PC was (self), or where the PC
+//or any caller was (inclusive, each symbol counted once per sample)
+static void by_symbol (FILE *out, sampler_t *sp, symtab_t *st, bool inclusive) {
+    int nsyms = (st != NULL) ? st->nsyms : 0;
+    //One row per symbol, and a last one for addresses below every symbol
+    profile_row_t *syms = (profile_row_t *) calloc(nsyms + 1, sizeof(profile_row_t));
+    uint64_t *seen = (uint64_t *) calloc(nsyms + 1, sizeof(uint64_t));
+    if(syms == NULL || seen == NULL) {
+        free(syms);
+        free(seen);
+        return;
+    }
+    for(int i = 0; i <= nsyms; i++)
+        syms[i].key = i;
+    uint64_t n = taken(sp);
+    for(uint64_t i = 0; i < n; i++) {
+        sample_t *s = &sp->samples[i];
+        if(!__atomic_load_n(&s->ready, __ATOMIC_ACQUIRE))
+            continue;
+        int frames = inclusive ? s->depth + 1 : 1;
+        for(int j = 0; j < frames; j++) {
+            int k = symtab_index(st, j == 0 ? s->pc : s->callers[j - 1]);
+            //seen[] holds the last sample each symbol was counted for (+1)
+            if(seen[k] != i + 1) {
+                seen[k] = i + 1;
+                syms[k].count++;
+            }
+        }
+    }
+    qsort(syms, nsyms + 1, sizeof(profile_row_t), profile_by_count);
+
+    fprintf(out, "%s samples by symbol:\n", inclusive ? "Inclusive" : "Self");
+    for(int i = 0; i <= nsyms && i < SAMPLER_TOP && syms[i].count > 0; i++) {
+        fprintf(out, "  %-24s %10lu %7.2f%%\n", symtab_name(st, syms[i].key),
+                syms[i].count, 100.0 * syms[i].count / n);
+    }
+    free(syms);
+    free(seen);
+}
+
+//The SAMPLER_TOP most sampled PCs
+static void by_address (FILE *out, sampler_t *sp, symtab_t *st) {
+    profile_table_t pcs;
+    uint64_t n = taken(sp);
+    bool ok = profile_table_init(&pcs, PROFILE_SLOTS);
+    for(uint64_t i = 0; ok && i < n; i++) {
+        if(__atomic_load_n(&sp->samples[i].ready, __ATOMIC_ACQUIRE))
+            ok = profile_table_add(&pcs, sp->samples[i].pc);
+    }
+    size_t used = 0;
+    profile_row_t *rows = ok ? profile_table_rows(&pcs, &used) : NULL;
+    if(rows == NULL) {
+        profile_table_free(&pcs);
+        return;
+    }
+    fprintf(out, "Most sampled PCs:\n");
+    for(size_t i = 0; i < used && i < SAMPLER_TOP; i++) {
+        char where[64];
+        fprintf(out, "  0x%08lx %-24s %10lu %7.2f%%\n", rows[i].key,
+                symtab_describe(st, rows[i].key, where, sizeof(where)), rows[i].count,
+                100.0 * rows[i].count / n);
+    }
+    free(rows);
+    profile_table_free(&pcs);
+}
+
+//Name the function an address is in (the symbol at or below it)
+static const char *frame_of (symtab_t *st, address_t addr, char *buf, size_t len) {
+    const symbol_t *sym = symtab_lookup(st, addr);
+    if(sym != NULL)
+        return sym->name;
+    snprintf(buf, len, "0x%04lx", addr);
+    return buf;
+}
@@ -0,0 +1,108 @@
+#ifndef __CS261_SAMPLER__
+#define __CS261_SAMPLER__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "y86.h"
+#include "y86vm.h"
+#include "symtab.h"
+
+/* Default and largest sampling rates (the kernel's tick may cap the rate
+   actually reached, so the report gives both) */
+#define SAMPLER_HZ 1000
+#define SAMPLER_MAXHZ 100000
+
+/* Samples the buffer holds; later ones are dropped (and counted) */
+#define SAMPLER_SLOTS (1 << 16)
+
+/* Callers kept per sample, and how many stack words are searched for them */
+#define SAMPLER_DEPTH 15
+#define SAMPLER_SCAN 256
+
+/* Entries each report lists */
+#define SAMPLER_TOP 10
+
+/* One sample: the guest PC when the timer fired and, optionally, the return
+   addresses found on the guest stack (innermost first) */
+typedef struct sample {
+    address_t pc;
+    address_t callers[SAMPLER_DEPTH];
+    uint8_t depth;              // callers found
+    uint8_t ready;              // written in full (set last)
+} sample_t;
+
+/* Statistical PC sampler for --sample. A SIGPROF timer interrupts the run
+   every 1/hz seconds of CPU time; the handler copies the guest PC (and
+   stack) into the next free slot and nothing else, so the run loop itself
+   is untouched. The process has one profiling timer, so only one sampler
+   runs at a time. */
+typedef struct sampler {
+
+    sample_t *samples;          // SAMPLER_SLOTS slots, claimed in order
+    uint64_t claimed;           // slots handed out (past SAMPLER_SLOTS, the
+                                // samples that found the buffer full)
+    long hz;                    // sampling rate asked for
+    double cpu;                 // CPU seconds while the timer ran
+    bool stacks;                // search the guest stack for callers
+    y86_vm_t *vm;               // VM being sampled while running
+
+} sampler_t;
+
+/**
+ * @brief Create a sampler
+ *
+ * @param hz Samples per second of CPU time (1 to SAMPLER_MAXHZ)
+ * @param stacks Whether to record callers with each sample
+ * @returns New sampler, or NULL on failure
+ */
+sampler_t *sampler_create (long hz, bool stacks);
+
+/**
+ * @brief Start sampling a VM
+ *
+ * @param sp Sampler (no other may be running)
+ * @param vm VM about to run
+ * @returns True if the timer was started
+ */
+bool sampler_start (sampler_t *sp, y86_vm_t *vm);
+
+/**
+ * @brief Stop the timer (samples taken so far are kept)
+ *
+ * @param sp Sampler
+ */
+void sampler_stop (sampler_t *sp);
+
+/**
+ * @brief Print the samples by symbol and by address, plus by caller when
+ * stacks were recorded
+ *
+ * @param out Stream to print to
+ * @param sp Stopped sampler
+ * @param st Symbols to attribute addresses to (may be NULL)
+ */
+void dump_sampler (FILE *out, sampler_t *sp, symtab_t *st);
+
+/**
+ * @brief Write collapsed stacks ("caller;callee count" lines) for flame
+ * graph tools
+ *
+ * @param out Stream to write to
+ * @param sp Stopped sampler (with stacks)
+ * @param st Symbols to name functions by (may be NULL)
+ * @returns True if every line was written
+ */
+bool write_sampled_stacks (FILE *out, sampler_t *sp, symtab_t *st);
+
+/**
+ * @brief Stop and release a sampler
+ *
+ * @param sp Sampler to be freed (may be NULL)
+ */
+void sampler_free (sampler_t *sp);
+
+#endif
@@ -0,0 +1,297 @@
+/*
+ * CS 261: Persistent job server on a Unix domain socket
+ *
+ * Name: Ben Berry
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "server.h"
+#include "p4-interp.h"
+#include "y86vm.h"
+
+/* An accepted connection waiting for a worker */
+typedef struct serve_job {
+    int fd;                     // client socket
+    struct timespec accepted;   // when it was accepted (for latency)
+} serve_job_t;
+
+/* State shared by the accept loop and the workers */
+typedef struct serve_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t nonempty;    // signalled when a job is queued
+    pthread_cond_t nonfull;     // signalled when a job is taken
+    serve_job_t queue[SERVE_QUEUE];
+    int head;                   // next job to take
+    bool closing;               // no more jobs will be queued
+    serve_stats_t stats;        // protected by lock
+} serve_pool_t;
+
+/* Per-thread argument: the pool and the worker's own warm VM */
+typedef struct serve_worker {
+    serve_pool_t *pool;
+    y86_vm_t *vm;
+} serve_worker_t;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void *worker_main (void *arg);
+static bool handle_job (serve_pool_t *pool, y86_vm_t *vm, int fd);
+
+/**********************************************************************
+ *                         SERVER FUNCTIONS
+ *********************************************************************/
+
+static void on_signal (int sig) {
+    (void) sig;
+    stopping = 1;
+}
+
+bool serve (const char *path) {
+    if(path == NULL)
+        return false;
+
+    //Set up the listening socket
+    struct sockaddr_un addr;
+    memset(&addr, 0x00, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path))
+        return false;
+    strcpy(addr.sun_path, path);
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listener < 0)
+        return false;
+    unlink(path);
+    if(bind(listener, (struct sockaddr *) &addr, sizeof(addr)) != 0
+            || listen(listener, SERVE_QUEUE) != 0) {
+        close(listener);
+        return false;
+    }
+
+    //Stop on SIGINT/SIGTERM (interrupting accept), and survive clients hanging up
+    struct sigaction action;
+    memset(&action, 0x00, sizeof(action));
+    action.sa_handler = on_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    serve_pool_t *pool = (serve_pool_t *) calloc(1, sizeof(serve_pool_t));
+    if(pool == NULL) {
+        close(listener);
+        return false;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->nonempty, NULL);
+    pthread_cond_init(&pool->nonfull, NULL);
+
+    //Fixed pool of workers, each with a VM allocated up front
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if(getenv("Y86_THREADS") != NULL)
+        cpus = atol(getenv("Y86_THREADS"));
+    int numworkers = (cpus < 1) ? 1 : (int) cpus;
+    pthread_t threads[numworkers];
+    serve_worker_t workers[numworkers];
+    int started = 0;
+    for(int w = 0; w < numworkers; w++) {
+        workers[w].pool = pool;
+        workers[w].vm = y86_vm_create();
+        if(workers[w].vm == NULL
+                || pthread_create(&threads[w], NULL, worker_main, &workers[w]) != 0) {
+            y86_vm_free(workers[w].vm);
+            break;
+        }
+        started++;
+    }
+    fprintf(stderr, "Serving on %s with %d workers\n", path, started);
+
+    //Accept connections until told to stop
+    while(started > 0 && !stopping) {
+        int fd = accept(listener, NULL, NULL);
+        if(fd < 0) {
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        serve_job_t job;
+        job.fd = fd;
+        clock_gettime(CLOCK_MONOTONIC, &job.accepted);
+
+        pthread_mutex_lock(&pool->lock);
+        while(pool->stats.depth == SERVE_QUEUE)
+            pthread_cond_wait(&pool->nonfull, &pool->lock);
+        pool->queue[(pool->head + pool->stats.depth) % SERVE_QUEUE] = job;
+        pool->stats.depth++;
+        pool->stats.accepted++;
+        if(pool->stats.depth > pool->stats.maxdepth)
+            pool->stats.maxdepth = pool->stats.depth;
+        pthread_cond_signal(&pool->nonempty);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    //Let the workers finish whatever is queued, then shut down
+    close(listener);
+    unlink(path);
+    pthread_mutex_lock(&pool->lock);
+    pool->closing = true;
+    pthread_cond_broadcast(&pool->nonempty);
+    pthread_mutex_unlock(&pool->lock);
+    for(int w = 0; w < started; w++) {
+        pthread_join(threads[w], NULL);
+        y86_vm_free(workers[w].vm);
+    }
+    dump_serve_stats(stderr, &pool->stats);
+
+    pthread_cond_destroy(&pool->nonfull);
+    pthread_cond_destroy(&pool->nonempty);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+    return started > 0;
+}
+
+void dump_serve_stats (FILE *out, serve_stats_t *stats) {
+    double avg = 0;
+    if(stats->completed > 0)
+        avg = stats->totallatency / stats->completed;
+    fprintf(out, "Jobs: %lu accepted, %lu completed, %lu failed\n",
+            stats->accepted, stats->completed, stats->failed);
+    fprintf(out, "Queue depth: %d (max %d)\n", stats->depth, stats->maxdepth);
+    fprintf(out, "Latency: %.3f ms average, %.3f ms max\n", avg * 1e3,
+            stats->maxlatency * 1e3);
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+static void *worker_main (void *arg) {
+    serve_worker_t *worker = (serve_worker_t *) arg;
+    serve_pool_t *pool = worker->pool;
+
+    while(true) {
+        //Wait for a job (or for the server to close with nothing left)
+        pthread_mutex_lock(&pool->lock);
+        while(pool->stats.depth == 0 && !pool->closing)
+            pthread_cond_wait(&pool->nonempty, &pool->lock);
+        if(pool->stats.depth == 0) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        serve_job_t job = pool->queue[pool->head];
+        pool->head = (pool->head + 1) % SERVE_QUEUE;
+        pool->stats.depth--;
+        pthread_cond_signal(&pool->nonfull);
+        pthread_mutex_unlock(&pool->lock);
+
+        bool ok = handle_job(pool, worker->vm, job.fd);
+
+        struct timespec done;
+        clock_gettime(CLOCK_MONOTONIC, &done);
+        double latency = (done.tv_sec - job.accepted.tv_sec)
+                + (done.tv_nsec - job.accepted.tv_nsec) / 1e9;
+        pthread_mutex_lock(&pool->lock);
+        pool->stats.completed++;
+        if(!ok)
+            pool->stats.failed++;
+        pool->stats.totallatency += latency;
+        if(latency > pool->stats.maxlatency)
+            pool->stats.maxlatency = latency;
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+//Read one request from a client and send back the output. Returns false for
+//bad requests and images that would not load.
+static bool handle_job (serve_pool_t *pool, y86_vm_t *vm, int fd) {
+    FILE *in = fdopen(fd, "r");
+    int outfd = dup(fd);
+    FILE *out = (outfd < 0) ? NULL : fdopen(outfd, "w");
+    if(in == NULL || out == NULL) {
+        if(in != NULL)
+            fclose(in);
+        else
+            close(fd);
+        if(out != NULL)
+            fclose(out);
+        else if(outfd >= 0)
+            close(outfd);
+        return false;
+    }
+
+    //Request line: option words, then the image size
+    char *line = NULL;
+    size_t linecap = 0;
+    bool run = false, trace = false, disas = false, data = false, stats = false;
+    long size = -1;
+    bool ok = getline(&line, &linecap, in) > 0;
+    for(char *save = NULL, *word = ok ? strtok_r(line, " \t\r\n", &save) : NULL;
+            word != NULL; word = strtok_r(NULL, " \t\r\n", &save)) {
+        char *end;
+        long n = strtol(word, &end, 10);
+        if(*end == '\0' && end != word)
+            size = n;
+        else if(strcmp(word, "run") == 0)
+            run = true;
+        else if(strcmp(word, "trace") == 0)
+            trace = true;
+        else if(strcmp(word, "disas") == 0)
+            disas = true;
+        else if(strcmp(word, "data") == 0)
+            data = true;
+        else if(strcmp(word, "stats") == 0)
+            stats = true;
+        else
+            ok = false;
+    }
+    free(line);
+
+    byte_t *image = NULL;
+    if(ok && stats) {
+        serve_stats_t snapshot;
+        pthread_mutex_lock(&pool->lock);
+        snapshot = pool->stats;
+        pthread_mutex_unlock(&pool->lock);
+        dump_serve_stats(out, &snapshot);
+    } else if(!ok || size <= 0 || size > SERVE_MAXIMAGE || (run && trace)) {
+        fprintf(out, "Bad request\n");
+        ok = false;
+    } else {
+        //Image bytes follow the request line; load them into this worker's VM
+        image = (byte_t *) malloc(size);
+        ok = image != NULL && fread(image, size, 1, in) == 1
+                && y86_vm_load_buffer(vm, image, size);
+        if(!ok)
+            fprintf(out, "Failed to read file\n");
+    }
+
+    //Same output, in the same order, as the command-line options
+    if(ok && !stats) {
+        //Guest output goes into the reply too (jobs get no input)
+        io_set_output(vm->io, out);
+        y86_vm_disassemble(vm, out, disas, data);
+        if(run) {
+            fprintf(out, "Beginning execution at 0x%04x\n", vm->hdr.e_entry);
+            if(y86_vm_run(vm, SERVE_BUDGET) == AOK)
+                fprintf(out, "Instruction budget exceeded\n");
+            fdump_cpu_state(out, &vm->cpu);
+            fprintf(out, "Total execution count: %d\n", vm->count);
+        }
+        if(trace && y86_vm_trace(vm, out, SERVE_BUDGET) == AOK)
+            fprintf(out, "Instruction budget exceeded\n");
+        io_set_output(vm->io, NULL);
+    }
+
+    free(image);
+    fclose(out);
+    fclose(in);
+    return ok;
+}
@@ -0,0 +1,58 @@
+#ifndef __CS261_SERVER__
+#define __CS261_SERVER__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "y86.h"
+
+/* Largest Mini-ELF image a client may send, in bytes */
+#define SERVE_MAXIMAGE (1 << 20)
+
+/* Connections that may wait for a worker before accept() stops */
+#define SERVE_QUEUE 256
+
+/* Instructions a run or trace job may execute before it is cut off */
+#define SERVE_BUDGET (1L << 30)
+
+/* Counters describing the load on a server */
+typedef struct serve_stats {
+    uint64_t accepted;          // connections accepted
+    uint64_t completed;         // jobs answered (including bad requests)
+    uint64_t failed;            // bad requests and images that would not load
+    int depth;                  // connections waiting for a worker right now
+    int maxdepth;               // largest depth seen
+    double totallatency;        // seconds from accept to reply, summed over jobs
+    double maxlatency;          // longest such time
+} serve_stats_t;
+
+/**
+ * @brief Serve jobs on a Unix domain socket until interrupted
+ *
+ * Each connection carries one request: a line of space-separated words
+ * naming what to do ("run" as -e, "trace" as -E, "disas" as -d, "data" as
+ * -D), the image size in bytes as the last word, then the Mini-ELF image
+ * itself. The reply is exactly the text y86 prints for the same options,
+ * after which the connection is closed. A request line of just "stats"
+ * returns the server's counters instead. Jobs are handled by a fixed pool
+ * of worker threads (one per online CPU, or $Y86_THREADS), each owning a
+ * preallocated VM that is reused for every job it runs.
+ *
+ * @param path Path of the socket to create (replaced if it already exists)
+ * @returns True if the server shut down cleanly after SIGINT/SIGTERM, false
+ * if the socket could not be set up
+ */
+bool serve (const char *path);
+
+/**
+ * @brief Print server counters
+ *
+ * @param out Stream to print to
+ * @param stats Counters to print
+ */
+void dump_serve_stats (FILE *out, serve_stats_t *stats);
+
+#endif
@@ -0,0 +1,125 @@
+/*
+ * CS 261: Mini-ELF symbol tables
+ *
+ * Name: Ben Berry
+ */
+
+#include "symtab.h"
+
+static int by_address (const void *a, const void *b);
+
+/**********************************************************************
+ *                         SYMBOL FUNCTIONS
+ *********************************************************************/
+
+symtab_t *symtab_load (const char *filename, const elf_hdr_t *hdr) {
+    if(filename == NULL || hdr == NULL)
+        return NULL;
+    symtab_t *st = (symtab_t *) calloc(1, sizeof(symtab_t));
+    if(st == NULL)
+        return NULL;
+    //No tables is not an error
+    if(hdr->e_symtab == 0 || hdr->e_strtab <= hdr->e_symtab)
+        return st;
+
+    FILE *file = fopen(filename, "rb");
+    if(file == NULL || fseek(file, 0, SEEK_END) != 0) {
+        if(file != NULL)
+            fclose(file);
+        symtab_free(st);
+        return NULL;
+    }
+    //The string table runs to the end of the file
+    long end = ftell(file);
+    size_t nsyms = (hdr->e_strtab - hdr->e_symtab) / sizeof(elf_sym_t);
+    if(nsyms == 0) {
+        fclose(file);
+        return st;
+    }
+    size_t size = (end > hdr->e_strtab) ? (size_t) (end - hdr->e_strtab) : 0;
+    elf_sym_t *raw = (elf_sym_t *) calloc(nsyms, sizeof(elf_sym_t));
+    st->strings = (char *) calloc(size + 1, 1);
+    st->syms = (symbol_t *) calloc(nsyms, sizeof(symbol_t));
+    bool ok = raw != NULL && st->strings != NULL && st->syms != NULL
+        && fseek(file, hdr->e_symtab, SEEK_SET) == 0
+        && fread(raw, sizeof(elf_sym_t), nsyms, file) == nsyms
+        && fseek(file, hdr->e_strtab, SEEK_SET) == 0
+        && fread(st->strings, 1, size, file) == size;
+    fclose(file);
+    if(!ok) {
+        free(raw);
+        symtab_free(st);
+        return NULL;
+    }
+
+    //Keep the entries whose names start in the table (the extra NUL
+    //appended above ends the last one)
+    for(size_t i = 0; i < nsyms; i++) {
+        if(raw[i].s_name >= size)
+            continue;
+        st->syms[st->nsyms].addr = raw[i].s_value;
+        st->syms[st->nsyms++].name = &st->strings[raw[i].s_name];
+    }
+    free(raw);
+    qsort(st->syms, st->nsyms, sizeof(symbol_t), by_address);
+    return st;
+}
+
+const symbol_t *symtab_lookup (symtab_t *st, address_t addr) {
+    if(st == NULL || st->nsyms == 0 || addr < st->syms[0].addr)
+        return NULL;
+    //Binary search for the last symbol at or below addr
+    int lo = 0;
+    int hi = st->nsyms - 1;
+    while(lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if(st->syms[mid].addr <= addr)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return &st->syms[lo];
+}
+
+const char *symtab_describe (symtab_t *st, address_t addr, char *buf, size_t len) {
+    const symbol_t *sym = symtab_lookup(st, addr);
+    if(sym != NULL && sym->addr == addr)
+        snprintf(buf, len, "%s", sym->name);
+    else if(sym != NULL)
+        snprintf(buf, len, "%s+0x%lx", sym->name, addr - sym->addr);
+    else
+        snprintf(buf, len, "0x%04lx", addr);
+    return buf;
+}
+
+int symtab_index (symtab_t *st, address_t addr) {
+    const symbol_t *sym = symtab_lookup(st, addr);
+    if(sym == NULL)
+        return (st != NULL) ? st->nsyms : 0;
+    return sym - st->syms;
+}
+
+const char *symtab_name (symtab_t *st, int index) {
+    return (st != NULL && index < st->nsyms) ? st->syms[index].name : "(no symbol)";
+}
+
+void symtab_free (symtab_t *st) {
+    if(st == NULL)
+        return;
+    free(st->syms);
+    free(st->strings);
+    free(st);
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+//Lowest address first, then by name
+static int by_address (const void *a, const void *b) {
+    const symbol_t *x = (const symbol_t *) a;
+    const symbol_t *y = (const symbol_t *) b;
+    if(x->addr != y->addr)
+        return x->addr < y->addr ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
@@ -0,0 +1,87 @@
+#ifndef __CS261_SYMTAB__
+#define __CS261_SYMTAB__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elf.h"
+#include "y86.h"
+
+/* A named address */
+typedef struct symbol {
+    address_t addr;             // address the symbol labels
+    const char *name;           // points into the table's string copy
+} symbol_t;
+
+/* Symbols of a Mini-ELF file, sorted by address */
+typedef struct symtab {
+    symbol_t *syms;
+    int nsyms;
+    char *strings;              // the file's string table (NUL-terminated)
+} symtab_t;
+
+/**
+ * @brief Read the symbol and string tables of a Mini-ELF file
+ *
+ * Entries whose names do not lie in the string table are skipped.
+ *
+ * @param filename Path of the Mini-ELF file
+ * @param hdr Its (validated) header
+ * @returns Symbol table (empty if the file has none), or NULL if the file
+ * could not be read
+ */
+symtab_t *symtab_load (const char *filename, const elf_hdr_t *hdr);
+
+/**
+ * @brief Find the symbol an address belongs to
+ *
+ * @param st Symbol table (may be NULL)
+ * @param addr Address to look up
+ * @returns The symbol with the highest address at or below addr, or NULL if
+ * there is none
+ */
+const symbol_t *symtab_lookup (symtab_t *st, address_t addr);
+
+/**
+ * @brief Name an address by the symbol at or below it, for reports
+ *
+ * @param st Symbol table (may be NULL)
+ * @param addr Address to name
+ * @param buf Space for the name
+ * @param len Size of buf
+ * @returns buf, holding the symbol, symbol+0xoffset inside it, or the bare
+ * address if no symbol is at or below it
+ */
+const char *symtab_describe (symtab_t *st, address_t addr, char *buf, size_t len);
+
+/**
+ * @brief Find the symbol an address belongs to as an index, for tallies
+ * kept per symbol
+ *
+ * @param st Symbol table (may be NULL)
+ * @param addr Address to look up
+ * @returns Index into st->syms, or st->nsyms (0 without a table) for
+ * addresses below every symbol
+ */
+int symtab_index (symtab_t *st, address_t addr);
+
+/**
+ * @brief Name a symbol index from symtab_index()
+ *
+ * @param st Symbol table (may be NULL)
+ * @param index Symbol index
+ * @returns The symbol's name, or "(no symbol)" for the last index
+ */
+const char *symtab_name (symtab_t *st, int index);
+
+/**
+ * @brief Release a symbol table
+ *
+ * @param st Symbol table to be freed (may be NULL)
+ */
+void symtab_free (symtab_t *st);
+
+#endif
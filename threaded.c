@@ -0,0 +1,382 @@
+/*
+ * CS 261: Direct-threaded execution engine
+ *
+ * Name: Ben Berry
+ */
+
+#include "threaded.h"
+#include "icache.h"
+#include "p3-disas.h"
+#include "p4-interp.h"
+#include "io.h"
+
+/* GCC and Clang can store label addresses directly in the threaded code.
+   Anything else gets a plain switch over the handler number instead. Both
+   extensions are kept out of -pedantic's sight only where they are used. */
+#if defined(__GNUC__)
+#define THREADED_GOTO 1
+#define EXTENSION_BEGIN _Pragma("GCC diagnostic push") \
+        _Pragma("GCC diagnostic ignored \"-Wpedantic\"")
+#define EXTENSION_END _Pragma("GCC diagnostic pop")
+#else
+#define THREADED_GOTO 0
+#endif
+
+/* Handler numbers; one per (icode, ifun) pair plus the two bookkeeping ones.
+   The cmov, OPq and jXX groups are in ifun order so ifun can be added on. */
+typedef enum {
+    T_DECODE = 0, T_SLOW,
+    T_HALT, T_NOP,
+    T_RRMOVQ, T_CMOVLE, T_CMOVL, T_CMOVE, T_CMOVNE, T_CMOVGE, T_CMOVG,
+    T_IRMOVQ, T_RMMOVQ, T_MRMOVQ,
+    T_ADDQ, T_SUBQ, T_ANDQ, T_XORQ,
+    T_JMP, T_JLE, T_JL, T_JE, T_JNE, T_JGE, T_JG,
+    T_CALL, T_RET, T_PUSHQ, T_POPQ,
+    T_NUMHANDLERS
+} thread_op_t;
+
+/* One slot of threaded code per address */
+typedef struct thread_slot {
+#if THREADED_GOTO
+    const void *handler;        // label of the handler for this instruction
+#endif
+    thread_op_t op;             // handler number for this instruction
+    y86_inst_t inst;            // predecoded instruction
+} thread_slot_t;
+
+static thread_op_t select_handler (y86_inst_t *inst);
+static void invalidate_slots (thread_slot_t *slots, address_t addr,
+        const void *decode);
+
+/**********************************************************************
+ *                         ENGINE FUNCTIONS
+ *********************************************************************/
+
+#if THREADED_GOTO
+#define HANDLER(name) name:
+#define DISPATCH() do { s = &slots[cpu->pc]; \
+        EXTENSION_BEGIN goto *s->handler; EXTENSION_END } while(0)
+#else
+#define HANDLER(name) case name:
+#define DISPATCH() do { s = &slots[cpu->pc]; goto next; } while(0)
+#endif
+
+//Straight-line instructions always leave the PC inside memory (fetch checks it)
+#define NEXT_SEQ() do { cpu->pc = s->inst.valP; n++; DISPATCH(); } while(0)
+
+//Control transfers can leave memory, which the -e loop reports as ADR
+#define NEXT_BRANCH() do { n++; \
+        if(cpu->pc >= MEMSIZE) { cpu->stat = ADR; goto done; } \
+        DISPATCH(); } while(0)
+
+//Conditions are spelled exactly as decode_execute() spells them
+#define COND_LE (cpu->zf || (cpu->sf && !cpu->of) || (!cpu->sf && cpu->of))
+#define COND_L  ((cpu->sf && !cpu->of) || (!cpu->sf && cpu->of))
+#define COND_E  (cpu->zf)
+#define COND_NE (!cpu->zf)
+#define COND_GE (cpu->sf == cpu->of)
+#define COND_G  (!cpu->zf && cpu->sf == cpu->of)
+
+#define CMOV_HANDLER(name, cond) HANDLER(name) \
+        if(cond) \
+            cpu->reg[s->inst.rb] = cpu->reg[s->inst.ra]; \
+        NEXT_SEQ();
+
+#define JUMP_HANDLER(name, cond) HANDLER(name) \
+        cpu->pc = (cond) ? s->inst.valC.dest : s->inst.valP; \
+        NEXT_BRANCH();
+
+y86_inst_t threaded_run (y86_t *cpu, byte_t *memory, int *count) {
+    y86_inst_t last;
+    memset(&last, 0x00, sizeof(last));
+
+    //Check for null parameters
+    if(cpu == NULL)
+        return last;
+    if(memory == NULL || count == NULL) {
+        cpu->stat = INS;
+        return last;
+    }
+    //Stores here are not tracked, so a snapshot restore must copy everything
+    cpu->dirty = DIRTY_ALL;
+
+#if THREADED_GOTO
+    //Table from handler number to label, in thread_op_t order
+    EXTENSION_BEGIN
+    static const void *labels[T_NUMHANDLERS] = {
+        &&T_DECODE, &&T_SLOW, &&T_HALT, &&T_NOP,
+        &&T_RRMOVQ, &&T_CMOVLE, &&T_CMOVL, &&T_CMOVE, &&T_CMOVNE, &&T_CMOVGE,
+        &&T_CMOVG, &&T_IRMOVQ, &&T_RMMOVQ, &&T_MRMOVQ,
+        &&T_ADDQ, &&T_SUBQ, &&T_ANDQ, &&T_XORQ,
+        &&T_JMP, &&T_JLE, &&T_JL, &&T_JE, &&T_JNE, &&T_JGE, &&T_JG,
+        &&T_CALL, &&T_RET, &&T_PUSHQ, &&T_POPQ
+    };
+    EXTENSION_END
+    const void *decode = labels[T_DECODE];
+#else
+    const void *decode = NULL;
+#endif
+
+    //Every slot starts out pointing at the decoder
+    thread_slot_t *slots = (thread_slot_t *) calloc(MEMSIZE, sizeof(thread_slot_t));
+    if(slots == NULL) {
+        cpu->stat = INS;
+        return last;
+    }
+#if THREADED_GOTO
+    for(int i = 0; i < MEMSIZE; i++)
+        slots[i].handler = decode;
+#endif
+
+    thread_slot_t *s = NULL;
+    y86_inst_t slow;
+    y86_inst_t *lastp = NULL;
+    y86_reg_t valE;
+    y86_reg_t valM;
+    address_t store;
+    address_t lo, hi;
+    int n = *count;
+
+    if(cpu->stat != AOK || cpu->pc >= MEMSIZE)
+        goto done;
+    DISPATCH();
+
+#if !THREADED_GOTO
+next:
+    switch(s->op) {
+#endif
+
+    //First visit to an address (or first since a store hit it): predecode
+    HANDLER(T_DECODE) {
+        y86_t probe = *cpu;
+        s->inst = fetch(&probe, memory);
+        s->op = (probe.stat == cpu->stat) ? select_handler(&s->inst) : T_SLOW;
+#if THREADED_GOTO
+        s->handler = labels[s->op];
+#endif
+        DISPATCH();
+    }
+
+    //Anything unusual runs through the reference pipeline
+    HANDLER(T_SLOW)
+        slow = step_reference(cpu, memory, &n, &store);
+        lastp = &slow;
+        invalidate_slots(slots, store, decode);
+        if(io_stored(cpu, &slow, &lo, &hi)) {
+            for(address_t a = lo; a < hi; a += STORE_SIZE)
+                invalidate_slots(slots, a, decode);
+        }
+        if(cpu->stat != AOK)
+            goto done;
+        lastp = NULL;
+        DISPATCH();
+
+    HANDLER(T_HALT)
+        cpu->stat = HLT;
+        cpu->pc = s->inst.valP;
+        n++;
+        goto done;
+
+    HANDLER(T_NOP)
+        NEXT_SEQ();
+
+    CMOV_HANDLER(T_RRMOVQ, true)
+    CMOV_HANDLER(T_CMOVLE, COND_LE)
+    CMOV_HANDLER(T_CMOVL,  COND_L)
+    CMOV_HANDLER(T_CMOVE,  COND_E)
+    CMOV_HANDLER(T_CMOVNE, COND_NE)
+    CMOV_HANDLER(T_CMOVGE, COND_GE)
+    CMOV_HANDLER(T_CMOVG,  COND_G)
+
+    HANDLER(T_IRMOVQ)
+        cpu->reg[s->inst.rb] = s->inst.valC.v;
+        NEXT_SEQ();
+
+    HANDLER(T_RMMOVQ)
+        valE = s->inst.valC.d + cpu->reg[s->inst.rb];
+        if(valE >= MEMSIZE) {
+            cpu->stat = ADR;
+            n++;
+            goto done;
+        }
+        *((uint64_t *)&memory[valE]) = cpu->reg[s->inst.ra];
+        invalidate_slots(slots, valE, decode);
+        NEXT_SEQ();
+
+    HANDLER(T_MRMOVQ)
+        valE = s->inst.valC.d + cpu->reg[s->inst.rb];
+        if(valE >= MEMSIZE) {
+            cpu->stat = ADR;
+            n++;
+            goto done;
+        }
+        cpu->reg[s->inst.ra] = *((uint64_t *)&memory[valE]);
+        NEXT_SEQ();
+
+    //OPq flags follow decode_execute(): only add and sub touch the overflow flag
+    HANDLER(T_ADDQ) {
+        y86_reg_t a = cpu->reg[s->inst.ra];
+        y86_reg_t b = cpu->reg[s->inst.rb];
+        valE = b + a;
+        cpu->of = (((int64_t)b < 0) == ((int64_t)a < 0)) &&
+                  (((int64_t)valE < 0) != ((int64_t)b < 0));
+        cpu->sf = ((int64_t)valE < 0);
+        cpu->zf = (valE == 0);
+        cpu->reg[s->inst.rb] = valE;
+        NEXT_SEQ();
+    }
+
+    HANDLER(T_SUBQ) {
+        y86_reg_t a = cpu->reg[s->inst.ra];
+        y86_reg_t b = cpu->reg[s->inst.rb];
+        valE = b - a;
+        cpu->of = (((int64_t)b < 0) != ((int64_t)a < 0)) &&
+                  (((int64_t)valE < 0) != ((int64_t)b < 0));
+        cpu->sf = ((int64_t)valE < 0);
+        cpu->zf = (valE == 0);
+        cpu->reg[s->inst.rb] = valE;
+        NEXT_SEQ();
+    }
+
+    HANDLER(T_ANDQ)
+        valE = cpu->reg[s->inst.rb] & cpu->reg[s->inst.ra];
+        cpu->sf = ((int64_t)valE < 0);
+        cpu->zf = (valE == 0);
+        cpu->reg[s->inst.rb] = valE;
+        NEXT_SEQ();
+
+    HANDLER(T_XORQ)
+        valE = cpu->reg[s->inst.rb] ^ cpu->reg[s->inst.ra];
+        cpu->sf = ((int64_t)valE < 0);
+        cpu->zf = (valE == 0);
+        cpu->reg[s->inst.rb] = valE;
+        NEXT_SEQ();
+
+    JUMP_HANDLER(T_JMP, true)
+    JUMP_HANDLER(T_JLE, COND_LE)
+    JUMP_HANDLER(T_JL,  COND_L)
+    JUMP_HANDLER(T_JE,  COND_E)
+    JUMP_HANDLER(T_JNE, COND_NE)
+    JUMP_HANDLER(T_JGE, COND_GE)
+    JUMP_HANDLER(T_JG,  COND_G)
+
+    HANDLER(T_CALL)
+        valE = cpu->reg[RSP] - 8;
+        //A failed call still moves the PC to the destination
+        if(valE >= MEMSIZE) {
+            cpu->stat = ADR;
+            cpu->pc = s->inst.valC.dest;
+            n++;
+            goto done;
+        }
+        *((uint64_t *)&memory[valE]) = s->inst.valP;
+        invalidate_slots(slots, valE, decode);
+        cpu->reg[RSP] = valE;
+        cpu->pc = s->inst.valC.dest;
+        NEXT_BRANCH();
+
+    HANDLER(T_RET)
+        if(cpu->reg[RSP] >= MEMSIZE) {
+            cpu->stat = ADR;
+            n++;
+            goto done;
+        }
+        valM = *((uint64_t *)&memory[cpu->reg[RSP]]);
+        cpu->reg[RSP] += 8;
+        cpu->pc = valM;
+        NEXT_BRANCH();
+
+    HANDLER(T_PUSHQ)
+        valE = cpu->reg[RSP] - 8;
+        if(valE >= MEMSIZE) {
+            cpu->stat = ADR;
+            n++;
+            goto done;
+        }
+        *((uint64_t *)&memory[valE]) = cpu->reg[s->inst.ra];
+        invalidate_slots(slots, valE, decode);
+        cpu->reg[RSP] = valE;
+        NEXT_SEQ();
+
+    //Popping into %rsp keeps the loaded value, as in memory_wb_pc()
+    HANDLER(T_POPQ)
+        if(cpu->reg[RSP] >= MEMSIZE) {
+            cpu->stat = ADR;
+            n++;
+            goto done;
+        }
+        valM = *((uint64_t *)&memory[cpu->reg[RSP]]);
+        cpu->reg[RSP] += 8;
+        cpu->reg[s->inst.ra] = valM;
+        NEXT_SEQ();
+
+#if !THREADED_GOTO
+        default:
+            goto done;
+    }
+#endif
+
+done:
+    //Report whichever instruction ran last so main can fix up the PC on ADR
+    if(lastp != NULL)
+        last = *lastp;
+    else if(s != NULL)
+        last = s->inst;
+    *count = n;
+    free(slots);
+    return last;
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+//Pick the handler for a cleanly decoded instruction. Operands naming %r15
+//(NOREG) reach past the register file in the reference code, so those take
+//the slow path to keep identical results.
+static thread_op_t select_handler (y86_inst_t *inst) {
+    switch(inst->icode) {
+        case(HALT):   return T_HALT;
+        case(NOP):    return T_NOP;
+        case(CMOV):   return T_RRMOVQ + inst->ifun.cmov;
+        case(IRMOVQ): return T_IRMOVQ;
+        case(RMMOVQ):
+            if(inst->ra == NOREG || inst->rb == NOREG)
+                return T_SLOW;
+            return T_RMMOVQ;
+        case(MRMOVQ):
+            if(inst->rb == NOREG)
+                return T_SLOW;
+            return T_MRMOVQ;
+        case(OPQ):
+            if(inst->ra == NOREG || inst->rb == NOREG)
+                return T_SLOW;
+            return T_ADDQ + inst->ifun.op;
+        case(JUMP):   return T_JMP + inst->ifun.jump;
+        case(CALL):   return T_CALL;
+        case(RET):    return T_RET;
+        case(PUSHQ):  return T_PUSHQ;
+        case(POPQ):
+            if(inst->ra == NOREG)
+                return T_SLOW;
+            return T_POPQ;
+        default:      return T_SLOW;
+    }
+}
+
+//Send every slot overlapping an 8-byte store back to the decoder
+static void invalidate_slots (thread_slot_t *slots, address_t addr,
+        const void *decode) {
+    if(addr >= MEMSIZE)
+        return;
+    address_t first = (addr >= INST_MAXLEN - 1) ? addr - (INST_MAXLEN - 1) : 0;
+    address_t last = addr + STORE_SIZE;
+    if(last > MEMSIZE)
+        last = MEMSIZE;
+    for(address_t a = first; a < last; a++) {
+        slots[a].op = T_DECODE;
+#if THREADED_GOTO
+        slots[a].handler = decode;
+#endif
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef __CS261_THREADED__
+#define __CS261_THREADED__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "y86.h"
+
+/**
+ * @brief Run a Y86 program to completion with the direct-threaded engine
+ *
+ * Every address gets a threaded-code slot holding the predecoded instruction
+ * and a pointer to the handler for its (icode, ifun) pair. Each handler ends
+ * by jumping straight to the handler of the next instruction, so there is one
+ * indirect branch per guest instruction instead of three. Anything unusual
+ * (invalid opcodes, address errors, iotrap, %r15 operands) is handed to the
+ * same fetch/decode_execute/memory_wb_pc sequence the -e loop uses, so the
+ * final CPU state and instruction count always match it.
+ *
+ * @param cpu Y86 CPU structure, already pointed at the entry address
+ * @param memory Pointer to the beginning of the Y86 address space
+ * @param count Pointer to the running execution count to be updated
+ * @returns The last instruction executed (needed to fix up the PC after ADR)
+ */
+y86_inst_t threaded_run (y86_t *cpu, byte_t *memory, int *count);
+
+#endif
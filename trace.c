@@ -0,0 +1,360 @@
+/*
+ * CS 261: Binary execution traces
+ *
+ * Name: Ben Berry
+ */
+
+#include "trace.h"
+#include "p3-disas.h"
+#include "varint.h"
+
+static void emit (trace_t *tr, const void *data, size_t len);
+static void flush (trace_t *tr);
+static bool count_page (address_t addr, const byte_t *page, void *arg);
+static bool emit_page (address_t addr, const byte_t *page, void *arg);
+static void consume (void *state, const y86_event_t *ev);
+static bool get_varint (FILE *in, uint64_t *value);
+
+/**********************************************************************
+ *                         WRITER FUNCTIONS
+ *********************************************************************/
+
+trace_t *trace_open (const char *path, y86_vm_t *vm) {
+    if(path == NULL || vm == NULL || !vm->loaded)
+        return NULL;
+    trace_t *tr = (trace_t *) calloc(1, sizeof(trace_t));
+    if(tr == NULL)
+        return NULL;
+    tr->buf = (byte_t *) malloc(TRACE_BUFSIZE);
+    tr->out = fopen(path, "wb");
+    if(tr->buf == NULL || tr->out == NULL) {
+        trace_close(tr);
+        return NULL;
+    }
+
+    //The state the run starts from; flags are copied as raw bytes because
+    //stores to the NOREG slot can leave any value in them
+    trace_hdr_t hdr;
+    memset(&hdr, 0x00, sizeof(hdr));
+    hdr.magic = TRACE_MAGIC;
+    hdr.version = TRACE_VERSION;
+    hdr.paged = vm->pmem != NULL;
+    hdr.elf = vm->hdr;
+    for(int i = 0; i < NUMREGS; i++)
+        hdr.reg[i] = tr->reg[i] = vm->cpu.reg[i];
+    hdr.pc = tr->next = vm->cpu.pc;
+    memcpy(&tr->flags[0], &vm->cpu.zf, 1);
+    memcpy(&tr->flags[1], &vm->cpu.sf, 1);
+    memcpy(&tr->flags[2], &vm->cpu.of, 1);
+    memcpy(hdr.flags, tr->flags, sizeof(hdr.flags));
+    hdr.stat = vm->cpu.stat;
+    hdr.count = vm->count;
+    if(vm->pmem != NULL)
+        pmem_walk(vm->pmem, count_page, &hdr.npages);
+    emit(tr, &hdr, sizeof(hdr));
+
+    //Then the memory it starts with
+    if(vm->pmem != NULL)
+        pmem_walk(vm->pmem, emit_page, tr);
+    else
+        emit(tr, vm->memory, MEMSIZE);
+    return tr;
+}
+
+y86_stat_t trace_run (trace_t *tr, y86_vm_t *vm, long budget) {
+    if(tr == NULL || vm == NULL)
+        return INS;
+    y86_t *cpu = &vm->cpu;
+    y86_event_t ev;
+    for(long i = 0; cpu->stat == AOK && (budget < 0 || i < budget); i++) {
+        address_t pc = cpu->pc;
+        y86_vm_step(vm);
+        y86_vm_event(vm, pc, &ev);
+        trace_record(tr, &ev);
+    }
+    //No more instructions: just the -e fix-up of the PC after ADR
+    return y86_vm_run(vm, 0);
+}
+
+void trace_record (trace_t *tr, const y86_event_t *ev) {
+    if(tr->ended)
+        return;
+
+    //Build the record straight into the buffer
+    if(tr->used > TRACE_BUFSIZE - TRACE_MAXRECORD)
+        flush(tr);
+    byte_t *rec = &tr->buf[tr->used];
+    byte_t *p = &rec[2];
+    byte_t tag = 0;
+    rec[1] = ev->opcode;
+    if(ev->pc != tr->next) {
+        tag |= TRACE_JUMP;
+        p = varint_put(p, varint_zigzag(ev->pc - tr->next));
+    }
+    if(memcmp(ev->flags, tr->flags, sizeof(tr->flags)) != 0) {
+        tag |= TRACE_FLAGS;
+        memcpy(p, ev->flags, sizeof(tr->flags));
+        memcpy(tr->flags, ev->flags, sizeof(tr->flags));
+        p += sizeof(tr->flags);
+    }
+    if(ev->stored) {
+        tag |= TRACE_STORE;
+        p = varint_put(p, ev->store);
+        memcpy(p, &ev->value, sizeof(ev->value));
+        p += sizeof(ev->value);
+    }
+    if(ev->stat != AOK) {
+        tag |= TRACE_STAT;
+        *p++ = ev->stat;
+        p = varint_put(p, ev->after);
+    }
+    //Only the registers the instruction can write need comparing
+    int nregs = 0;
+    for(int r = 0; r < ev->nregs; r++) {
+        byte_t reg = ev->regs[r];
+        if(ev->regval[r] == tr->reg[reg])
+            continue;
+        *p++ = reg;
+        p = varint_put(p, varint_zigzag(ev->regval[r] - tr->reg[reg]));
+        tr->reg[reg] = ev->regval[r];
+        nregs++;
+    }
+    rec[0] = tag | (nregs << TRACE_REGSHIFT);
+    tr->used = p - tr->buf;
+    tr->next = ev->valP;
+    tr->records++;
+
+    //Close the run off once the CPU stops
+    if(ev->stat != AOK) {
+        byte_t end[1 + 10];
+        end[0] = TRACE_END;
+        emit(tr, end, varint_put(&end[1], (uint64_t) ev->count) - end);
+        tr->ended = true;
+    }
+}
+
+pipe_consumer_t trace_consumer (trace_t *tr) {
+    pipe_consumer_t c = { "trace", tr, consume, NULL };
+    return c;
+}
+
+bool trace_close (trace_t *tr) {
+    if(tr == NULL)
+        return false;
+    if(tr->out != NULL) {
+        flush(tr);
+        if(fclose(tr->out) != 0)
+            tr->failed = true;
+    }
+    bool ok = tr->out != NULL && !tr->failed;
+    free(tr->buf);
+    free(tr);
+    return ok;
+}
+
+void dump_trace_stats (FILE *out, trace_t *tr) {
+    uint64_t bytes = tr->bytes + tr->used;
+    fprintf(out, "Trace: %lu instructions, %lu KiB (%.2f bytes per instruction)\n",
+            tr->records, bytes / 1024,
+            tr->records ? (double) bytes / tr->records : 0.0);
+}
+
+/**********************************************************************
+ *                         READER FUNCTIONS
+ *********************************************************************/
+
+bool trace_reader_open (FILE *in, trace_reader_t *rd) {
+    if(in == NULL || rd == NULL)
+        return false;
+    memset(rd, 0x00, sizeof(trace_reader_t));
+    rd->in = in;
+    if(fread(&rd->hdr, sizeof(trace_hdr_t), 1, in) != 1
+            || rd->hdr.magic != TRACE_MAGIC || rd->hdr.version != TRACE_VERSION)
+        return false;
+
+    rd->memory = (byte_t *) calloc(MEMSIZE, 1);
+    if(rd->memory == NULL)
+        return false;
+    if(rd->hdr.paged) {
+        //Each page is its address and then its bytes
+        rd->pmem = pmem_create();
+        byte_t page[PMEM_PAGESIZE];
+        address_t addr;
+        for(uint64_t i = 0; rd->pmem != NULL && i < rd->hdr.npages; i++) {
+            if(fread(&addr, sizeof(addr), 1, in) != 1 || fread(page, PMEM_PAGESIZE, 1, in) != 1
+                    || !pmem_write(rd->pmem, addr, page, PMEM_PAGESIZE)) {
+                trace_reader_close(rd);
+                return false;
+            }
+        }
+        if(rd->pmem == NULL) {
+            trace_reader_close(rd);
+            return false;
+        }
+        trace_window(rd);
+    } else if(fread(rd->memory, MEMSIZE, 1, in) != 1) {
+        trace_reader_close(rd);
+        return false;
+    }
+
+    for(int i = 0; i < NUMREGS; i++)
+        rd->cpu.reg[i] = rd->hdr.reg[i];
+    rd->cpu.pc = rd->next = rd->hdr.pc;
+    memcpy(&rd->cpu.zf, &rd->hdr.flags[0], 1);
+    memcpy(&rd->cpu.sf, &rd->hdr.flags[1], 1);
+    memcpy(&rd->cpu.of, &rd->hdr.flags[2], 1);
+    rd->cpu.stat = (y86_stat_t) rd->hdr.stat;
+    rd->cpu.pmem = rd->pmem;
+    rd->count = rd->hdr.count;
+    return true;
+}
+
+bool trace_next (trace_reader_t *rd, trace_event_t *ev) {
+    if(rd == NULL || ev == NULL || rd->ended)
+        return false;
+    FILE *in = rd->in;
+    uint64_t value;
+    int tag = getc(in);
+    if(tag == EOF)
+        return false;
+    if(tag & TRACE_END) {
+        if(get_varint(in, &value)) {
+            rd->count = (int) value;
+            rd->ended = true;
+        }
+        return false;
+    }
+    int opcode = getc(in);
+    if(opcode == EOF)
+        return false;
+
+    //Decode the instruction where the PC says, as the VM fetched it
+    memset(ev, 0x00, sizeof(trace_event_t));
+    ev->opcode = (byte_t) opcode;
+    address_t pc = rd->next;
+    if(tag & TRACE_JUMP) {
+        if(!get_varint(in, &value))
+            return false;
+        pc += varint_unzigzag(value);
+    }
+    rd->cpu.pc = pc;
+    ev->before = rd->cpu;
+    y86_t scratch = rd->cpu;
+    ev->ins = fetch(&scratch, rd->memory);
+
+    //Then replay what it did, field by field in tag bit order
+    if(tag & TRACE_FLAGS) {
+        byte_t flags[3];
+        if(fread(flags, sizeof(flags), 1, in) != 1)
+            return false;
+        memcpy(&rd->cpu.zf, &flags[0], 1);
+        memcpy(&rd->cpu.sf, &flags[1], 1);
+        memcpy(&rd->cpu.of, &flags[2], 1);
+    }
+    if(tag & TRACE_STORE) {
+        if(!get_varint(in, &ev->store) || fread(&ev->value, sizeof(ev->value), 1, in) != 1)
+            return false;
+        ev->stored = true;
+        if(rd->pmem != NULL && pmem_valid(ev->store))
+            pmem_write(rd->pmem, ev->store, &ev->value, sizeof(ev->value));
+        else if(rd->pmem == NULL && ev->store <= MEMSIZE - sizeof(uint64_t))
+            memcpy(&rd->memory[ev->store], &ev->value, sizeof(ev->value));
+    }
+    if(tag & TRACE_STAT) {
+        int stat = getc(in);
+        if(stat == EOF || !get_varint(in, &value))
+            return false;
+        rd->cpu.stat = (y86_stat_t) stat;
+        rd->cpu.pc = value;
+    }
+    ev->nregs = (tag & TRACE_REGS) >> TRACE_REGSHIFT;
+    for(int r = 0; r < ev->nregs; r++) {
+        int reg = getc(in);
+        if(reg == EOF || reg >= NOREG || !get_varint(in, &value))
+            return false;
+        ev->regs[r] = (y86_regnum_t) reg;
+        rd->cpu.reg[reg] += varint_unzigzag(value);
+    }
+
+    //Count it the way -e does
+    rd->count++;
+    if(rd->cpu.stat == INS)
+        rd->count--;
+    rd->next = ev->ins.valP;
+    return true;
+}
+
+void trace_window (trace_reader_t *rd) {
+    if(rd != NULL && rd->pmem != NULL)
+        pmem_read(rd->pmem, 0, rd->memory, MEMSIZE);
+}
+
+void trace_reader_close (trace_reader_t *rd) {
+    if(rd == NULL)
+        return;
+    free(rd->memory);
+    pmem_free(rd->pmem);
+    rd->memory = NULL;
+    rd->pmem = NULL;
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+//Add bytes to the trace through the buffer
+static void emit (trace_t *tr, const void *data, size_t len) {
+    const byte_t *in = (const byte_t *) data;
+    while(len > 0) {
+        if(tr->used == TRACE_BUFSIZE)
+            flush(tr);
+        size_t chunk = TRACE_BUFSIZE - tr->used;
+        if(chunk > len)
+            chunk = len;
+        memcpy(&tr->buf[tr->used], in, chunk);
+        tr->used += chunk;
+        in += chunk;
+        len -= chunk;
+    }
+}
+
+//Write out everything buffered
+static void flush (trace_t *tr) {
+    if(tr->used > 0 && fwrite(tr->buf, tr->used, 1, tr->out) != 1)
+        tr->failed = true;
+    tr->bytes += tr->used;
+    tr->used = 0;
+}
+
+//pmem_walk() visitors for the initial memory of paged traces
+static bool count_page (address_t addr, const byte_t *page, void *arg) {
+    (void) addr;
+    (void) page;
+    (*(uint64_t *) arg)++;
+    return true;
+}
+
+static bool emit_page (address_t addr, const byte_t *page, void *arg) {
+    emit((trace_t *) arg, &addr, sizeof(addr));
+    emit((trace_t *) arg, page, PMEM_PAGESIZE);
+    return true;
+}
+
+//Pipeline callback
+static void consume (void *state, const y86_event_t *ev) {
+    trace_record((trace_t *) state, ev);
+}
+
+//varint_get() for a stream rather than a buffer
+static bool get_varint (FILE *in, uint64_t *value) {
+    *value = 0;
+    for(int shift = 0; shift < 64; shift += 7) {
+        int c = getc(in);
+        if(c == EOF)
+            return false;
+        *value |= (uint64_t) (c & 0x7f) << shift;
+        if((c & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,204 @@
+#ifndef __CS261_TRACE__
+#define __CS261_TRACE__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elf.h"
+#include "y86.h"
+#include "pmem.h"
+#include "y86vm.h"
+#include "pipeline.h"
+
+/* Trace file marker ("Y86T" read as little-endian text) and format version */
+#define TRACE_MAGIC   0x54363859
+#define TRACE_VERSION 1
+
+/* Bytes buffered by the writer before each fwrite() */
+#define TRACE_BUFSIZE (1 << 20)
+
+/* Longest record: tag, opcode, PC delta, two register deltas, flags,
+   store and status (varints take at most 10 bytes) */
+#define TRACE_MAXRECORD 80
+
+/* Record tag bits */
+#define TRACE_JUMP   0x01       // PC did not follow on: zigzag varint delta
+#define TRACE_FLAGS  0x02       // zf, sf and of bytes changed: 3 bytes
+#define TRACE_STORE  0x04       // memory written: varint address, 8 bytes
+#define TRACE_STAT   0x08       // CPU stopped: status byte, varint PC after
+#define TRACE_REGS   0x30       // registers written (0-2): register number
+                                // byte, zigzag varint delta, for each
+#define TRACE_REGSHIFT 4
+#define TRACE_END    0x80       // end of the run: varint execution count
+
+/*
+   Binary execution trace: a header with the state the run started from,
+   then one record per instruction executed, then an end record.
+
+   +--------------------------------------------------------+
+   | header (trace_hdr_t) - 168 bytes                       |
+   +--------------------------------------------------------+
+   | initial memory: MEMSIZE bytes (flat), or for each page |
+   | its address (8) and PMEM_PAGESIZE bytes (paged)        |
+   +--------------------------------------------------------+
+   | records: tag, opcode byte, then the fields the tag     |
+   | bits ask for, in bit order                             |
+   +--------------------------------------------------------+
+   | end record: TRACE_END, varint execution count          |
+   +--------------------------------------------------------+
+
+   A record's PC is the previous instruction's valP unless TRACE_JUMP gives
+   the difference. Register deltas are new minus old. Everything a decoder
+   needs to redo the -E output (disassembly, final memory) follows from
+   replaying the stores onto the initial memory.
+*/
+typedef struct __attribute__((__packed__)) trace_hdr {
+    uint32_t magic;             // TRACE_MAGIC
+    uint16_t version;           // TRACE_VERSION
+    uint8_t paged;              // 1 if memory is paged (see pmem.h)
+    uint8_t pad;
+    elf_hdr_t elf;              // header of the program that was run
+    uint64_t reg[NUMREGS];      // registers at the start
+    uint64_t pc;                // program counter at the start
+    uint8_t flags[3];           // zf, sf and of at the start
+    uint8_t stat;               // CPU status at the start
+    int32_t count;              // execution count at the start
+    uint64_t npages;            // pages of initial memory (paged only)
+} trace_hdr_t;
+
+/* Writer state for recording a run */
+typedef struct trace {
+
+    FILE *out;                  // trace file
+    byte_t *buf;                // TRACE_BUFSIZE bytes waiting to be written
+    size_t used;                // bytes of buf in use
+    bool failed;                // a write failed
+    bool ended;                 // the end record has been written
+
+    address_t next;             // PC the next record is assumed to start at
+    y86_reg_t reg[NUMREGS];     // registers as of the last record
+    byte_t flags[3];            // zf, sf and of as of the last record
+
+    uint64_t records;           // instruction records written
+    uint64_t bytes;             // bytes written (header included)
+
+} trace_t;
+
+/* Reader state for replaying a trace */
+typedef struct trace_reader {
+
+    FILE *in;                   // trace file
+    trace_hdr_t hdr;            // its header
+    y86_t cpu;                  // CPU state after the last record read
+    byte_t *memory;             // flat memory (for paged traces, the first
+                                // MEMSIZE bytes as of trace_window())
+    pmem_t *pmem;               // paged memory, or NULL
+    address_t next;             // PC the next record is assumed to start at
+    int count;                  // execution count so far (as -e counts it)
+    bool ended;                 // the end record has been read
+
+} trace_reader_t;
+
+/* One instruction as replayed from a trace */
+typedef struct trace_event {
+    y86_t before;               // CPU state before the instruction
+    y86_inst_t ins;             // the instruction (decoded from replayed memory)
+    byte_t opcode;              // opcode byte recorded with it
+    int nregs;                  // registers written
+    y86_regnum_t regs[2];       // which ones
+    bool stored;                // memory was written
+    address_t store;            // where
+    uint64_t value;             // what (the eight bytes at store afterwards)
+} trace_event_t;
+
+/**
+ * @brief Start a trace of a loaded VM, writing the header and initial memory
+ *
+ * @param path Trace file to create
+ * @param vm VM with the program loaded
+ * @returns Writer state, or NULL if the file could not be created
+ */
+trace_t *trace_open (const char *path, y86_vm_t *vm);
+
+/**
+ * @brief Run the VM like y86_vm_run(), recording every instruction
+ *
+ * The end record is written once the CPU stops.
+ *
+ * @param tr Writer state
+ * @param vm VM to run (the one the trace was opened on)
+ * @param budget Maximum number of instructions to execute, or -1 for no limit
+ * @returns CPU status when the run stopped (AOK if the budget ran out)
+ */
+y86_stat_t trace_run (trace_t *tr, y86_vm_t *vm, long budget);
+
+/**
+ * @brief Add the record for one instruction (and the end record if the CPU
+ * stopped with it)
+ *
+ * @param tr Writer state
+ * @param ev What the instruction did
+ */
+void trace_record (trace_t *tr, const y86_event_t *ev);
+
+/**
+ * @brief Wrap a writer as a pipeline consumer
+ *
+ * @param tr Writer state (still closed with trace_close())
+ * @returns Consumer that records every event it is given
+ */
+pipe_consumer_t trace_consumer (trace_t *tr);
+
+/**
+ * @brief Flush and close a trace, releasing the writer
+ *
+ * @param tr Writer state (freed; may be NULL)
+ * @returns True if every byte of the trace was written
+ */
+bool trace_close (trace_t *tr);
+
+/**
+ * @brief Print trace writer counters
+ *
+ * @param out Stream to print to
+ * @param tr Writer state to describe
+ */
+void dump_trace_stats (FILE *out, trace_t *tr);
+
+/**
+ * @brief Open a trace for replay, loading its initial state
+ *
+ * @param in Trace file, positioned at its start
+ * @param rd Reader state to fill in
+ * @returns True if the header and initial memory could be read
+ */
+bool trace_reader_open (FILE *in, trace_reader_t *rd);
+
+/**
+ * @brief Replay the next record
+ *
+ * @param rd Reader state (rd->cpu and memory are updated)
+ * @param ev Filled in with the instruction that was replayed
+ * @returns True if an instruction record was read, false at the end record,
+ * the end of the file or a damaged record (rd->ended tells which)
+ */
+bool trace_next (trace_reader_t *rd, trace_event_t *ev);
+
+/**
+ * @brief Refresh rd->memory from paged memory (no-op for flat traces)
+ *
+ * @param rd Reader state
+ */
+void trace_window (trace_reader_t *rd);
+
+/**
+ * @brief Release what a reader allocated (not the file)
+ *
+ * @param rd Reader state
+ */
+void trace_reader_close (trace_reader_t *rd);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef __CS261_VARINT__
+#define __CS261_VARINT__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "y86.h"
+
+/* Longest encoding of a 64-bit value, in bytes */
+#define VARINT_MAX 10
+
+/* Variable-length integers as traces and input logs store them (LEB128):
+   seven bits per byte, low bits first, high bit set on all but the last.
+   Signed differences go through zigzag first, so small magnitudes of
+   either sign stay short. */
+
+/**
+ * @brief Encode a value
+ *
+ * @param p Where the bytes go (room for VARINT_MAX)
+ * @param value Value to encode
+ * @returns Pointer just past the last byte written
+ */
+static inline byte_t *varint_put (byte_t *p, uint64_t value) {
+    while(value >= 0x80) {
+        *p++ = (byte_t) (value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (byte_t) value;
+    return p;
+}
+
+/**
+ * @brief Decode a value from a buffer
+ *
+ * @param buf Encoded bytes
+ * @param used Number of bytes in buf
+ * @param pos Offset of the first byte, moved past the value
+ * @param value Where the value goes
+ * @returns True if a whole value was decoded, false if buf ran out first
+ * or the encoding is too long
+ */
+static inline bool varint_get (const byte_t *buf, size_t used, size_t *pos, uint64_t *value) {
+    *value = 0;
+    for(int shift = 0; shift < 64 && *pos < used; shift += 7) {
+        byte_t c = buf[(*pos)++];
+        *value |= (uint64_t) (c & 0x7f) << shift;
+        if((c & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Map a two's complement value to small unsigned values either side of 0
+ *
+ * @param value Value (a difference, or a signed number) to map
+ * @returns 0, 1, 2, 3, ... for 0, -1, 1, -2, ...
+ */
+static inline uint64_t varint_zigzag (uint64_t value) {
+    return (value << 1) ^ (0 - (value >> 63));
+}
+
+/**
+ * @brief Undo varint_zigzag()
+ *
+ * @param value Mapped value
+ * @returns The original value
+ */
+static inline uint64_t varint_unzigzag (uint64_t value) {
+    return (value >> 1) ^ (0 - (value & 1));
+}
+
+#endif
@@ -0,0 +1,158 @@
+/*
+ * CS 261: Offline decoder for binary execution traces
+ *
+ * Name: Ben Berry
+ */
+
+#include "p2-load.h"
+#include "p3-disas.h"
+#include "p4-interp.h"
+#include "trace.h"
+#include "flatprof.h"
+
+/* CPU status names, by y86_stat_t */
+static const char *statuses[] = { "???", "AOK", "HLT", "ADR", "INS" };
+
+static void usage (char **argv);
+static bool in_range (trace_event_t *ev, address_t lo, address_t hi);
+static void render (trace_reader_t *rd, FILE *out, address_t lo, address_t hi);
+static void statistics (trace_reader_t *rd, FILE *out, address_t lo, address_t hi);
+
+int main (int argc, char **argv)
+{
+    //Parse command line arguments
+    bool stats = false;
+    address_t lo = 0;
+    address_t hi = UINT64_MAX;
+    char *end = NULL;
+    int opt = -1;
+    while((opt = getopt(argc, argv, "hsA:")) != -1) {
+        switch(opt) {
+            case 's': stats = true; break;
+            case 'A':
+                //start:end, each in any base strtoull() accepts
+                lo = strtoull(optarg, &end, 0);
+                if(*end != ':') {
+                    usage(argv);
+                    return EXIT_FAILURE;
+                }
+                hi = strtoull(end + 1, &end, 0);
+                if(*end != '\0' || hi <= lo) {
+                    usage(argv);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default: usage(argv); return EXIT_FAILURE;
+        }
+    }
+    if(optind != argc - 1) {
+        usage(argv);
+        return EXIT_FAILURE;
+    }
+
+    FILE *in = fopen(argv[optind], "rb");
+    trace_reader_t rd;
+    if(in == NULL || !trace_reader_open(in, &rd)) {
+        printf("Failed to read trace\n");
+        if(in != NULL)
+            fclose(in);
+        return EXIT_FAILURE;
+    }
+    if(stats)
+        statistics(&rd, stdout, lo, hi);
+    else
+        render(&rd, stdout, lo, hi);
+    //A trace without its end record was cut short
+    bool complete = rd.ended;
+    if(!complete)
+        fprintf(stderr, "Trace ends early (damaged or interrupted)\n");
+    trace_reader_close(&rd);
+    fclose(in);
+    return complete ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+static void usage (char **argv) {
+    printf("Usage: %s <option(s)> trace-file\n", argv[0]);
+    printf(" Options are:\n");
+    printf("  -h              Display usage\n");
+    printf("  -s              Show statistics instead of the trace\n");
+    printf("  -A start:end    Only instructions at, or storing to, addresses in [start, end)\n");
+}
+
+//Check whether an instruction ran at, or stored to, an address in [lo, hi)
+static bool in_range (trace_event_t *ev, address_t lo, address_t hi) {
+    return (ev->before.pc >= lo && ev->before.pc < hi)
+        || (ev->stored && ev->store >= lo && ev->store < hi);
+}
+
+//Print the trace exactly as -E would have
+static void render (trace_reader_t *rd, FILE *out, address_t lo, address_t hi) {
+    trace_event_t ev;
+    y86_inst_t last;
+    memset(&last, 0x00, sizeof(last));
+    fprintf(out, "Beginning execution at 0x%04x\n", rd->hdr.elf.e_entry);
+    while(trace_next(rd, &ev)) {
+        last = ev.ins;
+        if(!in_range(&ev, lo, hi))
+            continue;
+        fdump_cpu_state(out, &ev.before);
+        if(rd->cpu.stat == INS) {
+            fprintf(out, "\nInvalid instruction at 0x%04lx\n", rd->cpu.pc);
+        } else {
+            fprintf(out, "\nExecuting: ");
+            fdisassemble(out, &ev.ins);
+            fprintf(out, "\n");
+        }
+    }
+    //Trace mode has never added the extra byte for failed calls
+    if(rd->cpu.stat == ADR)
+        rd->cpu.pc = last.valP;
+    fdump_cpu_state(out, &rd->cpu);
+    fprintf(out, "Total execution count: %d\n\n", rd->count);
+    trace_window(rd);
+    fdump_memory(out, rd->memory, 0, MEMSIZE);
+}
+
+//Summarize the instructions in the trace
+static void statistics (trace_reader_t *rd, FILE *out, address_t lo, address_t hi) {
+    trace_event_t ev;
+    uint64_t byop[INVALID + 1][16];
+    uint64_t instructions = 0;
+    uint64_t jumps = 0;
+    uint64_t stores = 0;
+    uint64_t regs = 0;
+    address_t next = rd->next;
+    memset(byop, 0x00, sizeof(byop));
+    while(trace_next(rd, &ev)) {
+        bool jumped = ev.before.pc != next;
+        next = ev.ins.valP;
+        if(!in_range(&ev, lo, hi))
+            continue;
+        instructions++;
+        byop[ev.ins.icode <= INVALID ? ev.ins.icode : INVALID][ev.ins.ifun.b & 0x0f]++;
+        jumps += jumped;
+        stores += ev.stored;
+        regs += ev.nregs;
+    }
+    long bytes = ftell(rd->in);
+    fprintf(out, "Instructions: %lu\n", instructions);
+    fprintf(out, "Trace size: %ld bytes (%.2f per instruction)\n", bytes,
+            instructions ? (double) bytes / instructions : 0.0);
+    fprintf(out, "Control transfers: %lu\n", jumps);
+    fprintf(out, "Stores: %lu\n", stores);
+    fprintf(out, "Register writes: %lu\n", regs);
+    char name[16];
+    for(int i = 0; i <= INVALID; i++) {
+        for(int j = 0; j < 16; j++) {
+            if(byop[i][j] > 0)
+                fprintf(out, "  %-9s %12lu  %5.1f%%\n", flatprof_mnemonic(i, j, name, sizeof(name)),
+                        byop[i][j], 100.0 * byop[i][j] / instructions);
+        }
+    }
+    fprintf(out, "Final status: %s\n", statuses[rd->cpu.stat <= INS ? rd->cpu.stat : 0]);
+    fprintf(out, "Total execution count: %d\n", rd->count);
+}
@@ -8,12 +8,19 @@
 #define MEMSIZE (1 << VADDRBITS)
 #define NUMREGS 15
 
+/* Flat memory is tracked for snapshots in 64 blocks, one bit each */
+#define DIRTY_BLOCKS 64
+#define DIRTY_BLOCK (MEMSIZE / DIRTY_BLOCKS)
+#define DIRTY_ALL UINT64_MAX
+
 /* type declarations */
 typedef uint8_t  byte_t;        // byte
 typedef uint64_t y86_reg_t;     // register
 typedef uint64_t address_t;     // address
 typedef bool     flag_t;        // CPU flag
 
+struct pmem;
+
 /* possible CPU statuses */
 typedef enum { AOK = 1, HLT, ADR, INS } y86_stat_t;
 
@@ -30,6 +37,16 @@ typedef struct y86 {
 
     y86_stat_t stat;            // program status
 
+    struct pmem *pmem;          // paged address space (see pmem.h), or NULL
+                                // when memory is the flat MEMSIZE array
+
+    uint64_t dirty;             // flat memory blocks stored to since the last
+                                // snapshot (bit n covers DIRTY_BLOCK bytes
+                                // from n * DIRTY_BLOCK)
+
+    struct y86_io *io;          // I/O channels for iotrap (see io.h), or NULL
+                                // when there are none (iotrap is then INS)
+
 } y86_t;
 
 /* These enums are specified to match the order of the numbers for all Y86
@@ -40,6 +57,14 @@ typedef enum {
     POPQ, IOTRAP, INVALID
 } y86_icode_t;
 
+/* Names by icode, with cmovXX, OPq and jXX standing for their groups; an
+   initializer rather than a table so that plugins, which link against
+   nothing, can have it too (flatprof_mnemonic() names single opcodes) */
+#define Y86_ICODE_NAMES { \
+    "halt", "nop", "cmovXX", "irmovq", "rmmovq", "mrmovq", "OPq", "jXX", \
+    "call", "ret", "pushq", "popq", "iotrap", "invalid" \
+}
+
 typedef enum {
     RRMOVQ = 0, CMOVLE, CMOVL, CMOVE, CMOVNE, CMOVGE, CMOVG, BADCMOV
 } y86_cmov_t;
@@ -52,10 +77,16 @@ typedef enum {
     JMP = 0, JLE, JL, JE, JNE, JGE, JG, BADJUMP
 } y86_jump_t;
 
+/* I/O traps run below BADTRAP; the functions from HCALL_BASE up are
+   hypercalls into native host routines (see hcall.h) */
 typedef enum {
-    CHAROUT = 0, CHARIN, DECOUT, DECIN, STROUT, FLUSH, BADTRAP
+    CHAROUT = 0, CHARIN, DECOUT, DECIN, STROUT, FLUSH, BADTRAP,
+    HCALL_MEMCPY = 8, HCALL_MEMSET, HCALL_MEMCMP, HCALL_SORT
 } y86_iotrap_t;
 
+#define HCALL_BASE  HCALL_MEMCPY
+#define HCALL_SLOTS (16 - HCALL_BASE)
+
 typedef enum {
     RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
     R8, R9, R10, R11, R12, R13, R14, NOREG
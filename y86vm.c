@@ -0,0 +1,561 @@
+/*
+ * CS 261: Embeddable Y86 virtual machine
+ *
+ * Name: Ben Berry
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "y86vm.h"
+#include "p1-check.h"
+#include "p2-load.h"
+#include "p3-disas.h"
+#include "p4-interp.h"
+#include "elfmap.h"
+#include "plugin.h"
+
+static void unload (y86_vm_t *vm);
+static bool load_image (y86_vm_t *vm, elf_image_t *img, bool borrow);
+static bool load_stream (y86_vm_t *vm, FILE *file);
+static bool finish_load (y86_vm_t *vm, bool ok);
+static void start_program (y86_vm_t *vm);
+static void revert_blocks (y86_vm_t *vm, uint64_t dirty);
+static void sync_window (y86_vm_t *vm);
+static bool in_window (y86_vm_t *vm, elf_phdr_t *phdr);
+static bool in_memory (y86_vm_t *vm, address_t addr);
+
+/**********************************************************************
+ *                         VM FUNCTIONS
+ *********************************************************************/
+
+y86_vm_t *y86_vm_create (void) {
+    y86_vm_t *vm = (y86_vm_t *) calloc(1, sizeof(y86_vm_t));
+    if(vm == NULL)
+        return NULL;
+    vm->memory = (byte_t *) calloc(MEMSIZE, sizeof(byte_t));
+    vm->image = (byte_t *) calloc(MEMSIZE, sizeof(byte_t));
+    vm->cache = icache_create();
+    vm->io = io_create();
+    if(vm->memory == NULL || vm->image == NULL || vm->cache == NULL || vm->io == NULL) {
+        y86_vm_free(vm);
+        return NULL;
+    }
+    start_program(vm);
+    return vm;
+}
+
+y86_vm_t *y86_vm_create_paged (void) {
+    y86_vm_t *vm = y86_vm_create();
+    if(vm == NULL)
+        return NULL;
+    vm->pmem = pmem_create();
+    vm->pimage = pmem_create();
+    if(vm->pmem == NULL || vm->pimage == NULL) {
+        y86_vm_free(vm);
+        return NULL;
+    }
+    start_program(vm);
+    return vm;
+}
+
+void y86_vm_free (y86_vm_t *vm) {
+    if(vm == NULL)
+        return;
+    plugin_release(vm);
+    io_free(vm->io);
+    icache_free(vm->cache);
+    //Paged memory may borrow from the mapped file, so it goes first
+    pmem_free(vm->pmem);
+    pmem_free(vm->pimage);
+    elf_unmap(&vm->file);
+    free(vm->memory);
+    free(vm->image);
+    free(vm->phdrs);
+    free(vm);
+}
+
+bool y86_vm_load_buffer (y86_vm_t *vm, const byte_t *buf, size_t size) {
+    //Check for null parameters
+    if(vm == NULL || buf == NULL || size == 0)
+        return false;
+    unload(vm);
+
+    //Validate and copy straight out of the caller's bytes (which we may not
+    //keep, so paged memory copies rather than borrows)
+    elf_image_t img;
+    elf_view_buffer(buf, size, &img);
+    return finish_load(vm, load_image(vm, &img, false));
+}
+
+bool y86_vm_load_file (y86_vm_t *vm, const char *filename) {
+    if(vm == NULL || filename == NULL)
+        return false;
+
+    //Map the file once and load from the mapping; paged memory borrows whole
+    //pages from it, so it is kept until the next load
+    elf_image_t img;
+    if(elf_map_file(filename, &img)) {
+        unload(vm);
+        vm->file = img;
+        bool ok = load_image(vm, &vm->file, true);
+        if(vm->pmem == NULL)
+            elf_unmap(&vm->file);
+        return finish_load(vm, ok);
+    }
+
+    //Files that cannot be mapped go through the stdio readers instead
+    FILE *file = fopen(filename, "rb");
+    if(file == NULL)
+        return false;
+    unload(vm);
+    bool ok = load_stream(vm, file);
+    fclose(file);
+    return finish_load(vm, ok);
+}
+
+void y86_vm_reset (y86_vm_t *vm) {
+    if(vm == NULL)
+        return;
+    //Copy back only the memory stored to since the snapshot
+    if(vm->pmem != NULL) {
+        pmem_revert(vm->pmem, vm->pimage);
+        sync_window(vm);
+        icache_flush(vm->cache);
+    } else {
+        revert_blocks(vm, vm->cpu.dirty);
+    }
+    io_reset(vm->io);
+    vm->cpu = vm->snap.cpu;
+    vm->count = vm->snap.count;
+    vm->last = vm->snap.last;
+    vm->settled = vm->snap.settled;
+}
+
+bool y86_vm_snapshot (y86_vm_t *vm) {
+    if(vm == NULL)
+        return false;
+    bool ok = true;
+    if(vm->pmem != NULL) {
+        ok = pmem_copy(vm->pimage, vm->pmem);
+        pmem_track(vm->pmem);
+    } else {
+        memcpy(vm->image, vm->memory, MEMSIZE);
+    }
+    vm->cpu.dirty = 0;
+    vm->snap.cpu = vm->cpu;
+    vm->snap.count = vm->count;
+    vm->snap.last = vm->last;
+    vm->snap.settled = vm->settled;
+    return ok;
+}
+
+void y86_vm_set_state (y86_vm_t *vm, const y86_t *cpu, int count) {
+    if(vm == NULL || cpu == NULL)
+        return;
+    struct pmem *pmem = vm->cpu.pmem;
+    uint64_t dirty = vm->cpu.dirty;
+    struct y86_io *io = vm->cpu.io;
+    vm->cpu = *cpu;
+    vm->cpu.pmem = pmem;
+    vm->cpu.dirty = dirty;
+    vm->cpu.io = io;
+    vm->count = count;
+    memset(&vm->last, 0x00, sizeof(vm->last));
+    //A stopped CPU was saved with its PC already reported
+    vm->settled = cpu->stat != AOK;
+}
+
+y86_stat_t y86_vm_step (y86_vm_t *vm) {
+    if(vm == NULL)
+        return INS;
+    y86_t *cpu = &vm->cpu;
+    if(cpu->stat != AOK)
+        return cpu->stat;
+
+    bool cnd = false;
+    y86_reg_t valA = 0;
+    y86_reg_t valE = 0;
+
+    //Fetch (the cache covers the low MEMSIZE bytes, flat or paged)
+    y86_inst_t ins = icache_fetch(vm->cache, cpu, vm->memory);
+    //Disinclude invalid instructions in total count
+    if(cpu->stat == INS)
+        vm->count--;
+    //Decode and execute
+    valE = decode_execute(cpu, ins, &cnd, &valA);
+    //Input is logged by when it was read
+    if(ins.icode == IOTRAP)
+        vm->io->count = vm->count;
+    //Memory, writeback, program counter increment
+    memory_wb_pc(cpu, ins, vm->memory, cnd, valA, valE);
+    //Forget cached decodes of any bytes that were just stored to
+    if(ins.icode == RMMOVQ || ins.icode == PUSHQ || ins.icode == CALL) {
+        icache_invalidate(vm->cache, valE);
+        vm->store = valE;
+    } else if(io_stores(&ins)) {
+        icache_invalidate(vm->cache, cpu->reg[RDI]);
+        vm->store = cpu->reg[RDI];
+    }
+    address_t lo, hi;
+    if(io_stored(cpu, &ins, &lo, &hi)) {
+        for(address_t a = lo; a < hi; a += STORE_SIZE)
+            icache_invalidate(vm->cache, a);
+    }
+    //Remember loads too, for y86_vm_event()
+    if(ins.icode == MRMOVQ)
+        vm->load = valE;
+    else if(ins.icode == POPQ || ins.icode == RET)
+        vm->load = valA;
+    vm->count++;
+    //Change cpu status to ADR if program counter leaves allocated memory
+    if(vm->pmem == NULL && cpu->pc >= MEMSIZE)
+        cpu->stat = ADR;
+    vm->last = ins;
+    return cpu->stat;
+}
+
+void y86_vm_event (y86_vm_t *vm, address_t pc, y86_event_t *ev) {
+    y86_t *cpu = &vm->cpu;
+    y86_inst_t *ins = &vm->last;
+    ev->pc = pc;
+    ev->valP = ins->valP;
+    ev->after = cpu->pc;
+    ev->count = vm->count;
+    ev->opcode = (byte_t) ((ins->icode << 4) | (ins->ifun.b & 0x0f));
+    ev->stat = cpu->stat;
+    //Flags are copied as raw bytes because writes to the NOREG slot can
+    //leave any value in them
+    memcpy(&ev->flags[0], &cpu->zf, 1);
+    memcpy(&ev->flags[1], &cpu->sf, 1);
+    memcpy(&ev->flags[2], &cpu->of, 1);
+
+    //Registers the instruction writes
+    y86_regnum_t regs[2];
+    int n = 0;
+    switch(ins->icode) {
+        case(CMOV): case(IRMOVQ): case(OPQ): regs[n++] = ins->rb; break;
+        case(MRMOVQ): regs[n++] = ins->ra; break;
+        case(CALL): case(RET): case(PUSHQ): regs[n++] = RSP; break;
+        case(POPQ): regs[n++] = RSP; regs[n++] = ins->ra; break;
+        case(IOTRAP):
+            //Hypercalls return in %rax
+            if(ins->ifun.trap >= HCALL_BASE)
+                regs[n++] = RAX;
+            break;
+        default: break;
+    }
+    ev->nregs = 0;
+    for(int i = 0; i < n; i++) {
+        //popq %rsp writes one register, and NOREG is not one
+        if(regs[i] >= NOREG || (i == 1 && regs[i] == RSP))
+            continue;
+        ev->regs[ev->nregs] = regs[i];
+        ev->regval[ev->nregs++] = cpu->reg[regs[i]];
+    }
+
+    //Memory accesses, with the bytes now at a store address (unchanged if
+    //the store itself failed)
+    ev->loaded = (ins->icode == MRMOVQ || ins->icode == POPQ || ins->icode == RET)
+            && in_memory(vm, vm->load);
+    ev->load = vm->load;
+    ev->stored = (ins->icode == RMMOVQ || ins->icode == PUSHQ || ins->icode == CALL
+                || io_stores(ins)) && in_memory(vm, vm->store);
+    ev->store = vm->store;
+    ev->value = 0;
+    if(ev->stored && vm->pmem != NULL)
+        ev->value = pmem_load(vm->pmem, vm->store);
+    else if(ev->stored)
+        memcpy(&ev->value, &vm->memory[vm->store], sizeof(ev->value));
+}
+
+y86_stat_t y86_vm_run (y86_vm_t *vm, long budget) {
+    if(vm == NULL)
+        return INS;
+    //The plain loop has no hooks at all; plugins get a loop of their own
+    if(vm->hooks != NULL)
+        plugin_run(vm, budget);
+    else {
+        for(long i = 0; vm->cpu.stat == AOK && (budget < 0 || i < budget); i++)
+            y86_vm_step(vm);
+    }
+    //Guest output is written out once it stops, however it stopped
+    if(vm->cpu.stat != AOK)
+        io_flush(vm->io);
+
+    //Update program counter if bad address was given (once per stop)
+    if(vm->cpu.stat == ADR && !vm->settled) {
+        vm->cpu.pc = vm->last.valP;
+        //Increment by 1 extra for failed call intructions
+        if(vm->last.icode == CALL)
+            vm->cpu.pc ++;
+        vm->settled = true;
+    }
+    return vm->cpu.stat;
+}
+
+y86_stat_t y86_vm_trace (y86_vm_t *vm, FILE *out, long budget) {
+    if(vm == NULL || out == NULL)
+        return INS;
+    y86_t *cpu = &vm->cpu;
+    fprintf(out, "Beginning execution at 0x%04x\n", vm->hdr.e_entry);
+    for(long i = 0; cpu->stat == AOK && (budget < 0 || i < budget); i++) {
+        //Print current cpu state
+        fdump_cpu_state(out, cpu);
+        y86_vm_step(vm);
+        //Handle invalid instructions
+        if(cpu->stat == INS){
+            fprintf(out, "\nInvalid instruction at 0x%04lx\n", cpu->pc);
+        //Otherwise, continue with diassembly
+        } else {
+            fprintf(out, "\nExecuting: ");
+            fdisassemble(out, &vm->last);
+            fprintf(out, "\n");
+        }
+    }
+    if(cpu->stat != AOK)
+        io_flush(vm->io);
+    //Trace mode has never added the extra byte for failed calls
+    if(cpu->stat == ADR && !vm->settled) {
+        cpu->pc = vm->last.valP;
+        vm->settled = true;
+    }
+    //Dump final cpu state
+    fdump_cpu_state(out, cpu);
+    fprintf(out, "Total execution count: %d\n\n", vm->count);
+    //Dump full memory
+    sync_window(vm);
+    fdump_memory(out, vm->memory, 0, MEMSIZE);
+    return cpu->stat;
+}
+
+void y86_vm_disassemble (y86_vm_t *vm, FILE *out, bool code, bool data) {
+    if(vm == NULL || out == NULL || !vm->loaded)
+        return;
+    sync_window(vm);
+    //Disassemble code
+    if(code) {
+        fprintf(out, "Disassembly of executable contents:\n");
+        for(int i = 0; i < vm->hdr.e_num_phdr; i++) {
+            if(!in_window(vm, &vm->phdrs[i]))
+                continue;
+            if(vm->phdrs[i].p_type == CODE)
+                fdisassemble_code(out, vm->memory, &vm->phdrs[i], &vm->hdr);
+        }
+    }
+    //Disassemble data or rodata if applicable
+    if(data) {
+        fprintf(out, "Disassembly of data contents:\n");
+        for(int i = 0; i < vm->hdr.e_num_phdr; i++) {
+            if(!in_window(vm, &vm->phdrs[i]))
+                continue;
+            if(vm->phdrs[i].p_type == DATA && vm->phdrs[i].p_flags == 6)
+                fdisassemble_data(out, vm->memory, &vm->phdrs[i]);
+            else if(vm->phdrs[i].p_type == DATA && vm->phdrs[i].p_flags == 4)
+                fdisassemble_rodata(out, vm->memory, &vm->phdrs[i]);
+        }
+    }
+}
+
+y86_reg_t y86_vm_get_reg (y86_vm_t *vm, y86_regnum_t reg) {
+    if(vm == NULL || reg < RAX || reg >= NOREG)
+        return 0;
+    return vm->cpu.reg[reg];
+}
+
+bool y86_vm_set_reg (y86_vm_t *vm, y86_regnum_t reg, y86_reg_t value) {
+    if(vm == NULL || reg < RAX || reg >= NOREG)
+        return false;
+    vm->cpu.reg[reg] = value;
+    return true;
+}
+
+bool y86_vm_read_mem (y86_vm_t *vm, address_t addr, void *buf, size_t len) {
+    if(vm != NULL && buf != NULL && vm->pmem != NULL && (len == 0 || len - 1 <= UINT64_MAX - addr)) {
+        pmem_fetch(vm->pmem, addr, buf, len);
+        return true;
+    }
+    if(vm == NULL || buf == NULL || addr > MEMSIZE || len > MEMSIZE - addr)
+        return false;
+    memcpy(buf, &vm->memory[addr], len);
+    return true;
+}
+
+bool y86_vm_map (y86_vm_t *vm, address_t addr, byte_t *bytes, size_t len, bool writable) {
+    if(vm == NULL || vm->pmem == NULL || !vm->loaded || bytes == NULL
+            || addr < MEMSIZE || addr % PMEM_PAGESIZE != 0 || len % PMEM_PAGESIZE != 0
+            || (len > 0 && len - 1 > UINT64_MAX - addr))
+        return false;
+    //A decode at the top of low memory may run on into the first page
+    if(addr < MEMSIZE + INST_MAXLEN - 1)
+        icache_flush(vm->cache);
+    //Into the snapshot as well, so resets keep the pages in place
+    bool ok = true;
+    for(size_t i = 0; ok && i < len; i += PMEM_PAGESIZE) {
+        if(writable)
+            ok = pmem_map_shared(vm->pimage, addr + i, &bytes[i])
+                    && pmem_map_shared(vm->pmem, addr + i, &bytes[i]);
+        else
+            ok = pmem_map(vm->pimage, addr + i, &bytes[i])
+                    && pmem_map(vm->pmem, addr + i, &bytes[i]);
+    }
+    return ok;
+}
+
+bool y86_vm_claim (y86_vm_t *vm, pmem_region_t *region) {
+    if(vm == NULL || vm->pmem == NULL || !vm->loaded || region == NULL || region->base < MEMSIZE)
+        return false;
+    //A decode at the top of low memory may run on into the first page
+    if(region->base < MEMSIZE + INST_MAXLEN - 1)
+        icache_flush(vm->cache);
+    return pmem_claim(vm->pimage, region) && pmem_claim(vm->pmem, region);
+}
+
+bool y86_vm_write_mem (y86_vm_t *vm, address_t addr, const void *buf, size_t len) {
+    if(vm != NULL && buf != NULL && vm->pmem != NULL && (len == 0 || len - 1 <= UINT64_MAX - addr)) {
+        for(size_t i = 0; i < len && addr + i < MEMSIZE + INST_MAXLEN - 1; i += STORE_SIZE)
+            icache_invalidate(vm->cache, addr + i);
+        return pmem_write(vm->pmem, addr, buf, len);
+    }
+    if(vm == NULL || buf == NULL || addr > MEMSIZE || len > MEMSIZE - addr)
+        return false;
+    memcpy(&vm->memory[addr], buf, len);
+    for(size_t i = 0; i < len; i += DIRTY_BLOCK)
+        vm->cpu.dirty |= (uint64_t) 1 << ((addr + i) / DIRTY_BLOCK);
+    if(len > 0)
+        vm->cpu.dirty |= (uint64_t) 1 << ((addr + len - 1) / DIRTY_BLOCK);
+    //Each invalidation covers one 8-byte store's worth of bytes
+    for(size_t i = 0; i < len; i += STORE_SIZE)
+        icache_invalidate(vm->cache, addr + i);
+    return true;
+}
+
+/**********************************************************************
+ *                         HELPER METHODS
+ *********************************************************************/
+
+//Forget the loaded program (and the file paged memory borrowed from)
+static void unload (y86_vm_t *vm) {
+    vm->loaded = false;
+    free(vm->phdrs);
+    vm->phdrs = NULL;
+    memset(vm->image, 0x00, MEMSIZE);
+    pmem_clear(vm->pimage);
+    pmem_clear(vm->pmem);
+    elf_unmap(&vm->file);
+}
+
+//Load a Mini-ELF held in memory, validating its headers where they lie
+static bool load_image (y86_vm_t *vm, elf_image_t *img, bool borrow) {
+    const elf_hdr_t *hdr = elf_header(img);
+    if(hdr == NULL)
+        return false;
+    vm->hdr = *hdr;
+    vm->phdrs = (elf_phdr_t *) calloc(vm->hdr.e_num_phdr + 1, sizeof(elf_phdr_t));
+    bool ok = vm->phdrs != NULL;
+    //Check each program header, then load each segment
+    for(int i = 0; ok && i < vm->hdr.e_num_phdr; i++) {
+        const elf_phdr_t *phdr = elf_phdr(img, vm->hdr.e_phdr_start + (i * sizeof(elf_phdr_t)));
+        ok = phdr != NULL;
+        if(ok)
+            vm->phdrs[i] = *phdr;
+    }
+    //Paged VMs take segments anywhere in the 32-bit range; devices have no
+    //bytes in the file (see y86_vm_map())
+    for(int i = 0; ok && i < vm->hdr.e_num_phdr; i++) {
+        if(vm->phdrs[i].p_type == DEVICE)
+            continue;
+        if(vm->pimage != NULL)
+            ok = elf_map_segment(img, vm->pimage, &vm->phdrs[i], borrow);
+        else
+            ok = elf_copy_segment(img, vm->image, &vm->phdrs[i]);
+    }
+    return ok;
+}
+
+//Load a Mini-ELF through the original FILE*-based readers
+static bool load_stream (y86_vm_t *vm, FILE *file) {
+    bool ok = read_header_quiet(file, &vm->hdr);
+    if(ok) {
+        vm->phdrs = (elf_phdr_t *) calloc(vm->hdr.e_num_phdr + 1, sizeof(elf_phdr_t));
+        ok = vm->phdrs != NULL;
+    }
+    //Read each program header, then load each segment
+    for(int i = 0; ok && i < vm->hdr.e_num_phdr; i++) {
+        int offset = vm->hdr.e_phdr_start + (i * sizeof(elf_phdr_t));
+        ok = read_phdr(file, offset, &vm->phdrs[i]);
+    }
+    for(int i = 0; ok && i < vm->hdr.e_num_phdr; i++) {
+        if(vm->phdrs[i].p_type == DEVICE)
+            continue;
+        if(vm->pimage != NULL)
+            ok = pmem_load_segment(file, vm->pimage, &vm->phdrs[i]);
+        else
+            ok = load_segment(file, vm->image, &vm->phdrs[i]);
+    }
+    return ok;
+}
+
+//Never leave half a program behind, then start it from the top
+static bool finish_load (y86_vm_t *vm, bool ok) {
+    if(!ok) {
+        memset(vm->image, 0x00, MEMSIZE);
+        pmem_clear(vm->pimage);
+        pmem_clear(vm->pmem);
+        elf_unmap(&vm->file);
+    }
+    vm->loaded = ok;
+    start_program(vm);
+    return ok;
+}
+
+//Start the loaded program from scratch: all of memory comes from the image
+//and the snapshot becomes the CPU at the entry point
+static void start_program (y86_vm_t *vm) {
+    memcpy(vm->memory, vm->image, MEMSIZE);
+    icache_flush(vm->cache);
+    memset(&vm->snap, 0x00, sizeof(vm->snap));
+    //Paged memory starts from the loaded pages (vm->memory mirrors the start)
+    if(vm->pmem != NULL) {
+        pmem_copy(vm->pmem, vm->pimage);
+        sync_window(vm);
+        vm->snap.cpu.pmem = vm->pmem;
+    }
+    vm->snap.cpu.io = vm->io;
+    vm->snap.cpu.pc = vm->loaded ? vm->hdr.e_entry : 0;
+    vm->snap.cpu.stat = AOK;
+    //Nothing is dirty, so this only sets up the CPU
+    vm->cpu.dirty = 0;
+    y86_vm_reset(vm);
+}
+
+//Copy the flat memory blocks marked in a dirty mask back from the snapshot
+static void revert_blocks (y86_vm_t *vm, uint64_t dirty) {
+    if(dirty == DIRTY_ALL) {
+        memcpy(vm->memory, vm->image, MEMSIZE);
+        icache_flush(vm->cache);
+        return;
+    }
+    for(int b = 0; b < DIRTY_BLOCKS; b++) {
+        if(((dirty >> b) & 1) == 0)
+            continue;
+        memcpy(&vm->memory[b * DIRTY_BLOCK], &vm->image[b * DIRTY_BLOCK], DIRTY_BLOCK);
+        for(int i = 0; i < DIRTY_BLOCK; i += STORE_SIZE)
+            icache_invalidate(vm->cache, b * DIRTY_BLOCK + i);
+    }
+}
+
+//Refresh the flat copy of the start of paged memory
+static void sync_window (y86_vm_t *vm) {
+    if(vm->pmem != NULL)
+        pmem_fetch(vm->pmem, 0, vm->memory, MEMSIZE);
+}
+
+//Check that all eight bytes of an access lie in guest memory
+static bool in_memory (y86_vm_t *vm, address_t addr) {
+    return (vm->pmem != NULL) ? pmem_valid(addr) : addr <= MEMSIZE - sizeof(uint64_t);
+}
+
+//Check that a segment can be shown from vm->memory (always, unless paged)
+static bool in_window (y86_vm_t *vm, elf_phdr_t *phdr) {
+    return vm->pmem == NULL || (uint64_t) phdr->p_vaddr + phdr->p_size <= MEMSIZE;
+}
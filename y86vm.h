@@ -0,0 +1,305 @@
+#ifndef __CS261_Y86VM__
+#define __CS261_Y86VM__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elf.h"
+#include "y86.h"
+#include "icache.h"
+#include "pmem.h"
+#include "elfmap.h"
+#include "io.h"
+
+struct y86_hooks;
+
+/* CPU-side state that y86_vm_reset() goes back to; memory is kept in
+   image/pimage alongside it */
+typedef struct y86_vm_snap {
+    y86_t cpu;                  // CPU state (never any dirty bits)
+    int count;                  // instructions executed
+    y86_inst_t last;            // last instruction executed
+    bool settled;               // the PC had its final ADR fix-up
+} y86_vm_snap_t;
+
+/* What one instruction did, for tracing and analysis (see y86_vm_event()) */
+typedef struct y86_event {
+    address_t pc;               // where the instruction started
+    address_t valP;             // address of the next instruction in sequence
+    address_t after;            // PC once it had executed
+    address_t load;             // address read from (if loaded)
+    address_t store;            // address written to (if stored)
+    uint64_t value;             // the eight bytes at store afterwards
+    y86_reg_t regval[2];        // values of the registers written
+    int count;                  // execution count afterwards
+    byte_t opcode;              // icode and ifun, as the first byte encodes them
+    byte_t nregs;               // registers the instruction writes (0-2)
+    byte_t regs[2];             // which ones (never NOREG)
+    byte_t flags[3];            // zf, sf and of afterwards, as raw bytes
+    byte_t stat;                // CPU status afterwards
+    bool loaded;                // memory was read
+    bool stored;                // memory was written
+} y86_event_t;
+
+/* A loaded Y86 program and everything needed to run it. This is the
+   embedding API of liby86.a: hosts create a VM, load a Mini-ELF into it and
+   step or run it without going through main(). Fields may be read directly
+   (the execution engines take &vm->cpu, vm->memory and &vm->count), but
+   should only be changed through the functions below. */
+typedef struct y86_vm {
+
+    y86_t cpu;                  // CPU state
+    byte_t *memory;             // guest address space (MEMSIZE bytes)
+    byte_t *image;              // memory at the snapshot, for y86_vm_reset()
+    icache_t *cache;            // predecoded instructions for stepping
+    pmem_t *pmem;               // paged address space, or NULL (see below)
+    pmem_t *pimage;             // pmem at the snapshot, for y86_vm_reset()
+    elf_image_t file;           // mapped Mini-ELF that pmem pages borrow from
+
+    elf_hdr_t hdr;              // Mini-ELF header of the loaded program
+    elf_phdr_t *phdrs;          // its program headers (hdr.e_num_phdr entries)
+    bool loaded;                // a program has been loaded
+
+    int count;                  // instructions executed (as -e counts them)
+    y86_inst_t last;            // last instruction executed
+    address_t load;             // address the last mrmovq/popq/ret loaded from
+    address_t store;            // address the last rmmovq/pushq/call stored to
+                                // (if its access succeeded)
+    bool settled;               // the PC has had its final ADR fix-up
+
+    y86_io_t *io;               // iotrap channels (output to stdout, no input
+                                // until given some; see io.h)
+    struct y86_hooks *hooks;    // instrumentation plugins, or NULL (plugin.h)
+    y86_vm_snap_t snap;         // the rest of the snapshot
+
+} y86_vm_t;
+
+/**
+ * @brief Allocate a VM with empty memory
+ *
+ * @returns Pointer to the new VM, or NULL if allocation failed
+ */
+y86_vm_t *y86_vm_create (void);
+
+/**
+ * @brief Allocate a VM whose guest memory covers the full 64-bit range
+ *
+ * Memory is paged (see pmem.h) and segments may be loaded at any 32-bit
+ * address. The VM executes with the reference pipeline only; vm->memory then
+ * holds a copy of the first MEMSIZE bytes, refreshed whenever the VM prints
+ * or resets, for the displays and disassembly that work on a flat array.
+ *
+ * @returns Pointer to the new VM, or NULL if allocation failed
+ */
+y86_vm_t *y86_vm_create_paged (void);
+
+/**
+ * @brief Release a VM and everything it owns (its plugins included)
+ *
+ * @param vm VM to be freed (may be NULL)
+ */
+void y86_vm_free (y86_vm_t *vm);
+
+/**
+ * @brief Load a Mini-ELF image held in memory
+ *
+ * Validates the header and program headers in place with the same checks
+ * as the p1/p2 readers and copies the segments straight out of buf, then
+ * resets the CPU to the entry point.
+ *
+ * @param vm VM to load into (any earlier program is discarded)
+ * @param buf Bytes of the Mini-ELF file
+ * @param size Number of bytes in buf
+ * @returns True if the image was loaded, false if it is not a valid Mini-ELF
+ */
+bool y86_vm_load_buffer (y86_vm_t *vm, const byte_t *buf, size_t size);
+
+/**
+ * @brief Load a Mini-ELF file by mapping it (falling back to stdio reads for
+ * files that cannot be mapped)
+ *
+ * A paged VM keeps the mapping and borrows the pages its segments fill
+ * completely, copying one only when the program first writes to it; the
+ * file must then stay unchanged until the VM is freed (see elf_map_file()).
+ *
+ * @param vm VM to load into (any earlier program is discarded)
+ * @param filename Path of the Mini-ELF file
+ * @returns True if the file was loaded, false if it could not be read or is
+ * not a valid Mini-ELF
+ */
+bool y86_vm_load_file (y86_vm_t *vm, const char *filename);
+
+/**
+ * @brief Put memory and the CPU back the way they were at the snapshot
+ *
+ * The snapshot is taken just after loading, or by y86_vm_snapshot(). Only
+ * memory stored to since then is copied back: 64-byte blocks of flat
+ * memory, tracked by memory_wb_pc() in cpu.dirty, or the written pages of
+ * paged memory. (The threaded, block and JIT engines do not track their
+ * stores, so after them all of flat memory is copied.) Pending guest output
+ * is dropped and in-memory input rewound (see io_reset()).
+ *
+ * @param vm VM to reset
+ */
+void y86_vm_reset (y86_vm_t *vm);
+
+/**
+ * @brief Make the current CPU state and memory the point y86_vm_reset()
+ * returns to
+ *
+ * @param vm VM to snapshot
+ * @returns True if the snapshot was taken, false if paged memory could not
+ * be copied (the previous snapshot is then lost; reset gives empty memory)
+ */
+bool y86_vm_snapshot (y86_vm_t *vm);
+
+/**
+ * @brief Place host memory (e.g. a mapped file) in the guest address space
+ *
+ * The pages replace whatever the program had there, in memory and in the
+ * snapshot alike, until the next load. Guest accesses reach the bytes
+ * directly; with writable set, stores do too (and are not undone by
+ * y86_vm_reset()), otherwise the first store to a page copies it.
+ *
+ * @param vm VM with paged memory and a program loaded
+ * @param addr Guest address to place the bytes at (a multiple of
+ * PMEM_PAGESIZE, at or above MEMSIZE so the flat window is unaffected)
+ * @param bytes Bytes to place (page-aligned; must stay mapped until the VM
+ * is freed or loads another program)
+ * @param len Number of bytes (a multiple of PMEM_PAGESIZE)
+ * @param writable True if guest stores may change the bytes
+ * @returns True if every page was placed
+ */
+bool y86_vm_map (y86_vm_t *vm, address_t addr, byte_t *bytes, size_t len, bool writable);
+
+/**
+ * @brief Hand a range of guest pages to a memory-mapped device
+ *
+ * Like y86_vm_map(), the claim goes into the snapshot as well and lasts
+ * until the next load. Guest loads and stores to the range call the
+ * region's read and write instead of touching memory.
+ *
+ * @param vm VM with paged memory and a program loaded
+ * @param region Device and range (see pmem_claim(); base at or above
+ * MEMSIZE; must stay valid until the VM is freed or loads another program)
+ * @returns True if every page was claimed
+ */
+bool y86_vm_claim (y86_vm_t *vm, pmem_region_t *region);
+
+/**
+ * @brief Put the CPU back in a saved state (e.g. read from a checkpoint)
+ *
+ * Registers, flags, PC and status come from cpu; memory is left alone (set
+ * it with y86_vm_write_mem()), as are the VM's own cpu.pmem, cpu.dirty and
+ * cpu.io.
+ *
+ * @param vm VM to change
+ * @param cpu CPU state to take on
+ * @param count Instructions executed up to that state
+ */
+void y86_vm_set_state (y86_vm_t *vm, const y86_t *cpu, int count);
+
+/**
+ * @brief Execute one instruction (one iteration of the -e loop)
+ *
+ * Does nothing once the CPU status is no longer AOK. The PC is left as the
+ * pipeline set it; see y86_vm_run() for the fix-up -e applies after ADR.
+ *
+ * @param vm VM to step
+ * @returns CPU status after the instruction
+ */
+y86_stat_t y86_vm_step (y86_vm_t *vm);
+
+/**
+ * @brief Describe the instruction y86_vm_step() just executed
+ *
+ * Register values are the ones the instruction may have written, whether
+ * or not they changed. Accesses count only if all eight bytes lie in guest
+ * memory.
+ *
+ * @param vm VM that was stepped
+ * @param pc PC before the step
+ * @param ev Event to fill in
+ */
+void y86_vm_event (y86_vm_t *vm, address_t pc, y86_event_t *ev);
+
+/**
+ * @brief Execute instructions until the CPU stops or a budget runs out
+ *
+ * When the program stops with ADR the PC is fixed up the way -e reports it
+ * (the address after the last instruction, plus one for a failed call).
+ * VMs with plugins run an instrumented copy of the loop (see plugin.h).
+ *
+ * @param vm VM to run
+ * @param budget Maximum number of instructions to execute, or -1 for no limit
+ * @returns CPU status when the run stopped (AOK if the budget ran out)
+ */
+y86_stat_t y86_vm_run (y86_vm_t *vm, long budget);
+
+/**
+ * @brief Run with the -E trace output: the CPU state before every
+ * instruction, then the final state, count and a full memory dump
+ *
+ * @param vm VM to run
+ * @param out Stream to print the trace to
+ * @param budget Maximum number of instructions to execute, or -1 for no limit
+ * @returns CPU status when the run stopped (AOK if the budget ran out)
+ */
+y86_stat_t y86_vm_trace (y86_vm_t *vm, FILE *out, long budget);
+
+/**
+ * @brief Print the -d and/or -D disassembly of the loaded program
+ *
+ * @param vm VM holding the program
+ * @param out Stream to print to
+ * @param code True to disassemble CODE segments (-d)
+ * @param data True to disassemble DATA segments (-D)
+ */
+void y86_vm_disassemble (y86_vm_t *vm, FILE *out, bool code, bool data);
+
+/**
+ * @brief Read a general-purpose register
+ *
+ * @param vm VM to read from
+ * @param reg Register number (RAX..R14)
+ * @returns Register value, or 0 for an invalid register number
+ */
+y86_reg_t y86_vm_get_reg (y86_vm_t *vm, y86_regnum_t reg);
+
+/**
+ * @brief Write a general-purpose register
+ *
+ * @param vm VM to write to
+ * @param reg Register number (RAX..R14)
+ * @param value New register value
+ * @returns True if the register number was valid
+ */
+bool y86_vm_set_reg (y86_vm_t *vm, y86_regnum_t reg, y86_reg_t value);
+
+/**
+ * @brief Copy bytes out of guest memory (device pages read as zero, and
+ * their devices are never asked)
+ *
+ * @param vm VM to read from
+ * @param addr First guest address to read
+ * @param buf Destination buffer
+ * @param len Number of bytes to read
+ * @returns True if the whole range lies inside guest memory
+ */
+bool y86_vm_read_mem (y86_vm_t *vm, address_t addr, void *buf, size_t len);
+
+/**
+ * @brief Copy bytes into guest memory, dropping any stale decodes
+ *
+ * @param vm VM to write to
+ * @param addr First guest address to write
+ * @param buf Source buffer
+ * @param len Number of bytes to write
+ * @returns True if the whole range lies inside guest memory
+ */
+bool y86_vm_write_mem (y86_vm_t *vm, address_t addr, const void *buf, size_t len);
+
+#endif